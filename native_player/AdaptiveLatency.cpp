@@ -0,0 +1,42 @@
+#include "AdaptiveLatency.h"
+
+AdaptiveLatency::AdaptiveLatency(Settings base, uint32_t maxLatencyMs,
+                                 uint32_t xrunsToRaise,
+                                 std::chrono::milliseconds xrunWindow,
+                                 std::chrono::milliseconds stableTime)
+    : base(base), maxLatencyMs(maxLatencyMs), xrunsToRaise(xrunsToRaise),
+      xrunWindow(xrunWindow), stableTime(stableTime),
+      stableSince(Clock::now()) {}
+
+bool AdaptiveLatency::onXrun(Clock::time_point now) {
+  stableSince = now;
+  recentXruns.push_back(now);
+  while (now - recentXruns.front() > xrunWindow) {
+    recentXruns.pop_front();
+  }
+
+  if (recentXruns.size() < xrunsToRaise ||
+      settingsAt(level + 1).latencyMs > maxLatencyMs) {
+    return false;
+  }
+  ++level;
+  recentXruns.clear();
+  return true;
+}
+
+bool AdaptiveLatency::lowerIfStable(Clock::time_point now) {
+  if (level == 0 || now - stableSince < stableTime) {
+    return false;
+  }
+  --level;
+  stableSince = now;
+  return true;
+}
+
+AdaptiveLatency::Settings AdaptiveLatency::getSettings() const {
+  return settingsAt(level);
+}
+
+AdaptiveLatency::Settings AdaptiveLatency::settingsAt(unsigned level) const {
+  return {base.latencyMs << level, base.periodMs << level};
+}
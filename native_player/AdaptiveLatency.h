@@ -0,0 +1,50 @@
+#ifndef ADAPTIVE_LATENCY_H
+#define ADAPTIVE_LATENCY_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+// Raises the ALSA buffer and period time after repeated xruns and lowers
+// them back step by step once the playback has been stable for a while.
+// Each step doubles the base settings.
+class AdaptiveLatency {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Settings {
+    uint32_t latencyMs;
+    uint32_t periodMs;
+
+    bool operator==(const Settings &other) const = default;
+  };
+
+  // The latency is raised when xrunsToRaise xruns happen within
+  // xrunWindow, and lowered after stableTime without xruns.
+  AdaptiveLatency(Settings base, uint32_t maxLatencyMs, uint32_t xrunsToRaise,
+                  std::chrono::milliseconds xrunWindow,
+                  std::chrono::milliseconds stableTime);
+
+  // Returns true if the settings have been raised.
+  bool onXrun(Clock::time_point now);
+  // Returns true if the settings have been lowered. To be called when
+  // new settings can be applied without interrupting the playback.
+  bool lowerIfStable(Clock::time_point now);
+
+  Settings getSettings() const;
+
+private:
+  Settings base;
+  uint32_t maxLatencyMs;
+  uint32_t xrunsToRaise;
+  std::chrono::milliseconds xrunWindow;
+  std::chrono::milliseconds stableTime;
+
+  unsigned level = 0;
+  std::deque<Clock::time_point> recentXruns;
+  Clock::time_point stableSince;
+
+  Settings settingsAt(unsigned level) const;
+};
+
+#endif
@@ -5,10 +5,17 @@
 #include "StreamState.h"
 #include "Utils.h"
 
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <pthread.h>
 #include <sstream>
 #include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #define throw_on_error(func) throw_on_error_impl(func, #func " failed")
 #define log_on_error(func) log_on_error_impl(func, #func " failed")
@@ -28,6 +35,10 @@ inline int log_on_error_impl(int err, const std::string &message) {
   return err;
 }
 
+// Periods of the buffer with timer scheduling, the period interrupts are
+// not used to wake up the writer.
+constexpr uint32_t TIMER_SCHEDULING_PERIODS = 4;
+
 std::unordered_map<AudioSampleFormat, snd_pcm_format_t> ALSA_FORMAT_MAP = {
     {AudioSampleFormat::PCM16_LE, SND_PCM_FORMAT_S16_LE},
     {AudioSampleFormat::PCM24_LE, SND_PCM_FORMAT_S24_LE},
@@ -65,7 +76,8 @@ AlsaAudioEmitter::AlsaAudioEmitter(const Config &config)
       sleepAfterFormatSetupMs(
           value_or(config, "fixups.alsa_sleep_after_format_setup_ms", 0)),
       reopenDeviceWithNewFormat(value_or(
-          config, "fixups.alsa_reopen_device_with_new_format", false)) {
+          config, "fixups.alsa_reopen_device_with_new_format", false)),
+      crossfadeEnabled(value_or(config, "output.crossfade_ms", 0) > 0) {
   auto configBufferSize =
       value<snd_pcm_uframes_t>(config, "output.alsa.buffer_size");
   auto configPeriodSize =
@@ -75,9 +87,82 @@ AlsaAudioEmitter::AlsaAudioEmitter(const Config &config)
     requestedBufferSize = configBufferSize.value();
     requestedPeriodSize = configPeriodSize.value();
   }
+
+  auto configNearMissMs = value<uint32_t>(config, "output.alsa.near_miss_ms");
+  if (configNearMissMs.has_value()) {
+    nearMissThreshold = std::chrono::milliseconds(configNearMissMs.value());
+  }
+
+  if (value_or(config, "output.alsa.adaptive_latency.enabled", false)) {
+    if (requestedBufferSize != 0) {
+      spdlog::warn("Adaptive latency is not supported with buffer_size and "
+                   "period_size set, disabling it");
+    } else {
+      adaptiveLatency.emplace(
+          AdaptiveLatency::Settings{requestedLatencyMs, requestedPeriodMs},
+          value_or(config, "output.alsa.adaptive_latency.max_latency_ms",
+                   500u),
+          value_or(config, "output.alsa.adaptive_latency.xruns", 3u),
+          std::chrono::milliseconds(value_or(
+              config, "output.alsa.adaptive_latency.window_ms", 30000)),
+          std::chrono::milliseconds(value_or(
+              config, "output.alsa.adaptive_latency.stable_ms", 300000)));
+    }
+  }
+
+  if (value_or(config, "output.alsa.timer_scheduling.enabled", false)) {
+    if (requestedBufferSize != 0) {
+      spdlog::warn("Timer scheduling is not supported with buffer_size and "
+                   "period_size set, disabling it");
+    } else {
+      timerScheduling.emplace(TimerScheduling{
+          .bufferMs = value_or(
+              config, "output.alsa.timer_scheduling.buffer_ms", 2000u),
+          .maxFillMs = value_or(
+              config, "output.alsa.timer_scheduling.max_fill_ms", 1000u),
+          .marginMs = value_or(
+              config, "output.alsa.timer_scheduling.margin_ms", 50u)});
+      timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (timerFd < 0 || wakeupFd < 0) {
+        const int err = errno;
+        ::close(timerFd);
+        ::close(wakeupFd);
+        throw std::runtime_error(
+            std::string("Cannot create the timer for timer scheduling: ") +
+            std::strerror(err));
+      }
+    }
+  }
+
+  if (value_or(config, "output.alsa.preroll.enabled", false)) {
+    preroll.emplace(Preroll{
+        .startMs = value_or(config, "output.alsa.preroll.start_ms", 50u),
+        .prepareDevice =
+            value_or(config, "output.alsa.preroll.prepare_device", true)});
+  }
+
+  metrics.gauge("buffer_time_ms", [this]() { return bufferTimeMs.load(); });
+  metrics.gauge("period_time_ms", [this]() { return periodTimeMs.load(); });
+  metrics.gauge("deadline_near_misses", [this]() {
+    return deadlineMonitor.getNearMisses();
+  });
+  metrics.gauge("deadline_min_slack_ms", [this]() {
+    return deadlineMonitor.getMinSlackNs() / 1e6;
+  });
+  // The slots reserved for the state changes scheduled by frame ran out.
+  metrics.gauge("frame_event_slots_grown", [this]() {
+    return playedFramesCounter.slotsGrown();
+  });
 }
 
-AlsaAudioEmitter::~AlsaAudioEmitter() { stop(); }
+AlsaAudioEmitter::~AlsaAudioEmitter() {
+  stop();
+  if (timerScheduling.has_value()) {
+    ::close(timerFd);
+    ::close(wakeupFd);
+  }
+}
 
 void AlsaAudioEmitter::connectTo(
     std::shared_ptr<AudioGraphOutputNode> outputNode) {
@@ -105,21 +190,12 @@ void AlsaAudioEmitter::disconnect(
   }
 }
 
-void AlsaAudioEmitter::pause(bool paused) {
-  if (playbackThread.joinable() && isWorkerRunning) {
-    pauseRequestSignal.sendValue(paused);
-    pauseRequestSignal.getResponse(playbackThread.get_stop_token());
-  }
+std::future<bool> AlsaAudioEmitter::pause(bool paused) {
+  return pauseRequests.post(paused);
 }
 
-size_t AlsaAudioEmitter::seek(size_t positionMs) {
-  if (playbackThread.joinable() && isWorkerRunning &&
-      !seekRequestSignal.getValue()) {
-    seekRequestSignal.sendValue(positionMs);
-    return seekRequestSignal.getResponse(playbackThread.get_stop_token());
-  }
-
-  return -1;
+std::future<size_t> AlsaAudioEmitter::seek(size_t positionMs) {
+  return seekRequests.post(positionMs);
 }
 
 void AlsaAudioEmitter::start() {
@@ -159,37 +235,44 @@ StreamState AlsaAudioEmitter::waitForInputToBeReady(std::stop_token token) {
     switch (inputNodeState.state) {
     case AudioGraphNodeState::PREPARING:
       setState(StreamState(AudioGraphNodeState::PREPARING));
+      if (!startRequested.has_value()) {
+        startRequested = std::chrono::steady_clock::now();
+      }
+      prerollDevice();
       break;
     case AudioGraphNodeState::STREAMING:
       return inputNodeState;
     case AudioGraphNodeState::FINISHED:
+      startRequested.reset();
       setState(
           StreamState(AudioGraphNodeState::FINISHED,
                       framesToTimeMs(currentSourceTotalFramesWritten).count()));
       break;
     case AudioGraphNodeState::ERROR:
+      startRequested.reset();
       setState({AudioGraphNodeState::ERROR, inputNodeState.message});
       break;
     case AudioGraphNodeState::SOURCE_CHANGED:
       setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+      reportTrackStats();
       inputNode->acceptSourceChange();
       currentSourceTotalFramesWritten = 0;
+      publishStoppedPosition(0);
       break;
     default:
       setState(StreamState(AudioGraphNodeState::STOPPED));
       break;
     }
-    if (seekRequestSignal.getValue()) {
-      handleSeekSignal();
+    if (auto positionMs = seekRequests.take()) {
+      handleSeekRequest(*positionMs);
     }
 
-    if (pauseRequestSignal.getValue()) {
-      pauseRequestSignal.respond(false);
+    if (pauseRequests.take()) {
+      pauseRequests.respond(false);
     }
 
-    auto combinedToken =
-        combineStopTokens(token, seekRequestSignal.getStopToken(),
-                          pauseRequestSignal.getStopToken());
+    auto combinedToken = combineStopTokens(
+        token, seekRequests.getStopToken(), pauseRequests.getStopToken());
     StateChangeWaitLock lock(combinedToken.get_token(), *inputNode,
                              inputNodeState.timestamp);
     inputNodeState = lock.state();
@@ -198,29 +281,36 @@ StreamState AlsaAudioEmitter::waitForInputToBeReady(std::stop_token token) {
   return inputNodeState;
 }
 
-bool AlsaAudioEmitter::handleSeekSignal() {
-  auto positionMs = *seekRequestSignal.getValue();
+bool AlsaAudioEmitter::handleSeekRequest(size_t positionMs) {
+  perfmon_event("seek", positionMs);
+  seeks.add();
   auto seekValue = positionMs * currentStreamAudioFormat.sampleRate / 1000;
   spdlog::info("Request seek to {}ms ({} frames)", positionMs, seekValue);
   auto retVal = inputNode->seekTo(seekValue);
   if (retVal == -1U) {
     spdlog::warn("Seek request failed: requested={}", seekValue);
-    seekRequestSignal.respond(-1);
+    seekRequests.respond(-1);
     return false;
   }
-  seekRequestSignal.respond(framesToTimeMs(retVal).count());
+  seekRequests.respond(framesToTimeMs(retVal).count());
   seekHappened = true;
+  startRequested = std::chrono::steady_clock::now();
+  publishStoppedPosition(retVal);
   return true;
 }
 
-bool AlsaAudioEmitter::handlePauseSignal(bool paused) {
+bool AlsaAudioEmitter::handlePauseRequest(bool paused) {
   auto state = getState();
   auto stateToSet =
       paused ? AudioGraphNodeState::PAUSED : AudioGraphNodeState::STREAMING;
 
+  rewindQueuedFrames();
   this->paused = paused;
+  framesSincePauseToggle = 0;
+  resetFillTarget();
   StreamState newState(stateToSet, 0, state.streamInfo);
   newState.position = framesToTimeMs(currentSourceTotalFramesWritten).count();
+  updatePlayedFrames();
   snd_pcm_sframes_t delay = 0;
   int err = snd_pcm_delay(pcmHandle, &delay);
   if (err < 0) {
@@ -248,14 +338,14 @@ void AlsaAudioEmitter::openDevice() {
     stream << "Cannot open audio device " << deviceName << " ("
            << snd_strerror(err) << ")";
     pcmHandle = nullptr;
-    spdlog::error(stream.str());
-    setState({AudioGraphNodeState::ERROR, stream.str()});
-
+    // Reported by the caller, the device is opened again after a failure
+    // in the preroll.
     throw std::runtime_error(stream.str());
   }
 
   currentSourceTotalFramesWritten = 0;
   playedFramesCounter.reset();
+  framesQueued = 0;
 }
 
 void AlsaAudioEmitter::closeDevice() {
@@ -270,42 +360,310 @@ void AlsaAudioEmitter::closeDevice() {
 
 snd_pcm_sframes_t AlsaAudioEmitter::waitForAlsaBufferSpace() {
   auto getAvailableFrames = [this]() -> snd_pcm_sframes_t {
-    return throw_on_error(snd_pcm_avail_update(pcmHandle));
+    auto frames = snd_pcm_avail_update(pcmHandle);
+    if (frames == -EPIPE || frames == -ESTRPIPE) {
+      throw_on_error(recoverFromXrun(frames));
+      frames = snd_pcm_avail_update(pcmHandle);
+    }
+    return throw_on_error(frames);
   };
 
   perfmon_end("fullPeriodProcessingTime");
   perfmon_begin("waitForAlsaBufferSpace");
-
-  snd_pcm_sframes_t frames = getAvailableFrames();
-  unsigned short revents = 0;
-
-  while (!playbackThread.get_stop_token().stop_requested() &&
-         static_cast<snd_pcm_uframes_t>(frames) < periodSize) {
-    int ret = poll(ufds.data(), ufds.size(), pollTimeout.count());
-    if (ret == 0) {
-      continue;
+  ScopedTimer timer(waitForDeviceNs);
+  wakeups.add();
+
+  snd_pcm_sframes_t frames = 0;
+  if (timerScheduling.has_value()) {
+    sleepUntilRefill();
+    frames = framesToRefill(getAvailableFrames());
+    if (frames == 0) {
+      // The buffer is full, commands have cut the sleeps short.
+      sleepOnTimer(std::chrono::milliseconds(requestedPeriodMs));
+      frames = framesToRefill(getAvailableFrames());
     }
+  } else {
     frames = getAvailableFrames();
-    throw_on_error(snd_pcm_poll_descriptors_revents(pcmHandle, ufds.data(),
-                                                    ufds.size(), &revents));
-    if (revents & POLLERR) {
-      throw std::runtime_error("Poll error");
-    }
-    if (revents & POLLOUT) {
-      break;
+    unsigned short revents = 0;
+
+    while (!playbackThread.get_stop_token().stop_requested() &&
+           static_cast<snd_pcm_uframes_t>(frames) < periodSize) {
+      int ret = poll(ufds.data(), ufds.size(), pollTimeout.count());
+      if (ret == 0) {
+        continue;
+      }
+      frames = getAvailableFrames();
+      throw_on_error(snd_pcm_poll_descriptors_revents(
+          pcmHandle, ufds.data(), ufds.size(), &revents));
+      if (revents & POLLERR) {
+        throw std::runtime_error("Poll error");
+      }
+      if (revents & POLLOUT) {
+        break;
+      }
     }
   }
 
+  frames = limitPrerollFill(frames);
+
+  drainDeadline.reset();
+  snd_pcm_status_t *status;
+  snd_pcm_status_alloca(&status);
+  if (updatePlaybackPosition(status)) {
+    auto delay = std::chrono::nanoseconds(snd_pcm_status_get_delay(status) *
+                                          1'000'000'000ll /
+                                          currentStreamAudioFormat.sampleRate);
+    drainDeadline = std::chrono::steady_clock::now() + delay;
+  }
+
   perfmon_end("waitForAlsaBufferSpace");
   perfmon_begin("fullPeriodProcessingTime");
   return frames;
 }
 
+void AlsaAudioEmitter::sleepUntilRefill() {
+  snd_pcm_sframes_t delayFrames = 0;
+  if (snd_pcm_state(pcmHandle) != SND_PCM_STATE_RUNNING ||
+      snd_pcm_delay(pcmHandle, &delayFrames) < 0) {
+    return;
+  }
+  const auto sampleRate = currentStreamAudioFormat.sampleRate;
+  const snd_pcm_sframes_t marginFrames =
+      timerScheduling->marginMs * sampleRate / 1000;
+  if (delayFrames <= marginFrames) {
+    return;
+  }
+
+  sleepOnTimer(std::chrono::nanoseconds((delayFrames - marginFrames) *
+                                         1'000'000'000ll / sampleRate));
+}
+
+void AlsaAudioEmitter::sleepOnTimer(std::chrono::nanoseconds duration) {
+  itimerspec spec{};
+  spec.it_value.tv_sec = duration.count() / 1'000'000'000;
+  spec.it_value.tv_nsec = duration.count() % 1'000'000'000;
+  if (timerfd_settime(timerFd, 0, &spec, nullptr) < 0) {
+    throw std::runtime_error(std::string("timerfd_settime failed: ") +
+                             std::strerror(errno));
+  }
+
+  // Commands are taken after the next write, a command or a stop posted
+  // meanwhile wakes the writer up right away.
+  auto combinedToken =
+      combineStopTokens(playbackThread.get_stop_token(),
+                        seekRequests.getStopToken(),
+                        pauseRequests.getStopToken());
+  std::stop_callback wakeup(combinedToken.get_token(), [this]() {
+    uint64_t value = 1;
+    if (::write(wakeupFd, &value, sizeof(value)) != sizeof(value)) {
+      spdlog::warn("Cannot wake up the ALSA writer: {}",
+                   std::strerror(errno));
+    }
+  });
+
+  std::array<pollfd, 2> fds = {pollfd{timerFd, POLLIN, 0},
+                               pollfd{wakeupFd, POLLIN, 0}};
+  while (poll(fds.data(), fds.size(), -1) < 0 && errno == EINTR) {
+  }
+  uint64_t value = 0;
+  if (fds[1].revents & POLLIN) {
+    [[maybe_unused]] auto ret = ::read(wakeupFd, &value, sizeof(value));
+  }
+}
+
+snd_pcm_sframes_t
+AlsaAudioEmitter::framesToRefill(snd_pcm_sframes_t availableFrames) {
+  auto &scheduling = timerScheduling.value();
+  const auto sampleRate = currentStreamAudioFormat.sampleRate;
+  const snd_pcm_sframes_t minWrite = requestedPeriodMs * sampleRate / 1000;
+  const snd_pcm_sframes_t minFill = requestedLatencyMs * sampleRate / 1000;
+  // Leaves room for the writes of commands which cut the sleep short.
+  const snd_pcm_sframes_t maxFill = std::max(
+      minFill,
+      std::min<snd_pcm_sframes_t>(scheduling.maxFillMs * sampleRate / 1000,
+                                  bufferSize - 2 * minWrite));
+
+  snd_pcm_sframes_t delayFrames = 0;
+  log_on_error(snd_pcm_delay(pcmHandle, &delayFrames));
+  if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_RUNNING) {
+    scheduling.fillTarget =
+        std::min(maxFill, std::max(minFill, 2 * scheduling.fillTarget));
+  } else {
+    scheduling.fillTarget = std::max(minFill, scheduling.fillTarget);
+  }
+  return std::min(availableFrames,
+                  std::max(scheduling.fillTarget - delayFrames, minWrite));
+}
+
+void AlsaAudioEmitter::resetFillTarget() {
+  if (timerScheduling.has_value()) {
+    timerScheduling->fillTarget = 0;
+  }
+}
+
+snd_pcm_sframes_t AlsaAudioEmitter::rewindQueuedFrames() {
+  if (!timerScheduling.has_value()) {
+    return 0;
+  }
+  const snd_pcm_sframes_t marginFrames =
+      timerScheduling->marginMs * currentStreamAudioFormat.sampleRate / 1000;
+  const snd_pcm_sframes_t rewindable = snd_pcm_rewindable(pcmHandle);
+  snd_pcm_sframes_t frames =
+      std::min(rewindable - marginFrames, framesSincePauseToggle);
+  if (!paused) {
+    // Frames written before a source change belong to the previous source,
+    // which cannot be read again.
+    frames = std::min(frames, currentSourceTotalFramesWritten);
+  }
+  if (frames <= 0) {
+    spdlog::debug("Not rewinding, rewindable={}, margin={}, "
+                  "framesSincePauseToggle={}",
+                  rewindable, marginFrames, framesSincePauseToggle);
+    return 0;
+  }
+  frames = snd_pcm_rewind(pcmHandle, frames);
+  if (frames <= 0) {
+    if (frames < 0) {
+      spdlog::warn("Cannot rewind the device: {}", snd_strerror(frames));
+    } else {
+      spdlog::debug("Not rewinding, the device has nothing to rewind");
+    }
+    return 0;
+  }
+
+  if (!paused) {
+    // Read the frames of the source again on resume.
+    const auto position =
+        inputNode->seekTo(currentSourceTotalFramesWritten - frames);
+    if (position == (size_t)-1) {
+      spdlog::warn("Cannot rewind the source, playing out the queue");
+      framesQueued += std::max(0l, snd_pcm_forward(pcmHandle, frames));
+      return 0;
+    }
+    currentSourceTotalFramesWritten = position;
+  }
+  framesSincePauseToggle -= frames;
+  // The rewound frames were never played, the count of the played frames
+  // stays and so do the pending events, all in front of the rewound frames.
+  framesQueued -= frames;
+  spdlog::debug("Rewound {}ms of queued audio, {} events pending",
+                framesToTimeMs(frames).count(),
+                playedFramesCounter.pendingEvents());
+  return frames;
+}
+
+void AlsaAudioEmitter::prerollDevice() {
+  if (!preroll.has_value()) {
+    return;
+  }
+  try {
+    openDevice();
+    if (!preroll->prepareDevice || lastStreamAudioFormat.sampleRate == 0 ||
+        currentStreamAudioFormat == lastStreamAudioFormat) {
+      return;
+    }
+
+    // Most likely the next stream has the same format, setupAudioFormat()
+    // then only prepares the device once the input is streaming.
+    spdlog::debug("Setting up the device for the last played format");
+    setupAudioFormat(lastStreamAudioFormat);
+  } catch (const std::exception &ex) {
+    spdlog::warn("Cannot set up the device in advance: {}", ex.what());
+    closeDevice();
+  }
+}
+
+snd_pcm_sframes_t AlsaAudioEmitter::prerollStartFrames() {
+  const auto sampleRate = currentStreamAudioFormat.sampleRate;
+  // Leaves time to wait for input data after the first write before the
+  // buffer would run empty.
+  const snd_pcm_sframes_t minFrames =
+      timerScheduling.has_value()
+          ? (2 * timerScheduling->marginMs + requestedPeriodMs) * sampleRate /
+                1000
+          : 3 * periodSize;
+  return std::min<snd_pcm_sframes_t>(
+      bufferSize,
+      std::max<snd_pcm_sframes_t>(preroll->startMs * sampleRate / 1000,
+                                  minFrames));
+}
+
+snd_pcm_sframes_t AlsaAudioEmitter::limitPrerollFill(snd_pcm_sframes_t frames) {
+  if (prerollFill == 0) {
+    return frames;
+  }
+  if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_RUNNING) {
+    // With timer scheduling the fill target grows instead.
+    prerollFill = timerScheduling.has_value()
+                      ? static_cast<snd_pcm_sframes_t>(bufferSize)
+                      : 2 * prerollFill;
+    if (prerollFill >= static_cast<snd_pcm_sframes_t>(bufferSize)) {
+      prerollFill = 0;
+      return frames;
+    }
+  }
+
+  const snd_pcm_sframes_t queued =
+      bufferSize - std::max(0l, snd_pcm_avail_update(pcmHandle));
+  const snd_pcm_sframes_t minWrite =
+      timerScheduling.has_value()
+          ? requestedPeriodMs * currentStreamAudioFormat.sampleRate / 1000
+          : periodSize;
+  return std::min(frames, std::max(prerollFill - queued, minWrite));
+}
+
+bool AlsaAudioEmitter::updatePlaybackPosition(snd_pcm_status_t *status) {
+  if (snd_pcm_status(pcmHandle, status) < 0 ||
+      snd_pcm_status_get_state(status) != SND_PCM_STATE_RUNNING) {
+    return false;
+  }
+
+  // The delay and the timestamp are taken at the same hardware pointer
+  // update. Not every plugin provides the timestamp.
+  snd_htimestamp_t htstamp;
+  snd_pcm_status_get_htstamp(status, &htstamp);
+  unsigned long long timestamp =
+      htstamp.tv_sec * 1'000'000'000ull + htstamp.tv_nsec;
+  if (timestamp == 0) {
+    timestamp = getTimestampNs();
+  }
+
+  // Silence is written while paused, the frames of the source are in front
+  // of it after a pause and behind it after a resume.
+  const snd_pcm_sframes_t delay = snd_pcm_status_get_delay(status);
+  const snd_pcm_sframes_t queued =
+      paused ? std::max(0l, delay - framesSincePauseToggle)
+             : std::min(delay, framesSincePauseToggle);
+  PlaybackPosition position{
+      .frames = currentSourceTotalFramesWritten - queued,
+      .sampleRate = currentStreamAudioFormat.sampleRate,
+      .timestamp = timestamp,
+      .running = paused ? queued > 0 : queued == delay};
+  snd_pcm_sframes_t limit = currentSourceTotalFramesWritten;
+  if (position.frames < 0) {
+    position.frames += previousSourceEndFrames;
+    limit = previousSourceEndFrames;
+  }
+  playbackClock.publish(position, limit);
+  return true;
+}
+
+void AlsaAudioEmitter::publishStoppedPosition(snd_pcm_sframes_t frames) {
+  playbackClock.publish({.frames = frames,
+                         .sampleRate = currentStreamAudioFormat.sampleRate,
+                         .timestamp = static_cast<unsigned long long>(
+                             getTimestampNs()),
+                         .running = false},
+                        frames);
+}
+
 bool AlsaAudioEmitter::handleInputNodeStateChange() {
   auto inputNodeState = inputNode->getState();
   if (inputNodeState.state == AudioGraphNodeState::SOURCE_CHANGED) {
+    reportTrackStats();
     inputNode->acceptSourceChange();
     inputNodeState = inputNode->getState();
+    previousSourceEndFrames = currentSourceTotalFramesWritten;
     currentSourceTotalFramesWritten = 0;
 
     auto newStreamInfo = inputNodeState.streamInfo;
@@ -315,16 +673,32 @@ bool AlsaAudioEmitter::handleInputNodeStateChange() {
       spdlog::info(
           "Source changed - not streaming or different format, draining");
       drainPcm();
+      publishStoppedPosition(0);
       setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
       return false;
     } else {
+      // A crossfading switcher hands over a source which has already been
+      // partially played, the transition happened leadInFrames earlier.
+      // Any other source is handed over from its start.
+      assert(crossfadeEnabled || inputNodeState.position == 0);
+      const snd_pcm_sframes_t leadInFrames =
+          crossfadeEnabled ? inputNodeState.position : 0;
+      currentSourceTotalFramesWritten = leadInFrames;
+      previousSourceEndFrames -= leadInFrames;
+
+      updatePlayedFrames();
       snd_pcm_sframes_t framesDelay = 0;
       log_on_error(snd_pcm_delay(pcmHandle, &framesDelay));
-      spdlog::debug("Reporting source change in {}ms, frames={}",
-                    framesToTimeMs(framesDelay).count(), framesDelay);
+      // The transition has already been played if the lead-in is longer
+      // than the audio queued in the device.
+      const snd_pcm_sframes_t framesToSwitch =
+          std::max(0l, framesDelay - leadInFrames);
+      spdlog::debug("Reporting source change in {}ms, frames={}, leadIn={}",
+                    framesToTimeMs(framesToSwitch).count(), framesDelay,
+                    leadInFrames);
 
       playedFramesCounter.callOnOrAfterFrame(
-          framesDelay,
+          framesToSwitch,
           [this, streamInfo = newStreamInfo](snd_pcm_sframes_t frames) {
             setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
             setState(StreamState{AudioGraphNodeState::STREAMING,
@@ -335,6 +709,7 @@ bool AlsaAudioEmitter::handleInputNodeStateChange() {
              inputNodeState.state == AudioGraphNodeState::ERROR) {
     spdlog::info("Source finished, state={}",
                  stateToString(inputNodeState.state));
+    reportTrackStats();
     drainPcm();
     return false;
   }
@@ -342,6 +717,19 @@ bool AlsaAudioEmitter::handleInputNodeStateChange() {
   return true;
 }
 
+void AlsaAudioEmitter::updatePlayedFrames() {
+  snd_pcm_sframes_t delay = 0;
+  if (snd_pcm_delay(pcmHandle, &delay) < 0) {
+    return;
+  }
+  // Frames are written in chunks of varying size with timer scheduling and
+  // preroll, the frames played are those which left the queue since.
+  if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_RUNNING) {
+    playedFramesCounter.update(std::max(0l, framesQueued - delay));
+  }
+  framesQueued = delay;
+}
+
 snd_pcm_sframes_t AlsaAudioEmitter::writeToAlsa(
     snd_pcm_uframes_t framesToWrite,
     std::function<snd_pcm_sframes_t(void *ptr, snd_pcm_uframes_t frames,
@@ -352,10 +740,13 @@ snd_pcm_sframes_t AlsaAudioEmitter::writeToAlsa(
   snd_pcm_uframes_t offset = 0, frames = framesToWrite;
   int err = snd_pcm_mmap_begin(pcmHandle, &my_areas, &offset, &frames);
   if (err < 0) {
-    if (xrun_recovery(pcmHandle, err) < 0) {
+    if (recoverFromXrun(err) < 0) {
       throw std::runtime_error("Error in mmap begin: " +
                                std::string(snd_strerror(err)));
     }
+    frames = framesToWrite;
+    throw_on_error(
+        snd_pcm_mmap_begin(pcmHandle, &my_areas, &offset, &frames));
   }
 
   void *ptr = static_cast<uint8_t *>(my_areas[0].addr) +
@@ -366,10 +757,12 @@ snd_pcm_sframes_t AlsaAudioEmitter::writeToAlsa(
 
   err = snd_pcm_mmap_commit(pcmHandle, offset, frames);
   if (static_cast<snd_pcm_uframes_t>(err) != frames || err < 0) {
-    if (xrun_recovery(pcmHandle, err) < 0) {
+    if (recoverFromXrun(err) < 0) {
       throw std::runtime_error("Error in mmap commit: " +
                                std::string(snd_strerror(err)));
     }
+  } else {
+    framesQueued += frames;
   }
 
   perfmon_end("writeToAlsa");
@@ -384,19 +777,19 @@ AlsaAudioEmitter::readIntoAlsaFromStream(std::stop_token stopToken,
 
   perfmon_begin("readIntoAlsaFromStream");
 
-  if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_RUNNING) {
-    playedFramesCounter.update(framesToRead);
-  }
+  updatePlayedFrames();
 
   while (framesRead < framesToRead) {
     snd_pcm_uframes_t frames = framesToRead - framesRead;
     if (paused) {
 
-      framesRead += writeToAlsa(
+      auto silenceFrames = writeToAlsa(
           frames, [](void *ptr, snd_pcm_uframes_t frames, size_t bytes) {
             memset(ptr, 0, bytes);
             return frames;
           });
+      framesRead += silenceFrames;
+      framesSincePauseToggle += silenceFrames;
 
       if (!handleInputNodeStateChange()) {
         return -1;
@@ -410,6 +803,9 @@ AlsaAudioEmitter::readIntoAlsaFromStream(std::stop_token stopToken,
 
       framesRead += actualFrames;
       currentSourceTotalFramesWritten += actualFrames;
+      framesSincePauseToggle += actualFrames;
+      framesWritten.add(actualFrames);
+      lapFrames += actualFrames;
 
       if (!handleInputNodeStateChange()) {
         return -1;
@@ -417,8 +813,11 @@ AlsaAudioEmitter::readIntoAlsaFromStream(std::stop_token stopToken,
 
       if (static_cast<snd_pcm_uframes_t>(actualFrames) < frames) {
         perfmon_begin("waitForMoreInputData");
-        auto bytesAvailable =
-            waitForInputData(stopToken, frames - actualFrames);
+        size_t bytesAvailable = 0;
+        {
+          ScopedTimer timer(waitForDataNs);
+          bytesAvailable = waitForInputData(stopToken, frames - actualFrames);
+        }
         perfmon_end("waitForMoreInputData");
         if (bytesAvailable == 0) {
           drainPcm();
@@ -436,8 +835,12 @@ size_t AlsaAudioEmitter::waitForInputData(std::stop_token stopToken,
   if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_RUNNING) {
     snd_pcm_sframes_t delayFrames = 0;
     log_on_error(snd_pcm_delay(pcmHandle, &delayFrames));
-    auto timeout = framesToTimeMs(std::max(
-        0l, delayFrames - static_cast<snd_pcm_sframes_t>(2 * periodSize)));
+    const snd_pcm_sframes_t marginFrames =
+        timerScheduling.has_value()
+            ? timerScheduling->marginMs * currentStreamAudioFormat.sampleRate /
+                  1000
+            : 2 * periodSize;
+    auto timeout = framesToTimeMs(std::max(0l, delayFrames - marginFrames));
     return inputNode->waitForDataFor(
         stopToken, timeout, snd_pcm_frames_to_bytes(pcmHandle, frames));
   }
@@ -454,22 +857,39 @@ AlsaAudioEmitter::framesToTimeMs(snd_pcm_sframes_t frames) {
 
 void AlsaAudioEmitter::startPcmStream(const StreamInfo &streamInfo,
                                       snd_pcm_uframes_t position) {
-  spdlog::info("Starting playback");
   throw_on_error(snd_pcm_start(pcmHandle));
+  if (startRequested.has_value()) {
+    auto elapsed = std::chrono::steady_clock::now() - *startRequested;
+    startRequested.reset();
+    timeToFirstSampleNs.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    spdlog::info(
+        "Starting playback, {}ms after the request",
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+  } else {
+    spdlog::info("Starting playback");
+  }
+  playbackClock.publish(
+      {.frames = static_cast<int64_t>(position),
+       .sampleRate = currentStreamAudioFormat.sampleRate,
+       .timestamp = static_cast<unsigned long long>(getTimestampNs()),
+       .running = true},
+      currentSourceTotalFramesWritten);
   setState({AudioGraphNodeState::STREAMING, framesToTimeMs(position).count(),
             streamInfo});
 }
 
 void AlsaAudioEmitter::drainPcm() {
+  if (!seekHappened) {
+    // Lets the position advance up to the last frame written.
+    snd_pcm_status_t *status;
+    snd_pcm_status_alloca(&status);
+    updatePlaybackPosition(status);
+  }
   if (snd_pcm_state(pcmHandle) == SND_PCM_STATE_RUNNING) {
-    auto drainSequence = playedFramesCounter.drainSequence();
-    if (!drainSequence.empty()) {
-      snd_pcm_sframes_t prevFrames = 0;
-      for (auto frames : drainSequence) {
-        std::this_thread::sleep_for(framesToTimeMs(frames - prevFrames));
-        playedFramesCounter.update(frames - prevFrames);
-        prevFrames = frames;
-      }
+    while (auto frames = playedFramesCounter.framesToNextEvent()) {
+      std::this_thread::sleep_for(framesToTimeMs(*frames));
+      playedFramesCounter.update(*frames);
     }
     log_on_error(snd_pcm_drop(pcmHandle));
   }
@@ -480,12 +900,116 @@ void AlsaAudioEmitter::drainPcm() {
   }
 }
 
+int AlsaAudioEmitter::recoverFromXrun(int err) {
+  if (err != -EPIPE && err != -ESTRPIPE) {
+    return err;
+  }
+
+  recordXrun(err);
+  err = xrun_recovery(pcmHandle, err);
+  // The buffer is empty, refill it quickly.
+  resetFillTarget();
+  if (err == 0 && adaptiveLatency.has_value() &&
+      adaptiveLatency->onXrun(std::chrono::steady_clock::now())) {
+    // The device is recovered in the middle of a write, it is set up again
+    // once the write has returned.
+    applyLatencySettings(adaptiveLatency->getSettings());
+    latencyChangePending = true;
+  }
+  return err;
+}
+
+void AlsaAudioEmitter::recordXrun(int err) {
+  perfmon_event("xrun", err);
+  xruns.add();
+  PerfMon::getInstance().requestTraceDump();
+
+  XrunEvent event{
+      .timestamp = static_cast<unsigned long long>(getTimestampNs()),
+      .positionMs = framesToTimeMs(currentSourceTotalFramesWritten).count(),
+      .error = err,
+      .bufferTimeMs = bufferTimeMs,
+      .periodTimeMs = periodTimeMs,
+      .bufferLevels = {}};
+  inputNode->getBufferLevels(event.bufferLevels);
+
+  std::string levels;
+  for (const auto &level : event.bufferLevels) {
+    levels += fmt::format(" {}={}/{}", level.node, level.bytes, level.capacity);
+  }
+  spdlog::warn("Xrun ({}) at {}ms, buffer={}ms, period={}ms, levels:{}",
+               snd_strerror(err), event.positionMs, event.bufferTimeMs,
+               event.periodTimeMs, levels);
+
+  std::lock_guard lock(xrunMutex);
+  ++xrunCount;
+  recentXruns.push_back(std::move(event));
+  if (recentXruns.size() > MAX_RECENT_XRUNS) {
+    recentXruns.pop_front();
+  }
+}
+
+XrunStats AlsaAudioEmitter::getXrunStats() {
+  std::lock_guard lock(xrunMutex);
+  XrunStats stats;
+  stats.count = xrunCount;
+  stats.recent.assign(recentXruns.begin(), recentXruns.end());
+  stats.bufferTimeMs = bufferTimeMs;
+  stats.periodTimeMs = periodTimeMs;
+  return stats;
+}
+
+void AlsaAudioEmitter::applyLatencySettings(
+    AdaptiveLatency::Settings settings) {
+  spdlog::warn("Changing ALSA latency from {}ms to {}ms, period from {}ms to "
+               "{}ms",
+               requestedLatencyMs, settings.latencyMs, requestedPeriodMs,
+               settings.periodMs);
+  requestedLatencyMs = settings.latencyMs;
+  requestedPeriodMs = settings.periodMs;
+}
+
+void AlsaAudioEmitter::reportTrackStats() {
+  auto usage = cpuMeter.lap();
+  if (lapFrames > 0 && currentStreamAudioFormat.sampleRate > 0) {
+    auto audioTime = std::chrono::nanoseconds(
+        lapFrames * 1'000'000'000ll / currentStreamAudioFormat.sampleRate);
+    realtimeFactor.set(usage.realtimeFactor(audioTime));
+    spdlog::info("AlsaAudioEmitter: played {:.1f}s with {:.1f}ms of CPU time, "
+                 "realtime factor {:.0f}, context switches voluntary={}, "
+                 "involuntary={}",
+                 audioTime.count() / 1e9, usage.cpuTime.count() / 1e6,
+                 realtimeFactor.get(), usage.voluntarySwitches,
+                 usage.involuntarySwitches);
+  }
+  lapFrames = 0;
+
+  auto stats = deadlineMonitor.getStats();
+  deadlineMonitor.reset();
+  if (stats.periods == 0) {
+    return;
+  }
+
+  auto level = stats.misses > 0 || stats.nearMisses > 0
+                   ? spdlog::level::warn
+                   : spdlog::level::debug;
+  spdlog::log(level,
+              "Period deadlines: periods={}, minSlack={:.2f}ms, "
+              "p1Slack={:.2f}ms, nearMisses={}, misses={}",
+              stats.periods, stats.minSlackNs / 1e6, stats.p1SlackNs / 1e6,
+              stats.nearMisses, stats.misses);
+}
+
 void AlsaAudioEmitter::workerThread(std::stop_token token) {
   if (inputNode == nullptr) {
     return;
   }
   pthread_setname_np(pthread_self(), "AlsaAudio");
-  isWorkerRunning = true;
+  startRequested = std::chrono::steady_clock::now();
+  cpuMeter.start();
+  lapFrames = 0;
+  seekRequests.open();
+  pauseRequests.open();
   try {
     while (!token.stop_requested()) {
       auto inputNodeState = waitForInputToBeReady(token);
@@ -514,37 +1038,51 @@ void AlsaAudioEmitter::workerThread(std::stop_token token) {
 
       snd_pcm_uframes_t streamStartPosition = currentSourceTotalFramesWritten;
       paused = false;
+      framesSincePauseToggle = 0;
+      resetFillTarget();
+      prerollFill = preroll.has_value() ? prerollStartFrames() : 0;
 
       while (!token.stop_requested()) {
+        if (latencyChangePending) {
+          // The device buffer has run empty, the few frames written since
+          // the xrun are dropped with the old settings.
+          configureDevice(currentStreamAudioFormat);
+          resetFillTarget();
+        }
+
         auto framesToRead = waitForAlsaBufferSpace();
         if (!framesToRead) {
           break;
         }
 
         auto combinedToken =
-            combineStopTokens(token, seekRequestSignal.getStopToken(),
-                              pauseRequestSignal.getStopToken());
+            combineStopTokens(token, seekRequests.getStopToken(),
+                              pauseRequests.getStopToken());
 
         auto framesRead =
             readIntoAlsaFromStream(combinedToken.get_token(), framesToRead);
         if (framesRead < 0) {
           break;
         }
+        if (drainDeadline.has_value()) {
+          deadlineMonitor.record(*drainDeadline -
+                                 std::chrono::steady_clock::now());
+        }
+        cpuMeter.sample();
 
-        if (pauseRequestSignal.getValue()) {
-          if (paused != *pauseRequestSignal.getValue()) {
-            bool success = handlePauseSignal(*pauseRequestSignal.getValue());
-            pauseRequestSignal.respond(success ? *pauseRequestSignal.getValue()
-                                               : paused);
+        if (auto pauseRequest = pauseRequests.take()) {
+          if (paused != *pauseRequest) {
+            bool success = handlePauseRequest(*pauseRequest);
+            pauseRequests.respond(success ? *pauseRequest : paused);
           } else {
-            pauseRequestSignal.respond(paused);
+            pauseRequests.respond(paused);
           }
           continue;
         }
 
-        if (seekRequestSignal.getValue()) {
+        if (auto positionMs = seekRequests.take()) {
           setState(StreamState{AudioGraphNodeState::PREPARING});
-          if (!handleSeekSignal()) {
+          if (!handleSeekRequest(*positionMs)) {
             continue;
           }
 
@@ -569,8 +1107,10 @@ void AlsaAudioEmitter::workerThread(std::stop_token token) {
   }
 
   closeDevice();
+  playbackClock.reset();
   inputNode = nullptr;
-  isWorkerRunning = false;
+  seekRequests.close();
+  pauseRequests.close();
 }
 
 void AlsaAudioEmitter::setupAudioFormat(
@@ -578,7 +1118,17 @@ void AlsaAudioEmitter::setupAudioFormat(
 
   spdlog::debug("Setting up audio format: {}", streamAudioFormat.toString());
 
-  if (pcmHandle != nullptr && streamAudioFormat == currentStreamAudioFormat) {
+  // Lowering the latency needs the device to be set up again, which is
+  // only done when a new stream starts.
+  bool latencyLowered =
+      adaptiveLatency.has_value() &&
+      adaptiveLatency->lowerIfStable(std::chrono::steady_clock::now());
+  if (latencyLowered) {
+    applyLatencySettings(adaptiveLatency->getSettings());
+  }
+
+  if (pcmHandle != nullptr && streamAudioFormat == currentStreamAudioFormat &&
+      !latencyLowered) {
     spdlog::debug("Audio format is already set up - ignoring");
     throw_on_error(snd_pcm_prepare(pcmHandle));
     return;
@@ -592,68 +1142,55 @@ void AlsaAudioEmitter::setupAudioFormat(
     openDevice();
   }
 
+  configureDevice(streamAudioFormat);
+  currentStreamAudioFormat = streamAudioFormat;
+  lastStreamAudioFormat = streamAudioFormat;
+
+  // Hack for HiFiBerry boards on Raspberry Pi
+  // Sleep to make sure RPi is ready to play.
+  // I2S sync mechanism doesn't work properly
+  // wich results in the first ~500 ms of the track being cut off.
+  if (sleepAfterFormatSetupMs) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(sleepAfterFormatSetupMs));
+  }
+}
+
+void AlsaAudioEmitter::configureDevice(
+    const StreamAudioFormat &streamAudioFormat) {
   unsigned sampleRate = streamAudioFormat.sampleRate;
+  latencyChangePending = false;
   bufferSize = requestedBufferSize;
   periodSize = requestedPeriodSize;
 
   initHwParams(sampleRate, streamAudioFormat.sampleFormat);
   setSwParams();
 
-  currentStreamAudioFormat = streamAudioFormat;
-
   int count = throw_on_error(snd_pcm_poll_descriptors_count(pcmHandle));
   ufds.resize(count);
   throw_on_error(snd_pcm_poll_descriptors(pcmHandle, ufds.data(), count));
 
+  // A write schedules at most a pause toggle and a source change, the
+  // buffer holds the frames of that many writes.
+  const snd_pcm_uframes_t minWrite =
+      timerScheduling.has_value() ? requestedPeriodMs * sampleRate / 1000
+                                  : periodSize;
+  playedFramesCounter.reserve(2 * (bufferSize / std::max(minWrite, 1ul) + 1));
+
   pollTimeout = std::chrono::milliseconds(bufferSize * 1000 / sampleRate);
+  bufferTimeMs = pollTimeout.count();
+  periodTimeMs = periodSize * 1000 / sampleRate;
+  // By default a near miss is less than a period left in the buffer, with
+  // timer scheduling less than half of the margin.
+  deadlineMonitor.setNearMissThreshold(
+      nearMissThreshold.value_or(std::chrono::milliseconds(
+          timerScheduling.has_value() ? timerScheduling->marginMs / 2
+                                      : periodTimeMs.load())));
 
   spdlog::info(
       "Audio format set up: {}, bufferSize={}, periodSize={}, latency={}ms",
       streamAudioFormat.toString(), bufferSize, periodSize,
       pollTimeout.count());
-
-  // Hack for HiFiBerry boards on Raspberry Pi
-  // Sleep to make sure RPi is ready to play.
-  // I2S sync mechanism doesn't work properly
-  // wich results in the first ~500 ms of the track being cut off.
-  if (sleepAfterFormatSetupMs) {
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(sleepAfterFormatSetupMs));
-  }
-}
-
-void PlayedFramesCounter::update(snd_pcm_sframes_t frames) {
-  lastPlayedFrames += frames;
-  for (auto it = onFramesPlayedCallbacks.begin();
-       it != onFramesPlayedCallbacks.end();) {
-    if (lastPlayedFrames >= it->first) {
-      it->second(lastPlayedFrames - it->first);
-      it = onFramesPlayedCallbacks.erase(it);
-    } else {
-      ++it;
-    }
-  }
-}
-
-std::vector<snd_pcm_sframes_t> PlayedFramesCounter::drainSequence() {
-  std::vector<snd_pcm_sframes_t> sequence;
-  for (auto &callback : onFramesPlayedCallbacks) {
-    sequence.push_back(callback.first - lastPlayedFrames);
-  }
-
-  std::sort(sequence.begin(), sequence.end());
-  return sequence;
-}
-
-void PlayedFramesCounter::callOnOrAfterFrame(
-    snd_pcm_sframes_t frame,
-    std::function<void(snd_pcm_sframes_t)> onFramesPlayed) {
-  onFramesPlayedCallbacks.push_back({frame + lastPlayedFrames, onFramesPlayed});
-}
-
-void PlayedFramesCounter::reset() {
-  onFramesPlayedCallbacks.clear();
-  lastPlayedFrames = 0;
 }
 
 void AlsaAudioEmitter::setSampleFormat(AudioSampleFormat requestedFormat,
@@ -763,6 +1300,13 @@ void AlsaAudioEmitter::setSwParams() {
     throw_on_error(
         snd_pcm_sw_params_set_avail_min(pcmHandle, sw_params, periodSize));
 
+    // Timestamps of the hardware pointer updates, in the clock of
+    // getTimestampNs(), for the playback position.
+    log_on_error(snd_pcm_sw_params_set_tstamp_mode(pcmHandle, sw_params,
+                                                   SND_PCM_TSTAMP_ENABLE));
+    log_on_error(snd_pcm_sw_params_set_tstamp_type(
+        pcmHandle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC));
+
     /* write the parameters to the playback device */
     throw_on_error(snd_pcm_sw_params(pcmHandle, sw_params));
   } catch (const std::exception &ex) {
@@ -778,9 +1322,18 @@ void AlsaAudioEmitter::setLatencyBasedBufferSize(snd_pcm_hw_params_t *params) {
   throw_on_error(snd_pcm_hw_params_malloc(&paramsSaved));
   snd_pcm_hw_params_copy(paramsSaved, params);
 
+  // With timer scheduling the buffer is large and has a few long periods,
+  // the latency is the fill level.
+  const uint32_t latencyMs = timerScheduling.has_value()
+                                 ? timerScheduling->bufferMs
+                                 : requestedLatencyMs;
+  const uint32_t periodMs = timerScheduling.has_value()
+                                ? latencyMs / TIMER_SCHEDULING_PERIODS
+                                : requestedPeriodMs;
+
   int dir = 0;
-  auto latencyMcs = requestedLatencyMs * 1000;
-  auto periodMcs = requestedPeriodMs * 1000;
+  auto latencyMcs = latencyMs * 1000;
+  auto periodMcs = periodMs * 1000;
   int err = snd_pcm_hw_params_set_buffer_time_near(pcmHandle, params,
                                                    &latencyMcs, &dir);
   try {
@@ -793,7 +1346,7 @@ void AlsaAudioEmitter::setLatencyBasedBufferSize(snd_pcm_hw_params_t *params) {
 
       throw_on_error(snd_pcm_hw_params_get_period_size(params, &periodSize, 0));
 
-      bufferSize = periodSize * (requestedLatencyMs / requestedPeriodMs);
+      bufferSize = periodSize * (latencyMs / periodMs);
       throw_on_error(snd_pcm_hw_params_set_buffer_size_near(pcmHandle, params,
                                                             &bufferSize));
 
@@ -805,7 +1358,7 @@ void AlsaAudioEmitter::setLatencyBasedBufferSize(snd_pcm_hw_params_t *params) {
       throw_on_error(snd_pcm_hw_params_get_buffer_time(params, &latencyMcs, 0));
 
       /* set the period time */
-      periodMcs = latencyMcs / (requestedLatencyMs / requestedPeriodMs);
+      periodMcs = latencyMcs / (latencyMs / periodMs);
       throw_on_error(snd_pcm_hw_params_set_period_time_near(pcmHandle, params,
                                                             &periodMcs, 0));
 
@@ -1,41 +1,26 @@
 #ifndef ALSA_AUDIO_EMITTER_H
 #define ALSA_AUDIO_EMITTER_H
 
+#include "AdaptiveLatency.h"
 #include "AudioGraphNode.h"
+#include "CommandQueue.h"
 #include "Config.h"
+#include "DeadlineMonitor.h"
+#include "Metrics.h"
+#include "PlayedFramesCounter.h"
 #include "Utils.h"
+#include "XrunStats.h"
 
 #include <alsa/asoundlib.h>
 
 #include <functional>
-#include <list>
+#include <deque>
+#include <mutex>
+#include <optional>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
-class PlayedFramesCounter {
-public:
-  PlayedFramesCounter() = default;
-  void update(snd_pcm_sframes_t frames);
-
-  snd_pcm_sframes_t getPlayedFrames() const { return lastPlayedFrames; }
-
-  std::vector<snd_pcm_sframes_t> drainSequence();
-
-  void
-  callOnOrAfterFrame(snd_pcm_sframes_t frame,
-                     std::function<void(snd_pcm_sframes_t)> onFramesPlayed);
-
-  void reset();
-
-private:
-  snd_pcm_sframes_t lastPlayedFrames = 0;
-
-  std::list<
-      std::pair<snd_pcm_sframes_t, std::function<void(snd_pcm_sframes_t)>>>
-      onFramesPlayedCallbacks;
-};
-
 class AlsaAudioEmitter : public AudioGraphEmitterNode {
 public:
   AlsaAudioEmitter(const Config &config);
@@ -45,8 +30,17 @@ public:
   virtual void
   disconnect(std::shared_ptr<AudioGraphOutputNode> outputNode) override;
 
-  virtual void pause(bool paused) override;
-  virtual size_t seek(size_t positionMs) override;
+  virtual std::future<bool> pause(bool paused) override;
+  virtual std::future<size_t> seek(size_t positionMs) override;
+  virtual PlaybackPosition getPosition() const override {
+    return playbackClock.get();
+  }
+
+  // Period deadline stats of the track being played.
+  DeadlineStats getDeadlineStats() const { return deadlineMonitor.getStats(); }
+  XrunStats getXrunStats();
+  // Name of the metric group of this emitter in the MetricsRegistry.
+  const std::string &getMetricsGroupName() const { return metrics.getName(); }
 
   virtual ~AlsaAudioEmitter();
 
@@ -60,31 +54,110 @@ private:
 
   snd_pcm_uframes_t bufferSize;
   snd_pcm_uframes_t periodSize;
+  // Actual buffer and period time, readable from any thread.
+  std::atomic<uint32_t> bufferTimeMs = 0;
+  std::atomic<uint32_t> periodTimeMs = 0;
 
   // Fixups
   size_t sleepAfterFormatSetupMs;
   bool reopenDeviceWithNewFormat;
+  // Set if `output.crossfade_ms` is non-zero, the input then hands over
+  // sources which have been partially played while crossfading.
+  bool crossfadeEnabled;
 
   std::shared_ptr<AudioGraphOutputNode> inputNode;
   std::jthread playbackThread;
-  std::atomic<bool> isWorkerRunning = false;
 
   StreamAudioFormat currentStreamAudioFormat;
   PlayedFramesCounter playedFramesCounter;
+  // Frames in the device buffer when the played frames were last counted,
+  // plus the frames written since.
+  snd_pcm_sframes_t framesQueued = 0;
   snd_pcm_sframes_t currentSourceTotalFramesWritten = 0;
+  // Position at which the previous source ends, while its last frames are
+  // still in the device buffer after a gapless source change.
+  snd_pcm_sframes_t previousSourceEndFrames = 0;
+  // Frames written since the stream started or was last paused or resumed.
+  snd_pcm_sframes_t framesSincePauseToggle = 0;
+  PlaybackClock playbackClock;
   std::chrono::milliseconds pollTimeout = std::chrono::milliseconds(100);
   snd_pcm_t *pcmHandle = nullptr;
   std::vector<pollfd> ufds;
   std::unordered_map<AudioSampleFormat, AudioSampleFormat> sampleSubstitute;
 
-  Signal<size_t> seekRequestSignal;
-  Signal<bool> pauseRequestSignal;
+  // Created if `output.alsa.adaptive_latency.enabled` is set.
+  std::optional<AdaptiveLatency> adaptiveLatency;
+  // Set by the xrun recovery, the device is set up with the new latency
+  // at the top of the write loop.
+  bool latencyChangePending = false;
+
+  // Set if `output.alsa.timer_scheduling.enabled` is set. Instead of waking
+  // up every period, the writer sleeps on timerFd until marginMs of audio
+  // is left in a large buffer and fills it up to fillTarget. The target is
+  // the latency after a start, a pause or an xrun and doubles with every
+  // wakeup up to maxFillMs. The frames queued beyond marginMs are taken
+  // back on a pause or a resume, so it takes effect right away.
+  struct TimerScheduling {
+    uint32_t bufferMs;
+    uint32_t maxFillMs;
+    uint32_t marginMs;
+    snd_pcm_sframes_t fillTarget = 0;
+  };
+  std::optional<TimerScheduling> timerScheduling;
+  int timerFd = -1;
+  // Written to cut the sleep short when a command is posted.
+  int wakeupFd = -1;
+
+  // Set if `output.alsa.preroll.enabled` is set. While the input connects
+  // and reads the metadata the device is opened and, if prepareDevice is
+  // set, set up for the format played last. A stream is started with
+  // startMs of audio in the buffer, then the fill limit doubles with every
+  // write until the whole buffer is used.
+  struct Preroll {
+    uint32_t startMs;
+    bool prepareDevice;
+  };
+  std::optional<Preroll> preroll;
+  // Fill limit of the device buffer, 0 once the whole buffer is used.
+  snd_pcm_sframes_t prerollFill = 0;
+  // Format of the last stream, kept when the device is closed.
+  StreamAudioFormat lastStreamAudioFormat;
+  // Time playback or a seek was requested, until the stream is started.
+  std::optional<std::chrono::steady_clock::time_point> startRequested;
+
+  static constexpr size_t MAX_RECENT_XRUNS = 16;
+  std::mutex xrunMutex;
+  uint64_t xrunCount = 0;
+  std::deque<XrunEvent> recentXruns;
+
+  DeadlineMonitor deadlineMonitor;
+  std::optional<std::chrono::milliseconds> nearMissThreshold;
+  // Time at which the device buffer runs empty if no more frames are
+  // written, measured when woken up for the current period.
+  std::optional<std::chrono::steady_clock::time_point> drainDeadline;
+
+  CommandQueue<size_t> seekRequests{static_cast<size_t>(-1)};
+  CommandQueue<bool> pauseRequests{false};
   bool paused = false;
   bool seekHappened = false;
 
+  MetricGroup metrics{"AlsaAudioEmitter"};
+  Counter &framesWritten = metrics.counter("frames_written");
+  Counter &xruns = metrics.counter("xruns");
+  Counter &seeks = metrics.counter("seeks");
+  Counter &wakeups = metrics.counter("wakeups");
+  LatencyHistogram &waitForDeviceNs = metrics.histogram("wait_for_device_ns");
+  LatencyHistogram &waitForDataNs = metrics.histogram("wait_for_data_ns");
+  LatencyHistogram &timeToFirstSampleNs =
+      metrics.histogram("time_to_first_sample_ns");
+  Gauge &realtimeFactor = metrics.gauge("realtime_factor");
+  ThreadCpuMeter cpuMeter{metrics};
+  // Frames written since the track stats were last reported.
+  snd_pcm_sframes_t lapFrames = 0;
+
   void workerThread(std::stop_token token);
-  bool handleSeekSignal();
-  bool handlePauseSignal(bool paused);
+  bool handleSeekRequest(size_t positionMs);
+  bool handlePauseRequest(bool paused);
 
   void openDevice();
   void closeDevice();
@@ -94,12 +167,33 @@ private:
                        snd_pcm_hw_params_t *params);
   void setSwParams();
   void setLatencyBasedBufferSize(snd_pcm_hw_params_t *params);
+  void configureDevice(const StreamAudioFormat &streamAudioFormat);
+  int recoverFromXrun(int err);
+  void recordXrun(int err);
+  void applyLatencySettings(AdaptiveLatency::Settings settings);
   size_t readAndConvertFrames(void *dest, size_t bytes);
 
   void setupAudioFormat(const StreamAudioFormat &streamAudioFormat);
   StreamState waitForInputToBeReady(std::stop_token token);
   snd_pcm_sframes_t waitForAlsaBufferSpace();
+  void sleepUntilRefill();
+  // Sleeps on timerFd, cut short by a command or a stop.
+  void sleepOnTimer(std::chrono::nanoseconds duration);
+  snd_pcm_sframes_t framesToRefill(snd_pcm_sframes_t availableFrames);
+  void resetFillTarget();
+  // Takes back the frames written since the last pause toggle which are
+  // not about to be played, returns the number of frames taken back.
+  snd_pcm_sframes_t rewindQueuedFrames();
+  // Opens the device, and sets it up if Preroll::prepareDevice is set,
+  // while the input is preparing.
+  void prerollDevice();
+  snd_pcm_sframes_t prerollStartFrames();
+  snd_pcm_sframes_t limitPrerollFill(snd_pcm_sframes_t frames);
+  bool updatePlaybackPosition(snd_pcm_status_t *status);
+  void publishStoppedPosition(snd_pcm_sframes_t frames);
   bool handleInputNodeStateChange();
+  // Counts the frames played since the last call, calling the events due.
+  void updatePlayedFrames();
   snd_pcm_sframes_t writeToAlsa(
       snd_pcm_uframes_t framesToWrite,
       std::function<snd_pcm_sframes_t(void *ptr, snd_pcm_uframes_t frames,
@@ -110,6 +204,7 @@ private:
   size_t waitForInputData(std::stop_token stopToken, snd_pcm_uframes_t frames);
   void startPcmStream(const StreamInfo &streamInfo, snd_pcm_uframes_t position);
   void drainPcm();
+  void reportTrackStats();
 
   inline std::chrono::milliseconds framesToTimeMs(snd_pcm_sframes_t frames);
 
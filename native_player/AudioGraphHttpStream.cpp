@@ -7,29 +7,48 @@
 
 #include <boost/algorithm/string.hpp>
 #include <functional>
-#include <pthread.h>
 
 #include "Log.h"
+#include "PerfMon.h"
 
 AudioGraphHttpStream::AudioGraphHttpStream(const std::string &url,
                                            size_t bufferSize, size_t chunkSize)
-    : url(url),
-      buffer(std::max(bufferSize, static_cast<size_t>(CURL_MAX_WRITE_SIZE)),
+    : AudioGraphHttpStream(bufferSize, chunkSize) {
+  open(url);
+}
+
+AudioGraphHttpStream::AudioGraphHttpStream(size_t bufferSize,
+                                           size_t chunkSize)
+    : buffer(std::max(bufferSize, static_cast<size_t>(CURL_MAX_WRITE_SIZE)),
              std::bind(&AudioGraphHttpStream::emptyBufferCallback, this,
                        std::placeholders::_1)),
       chunkSize(chunkSize) {
-  readerThread =
-      std::jthread(std::bind_front(&AudioGraphHttpStream::reader, this));
+  metrics.gauge("buffer_bytes", [this]() { return buffer.size(); });
+  metrics.gauge("buffer_capacity", [this]() { return buffer.max_size(); });
+  metrics.gauge("bytes_per_second",
+                [this]() { return transferRate.perSecond(); });
 }
 
-AudioGraphHttpStream::~AudioGraphHttpStream() {
-  if (readerThread.joinable()) {
-    readerThread.request_stop();
-    readerThread.join();
-    readerThread = std::jthread();
-  }
+AudioGraphHttpStream::~AudioGraphHttpStream() { close(); }
+
+void AudioGraphHttpStream::open(const std::string &url) {
+  close();
+
+  this->url = url;
+  contentLength = 1;
+  offset = 0;
+  acceptRange = true;
+  hasReadHeader = false;
+  setStreamingState = true;
+  buffer.resetEof();
+  buffer.clear();
+
+  setState(StreamState(AudioGraphNodeState::PREPARING));
+  readerThread.start(std::bind_front(&AudioGraphHttpStream::reader, this));
 }
 
+void AudioGraphHttpStream::close() { readerThread.stop(); }
+
 size_t AudioGraphHttpStream::WriteCallback(void *contents, size_t size,
                                            size_t nmemb) {
   size_t sizeWritten = 0;
@@ -48,12 +67,16 @@ size_t AudioGraphHttpStream::WriteCallback(void *contents, size_t size,
                                     .streamSize = contentLength}));
     setStreamingState = false;
   }
-  auto combinedStopToken = combineStopTokens(seekRequestSignal.getStopToken(),
-                                             readerThread.get_stop_token());
+  auto combinedStopToken = combineStopTokens(seekRequests.getStopToken(),
+                                             readerThread.getStopToken());
   while (sizeWritten < totalSize) {
-    auto spaceAvailable = buffer.waitForSpace(combinedStopToken.get_token());
+    size_t spaceAvailable = 0;
+    {
+      ScopedTimer timer(waitForSpaceNs);
+      spaceAvailable = buffer.waitForSpace(combinedStopToken.get_token());
+    }
     if (combinedStopToken.get_token().stop_requested()) {
-      if (seekRequestSignal.getStopToken().stop_requested()) {
+      if (seekRequests.pending()) {
         return chunkSize ? totalSize : 0;
       }
       return 0;
@@ -63,7 +86,11 @@ size_t AudioGraphHttpStream::WriteCallback(void *contents, size_t size,
                      std::min(totalSize - sizeWritten, spaceAvailable));
     sizeWritten += writtenChunkSize;
     offset += writtenChunkSize;
+    bytesTransferred.add(writtenChunkSize);
+    transferRate.add(writtenChunkSize);
+    lapBytes += writtenChunkSize;
   }
+  cpuMeter.sample();
 
   return sizeWritten;
 }
@@ -104,9 +131,22 @@ size_t AudioGraphHttpStream::headerCallback(char *buffer, size_t size,
   return totalSize;
 }
 
-void AudioGraphHttpStream::handleSeekSignal(size_t position) {
+void AudioGraphHttpStream::reportCpuUsage() {
+  auto usage = cpuMeter.lap();
+  if (lapBytes == 0) {
+    return;
+  }
+  spdlog::info("AudioGraphHttpStream: transferred {} bytes in {:.1f}ms of "
+               "CPU time, context switches voluntary={}, involuntary={}",
+               lapBytes, usage.cpuTime.count() / 1e6, usage.voluntarySwitches,
+               usage.involuntarySwitches);
+  lapBytes = 0;
+}
+
+void AudioGraphHttpStream::handleSeekRequest(size_t position) {
+  seeks.add();
   if (!acceptRange && position != 0) {
-    seekRequestSignal.respond(offset);
+    seekRequests.respond(offset);
     return;
   }
 
@@ -119,22 +159,25 @@ void AudioGraphHttpStream::handleSeekSignal(size_t position) {
     setStreamingState = true;
     setState(StreamState(AudioGraphNodeState::PREPARING));
   }
-  seekRequestSignal.respond(offset);
+  seekRequests.respond(offset);
 }
 
 void AudioGraphHttpStream::reader(std::stop_token stopToken) {
-  pthread_setname_np(pthread_self(), "HttpStream");
+  cpuMeter.start();
+  lapBytes = 0;
+  seekRequests.open();
   try {
     setState(StreamState(AudioGraphNodeState::PREPARING));
     while (!stopToken.stop_requested()) {
       readContentChunks(stopToken);
       buffer.setEof();
+      reportCpuUsage();
       spdlog::debug("Finished reading content");
-      auto seekValue = seekRequestSignal.waitValue(stopToken);
-      if (!seekValue) {
+      auto position = seekRequests.waitAndTake(stopToken);
+      if (!position) {
         break;
       }
-      handleSeekSignal(*seekValue);
+      handleSeekRequest(*position);
     }
   } catch (curlpp::LibcurlRuntimeError &ex) {
     if (!stopToken.stop_requested()) {
@@ -146,6 +189,7 @@ void AudioGraphHttpStream::reader(std::stop_token stopToken) {
     spdlog::error(ex.what());
     setState({AudioGraphNodeState::ERROR, ex.what()});
   }
+  seekRequests.close();
   buffer.setEof();
   spdlog::debug("Reader thread is finished");
 }
@@ -154,22 +198,25 @@ void AudioGraphHttpStream::readContentChunks(std::stop_token stopToken) {
   using namespace std::placeholders;
   int numRetries = 3;
   while (offset < contentLength) {
-    auto seekToPos = seekRequestSignal.getValue();
-    if (seekToPos) {
-      handleSeekSignal(seekToPos.value());
+    if (auto position = seekRequests.take()) {
+      handleSeekRequest(*position);
       continue;
     }
 
     auto combinedStopToken =
-        combineStopTokens(stopToken, seekRequestSignal.getStopToken());
+        combineStopTokens(stopToken, seekRequests.getStopToken());
 
-    buffer.waitForSpace(combinedStopToken.get_token(), buffer.max_size() / 2);
+    {
+      ScopedTimer timer(waitForSpaceNs);
+      buffer.waitForSpace(combinedStopToken.get_token(),
+                          buffer.max_size() / 2);
+    }
     long responseCode = 0;
     if (stopToken.stop_requested()) {
       break;
     }
 
-    if (seekRequestSignal.getStopToken().stop_requested()) {
+    if (seekRequests.pending()) {
       continue;
     }
 
@@ -179,7 +226,7 @@ void AudioGraphHttpStream::readContentChunks(std::stop_token stopToken) {
       if (stopToken.stop_requested()) {
         break;
       }
-      if (seekRequestSignal.getStopToken().stop_requested()) {
+      if (seekRequests.pending()) {
         continue;
       }
       responseCode = -1;
@@ -192,6 +239,7 @@ void AudioGraphHttpStream::readContentChunks(std::stop_token stopToken) {
         spdlog::warn("Request failed at offset {}/{} - retrying {} more times",
                      offset, contentLength, numRetries);
         --numRetries;
+        retries.add();
         continue;
       }
     }
@@ -219,6 +267,7 @@ void AudioGraphHttpStream::readContentChunks(std::stop_token stopToken) {
         throw std::runtime_error(message);
       } else {
         --numRetries;
+        retries.add();
         spdlog::warn(
             "HTTP GET request failed with code {}, retrying {} more times",
             responseCode, numRetries);
@@ -256,7 +305,10 @@ int AudioGraphHttpStream::readSingleChunk(std::stop_token stopToken) {
         std::placeholders::_2, std::placeholders::_3)));
     hasReadHeader = true;
   }
+  requests.add();
+  perfmon_begin("AudioGraphHttpStream::perform");
   request.perform();
+  perfmon_end("AudioGraphHttpStream::perform");
 
   long responseCode = 0;
   curlpp::Info<CURLINFO_RESPONSE_CODE, long>::get(request, responseCode);
@@ -270,7 +322,7 @@ size_t AudioGraphHttpStream::read(void *data, size_t size) {
 size_t AudioGraphHttpStream::waitForData(std::stop_token stopToken,
                                          size_t size) {
   auto combinedToken =
-      combineStopTokens(stopToken, readerThread.get_stop_token());
+      combineStopTokens(stopToken, readerThread.getStopToken());
   return buffer.waitForData(combinedToken.get_token(), size);
 }
 
@@ -278,19 +330,22 @@ size_t AudioGraphHttpStream::waitForDataFor(std::stop_token stopToken,
                                             std::chrono::milliseconds timeout,
                                             size_t size) {
   auto combinedToken =
-      combineStopTokens(stopToken, readerThread.get_stop_token());
+      combineStopTokens(stopToken, readerThread.getStopToken());
   return buffer.waitForDataFor(combinedToken.get_token(), timeout, size);
 }
 
+void AudioGraphHttpStream::getBufferLevels(
+    std::vector<NodeBufferLevel> &levels) {
+  levels.push_back({"AudioGraphHttpStream", buffer.size(), buffer.max_size()});
+}
+
 size_t AudioGraphHttpStream::seekTo(size_t absolutePosition) {
-  if (getState().state == AudioGraphNodeState::ERROR ||
-      seekRequestSignal.getValue()) {
+  if (getState().state == AudioGraphNodeState::ERROR) {
     return -1;
   }
 
   spdlog::trace("AudioGraphHttpStream::seekTo({})", absolutePosition);
-  seekRequestSignal.sendValue(absolutePosition);
-  auto retVal = seekRequestSignal.getResponse(readerThread.get_stop_token());
+  auto retVal = seekRequests.post(absolutePosition).get();
   spdlog::trace("AudioGraphHttpStream::seekTo({}) -> {}", absolutePosition,
                 retVal);
   return retVal;
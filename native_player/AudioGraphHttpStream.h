@@ -3,6 +3,8 @@
 
 #include "AudioGraphNode.h"
 #include "Buffer.h"
+#include "CommandQueue.h"
+#include "Metrics.h"
 
 #include "Utils.h"
 #include <curlpp/Easy.hpp>
@@ -11,22 +13,35 @@ class AudioGraphHttpStream : public AudioGraphOutputNode {
 public:
   AudioGraphHttpStream(const std::string &url, size_t bufferSize,
                        size_t chunkSize = 0);
+  // Creates a closed stream, to be started with open().
+  AudioGraphHttpStream(size_t bufferSize, size_t chunkSize = 0);
+
+  // Start streaming from the given url. A stream which is already open is
+  // closed first. The buffer, the HTTP handle and the reader thread are
+  // reused, so are the connections to the same host.
+  void open(const std::string &url);
+
+  // Stop streaming, the stream can be opened again afterwards.
+  void close();
+
   virtual size_t read(void *data, size_t size) override;
   virtual size_t waitForData(std::stop_token stopToken, size_t size) override;
   virtual size_t waitForDataFor(std::stop_token stopToken,
                                 std::chrono::milliseconds timeout,
                                 size_t size) override;
   virtual size_t seekTo(size_t absolutePosition) override;
+  virtual void
+  getBufferLevels(std::vector<NodeBufferLevel> &levels) override;
 
   virtual ~AudioGraphHttpStream();
 
 private:
-  std::jthread readerThread;
+  TrackWorker readerThread{"HttpStream"};
   std::string url;
   Buffer<uint8_t> buffer;
   size_t contentLength = 1;
   size_t offset = 0;
-  Signal<size_t> seekRequestSignal;
+  CommandQueue<size_t> seekRequests{static_cast<size_t>(-1)};
   size_t chunkSize = 0;
   bool acceptRange = true;
   bool hasReadHeader = false;
@@ -39,9 +54,22 @@ private:
   void emptyBufferCallback(Buffer<uint8_t> &buffer);
   size_t headerCallback(char *buffer, size_t size, size_t nitems);
 
-  void handleSeekSignal(size_t position);
+  void handleSeekRequest(size_t position);
 
   curlpp::Easy request;
+
+  RateMeter transferRate;
+  MetricGroup metrics{"AudioGraphHttpStream"};
+  Counter &bytesTransferred = metrics.counter("bytes_transferred");
+  Counter &requests = metrics.counter("requests");
+  Counter &retries = metrics.counter("retries");
+  Counter &seeks = metrics.counter("seeks");
+  LatencyHistogram &waitForSpaceNs = metrics.histogram("wait_for_space_ns");
+  ThreadCpuMeter cpuMeter{metrics};
+  // Bytes transferred since the CPU usage was last reported.
+  size_t lapBytes = 0;
+
+  void reportCpuUsage();
 };
 
 #endif
\ No newline at end of file
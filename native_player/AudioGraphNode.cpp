@@ -1,15 +1,25 @@
 #include "AudioGraphNode.h"
 #include "Log.h"
+#include "PerfMon.h"
 
 StreamState AudioGraphNode::getState() {
   std::lock_guard lock(mutex);
   return state;
 }
 
-int AudioGraphNode::onStateChange(
-    std::function<bool(AudioGraphNode *, StreamState)> callback) {
+int AudioGraphNode::onStateChange(StateChangeCallback callback,
+                                  StateDispatch dispatch) {
   std::lock_guard lock(mutex);
-  stateChangeCallbacks.insert({++callbackId, callback});
+  ++callbackId;
+  if (dispatch == StateDispatch::INLINE) {
+    stateChangeCallbacks.insert({callbackId, callback});
+  } else {
+    auto subscription = std::make_shared<StateSubscribers::Subscription>();
+    subscription->id = callbackId;
+    subscription->callback = callback;
+    subscription->version = stateVersion;
+    subscribers->add(std::move(subscription));
+  }
   callback(this, state);
   return callbackId;
 }
@@ -19,18 +29,31 @@ void AudioGraphNode::removeStateChangeCallback(int id) {
     return;
   }
 
-  std::lock_guard lock(mutex);
-  stateChangeCallbacks.erase(id);
+  {
+    std::lock_guard lock(mutex);
+    if (stateChangeCallbacks.erase(id) > 0) {
+      return;
+    }
+  }
+  if (subscribers->remove(id)) {
+    // Waits for the notifier to return from the callback.
+    std::lock_guard dispatchLock(subscribers->dispatchMutex);
+  }
 }
 
-AudioGraphNode::~AudioGraphNode() {}
+AudioGraphNode::~AudioGraphNode() {
+  subscribers->clear();
+  std::lock_guard dispatchLock(subscribers->dispatchMutex);
+}
 
 void AudioGraphNode::setState(const StreamState &newState) {
-  std::lock_guard lock(mutex);
+  std::unique_lock lock(mutex);
   if (state.state == newState.state) {
     return;
   }
   state = newState;
+  ++stateVersion;
+  perfmon_event("setState", static_cast<int64_t>(state.state));
   for (auto it = stateChangeCallbacks.begin();
        it != stateChangeCallbacks.end();) {
     auto stateChangeCallback = it->second;
@@ -40,4 +63,14 @@ void AudioGraphNode::setState(const StreamState &newState) {
       ++it;
     }
   }
+  if (subscribers->count.load() == 0) {
+    return;
+  }
+  // Queued under the lock to keep the order of the states.
+  auto &notifier = StateNotifier::getInstance();
+  notifier.post(subscribers, this, stateVersion, state);
+  lock.unlock();
+  if (StateNotifier::isSynchronous()) {
+    notifier.deliverPending();
+  }
 }
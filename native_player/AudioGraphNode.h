@@ -3,11 +3,32 @@
 
 #include "AudioInfo.h"
 #include "Buffer.h"
+#include "PlaybackClock.h"
+#include "StateNotifier.h"
 #include "StreamState.h"
 
+#include <future>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
+
+// How the state change callbacks of a node are called.
+enum class StateDispatch {
+  // On the StateNotifier thread, after the node has set the state.
+  NOTIFIER,
+  // By the thread setting the state, while it holds the node mutex. Only
+  // for callbacks which are cheap and never block.
+  INLINE
+};
+
+// Fill level of a buffer held by a node of the graph.
+struct NodeBufferLevel {
+  std::string node;
+  size_t bytes;
+  size_t capacity;
+};
 
 class AudioGraphNode {
 public:
@@ -19,11 +40,14 @@ public:
   virtual StreamState getState();
 
   // Set the callback to be called when the state changes.
+  // The callback is called with the current state right away, then with
+  // the states set later, until it returns false for one of them.
   // Returns the id of the callback.
-  virtual int
-  onStateChange(std::function<bool(AudioGraphNode *, StreamState)> callback);
+  virtual int onStateChange(StateChangeCallback callback,
+                            StateDispatch dispatch = StateDispatch::NOTIFIER);
 
-  // Remove the callback with the given id.
+  // Remove the callback with the given id. Waits for the callback to return
+  // if the notifier is running it.
   virtual void removeStateChangeCallback(int id);
 
   // Accept the source change. This is called when the source has changed and
@@ -40,9 +64,13 @@ protected:
 private:
   std::mutex mutex;
   StreamState state;
+  // Incremented on every state change, for the notifier to skip the states
+  // older than the callback.
+  uint64_t stateVersion = 0;
 
-  std::unordered_map<int, std::function<bool(AudioGraphNode *, StreamState)>>
-      stateChangeCallbacks;
+  std::unordered_map<int, StateChangeCallback> stateChangeCallbacks;
+  std::shared_ptr<StateSubscribers> subscribers =
+      std::make_shared<StateSubscribers>();
   int callbackId = 0;
 };
 
@@ -64,6 +92,10 @@ public:
                                 size_t size) = 0;
   virtual size_t seekTo(size_t absolutePosition) { return -1; }
 
+  // Appends the fill levels of the buffers of this node and of the nodes
+  // it reads from. For diagnostics only, the levels may be inconsistent.
+  virtual void getBufferLevels(std::vector<NodeBufferLevel> &levels) {}
+
   virtual ~AudioGraphOutputNode() = default;
 };
 
@@ -79,8 +111,17 @@ public:
 
 class AudioGraphEmitterNode : public AudioGraphInputNode {
 public:
-  virtual void pause(bool paused) = 0;
-  virtual size_t seek(size_t positionMs) = 0;
+  // Requests are handled asynchronously by the playback thread, see
+  // CommandQueue. The futures complete with the pause state reached and
+  // the position sought to in ms, -1 if the seek failed. Requests
+  // superseded by a newer one before they were handled complete with the
+  // result of the newer one.
+  virtual std::future<bool> pause(bool paused) = 0;
+  virtual std::future<size_t> seek(size_t positionMs) = 0;
+
+  // Position played out by the device, lock free and without waking up
+  // the playback thread, so it can be polled e.g. for a progress bar.
+  virtual PlaybackPosition getPosition() const = 0;
 };
 
 #endif
\ No newline at end of file
@@ -3,11 +3,16 @@
 #include "AudioGraphHttpStream.h"
 #include "AudioStreamSwitcher.h"
 #include "Config.h"
+#include "FileAudioEmitter.h"
 #include "FlacStreamDecoder.h"
+#include "GainNode.h"
 #include "Log.h"
+#include "NullAudioEmitter.h"
 #include "PerfMon.h"
 #include "StateMonitor.h"
 
+#include <algorithm>
+
 namespace {
 // These numbers can be reduced depending on audio bitness,
 // sample rate and network throughput.
@@ -20,6 +25,45 @@ const size_t HTTP_BUFFER_SIZE = 768000;
 
 const size_t CHUNK_SIZE = HTTP_BUFFER_SIZE / 2;
 
+// Number of closed streams kept around to be reused.
+const size_t STREAM_POOL_SIZE = 2;
+
+// How long before the end of the current track the next one is opened.
+const size_t PREFETCH_TIME_MS = 5000;
+
+// Decoded audio the next track needs before it is switched to.
+const size_t PREBUFFER_TIME_MS = 500;
+
+// Upper bound for the prefetch scheduler sleep, in case a position change
+// (e.g. seek) is not accompanied by a state change.
+const std::chrono::milliseconds MAX_PREFETCH_SLEEP(1000);
+
+std::shared_ptr<AudioGraphEmitterNode>
+createAudioEmitter(const Config &config) {
+  auto type = value_or(config, "output.type", std::string("alsa"));
+  if (type == "alsa") {
+    return std::make_shared<AlsaAudioEmitter>(config);
+  }
+  if (type == "null") {
+    return std::make_shared<NullAudioEmitter>(
+        value_or(config, "output.null.realtime", true),
+        std::chrono::milliseconds(
+            value_or(config, "output.null.period_ms", 20)));
+  }
+  if (type == "file") {
+    auto format = value_or(config, "output.file.format", std::string("wav"));
+    if (format != "wav" && format != "raw") {
+      throw std::runtime_error("Unknown output file format: " + format);
+    }
+    return std::make_shared<FileAudioEmitter>(
+        value_or(config, "output.file.path", std::string("output.wav")),
+        format == "wav" ? PcmFileContainer::WAV : PcmFileContainer::RAW,
+        value_or(config, "output.file.direct_io", false),
+        value_or(config, "output.file.realtime", false));
+  }
+  throw std::runtime_error("Unknown output type: " + type);
+}
+
 bool isInvalidState(AudioGraphNodeState state) {
   return state == AudioGraphNodeState::FINISHED ||
          state == AudioGraphNodeState::STOPPED ||
@@ -27,107 +71,317 @@ bool isInvalidState(AudioGraphNodeState state) {
 }
 } // namespace
 
+// Reusable HTTP stream and decoder pair. The nodes keep their buffers,
+// worker threads, HTTP handle and libFLAC decoder between tracks.
 struct StreamNodes {
-  using NodeChain = std::list<std::shared_ptr<AudioGraphOutputNode>>;
-  NodeChain nodeChain;
-  const std::string url;
-
-  StreamNodes(const std::string &url, const Config &config) : url(url) {
-    nodeChain.emplace_back(std::make_shared<AudioGraphHttpStream>(
-        url, value_or(config, "input.http.buffer_size", HTTP_BUFFER_SIZE),
-        value_or(config, "input.http.chunk_size", CHUNK_SIZE)));
-
-    auto decoder = std::make_shared<FlacStreamDecoder>(
-        value_or(config, "decoder.flac.buffer_size", FLAC_BUFFER_SIZE));
-    decoder->connectTo(nodeChain.back());
-    nodeChain.emplace_back(std::move(decoder));
-  }
-
-  StreamNodes(StreamNodes &&other) : nodeChain(std::move(other.nodeChain)) {}
-
-  ~StreamNodes() {
-    for (NodeChain::reverse_iterator rit = nodeChain.rbegin();
-         rit != nodeChain.rend(); ++rit) {
-      auto inputNode = std::dynamic_pointer_cast<AudioGraphInputNode>(*rit);
-      if (inputNode) {
-        ++rit;
-        if (rit != nodeChain.rend()) {
-          inputNode->disconnect(*rit);
-        }
-      }
-    }
+  std::shared_ptr<AudioGraphHttpStream> httpStream;
+  std::shared_ptr<FlacStreamDecoder> decoder;
+  std::string url;
+
+  StreamNodes(const Config &config)
+      : httpStream(std::make_shared<AudioGraphHttpStream>(
+            value_or(config, "input.http.buffer_size", HTTP_BUFFER_SIZE),
+            value_or(config, "input.http.chunk_size", CHUNK_SIZE))),
+        decoder(std::make_shared<FlacStreamDecoder>(
+            value_or(config, "decoder.flac.buffer_size", FLAC_BUFFER_SIZE))) {}
+
+  void open(const std::string &newUrl) {
+    url = newUrl;
+    httpStream->open(url);
+    decoder->connectTo(httpStream);
+  }
+
+  void close() {
+    decoder->disconnect(httpStream);
+    httpStream->close();
   }
+
+  std::shared_ptr<AudioGraphOutputNode> output() const { return decoder; }
 };
 
 AudioPlayer::AudioPlayer(const Config &config)
-    : config(config), audioEmitter(std::make_shared<AlsaAudioEmitter>(config)),
-      streamSwitcher(std::make_shared<AudioStreamSwitcher>()) {
+    : config(config), audioEmitter(createAudioEmitter(config)),
+      streamSwitcher(std::make_shared<AudioStreamSwitcher>(
+          std::chrono::milliseconds(value_or(config, "output.crossfade_ms", 0)),
+          std::chrono::milliseconds(
+              value_or(config, "output.prebuffer_ms", PREBUFFER_TIME_MS)))),
+      gainNode(std::make_shared<GainNode>(std::chrono::milliseconds(
+          value_or(config, "output.volume.ramp_ms", 20)))),
+      replayGainEnabled(value_or(config, "output.volume.replaygain", false)),
+      streamPoolSize(
+          value_or(config, "input.stream_pool_size", STREAM_POOL_SIZE)),
+      prefetchTime(std::chrono::milliseconds(
+          value_or(config, "output.prefetch_ms", PREFETCH_TIME_MS))) {
   initLogger(value_or(config, "server.log_level", std::string("debug")));
-  perfmon_print_periodically(5);
+  if (value_or(config, "server.profiling", false)) {
+    PerfMon::setEnabled(true);
+    perfmon_print_periodically(5);
+  }
+  if (value_or(config, "server.trace.enabled", false)) {
+    PerfMon::getInstance().setTracing(
+        true, value_or(config, "server.trace.buffer_events",
+                       PerfMon::TRACE_BUFFER_EVENTS));
+  }
+  PerfMon::getInstance().setTraceDumpPath(
+      value_or(config, "server.trace.xrun_dump_path", std::string()));
+  gainNode->connectTo(streamSwitcher);
+
+  if (prefetchTime.count() > 0) {
+    switcherCallbackId = streamSwitcher->onStateChange(
+        [this](AudioGraphNode *, StreamState) -> bool {
+          wakeUpPrefetch();
+          return true;
+        });
+    prefetchThread = std::jthread(
+        [this](std::stop_token token) { prefetchWorker(token); });
+  }
 }
 
-AudioPlayer::~AudioPlayer() { stop(); }
+AudioPlayer::~AudioPlayer() {
+  if (prefetchThread.joinable()) {
+    prefetchThread.request_stop();
+    prefetchThread.join();
+    streamSwitcher->removeStateChangeCallback(switcherCallbackId);
+  }
+  stop();
+  gainNode->disconnect(streamSwitcher);
+}
+
+void AudioPlayer::play(const std::string &url, float replayGainDb,
+                       float replayGainPeak) {
+  std::unique_lock lock(mutex);
+  ++playbackGeneration;
+  if (replayGainEnabled) {
+    // The stream is played right away, the queued gains are for the
+    // streams played next.
+    gainNode->clearReplayGainQueue();
+    gainNode->setReplayGain(replayGainDb, replayGainPeak);
+  }
 
-void AudioPlayer::play(const std::string &url) {
   for (auto it = streamNodesList.begin(); it != streamNodesList.end(); ++it) {
-    if (it->url == url &&
-        !isInvalidState(it->nodeChain.back()->getState().state)) {
+    if (it->url == url && !isInvalidState(it->output()->getState().state)) {
       std::list<StreamNodes> newStreamNodesList;
-      newStreamNodesList.emplace_back(std::move(*it));
-      streamNodesList.erase(it);
-      audioEmitter->connectTo(streamSwitcher);
+      newStreamNodesList.splice(newStreamNodesList.end(), streamNodesList, it);
+      audioEmitter->connectTo(gainNode);
       disconnectAllStreams();
       streamNodesList.swap(newStreamNodesList);
+      lock.unlock();
+      wakeUpPrefetch();
       return;
     }
   }
 
-  StreamNodes newStream(url, config);
-  streamSwitcher->connectTo(newStream.nodeChain.back());
-  audioEmitter->connectTo(streamSwitcher);
+  auto newStream = openStream(url);
+  streamSwitcher->connectTo(newStream.front().output());
+  audioEmitter->connectTo(gainNode);
   disconnectAllStreams();
-  streamNodesList.emplace_back(std::move(newStream));
+  streamNodesList.splice(streamNodesList.end(), newStream);
+  lock.unlock();
+  wakeUpPrefetch();
+}
+
+void AudioPlayer::playNext(const std::string &url, float replayGainDb,
+                           float replayGainPeak) {
+  std::lock_guard lock(mutex);
+  connectNext(TrackSource{url, replayGainDb, replayGainPeak});
 }
 
-void AudioPlayer::playNext(const std::string &url) {
+void AudioPlayer::connectNext(const TrackSource &track) {
   spdlog::debug("Adding new track to play next");
-  StreamNodes newStream(url, config);
-  streamSwitcher->connectTo(newStream.nodeChain.back());
-  audioEmitter->connectTo(streamSwitcher);
+  if (replayGainEnabled) {
+    gainNode->queueReplayGain(track.replayGainDb, track.replayGainPeak);
+  }
+  auto newStream = openStream(track.url);
+  streamSwitcher->connectTo(newStream.front().output());
+  audioEmitter->connectTo(gainNode);
   cleanUpFinishedStreams();
-  streamNodesList.emplace_back(std::move(newStream));
+  streamNodesList.splice(streamNodesList.end(), newStream);
+}
+
+void AudioPlayer::setNextTrackProvider(NextTrackProvider provider) {
+  {
+    // Waits for the provider to return if it is being called.
+    std::lock_guard lock(providerMutex);
+    nextTrackProvider = std::move(provider);
+  }
+  wakeUpPrefetch();
 }
 
 void AudioPlayer::stop() {
-  audioEmitter->disconnect(streamSwitcher);
+  std::lock_guard lock(mutex);
+  ++playbackGeneration;
+  audioEmitter->disconnect(gainNode);
   disconnectAllStreams();
 }
 
-void AudioPlayer::pause(bool paused) { audioEmitter->pause(paused); }
+std::future<bool> AudioPlayer::pause(bool paused) {
+  return audioEmitter->pause(paused);
+}
 
-size_t AudioPlayer::seek(size_t positionMs) {
+std::future<size_t> AudioPlayer::seek(size_t positionMs) {
   return audioEmitter->seek(positionMs);
 }
 
+void AudioPlayer::setVolume(float volume) { gainNode->setVolume(volume); }
+
+float AudioPlayer::getVolume() const { return gainNode->getVolume(); }
+
+bool AudioPlayer::isNextReady() { return streamSwitcher->isNextSourceReady(); }
+
+DeadlineStats AudioPlayer::getDeadlineStats() {
+  auto alsaEmitter = std::dynamic_pointer_cast<AlsaAudioEmitter>(audioEmitter);
+  return alsaEmitter ? alsaEmitter->getDeadlineStats() : DeadlineStats();
+}
+
+std::vector<MetricSample> AudioPlayer::getMetrics() {
+  return MetricsRegistry::getInstance().snapshot();
+}
+
+XrunStats AudioPlayer::getXrunStats() {
+  auto alsaEmitter = std::dynamic_pointer_cast<AlsaAudioEmitter>(audioEmitter);
+  return alsaEmitter ? alsaEmitter->getXrunStats() : XrunStats();
+}
+
+void AudioPlayer::enableProfiling(bool enabled) {
+  PerfMon::setEnabled(enabled);
+}
+
+std::vector<PerfMon::MarkStats> AudioPlayer::getProfilingStats() {
+  return PerfMon::getInstance().getStats();
+}
+
+void AudioPlayer::enableTracing(bool enabled) {
+  PerfMon::getInstance().setTracing(enabled);
+}
+
+bool AudioPlayer::dumpTrace(const std::string &path) {
+  return PerfMon::getInstance().dumpTrace(path);
+}
+
 StreamState AudioPlayer::getState() { return audioEmitter->getState(); }
 
+PlaybackPosition AudioPlayer::getPosition() {
+  return audioEmitter->getPosition();
+}
+
 std::unique_ptr<StateMonitor> AudioPlayer::monitor() {
-  return std::make_unique<StateMonitor>(audioEmitter.get());
+  return std::make_unique<StateMonitor>(
+      audioEmitter.get(),
+      value_or(config, "server.state_queue_size",
+               StateMonitor::DEFAULT_CAPACITY));
+}
+
+std::list<StreamNodes> AudioPlayer::openStream(const std::string &url) {
+  std::list<StreamNodes> streamNodes;
+  if (!idleStreamNodes.empty()) {
+    streamNodes.splice(streamNodes.end(), idleStreamNodes,
+                       std::prev(idleStreamNodes.end()));
+  } else {
+    streamNodes.emplace_back(config);
+  }
+  streamNodes.front().open(url);
+  return streamNodes;
+}
+
+void AudioPlayer::releaseStream(std::list<StreamNodes>::iterator it) {
+  // The switcher waits for a read of the stream in progress, nothing
+  // refers to the nodes once they are disconnected and closed.
+  streamSwitcher->disconnect(it->output());
+  it->close();
+  idleStreamNodes.splice(idleStreamNodes.end(), streamNodesList, it);
+  while (idleStreamNodes.size() > streamPoolSize) {
+    idleStreamNodes.pop_front();
+  }
 }
 
 void AudioPlayer::disconnectAllStreams() {
-  for (auto &streamNodes : streamNodesList) {
-    streamSwitcher->disconnect(streamNodes.nodeChain.back());
+  while (!streamNodesList.empty()) {
+    releaseStream(streamNodesList.begin());
   }
-  streamNodesList.clear();
 }
 
 void AudioPlayer::cleanUpFinishedStreams() {
   for (auto it = streamNodesList.begin(); it != streamNodesList.end();) {
-    if (isInvalidState(it->nodeChain.back()->getState().state)) {
-      it = streamNodesList.erase(it);
+    if (isInvalidState(it->output()->getState().state)) {
+      releaseStream(it++);
     } else {
       ++it;
     }
   }
 }
+
+void AudioPlayer::wakeUpPrefetch() {
+  {
+    std::lock_guard lock(prefetchMutex);
+    prefetchWakeup = true;
+  }
+  prefetchCondition.notify_one();
+}
+
+void AudioPlayer::prefetchWorker(std::stop_token token) {
+  while (!token.stop_requested()) {
+    auto timeout = prefetchIfDue();
+
+    std::unique_lock lock(prefetchMutex);
+    auto woken = [this] { return prefetchWakeup; };
+    if (timeout.has_value()) {
+      prefetchCondition.wait_for(lock, token, *timeout, woken);
+    } else {
+      prefetchCondition.wait(lock, token, woken);
+    }
+    prefetchWakeup = false;
+  }
+}
+
+std::optional<std::chrono::milliseconds> AudioPlayer::prefetchIfDue() {
+  // The next track is opened at most once per track change, the scheduler
+  // is woken up again by the state change of the switcher.
+  if (streamSwitcher->hasNextSource()) {
+    return std::nullopt;
+  }
+  auto remaining = streamSwitcher->remainingTime();
+  if (!remaining.has_value()) {
+    return std::nullopt;
+  }
+  if (*remaining > prefetchTime) {
+    return std::min(*remaining - prefetchTime, MAX_PREFETCH_SLEEP);
+  }
+
+  std::unique_lock lock(mutex);
+  if (streamNodesList.empty()) {
+    return std::nullopt;
+  }
+  auto generation = playbackGeneration;
+  lock.unlock();
+
+  std::optional<TrackSource> track;
+  {
+    std::lock_guard providerLock(providerMutex);
+    if (!nextTrackProvider) {
+      return std::nullopt;
+    }
+    try {
+      track = nextTrackProvider();
+    } catch (const std::exception &e) {
+      spdlog::error("Failed to get the next track: {}", e.what());
+      return std::nullopt;
+    }
+  }
+
+  if (!track.has_value()) {
+    return std::nullopt;
+  }
+
+  lock.lock();
+  if (generation != playbackGeneration) {
+    spdlog::debug("Playback has been restarted, dropping the next track");
+    return std::chrono::milliseconds(0);
+  }
+  if (streamSwitcher->hasNextSource()) {
+    return std::nullopt;
+  }
+
+  spdlog::info("Prefetching next track, {}ms left", remaining->count());
+  connectNext(*track);
+  return std::nullopt;
+}
@@ -1,30 +1,65 @@
 #ifndef AUDIO_PLAYER_H
 #define AUDIO_PLAYER_H
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "Config.h"
+#include "DeadlineMonitor.h"
+#include "Metrics.h"
+#include "PerfMon.h"
+#include "XrunStats.h"
 
+struct PlaybackPosition;
 struct StreamState;
 class AudioGraphEmitterNode;
 class AudioStreamSwitcher;
+class GainNode;
 struct StreamNodes;
 class StateMonitor;
 
+// A track to be started by the prefetch scheduler.
+struct TrackSource {
+  std::string url;
+  float replayGainDb = 0.0f;
+  float replayGainPeak = 0.0f;
+};
+
 class AudioPlayer {
 public:
+  // Called from the prefetch thread to get the track to be played next.
+  // Returning nullopt means there is nothing to play at the moment, the
+  // provider is asked again on the next state change. A provider may as
+  // well return nullopt and call playNext() later on its own.
+  using NextTrackProvider = std::function<std::optional<TrackSource>()>;
+
   AudioPlayer(const Config &config);
   ~AudioPlayer();
 
   // Open a stream and start playing it immediately.
   // Cleans the list of the next streams to be played.
-  void play(const std::string &url);
+  // The ReplayGain is applied to the stream if enabled in the config.
+  void play(const std::string &url, float replayGainDb = 0.0f,
+            float replayGainPeak = 0.0f);
 
   // Open a stream and set it to be played next after the current one is
   // finished.
-  void playNext(const std::string &url);
+  void playNext(const std::string &url, float replayGainDb = 0.0f,
+                float replayGainPeak = 0.0f);
+
+  // Set the callback used by the prefetch scheduler, which opens the next
+  // track once less than `output.prefetch_ms` of the current one is left
+  // to be read. Pass an empty function to remove it.
+  void setNextTrackProvider(NextTrackProvider provider);
 
   // Stop playback and close the device
   void stop();
@@ -33,13 +68,43 @@ public:
   // Note that if paused for too long, the http stream may be closed by the
   // server. The API supports reconnection but depending on the URL, it might
   // expire by the time the player tries to reconnect.
-  void pause(bool paused);
+  std::future<bool> pause(bool paused);
+
+  // Does not wait for the seek, rapid seeks coalesce to the latest one.
+  std::future<size_t> seek(size_t positionMs);
+
+  // Software volume in range [0, 1], applied within one ALSA period.
+  void setVolume(float volume);
+  float getVolume() const;
+
+  // Returns true if the stream to be played next has decoded enough
+  // data to start playing without a gap.
+  bool isNextReady();
 
-  size_t seek(size_t positionMs);
+  // Slack of the ALSA periods of the track being played.
+  DeadlineStats getDeadlineStats();
+  // Xruns since startup and the current ALSA buffer settings.
+  XrunStats getXrunStats();
+  // Snapshot of the metrics of all graph nodes.
+  std::vector<MetricSample> getMetrics();
+
+  // Turn the collection of pipeline timings on or off. Can be enabled at
+  // startup with `server.profiling`.
+  static void enableProfiling(bool enabled = true);
+  // Timings collected since startup, merged from all threads.
+  static std::vector<PerfMon::MarkStats> getProfilingStats();
+  // Turn the recording of the timeline trace on or off, see
+  // `server.trace`.
+  static void enableTracing(bool enabled = true);
+  // Writes the recorded timeline in Chrome trace JSON format.
+  static bool dumpTrace(const std::string &path);
 
   // Retrieves the current state of the node (non-blocking)
   StreamState getState();
 
+  // Position played out by the device, cheap enough to be polled.
+  PlaybackPosition getPosition();
+
   // Returns all state changes one by one as they occur.
   // Waits for the state change if no new state has been set yet.
   std::unique_ptr<StateMonitor> monitor();
@@ -48,10 +113,38 @@ private:
   Config config;
   std::shared_ptr<AudioGraphEmitterNode> audioEmitter;
   std::shared_ptr<AudioStreamSwitcher> streamSwitcher;
+  std::shared_ptr<GainNode> gainNode;
+  bool replayGainEnabled;
   std::list<StreamNodes> streamNodesList;
+  // Closed streams to be reused for the next tracks.
+  std::list<StreamNodes> idleStreamNodes;
+  size_t streamPoolSize;
+
+  // Guards the stream list and the generation counter.
+  std::mutex mutex;
+  // Incremented when the playback is restarted or stopped, so that a
+  // track obtained from the provider for the previous playback is dropped.
+  size_t playbackGeneration = 0;
 
+  std::chrono::milliseconds prefetchTime;
+  std::mutex providerMutex;
+  NextTrackProvider nextTrackProvider;
+
+  std::mutex prefetchMutex;
+  std::condition_variable_any prefetchCondition;
+  bool prefetchWakeup = false;
+  int switcherCallbackId = -1;
+  std::jthread prefetchThread;
+
+  void connectNext(const TrackSource &track);
+  std::list<StreamNodes> openStream(const std::string &url);
+  void releaseStream(std::list<StreamNodes>::iterator it);
   void disconnectAllStreams();
   void cleanUpFinishedStreams();
+
+  void wakeUpPrefetch();
+  void prefetchWorker(std::stop_token token);
+  std::optional<std::chrono::milliseconds> prefetchIfDue();
 };
 
 #endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "AudioSampleFormat.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <stdexcept>
 
@@ -109,3 +111,248 @@ size_t convertSampleFormat(const void *source, AudioSampleFormat sourceFormat,
   }
   return sourceSamples;
 }
+
+namespace {
+// GCC/Clang vector extensions, lowered to SSE on x86 and NEON on ARM.
+typedef float float4 __attribute__((vector_size(16)));
+typedef int32_t int4 __attribute__((vector_size(16)));
+typedef uint32_t uint4 __attribute__((vector_size(16)));
+typedef int16_t short4 __attribute__((vector_size(8)));
+
+constexpr int32_t SAMPLE_MIN = -8388608;
+constexpr int32_t SAMPLE_MAX = 8388607;
+// Converts the upper 24 bits of a random number to [0, 1)
+constexpr float RANDOM_SCALE = 1.0f / 16777216.0f;
+
+inline int32_t signExtend24(int32_t sample) {
+  return static_cast<int32_t>(static_cast<uint32_t>(sample) << 8) >> 8;
+}
+
+inline int32_t mixSample(int32_t fadeOut, int32_t fadeIn, float gain) {
+  const float a = static_cast<float>(signExtend24(fadeOut));
+  const float b = static_cast<float>(signExtend24(fadeIn));
+  return static_cast<int32_t>(a + (b - a) * gain);
+}
+
+// Loads two interleaved stereo frames as 24 bit samples.
+template <AudioSampleFormat Format> inline int4 loadFrames(const uint8_t *src) {
+  if constexpr (Format == PCM16_LE) {
+    short4 samples;
+    std::memcpy(&samples, src, sizeof(samples));
+    return __builtin_convertvector(samples, int4) << 8;
+  } else {
+    int4 samples;
+    std::memcpy(&samples, src, sizeof(samples));
+    return Format == PCM32_LE ? samples >> 8 : (samples << 8) >> 8;
+  }
+}
+
+// Stores two interleaved stereo frames of 24 bit samples.
+template <AudioSampleFormat Format>
+inline void storeFrames(uint8_t *dest, int4 samples) {
+  if constexpr (Format == PCM16_LE) {
+    const short4 result = __builtin_convertvector(samples >> 8, short4);
+    std::memcpy(dest, &result, sizeof(result));
+  } else {
+    samples = Format == PCM32_LE ? samples << 8 : samples & 0xffffff;
+    std::memcpy(dest, &samples, sizeof(samples));
+  }
+}
+
+template <AudioSampleFormat Format>
+void crossfadeStereo(uint8_t *fadeOut, const uint8_t *fadeIn, size_t frames,
+                     size_t rampPosition, size_t rampLength) {
+  constexpr size_t bytes = Format == PCM16_LE ? 2 : 4;
+  const float step = 1.0f / static_cast<float>(rampLength);
+  const float4 laneOffset = {0.0f, 0.0f, 1.0f, 1.0f};
+
+  size_t frame = 0;
+  for (; frame + 2 <= frames; frame += 2) {
+    const int4 a = loadFrames<Format>(fadeOut);
+    const int4 b = loadFrames<Format>(fadeIn);
+
+    const float4 gain =
+        (static_cast<float>(rampPosition + frame) + laneOffset) * step;
+    const float4 fa = __builtin_convertvector(a, float4);
+    const float4 fb = __builtin_convertvector(b, float4);
+    storeFrames<Format>(fadeOut,
+                        __builtin_convertvector(fa + (fb - fa) * gain, int4));
+    fadeOut += 4 * bytes;
+    fadeIn += 4 * bytes;
+  }
+
+  for (; frame < frames; ++frame) {
+    const float gain = static_cast<float>(rampPosition + frame) * step;
+    for (int channel = 0; channel < 2; ++channel) {
+      putSample(fadeOut, mixSample(getSample(fadeOut, Format),
+                                   getSample(fadeIn, Format), gain),
+                Format);
+      fadeOut += bytes;
+      fadeIn += bytes;
+    }
+  }
+}
+} // namespace
+
+void crossfadeSamples(void *fadeOut, const void *fadeIn,
+                      AudioSampleFormat format, size_t frames, size_t channels,
+                      size_t rampPosition, size_t rampLength) {
+  if (rampLength == 0 || frames == 0) {
+    return;
+  }
+
+  uint8_t *outPtr = static_cast<uint8_t *>(fadeOut);
+  const uint8_t *inPtr = static_cast<const uint8_t *>(fadeIn);
+
+  if (channels == 2) {
+    switch (format) {
+    case PCM16_LE:
+      crossfadeStereo<PCM16_LE>(outPtr, inPtr, frames, rampPosition,
+                                rampLength);
+      return;
+    case PCM24_LE:
+      crossfadeStereo<PCM24_LE>(outPtr, inPtr, frames, rampPosition,
+                                rampLength);
+      return;
+    case PCM32_LE:
+      crossfadeStereo<PCM32_LE>(outPtr, inPtr, frames, rampPosition,
+                                rampLength);
+      return;
+    default:
+      break;
+    }
+  }
+
+  const size_t bytes = sampleSize(format);
+  const float step = 1.0f / static_cast<float>(rampLength);
+  for (size_t frame = 0; frame < frames; ++frame) {
+    const float gain = static_cast<float>(rampPosition + frame) * step;
+    for (size_t channel = 0; channel < channels; ++channel) {
+      putSample(outPtr,
+                mixSample(getSample(outPtr, format), getSample(inPtr, format),
+                          gain),
+                format);
+      outPtr += bytes;
+      inPtr += bytes;
+    }
+  }
+}
+
+namespace {
+inline uint32_t nextRandom(uint32_t &seed) {
+  seed = seed * 1664525u + 1013904223u;
+  return seed >> 8;
+}
+
+inline uint4 nextRandom(uint4 &seed) {
+  seed = seed * 1664525u + 1013904223u;
+  return seed >> 8;
+}
+
+// Samples are processed with 24 bit scale regardless of the format,
+// so 16 bit formats have an LSB of 256.
+constexpr float formatLsb(AudioSampleFormat format) {
+  return format == PCM16_LE ? 256.0f : 1.0f;
+}
+
+inline int32_t quantizeSample(float value, float lsb) {
+  const int32_t sample =
+      static_cast<int32_t>(std::floor(value / lsb + 0.5f)) *
+      static_cast<int32_t>(lsb);
+  return std::clamp(sample, SAMPLE_MIN, SAMPLE_MAX);
+}
+
+inline int32_t gainSample(int32_t sample, float gain, float lsb,
+                          uint32_t &seed) {
+  const float tpdf = static_cast<float>(nextRandom(seed)) * RANDOM_SCALE -
+                     static_cast<float>(nextRandom(seed)) * RANDOM_SCALE;
+  return quantizeSample(
+      static_cast<float>(signExtend24(sample)) * gain + tpdf * lsb, lsb);
+}
+
+template <AudioSampleFormat Format>
+void applyGainStereo(uint8_t *samples, size_t frames, float startGain,
+                     float gainStep, DitherState &dither) {
+  constexpr size_t bytes = Format == PCM16_LE ? 2 : 4;
+  constexpr float lsb = formatLsb(Format);
+  const float4 laneOffset = {0.0f, 0.0f, 1.0f, 1.0f};
+  const int4 minSample = {SAMPLE_MIN, SAMPLE_MIN, SAMPLE_MIN, SAMPLE_MIN};
+  const int4 maxSample = {SAMPLE_MAX, SAMPLE_MAX, SAMPLE_MAX, SAMPLE_MAX};
+
+  uint4 seed;
+  std::memcpy(&seed, dither.seed, sizeof(seed));
+
+  size_t frame = 0;
+  for (; frame + 2 <= frames; frame += 2) {
+    const int4 sample = loadFrames<Format>(samples);
+
+    const float4 gain =
+        startGain + (static_cast<float>(frame) + laneOffset) * gainStep;
+    const float4 tpdf =
+        __builtin_convertvector(nextRandom(seed), float4) * RANDOM_SCALE -
+        __builtin_convertvector(nextRandom(seed), float4) * RANDOM_SCALE;
+    const float4 value =
+        (__builtin_convertvector(sample, float4) * gain + tpdf * lsb) / lsb +
+        0.5f;
+
+    // floor() and clip without branches
+    int4 result = __builtin_convertvector(value, int4);
+    result += (__builtin_convertvector(result, float4) > value);
+    result *= static_cast<int32_t>(lsb);
+    int4 mask = result < minSample;
+    result = (result & ~mask) | (minSample & mask);
+    mask = result > maxSample;
+    result = (result & ~mask) | (maxSample & mask);
+
+    storeFrames<Format>(samples, result);
+    samples += 4 * bytes;
+  }
+
+  std::memcpy(dither.seed, &seed, sizeof(seed));
+
+  for (; frame < frames; ++frame) {
+    const float gain = startGain + static_cast<float>(frame) * gainStep;
+    for (int channel = 0; channel < 2; ++channel) {
+      putSample(samples,
+                gainSample(getSample(samples, Format), gain, lsb,
+                           dither.seed[0]),
+                Format);
+      samples += bytes;
+    }
+  }
+}
+} // namespace
+
+void applyGain(void *samples, AudioSampleFormat format, size_t frames,
+               size_t channels, float startGain, float gainStep,
+               DitherState &dither) {
+  uint8_t *ptr = static_cast<uint8_t *>(samples);
+
+  if (channels == 2) {
+    switch (format) {
+    case PCM16_LE:
+      applyGainStereo<PCM16_LE>(ptr, frames, startGain, gainStep, dither);
+      return;
+    case PCM24_LE:
+      applyGainStereo<PCM24_LE>(ptr, frames, startGain, gainStep, dither);
+      return;
+    case PCM32_LE:
+      applyGainStereo<PCM32_LE>(ptr, frames, startGain, gainStep, dither);
+      return;
+    default:
+      break;
+    }
+  }
+
+  const size_t bytes = sampleSize(format);
+  const float lsb = formatLsb(format);
+  for (size_t frame = 0; frame < frames; ++frame) {
+    const float gain = startGain + static_cast<float>(frame) * gainStep;
+    for (size_t channel = 0; channel < channels; ++channel) {
+      putSample(ptr,
+                gainSample(getSample(ptr, format), gain, lsb, dither.seed[0]),
+                format);
+      ptr += bytes;
+    }
+  }
+}
@@ -68,4 +68,37 @@ size_t convertSampleFormat(const void *source, AudioSampleFormat sourceFormat,
                            size_t sourceSamples, void *dest,
                            AudioSampleFormat destFormat, size_t destSizeBytes);
 
+/// @brief Mix two interleaved buffers of the same format using a linear
+/// crossfade ramp. Frame i gets the gain (rampPosition + i) / rampLength
+/// applied to fadeIn and the complementary gain applied to fadeOut.
+/// @param fadeOut samples fading out, the mixed result is written back here
+/// @param fadeIn samples fading in
+/// @param format sample format of both buffers
+/// @param frames number of frames to mix
+/// @param channels number of interleaved channels
+/// @param rampPosition position of the first frame within the ramp
+/// @param rampLength total length of the ramp in frames
+void crossfadeSamples(void *fadeOut, const void *fadeIn,
+                      AudioSampleFormat format, size_t frames, size_t channels,
+                      size_t rampPosition, size_t rampLength);
+
+/// @brief State of the noise generator used for dithering.
+struct DitherState {
+  uint32_t seed[4] = {0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35};
+};
+
+/// @brief Multiply interleaved samples by a gain. The gain of frame i is
+/// startGain + i * gainStep. The result is TPDF dithered, rounded to the bit
+/// depth of the format and clipped.
+/// @param samples samples to process in place
+/// @param format sample format of the buffer
+/// @param frames number of frames to process
+/// @param channels number of interleaved channels
+/// @param startGain gain of the first frame
+/// @param gainStep gain increment per frame
+/// @param dither noise generator state, updated by the call
+void applyGain(void *samples, AudioSampleFormat format, size_t frames,
+               size_t channels, float startGain, float gainStep,
+               DitherState &dither);
+
 #endif // AUDIO_SAMPLE_FORMAT_H
\ No newline at end of file
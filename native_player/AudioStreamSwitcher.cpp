@@ -1,8 +1,46 @@
 #include "AudioStreamSwitcher.h"
+#include "AudioSampleFormat.h"
 #include "Log.h"
 #include "Utils.h"
 
-AudioStreamSwitcher::AudioStreamSwitcher() {}
+#include <cstring>
+#include <utility>
+
+namespace {
+size_t frameBytes(const StreamAudioFormat &format) {
+  return format.channels * sampleSize(format.sampleFormat);
+}
+
+bool hasFramesInfo(const StreamState &state) {
+  return state.streamInfo.has_value() &&
+         state.streamInfo->streamType == StreamType::FRAMES &&
+         state.streamInfo->streamSize > 0 &&
+         frameBytes(state.streamInfo->format) > 0;
+}
+} // namespace
+
+AudioStreamSwitcher::AudioStreamSwitcher(
+    std::chrono::milliseconds crossfadeTime,
+    std::chrono::milliseconds prebufferTime)
+    : crossfadeTime(crossfadeTime), prebufferTime(prebufferTime) {
+  metrics.gauge("queued_sources", [this]() {
+    std::lock_guard lock(mutex);
+    return inputNodes.size();
+  });
+}
+
+AudioStreamSwitcher::~AudioStreamSwitcher() {
+  if (callbackNode != nullptr) {
+    callbackNode->removeStateChangeCallback(stateCallbackId);
+  }
+}
+
+StreamState AudioStreamSwitcher::getState() {
+  std::unique_lock lock(mutex);
+  forwardInputStateLocked(lock);
+  lock.unlock();
+  return AudioGraphNode::getState();
+}
 
 void AudioStreamSwitcher::connectTo(
     std::shared_ptr<AudioGraphOutputNode> inputNode) {
@@ -14,7 +52,7 @@ void AudioStreamSwitcher::connectTo(
   inputNodes.push_back(inputNode);
 
   if (currentInputNode == nullptr ||
-      getState().state == AudioGraphNodeState::FINISHED) {
+      AudioGraphNode::getState().state == AudioGraphNodeState::FINISHED) {
     if (currentInputNode != nullptr) {
       currentInputNode = nullptr;
     }
@@ -31,9 +69,13 @@ void AudioStreamSwitcher::disconnect(
     throw std::runtime_error("Input node cannot be nullptr");
   }
   std::unique_lock lock(mutex);
+  std::shared_ptr<AudioGraphOutputNode> staleCallbackNode = nullptr;
+  if (inputNode == callbackNode) {
+    staleCallbackNode = std::exchange(callbackNode, nullptr);
+  }
   if (inputNode == currentInputNode) {
-    currentInputNode->removeStateChangeCallback(stateCallbackId);
     currentInputNode = nullptr;
+    waitingForNextSource = false;
     stopSource.request_stop();
     stopSource = std::stop_source();
     if (inputNodes.empty()) {
@@ -45,90 +87,464 @@ void AudioStreamSwitcher::disconnect(
                  : StreamState(AudioGraphNodeState::SOURCE_CHANGED));
   } else {
     inputNodes.remove(inputNode);
+    if (waitingForNextSource && inputNodes.empty()) {
+      // The current source has finished, there is nothing to wait for.
+      waitingForNextSource = false;
+      currentInputNode = nullptr;
+    }
     if (currentInputNode == nullptr && inputNodes.empty()) {
       spdlog::debug("Removed other node, no more input nodes available, "
                     "setting state to FINISHED");
       setState(StreamState(AudioGraphNodeState::FINISHED));
     }
   }
+  readFinished.wait(lock, [this] { return !readInProgress; });
+  auto id = stateCallbackId;
+  lock.unlock();
+
+  // The notifier may be running the callback, which takes the mutex.
+  if (staleCallbackNode != nullptr) {
+    staleCallbackNode->removeStateChangeCallback(id);
+  }
 }
 
 void AudioStreamSwitcher::switchToNextSource() {
   std::unique_lock lock(mutex);
   if (currentInputNode != nullptr ||
-      getState().state != AudioGraphNodeState::SOURCE_CHANGED) {
+      AudioGraphNode::getState().state != AudioGraphNodeState::SOURCE_CHANGED) {
     spdlog::warn("Not in SOURCE_CHANGED state or currentInputNode is not null");
     return;
   }
   auto inputNode = inputNodes.front();
   currentInputNode = inputNode;
   inputNodes.pop_front();
-  lock.unlock();
+  sourceSwitches.add();
 
-  auto id = inputNode->onStateChange([this](AudioGraphNode *node,
-                                            StreamState state) -> bool {
-    std::lock_guard lock(mutex);
-    if (node != currentInputNode.get()) {
-      return false;
-    }
-    if (state.state == AudioGraphNodeState::FINISHED && !inputNodes.empty()) {
-      currentInputNode = nullptr;
-      setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
-      return false;
+  // If the new source has already been partially played as part of the
+  // crossfade, continue from where the mixing stopped and report the
+  // lead-in as the position of the source.
+  size_t leadIn = 0;
+  if (crossfadeTime.count() > 0 && crossfadeState == CrossfadeState::ACTIVE &&
+      inputNode == crossfadeNode) {
+    leadIn = leadInBytes;
+  }
+  resetCrossfade();
+  if (leadIn > 0) {
+    auto newState = inputNode->getState();
+    if (hasFramesInfo(newState)) {
+      sourcePositionBytes = leadIn;
+      pendingLeadInFrames = leadIn / frameBytes(newState.streamInfo->format);
     }
+  }
+  const auto generation = ++lastGeneration;
+  lock.unlock();
 
-    // Restamp the state to avoid time jumping backwards
-    state.timestamp = getTimestampNs();
-    setState(state);
+  // Runs on the notifier thread, the reader pulls the state through
+  // getState() in between. The callback is not current yet when it is
+  // called by onStateChange(), which holds the lock of the source.
+  auto id = inputNode->onStateChange(
+      [this, generation](AudioGraphNode *, StreamState) -> bool {
+        return forwardInputState(generation);
+      });
 
-    return true;
-  });
   lock.lock();
+  auto staleCallbackNode = callbackNode;
+  auto staleId = stateCallbackId;
   if (currentInputNode == inputNode) {
+    callbackNode = inputNode;
     stateCallbackId = id;
+    sourceGeneration = generation;
+  } else {
+    // Disconnected in the meantime.
+    staleCallbackNode = inputNode;
+    staleId = id;
   }
+  lock.unlock();
+
+  if (staleCallbackNode != nullptr) {
+    staleCallbackNode->removeStateChangeCallback(staleId);
+  }
+  forwardInputState(generation);
+}
+
+bool AudioStreamSwitcher::forwardInputState(uint64_t generation) {
+  std::unique_lock lock(mutex);
+  if (generation > sourceGeneration) {
+    // Still being registered.
+    return true;
+  }
+  if (generation < sourceGeneration) {
+    return false;
+  }
+  return forwardInputStateLocked(lock);
+}
+
+bool AudioStreamSwitcher::forwardInputStateLocked(
+    std::unique_lock<std::mutex> &lock) {
+  auto node = currentInputNode;
+  if (node == nullptr) {
+    return false;
+  }
+  lock.unlock();
+  auto state = node->getState();
+  lock.lock();
+  if (node != currentInputNode) {
+    return false;
+  }
+
+  if (waitingForNextSource) {
+    // Only a seek brings the finished source back.
+    if (state.state != AudioGraphNodeState::STREAMING) {
+      return true;
+    }
+    waitingForNextSource = false;
+  }
+  if (state.state == AudioGraphNode::getState().state) {
+    return true;
+  }
+  if (state.state == AudioGraphNodeState::FINISHED && !inputNodes.empty()) {
+    if (switchIfNextSourceReady(lock) || node != currentInputNode) {
+      return false;
+    }
+    if (waitingForNextSource) {
+      // Found not prebuffered by a concurrent call.
+      return true;
+    }
+    // The next source may have been removed while it was queried, then
+    // the finished state is forwarded.
+    if (!inputNodes.empty()) {
+      // Silence is read until the next source is prebuffered, the
+      // reader thread must not wait for it.
+      spdlog::warn("Next source is not prebuffered, playing silence");
+      waitingForNextSource = true;
+      prebufferGaps.add();
+      return true;
+    }
+  }
+
+  if (crossfadeTime.count() > 0 && pendingLeadInFrames != 0 &&
+      state.state == AudioGraphNodeState::STREAMING) {
+    state.position += pendingLeadInFrames;
+    pendingLeadInFrames = 0;
+  }
+
+  // Restamp the state to avoid time jumping backwards
+  state.timestamp = getTimestampNs();
+  setState(state);
+  return true;
 }
 
 size_t AudioStreamSwitcher::read(void *data, size_t size) {
   std::unique_lock lock(mutex);
+  if (waitingForNextSource) {
+    if (switchIfNextSourceReady(lock)) {
+      return 0;
+    }
+    // Unless the source has been sought back or disconnected meanwhile.
+    if (waitingForNextSource) {
+      std::memset(data, 0, size);
+      return size;
+    }
+  }
   auto currentInput = currentInputNode;
-  lock.unlock();
+  auto nextInput = inputNodes.empty() ? nullptr : inputNodes.front();
   if (currentInput == nullptr) {
     return 0;
   }
+  readInProgress = true;
+  lock.unlock();
 
-  return currentInput->read(data, size);
+  size_t bytes = 0;
+  if (crossfadeTime.count() == 0) {
+    bytes = currentInput->read(data, size);
+    sourcePositionBytes += bytes;
+  } else {
+    bytes = readWithCrossfade(currentInput, nextInput, data, size);
+  }
+  bytesRead.add(bytes);
+
+  lock.lock();
+  readInProgress = false;
+  // The source may have finished without the notifier having forwarded
+  // it yet.
+  if (bytes == 0 && forwardInputStateLocked(lock) && waitingForNextSource) {
+    std::memset(data, 0, size);
+    bytes = size;
+  }
+  lock.unlock();
+  readFinished.notify_all();
+  return bytes;
+}
+
+size_t AudioStreamSwitcher::readWithCrossfade(
+    std::shared_ptr<AudioGraphOutputNode> currentInput,
+    std::shared_ptr<AudioGraphOutputNode> nextInput, void *data, size_t size) {
+  auto readCurrent = [this, &currentInput, data](size_t bytes) {
+    auto bytesRead = currentInput->read(data, bytes);
+    sourcePositionBytes += bytesRead;
+    return bytesRead;
+  };
+
+  auto currentState = currentInput->getState();
+  if (crossfadeState == CrossfadeState::SKIPPED ||
+      !hasFramesInfo(currentState)) {
+    return readCurrent(size);
+  }
+
+  const auto &format = currentState.streamInfo->format;
+  const size_t bytesPerFrame = frameBytes(format);
+  const size_t totalFrames = currentState.streamInfo->streamSize;
+  const size_t totalBytes = totalFrames * bytesPerFrame;
+
+  if (sourcePositionBytes >= totalBytes) {
+    return readCurrent(size);
+  }
+
+  if (crossfadeState == CrossfadeState::PENDING) {
+    const size_t fadeFrames = std::min<size_t>(
+        crossfadeTime.count() * format.sampleRate / 1000, totalFrames);
+    const size_t fadeStart = totalBytes - fadeFrames * bytesPerFrame;
+    if (sourcePositionBytes < fadeStart) {
+      return readCurrent(std::min(size, fadeStart - sourcePositionBytes));
+    }
+
+    auto nextState = nextInput != nullptr
+                         ? nextInput->getState()
+                         : StreamState(AudioGraphNodeState::STOPPED);
+    if (nextState.state != AudioGraphNodeState::STREAMING ||
+        !hasFramesInfo(nextState) || nextState.streamInfo->format != format) {
+      spdlog::debug("Next source is not ready or has a different format, "
+                    "skipping crossfade");
+      crossfadeState = CrossfadeState::SKIPPED;
+      return readCurrent(size);
+    }
+
+    // Shorten the ramp if the next source is shorter than the crossfade
+    // or the fade region has been entered by seeking into it.
+    fadeLengthFrames = std::min<size_t>(
+        (totalBytes - sourcePositionBytes) / bytesPerFrame,
+        nextState.streamInfo->streamSize);
+    fadeStartBytes = totalBytes - fadeLengthFrames * bytesPerFrame;
+    crossfadeNode = nextInput;
+    leadInBytes = 0;
+    crossfadeState = CrossfadeState::ACTIVE;
+    crossfades.add();
+    spdlog::debug("Crossfading into the next source, frames={}",
+                  fadeLengthFrames);
+  }
+
+  if (nextInput != crossfadeNode) {
+    spdlog::debug("Next source has been removed, stopping crossfade");
+    crossfadeState = CrossfadeState::SKIPPED;
+    return readCurrent(size);
+  }
+
+  if (sourcePositionBytes < fadeStartBytes) {
+    return readCurrent(std::min(size, fadeStartBytes - sourcePositionBytes));
+  }
+
+  size_t bytesToMix = std::min(size, totalBytes - sourcePositionBytes);
+  bytesToMix = std::min(bytesToMix,
+                        nextInput->waitForDataFor(std::stop_token(),
+                                                  std::chrono::milliseconds(0),
+                                                  bytesToMix));
+  bytesToMix -= bytesToMix % bytesPerFrame;
+  if (bytesToMix == 0) {
+    return 0;
+  }
+
+  const size_t rampPosition =
+      (sourcePositionBytes - fadeStartBytes) / bytesPerFrame;
+  auto bytesRead = readCurrent(bytesToMix);
+  if (mixBuffer.size() < bytesRead) {
+    mixBuffer.resize(bytesRead);
+  }
+  auto nextBytesRead = nextInput->read(mixBuffer.data(), bytesRead);
+  leadInBytes += nextBytesRead;
+
+  crossfadeSamples(data, mixBuffer.data(), format.sampleFormat,
+                   std::min(bytesRead, nextBytesRead) / bytesPerFrame,
+                   format.channels, rampPosition, fadeLengthFrames);
+
+  return bytesRead;
+}
+
+bool AudioStreamSwitcher::isMixing(
+    const std::shared_ptr<AudioGraphOutputNode> &nextInput) const {
+  return crossfadeState == CrossfadeState::ACTIVE &&
+         nextInput == crossfadeNode && sourcePositionBytes >= fadeStartBytes;
+}
+
+void AudioStreamSwitcher::resetCrossfade() {
+  crossfadeState = CrossfadeState::PENDING;
+  crossfadeNode = nullptr;
+  sourcePositionBytes = 0;
+  fadeStartBytes = 0;
+  fadeLengthFrames = 0;
+  leadInBytes = 0;
+  pendingLeadInFrames = 0;
 }
 
 size_t AudioStreamSwitcher::waitForData(std::stop_token stopToken,
                                         size_t size) {
   std::unique_lock lock(mutex);
+  if (waitingForNextSource) {
+    return size;
+  }
   auto currentNode = currentInputNode;
+  auto nextNode = inputNodes.empty() ? nullptr : inputNodes.front();
   lock.unlock();
   if (currentNode == nullptr) {
     return 0;
   }
 
   auto combinedToken = combineStopTokens(stopToken, stopSource.get_token());
-  return currentNode->waitForData(combinedToken.get_token(), size);
+  auto bytesAvailable =
+      currentNode->waitForData(combinedToken.get_token(), size);
+  if (isMixing(nextNode)) {
+    bytesAvailable = std::min(
+        bytesAvailable, nextNode->waitForData(combinedToken.get_token(), size));
+  }
+  return bytesAvailable;
 }
 
 size_t AudioStreamSwitcher::waitForDataFor(std::stop_token stopToken,
                                            std::chrono::milliseconds timeout,
                                            size_t size) {
   std::unique_lock lock(mutex);
+  if (waitingForNextSource) {
+    return size;
+  }
   auto currentNode = currentInputNode;
+  auto nextNode = inputNodes.empty() ? nullptr : inputNodes.front();
   lock.unlock();
   if (currentNode == nullptr) {
     return 0;
   }
 
   auto combinedToken = combineStopTokens(stopToken, stopSource.get_token());
-  return currentNode->waitForDataFor(combinedToken.get_token(), timeout, size);
+  auto bytesAvailable =
+      currentNode->waitForDataFor(combinedToken.get_token(), timeout, size);
+  if (isMixing(nextNode)) {
+    bytesAvailable = std::min(
+        bytesAvailable,
+        nextNode->waitForDataFor(combinedToken.get_token(), timeout, size));
+  }
+  return bytesAvailable;
 }
 
 void AudioStreamSwitcher::acceptSourceChange() { switchToNextSource(); }
 
+size_t AudioStreamSwitcher::prebufferBytes(const StreamState &state) const {
+  if (!hasFramesInfo(state)) {
+    return 0;
+  }
+  const auto &format = state.streamInfo->format;
+  // A source shorter than the prebuffer is ready once fully decoded.
+  return std::min<size_t>(prebufferTime.count() * format.sampleRate / 1000,
+                          state.streamInfo->streamSize) *
+         frameBytes(format);
+}
+
+bool AudioStreamSwitcher::isSourceReady(
+    const std::shared_ptr<AudioGraphOutputNode> &node) {
+  auto state = node->getState();
+  if (state.state != AudioGraphNodeState::STREAMING) {
+    return false;
+  }
+  auto bytes = prebufferBytes(state);
+  return bytes == 0 || node->waitForDataFor(std::stop_token(),
+                                            std::chrono::milliseconds(0),
+                                            bytes) >= bytes;
+}
+
+bool AudioStreamSwitcher::hasNextSource() {
+  std::lock_guard lock(mutex);
+  return !inputNodes.empty();
+}
+
+std::optional<std::chrono::milliseconds>
+AudioStreamSwitcher::remainingTime() {
+  std::unique_lock lock(mutex);
+  auto currentNode = currentInputNode;
+  size_t positionBytes = sourcePositionBytes;
+  lock.unlock();
+  if (currentNode == nullptr) {
+    return std::nullopt;
+  }
+
+  auto state = currentNode->getState();
+  if (!hasFramesInfo(state) || state.streamInfo->format.sampleRate == 0) {
+    return std::nullopt;
+  }
+  const auto &streamInfo = *state.streamInfo;
+  size_t positionFrames = positionBytes / frameBytes(streamInfo.format);
+  size_t framesLeft = streamInfo.streamSize > positionFrames
+                          ? streamInfo.streamSize - positionFrames
+                          : 0;
+  return std::chrono::milliseconds(framesLeft * 1000 /
+                                   streamInfo.format.sampleRate);
+}
+
+bool AudioStreamSwitcher::isNextSourceReady() {
+  std::unique_lock lock(mutex);
+  auto nextNode = inputNodes.empty() ? nullptr : inputNodes.front();
+  lock.unlock();
+
+  return nextNode != nullptr && isSourceReady(nextNode);
+}
+
+bool AudioStreamSwitcher::switchIfNextSourceReady(
+    std::unique_lock<std::mutex> &lock) {
+  const auto node = currentInputNode;
+  while (!inputNodes.empty()) {
+    auto nextNode = inputNodes.front();
+    lock.unlock();
+    auto state = nextNode->getState().state;
+    // A source which can no longer be prebuffered, e.g. which has failed,
+    // is switched to as well and handled by the reader.
+    const bool ready = prebufferTime.count() == 0 ||
+                       (state != AudioGraphNodeState::PREPARING &&
+                        state != AudioGraphNodeState::STREAMING) ||
+                       isSourceReady(nextNode);
+    lock.lock();
+    if (node != currentInputNode) {
+      return false;
+    }
+    if (inputNodes.empty() || nextNode != inputNodes.front()) {
+      // Disconnected while it was queried.
+      continue;
+    }
+    if (!ready) {
+      return false;
+    }
+    waitingForNextSource = false;
+    currentInputNode = nullptr;
+    setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+    return true;
+  }
+  return false;
+}
+
+void AudioStreamSwitcher::getBufferLevels(
+    std::vector<NodeBufferLevel> &levels) {
+  std::unique_lock lock(mutex);
+  auto currentNode = currentInputNode;
+  auto nextNode = inputNodes.empty() ? nullptr : inputNodes.front();
+  lock.unlock();
+
+  if (currentNode != nullptr) {
+    currentNode->getBufferLevels(levels);
+  }
+  if (nextNode != nullptr) {
+    auto first = levels.size();
+    nextNode->getBufferLevels(levels);
+    for (auto i = first; i < levels.size(); ++i) {
+      levels[i].node = "next:" + levels[i].node;
+    }
+  }
+}
+
 size_t AudioStreamSwitcher::seekTo(size_t absolutePosition) {
   std::unique_lock lock(mutex);
   auto currentNode = currentInputNode;
@@ -137,5 +553,24 @@ size_t AudioStreamSwitcher::seekTo(size_t absolutePosition) {
   if (currentNode == nullptr) {
     return -1;
   }
-  return currentNode->seekTo(absolutePosition);
+  auto position = currentNode->seekTo(absolutePosition);
+  if (position == (size_t)-1) {
+    return position;
+  }
+
+  if (crossfadeTime.count() > 0) {
+    // Rewind the next source if it has been partially consumed by an
+    // interrupted crossfade.
+    if (crossfadeState == CrossfadeState::ACTIVE && leadInBytes > 0 &&
+        crossfadeNode != nullptr) {
+      crossfadeNode->seekTo(0);
+    }
+    resetCrossfade();
+  }
+
+  auto state = currentNode->getState();
+  sourcePositionBytes =
+      hasFramesInfo(state) ? position * frameBytes(state.streamInfo->format)
+                           : 0;
+  return position;
 }
\ No newline at end of file
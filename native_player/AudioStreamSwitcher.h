@@ -2,18 +2,38 @@
 #define AUDIO_GRAPH_CONTROLLER_H
 
 #include "AudioGraphNode.h"
+#include "Metrics.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <list>
+#include <optional>
+#include <vector>
 
 class AudioStreamSwitcher : public AudioGraphOutputNode,
                             public AudioGraphInputNode {
 public:
-  AudioStreamSwitcher();
-  virtual ~AudioStreamSwitcher() = default;
+  // When crossfadeTime is non-zero, the last crossfadeTime of the current
+  // source is mixed with the beginning of the next one, provided both have
+  // the same format. Otherwise the sources are played back to back.
+  // When prebufferTime is non-zero, the next source is switched to once it
+  // has prebufferTime of data decoded. Until then silence is read after
+  // the current source has finished, the reader never waits for it.
+  AudioStreamSwitcher(
+      std::chrono::milliseconds crossfadeTime = std::chrono::milliseconds(0),
+      std::chrono::milliseconds prebufferTime = std::chrono::milliseconds(0));
+  virtual ~AudioStreamSwitcher();
+
+  // Forwards the state of the current source before returning the state,
+  // so the reader sees it without waiting for the notifier.
+  virtual StreamState getState() override;
 
   virtual void
   connectTo(std::shared_ptr<AudioGraphOutputNode> inputNode) override;
 
+  // Returns once a read of the input node which may still be in
+  // progress has finished, so the node can be reused afterwards.
   virtual void
   disconnect(std::shared_ptr<AudioGraphOutputNode> inputNode) override;
 
@@ -26,9 +46,22 @@ public:
                                 std::chrono::milliseconds timeout,
                                 size_t size) override;
   virtual size_t seekTo(size_t absolutePosition) override;
+  virtual void
+  getBufferLevels(std::vector<NodeBufferLevel> &levels) override;
 
   virtual void acceptSourceChange() override;
 
+  // Returns true if the source to be played next has the prebuffer filled.
+  bool isNextSourceReady();
+
+  // Returns true if there is a source queued after the current one.
+  bool hasNextSource();
+
+  // Returns the playback time of the frames of the current source which
+  // have not been read yet, or nullopt if there is no current source or
+  // its length is unknown.
+  std::optional<std::chrono::milliseconds> remainingTime();
+
 private:
   std::list<std::shared_ptr<AudioGraphOutputNode>> inputNodes;
   std::shared_ptr<AudioGraphOutputNode> currentInputNode = nullptr;
@@ -36,9 +69,67 @@ private:
   std::mutex mutex;
   std::stop_source stopSource;
 
+  // The node the state change callback is registered with, which may
+  // have already been switched away from.
+  std::shared_ptr<AudioGraphOutputNode> callbackNode = nullptr;
   int stateCallbackId = -1;
+  // Generation of the callback forwarding the state of the current source,
+  // incremented on every switch. Callbacks of older sources remove
+  // themselves.
+  uint64_t sourceGeneration = 0;
+  uint64_t lastGeneration = 0;
+  // Set when the current source has finished before the next one has been
+  // prebuffered.
+  bool waitingForNextSource = false;
+  // Set while read() uses the input nodes outside of the mutex.
+  bool readInProgress = false;
+  std::condition_variable readFinished;
+
+  // Read position within the current source. Updated by the reader,
+  // can be queried from any thread through remainingTime().
+  std::atomic<size_t> sourcePositionBytes = 0;
+
+  // Crossfade bookkeeping. Only accessed from the reader side
+  // (read, waitForData, seekTo, acceptSourceChange).
+  enum class CrossfadeState { PENDING, ACTIVE, SKIPPED };
+
+  std::chrono::milliseconds crossfadeTime;
+  std::chrono::milliseconds prebufferTime;
+  CrossfadeState crossfadeState = CrossfadeState::PENDING;
+  std::shared_ptr<AudioGraphOutputNode> crossfadeNode = nullptr;
+  size_t fadeStartBytes = 0;
+  size_t fadeLengthFrames = 0;
+  size_t leadInBytes = 0;
+  long pendingLeadInFrames = 0;
+  std::vector<uint8_t> mixBuffer;
+
+  MetricGroup metrics{"AudioStreamSwitcher"};
+  Counter &bytesRead = metrics.counter("bytes_read");
+  Counter &sourceSwitches = metrics.counter("source_switches");
+  Counter &crossfades = metrics.counter("crossfades");
+  // Source changes delayed by silence as the next source was not
+  // prebuffered in time.
+  Counter &prebufferGaps = metrics.counter("prebuffer_gaps");
 
   void switchToNextSource();
+  // Forwards the state of the current source, if the callback of the given
+  // generation is the one forwarding it. Returns false once it is not.
+  bool forwardInputState(uint64_t generation);
+  // To be called with the mutex held, which is released while the state of
+  // the source is read.
+  bool forwardInputStateLocked(std::unique_lock<std::mutex> &lock);
+  size_t prebufferBytes(const StreamState &state) const;
+  bool isSourceReady(const std::shared_ptr<AudioGraphOutputNode> &node);
+  // Switches to the next source unless it can still be prebuffered. To be
+  // called with the mutex held, which is released while the next source is
+  // queried. Returns false as well if the current source has changed or no
+  // source is queued anymore in the meantime.
+  bool switchIfNextSourceReady(std::unique_lock<std::mutex> &lock);
+  void resetCrossfade();
+  bool isMixing(const std::shared_ptr<AudioGraphOutputNode> &nextInput) const;
+  size_t readWithCrossfade(std::shared_ptr<AudioGraphOutputNode> currentInput,
+                           std::shared_ptr<AudioGraphOutputNode> nextInput,
+                           void *data, size_t size);
 };
 
 #endif
\ No newline at end of file
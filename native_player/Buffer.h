@@ -4,14 +4,18 @@
 #include <atomic>
 #include <cassert>
 #include <condition_variable>
-#include <deque>
 #include <functional>
 #include <iostream>
 #include <mutex>
 #include <stop_token>
+#include <vector>
 
+// Bounded FIFO on top of a ring buffer allocated once at construction,
+// so streaming data through it does not touch the allocator.
 template <class T> class Buffer {
-  std::deque<T> data;
+  std::vector<T> data;
+  size_t head = 0;
+  size_t count = 0;
   mutable std::mutex m;
   std::condition_variable_any hasDataCon;
   std::condition_variable_any hasSpaceCon;
@@ -25,7 +29,8 @@ public:
   Buffer(
       size_t capacity,
       std::function<void(Buffer<T> &)> onEmptyCallback = [](Buffer<T> &) {})
-      : capacity(capacity), eof(false), onEmptyCallback(onEmptyCallback) {}
+      : data(capacity), capacity(capacity), eof(false),
+        onEmptyCallback(onEmptyCallback) {}
 
   ~Buffer() {
     {
@@ -45,13 +50,15 @@ public:
     size_t remainingSize = 0;
     {
       std::lock_guard<std::mutex> lock(m);
-      auto availableData = data.size();
-      if (availableData > 0) {
-        sizeToCopy = std::min(availableData, size);
-        std::copy_n(data.begin(), sizeToCopy, dest);
-        data.erase(data.begin(), data.begin() + sizeToCopy);
+      if (count > 0) {
+        sizeToCopy = std::min(count, size);
+        const size_t firstPart = std::min(sizeToCopy, capacity - head);
+        std::copy_n(data.begin() + head, firstPart, dest);
+        std::copy_n(data.begin(), sizeToCopy - firstPart, dest + firstPart);
+        head = (head + sizeToCopy) % capacity;
+        count -= sizeToCopy;
       }
-      remainingSize = data.size();
+      remainingSize = count;
     }
 
     if (remainingSize == 0) {
@@ -69,9 +76,15 @@ public:
     size_t sizeToCopy = 0;
     {
       std::lock_guard<std::mutex> lock(m);
-      sizeToCopy = std::min(size, capacity - data.size());
-      data.insert(data.end(), source, source + sizeToCopy);
-      assert(data.size() <= capacity);
+      sizeToCopy = std::min(size, capacity - count);
+      if (sizeToCopy > 0) {
+        const size_t tail = (head + count) % capacity;
+        const size_t firstPart = std::min(sizeToCopy, capacity - tail);
+        std::copy_n(source, firstPart, data.begin() + tail);
+        std::copy_n(source + firstPart, sizeToCopy - firstPart, data.begin());
+        count += sizeToCopy;
+      }
+      assert(count <= capacity);
     }
 
     if (sizeToCopy != 0) {
@@ -85,11 +98,11 @@ public:
     if (size > 0) {
       std::unique_lock<std::mutex> lock(m);
       hasDataCon.wait(lock, stopToken, [this, size] {
-        return done || data.size() >= std::min(size, capacity) || eof.load();
+        return done || count >= std::min(size, capacity) || eof.load();
       });
     }
 
-    return data.size();
+    return count;
   }
 
   size_t waitForDataFor(std::stop_token stopToken = std::stop_token(),
@@ -98,11 +111,11 @@ public:
     if (size > 0) {
       std::unique_lock<std::mutex> lock(m);
       hasDataCon.wait_for(lock, stopToken, timeout, [this, size] {
-        return done || data.size() >= std::min(size, capacity) || eof.load();
+        return done || count >= std::min(size, capacity) || eof.load();
       });
     }
 
-    return data.size();
+    return count;
   }
 
   size_t waitForSpace(std::stop_token stopToken = std::stop_token(),
@@ -111,29 +124,32 @@ public:
     if (size > 0) {
       std::unique_lock<std::mutex> lock(m);
       hasSpaceCon.wait(lock, stopToken, [this, size]() {
-        return done || (capacity - data.size()) >= size;
+        return done || (capacity - count) >= size;
       });
     }
-    return capacity - data.size();
+    return capacity - count;
   }
 
   size_t size() const {
     std::lock_guard lock(m);
-    return data.size();
+    return count;
   }
 
   size_t availableSpace() const {
     std::lock_guard lock(m);
-    return capacity - data.size();
+    return capacity - count;
   }
 
-  bool empty() const { return data.empty(); }
+  bool empty() const {
+    std::lock_guard lock(m);
+    return count == 0;
+  }
 
   void setEof() {
     eof.store(true);
     {
       std::lock_guard<std::mutex> lock(m);
-      if (data.empty()) {
+      if (count == 0) {
         onEmptyCallback(*this);
       }
     }
@@ -147,10 +163,9 @@ public:
   void clear() {
     {
       std::lock_guard<std::mutex> lock(m);
-      data.clear();
-      if (data.empty()) {
-        onEmptyCallback(*this);
-      }
+      head = 0;
+      count = 0;
+      onEmptyCallback(*this);
     }
     hasSpaceCon.notify_all();
   }
@@ -0,0 +1,220 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include "Utils.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+
+// Commands such as seeks posted to a worker thread by any number of
+// threads. Posting does not wait for the worker, the result comes back as
+// a future.
+// Commands coalesce: the worker takes all commands posted so far at once,
+// handles the latest and its result completes the futures of all of them.
+// Pending commands are kept in a ring of CAPACITY slots indexed by their
+// sequence number. If more are posted before the worker takes them, the
+// oldest are dropped and their futures complete with notHandled, the
+// latest command is never dropped.
+// The queue is closed while no worker runs, commands posted meanwhile
+// complete with notHandled right away.
+template <typename T, typename R = T, std::size_t CAPACITY = 16>
+class CommandQueue {
+  static_assert(CAPACITY > 0, "Capacity must be greater than 0");
+
+public:
+  explicit CommandQueue(R notHandled = R()) : notHandled(notHandled) {}
+  ~CommandQueue() { close(); }
+
+  CommandQueue(const CommandQueue &) = delete;
+  CommandQueue &operator=(const CommandQueue &) = delete;
+
+  std::future<R> post(T command) {
+    std::promise<R> result;
+    auto future = result.get_future();
+    if (closed.load()) {
+      result.set_value(notHandled);
+      return future;
+    }
+
+    const uint64_t sequence = posted.fetch_add(1) + 1;
+    auto &slot = slots[sequence % CAPACITY];
+    uint64_t state = slot.state.load();
+    while (true) {
+      if (state == WRITING) {
+        std::this_thread::yield();
+        state = slot.state.load();
+        continue;
+      }
+      if ((state >> 1) > sequence) {
+        // Lapped by a newer command before it could be stored.
+        result.set_value(notHandled);
+        return future;
+      }
+      if (slot.state.compare_exchange_weak(state, WRITING)) {
+        break;
+      }
+    }
+    if (!(state & TAKEN)) {
+      // The command in the slot was not taken in time.
+      slot.result.set_value(notHandled);
+    }
+    slot.command = std::move(command);
+    slot.result = std::move(result);
+    slot.state.store(sequence << 1);
+
+    if (closed.load()) {
+      // The worker stopped meanwhile, unless close() has completed the
+      // command, do it here.
+      uint64_t committed = sequence << 1;
+      if (slot.state.compare_exchange_strong(committed, WRITING)) {
+        slot.result.set_value(notHandled);
+        slot.state.store(committed | TAKEN);
+      }
+      return future;
+    }
+
+    signalSource().request_stop();
+    signalled.store(true);
+    return future;
+  }
+
+  // Worker thread only: takes the commands posted so far and returns the
+  // latest of them, if any. respond() has to be called with its result
+  // before the next take().
+  std::optional<T> take() {
+    if (takenCount > 0) {
+      respond(notHandled);
+    }
+    if (signalled.load() && signalled.exchange(false)) {
+      // Reset before looking for commands, so a command stored meanwhile
+      // signals the new stop source.
+      std::stop_source source;
+      lockSignal();
+      signal.swap(source);
+      unlockSignal();
+    }
+
+    const uint64_t latest = posted.load();
+    std::optional<T> command;
+    uint64_t sequence = taken + 1;
+    if (latest >= CAPACITY && sequence < latest - CAPACITY + 1) {
+      sequence = latest - CAPACITY + 1;
+    }
+    for (; sequence <= latest; ++sequence) {
+      auto &slot = slots[sequence % CAPACITY];
+      uint64_t state = slot.state.load();
+      if (state == WRITING || (state >> 1) < sequence) {
+        // Not stored yet, the poster signals once it is.
+        break;
+      }
+      // Otherwise the command was lapped or completed by a poster, unless
+      // it is still to be taken.
+      if (state == sequence << 1 &&
+          slot.state.compare_exchange_strong(state, WRITING)) {
+        command = std::move(slot.command);
+        takenResults[takenCount++] = std::move(slot.result);
+        slot.state.store((sequence << 1) | TAKEN);
+      }
+      taken = sequence;
+    }
+    return command;
+  }
+
+  // Worker thread only: completes the futures of the commands returned by
+  // the last take().
+  void respond(const R &result) {
+    for (std::size_t i = 0; i < takenCount; ++i) {
+      takenResults[i].set_value(result);
+    }
+    takenCount = 0;
+  }
+
+  // Worker thread only: waits until commands are posted or stopToken is
+  // stopped and takes them.
+  std::optional<T> waitAndTake(std::stop_token stopToken) {
+    while (!stopToken.stop_requested()) {
+      if (auto command = take()) {
+        return command;
+      }
+      auto combinedToken = combineStopTokens(stopToken, getStopToken());
+      std::mutex mutex;
+      std::condition_variable_any cv;
+      std::unique_lock lock(mutex);
+      cv.wait(lock, combinedToken.get_token(), []() { return false; });
+    }
+    return std::nullopt;
+  }
+
+  // Whether commands were posted since the last take(), from the worker
+  // thread. Cheaper than checking the stop token.
+  bool pending() const { return posted.load() != taken; }
+
+  // Stopped once a command is posted, until it is taken.
+  std::stop_token getStopToken() const { return signalSource().get_token(); }
+
+  // Called by the worker when it starts and before it exits.
+  void open() { closed.store(false); }
+  void close() {
+    closed.store(true);
+    respond(notHandled);
+    for (auto &slot : slots) {
+      uint64_t state = slot.state.load();
+      while (state != WRITING && !(state & TAKEN)) {
+        if (slot.state.compare_exchange_weak(state, WRITING)) {
+          slot.result.set_value(notHandled);
+          slot.state.store(state | TAKEN);
+          break;
+        }
+      }
+    }
+  }
+
+private:
+  // Slot states are the sequence number of the command shifted left by
+  // one, with TAKEN set once its future is handed over.
+  static constexpr uint64_t TAKEN = 1;
+  static constexpr uint64_t WRITING = UINT64_MAX;
+
+  struct Slot {
+    std::atomic<uint64_t> state = TAKEN;
+    T command{};
+    std::promise<R> result;
+  };
+
+  const R notHandled;
+  std::array<Slot, CAPACITY> slots;
+  std::atomic<uint64_t> posted = 0;
+  std::atomic<bool> closed = true;
+  std::atomic<bool> signalled = false;
+  // Replaced by the worker once stopped. Guarded by a spin lock held only
+  // to copy or swap it, posting must not wait for the worker.
+  std::stop_source signal;
+  mutable std::atomic_flag signalLock;
+
+  void lockSignal() const {
+    while (signalLock.test_and_set(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+  void unlockSignal() const { signalLock.clear(std::memory_order_release); }
+  std::stop_source signalSource() const {
+    lockSignal();
+    auto source = signal;
+    unlockSignal();
+    return source;
+  }
+
+  // Worker thread only.
+  uint64_t taken = 0;
+  std::array<std::promise<R>, CAPACITY> takenResults;
+  std::size_t takenCount = 0;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "DeadlineMonitor.h"
+
+#include <algorithm>
+
+void DeadlineMonitor::setNearMissThreshold(std::chrono::nanoseconds threshold) {
+  nearMissThresholdNs.store(threshold.count(), std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds DeadlineMonitor::getNearMissThreshold() const {
+  return std::chrono::nanoseconds(
+      nearMissThresholdNs.load(std::memory_order_relaxed));
+}
+
+void DeadlineMonitor::record(std::chrono::nanoseconds slack) {
+  const int64_t slackNs = slack.count();
+  if (slackNs < 0) {
+    misses.store(misses.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+  } else {
+    slackHistogram.record(slackNs);
+    if (slackNs < nearMissThresholdNs.load(std::memory_order_relaxed)) {
+      nearMisses.store(nearMisses.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    }
+  }
+  if (slackNs < minSlackNs.load(std::memory_order_relaxed)) {
+    minSlackNs.store(slackNs, std::memory_order_relaxed);
+  }
+}
+
+void DeadlineMonitor::reset() {
+  slackHistogram.reset();
+  nearMisses.store(0, std::memory_order_relaxed);
+  misses.store(0, std::memory_order_relaxed);
+  minSlackNs.store(INT64_MAX, std::memory_order_relaxed);
+}
+
+DeadlineStats DeadlineMonitor::getStats() const {
+  DeadlineStats stats;
+  stats.misses = misses.load(std::memory_order_relaxed);
+  stats.nearMisses = nearMisses.load(std::memory_order_relaxed);
+  stats.periods = slackHistogram.count() + stats.misses;
+  if (stats.periods == 0) {
+    return stats;
+  }
+  stats.minSlackNs = minSlackNs.load(std::memory_order_relaxed);
+  stats.p1SlackNs = slackHistogram.percentile(1);
+  stats.p50SlackNs = slackHistogram.percentile(50);
+  return stats;
+}
+
+uint64_t DeadlineMonitor::getNearMisses() const {
+  return nearMisses.load(std::memory_order_relaxed);
+}
+
+int64_t DeadlineMonitor::getMinSlackNs() const {
+  auto slackNs = minSlackNs.load(std::memory_order_relaxed);
+  return slackNs == INT64_MAX ? 0 : slackNs;
+}
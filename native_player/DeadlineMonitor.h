@@ -0,0 +1,51 @@
+#ifndef DEADLINE_MONITOR_H
+#define DEADLINE_MONITOR_H
+
+#include "PerfMon.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct DeadlineStats {
+  // Number of periods written since the start of the track.
+  uint64_t periods = 0;
+  // Periods written with less slack than the near miss threshold.
+  uint64_t nearMisses = 0;
+  // Periods written after the buffer would have drained.
+  uint64_t misses = 0;
+  // Negative if a deadline was missed.
+  int64_t minSlackNs = 0;
+  uint64_t p1SlackNs = 0;
+  uint64_t p50SlackNs = 0;
+};
+
+// Tracks how close the playback thread gets to the period deadlines.
+// The slack of a period is the time left between writing the period and
+// the moment the device buffer would have run empty.
+// Written by the playback thread only, the stats can be read from any
+// thread.
+class DeadlineMonitor {
+public:
+  void setNearMissThreshold(std::chrono::nanoseconds threshold);
+  std::chrono::nanoseconds getNearMissThreshold() const;
+
+  void record(std::chrono::nanoseconds slack);
+  // Starts collecting the stats of a new track.
+  void reset();
+
+  DeadlineStats getStats() const;
+  // Cheap parts of the stats, without computing the percentiles.
+  uint64_t getNearMisses() const;
+  int64_t getMinSlackNs() const;
+
+private:
+  std::atomic<int64_t> nearMissThresholdNs = 0;
+  std::atomic<uint64_t> nearMisses = 0;
+  std::atomic<uint64_t> misses = 0;
+  std::atomic<int64_t> minSlackNs = INT64_MAX;
+  // Slack of the periods which met their deadline.
+  LatencyHistogram slackHistogram;
+};
+
+#endif
@@ -0,0 +1,313 @@
+#include "FileAudioEmitter.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+constexpr uint16_t WAVE_FORMAT_PCM = 1;
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xfffe;
+// KSDATAFORMAT_SUBTYPE_PCM
+constexpr uint8_t PCM_SUBFORMAT_GUID[] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                          0x10, 0x00, 0x80, 0x00, 0x00, 0xaa,
+                                          0x00, 0x38, 0x9b, 0x71};
+
+void putLe16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+void putLe32(std::vector<uint8_t> &out, uint32_t value) {
+  putLe16(out, value & 0xffff);
+  putLe16(out, value >> 16);
+}
+
+void putTag(std::vector<uint8_t> &out, const char *tag) {
+  out.insert(out.end(), tag, tag + 4);
+}
+
+uint32_t clampToUint32(size_t value) {
+  return static_cast<uint32_t>(
+      std::min<size_t>(value, std::numeric_limits<uint32_t>::max()));
+}
+
+std::runtime_error systemError(const std::string &message) {
+  return std::runtime_error(message + ": " + std::strerror(errno));
+}
+
+void writeAll(int fd, const uint8_t *data, size_t bytes, off_t offset = -1) {
+  while (bytes > 0) {
+    auto written = offset < 0 ? ::write(fd, data, bytes)
+                              : ::pwrite(fd, data, bytes, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw systemError("Cannot write audio file");
+    }
+    data += written;
+    bytes -= written;
+    if (offset >= 0) {
+      offset += written;
+    }
+  }
+}
+} // namespace
+
+void PcmFileWriter::FreeDeleter::operator()(uint8_t *ptr) const {
+  std::free(ptr);
+}
+
+PcmFileWriter::PcmFileWriter(const std::string &path,
+                             PcmFileContainer container,
+                             const StreamAudioFormat &format, bool directIo)
+    : path(path), container(container), format(format),
+      fileSampleFormat(container == PcmFileContainer::WAV &&
+                               format.sampleFormat == PCM24_LE
+                           ? PCM24_3LE
+                           : format.sampleFormat),
+      directIo(directIo) {
+  if (format.sampleRate == 0 || format.channels == 0 ||
+      sampleSize(format.sampleFormat) == 0) {
+    throw std::runtime_error("Unsupported audio format: " + format.toString());
+  }
+
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  if (directIo) {
+    fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) {
+      spdlog::warn("O_DIRECT is not supported for {}, using buffered writes",
+                   path);
+      this->directIo = false;
+    }
+  }
+  if (!this->directIo) {
+    fd = ::open(path.c_str(), flags, 0644);
+  }
+  if (fd < 0) {
+    throw systemError("Cannot open " + path);
+  }
+
+  void *memory = nullptr;
+  if (posix_memalign(&memory, DIRECT_IO_ALIGNMENT, BUFFER_SIZE) != 0) {
+    ::close(fd);
+    throw std::bad_alloc();
+  }
+  buffer.reset(static_cast<uint8_t *>(memory));
+
+  if (container == PcmFileContainer::WAV) {
+    // Completed with the data size on close().
+    auto header = wavHeader();
+    headerSize = header.size();
+    append(header.data(), header.size());
+  }
+}
+
+PcmFileWriter::~PcmFileWriter() {
+  try {
+    close();
+  } catch (const std::exception &ex) {
+    spdlog::error("Error closing {}: {}", path, ex.what());
+  }
+}
+
+void PcmFileWriter::write(const void *data, size_t bytes) {
+  const auto *source = static_cast<const uint8_t *>(data);
+  if (fileSampleFormat == format.sampleFormat) {
+    append(source, bytes);
+    dataSize += bytes;
+    return;
+  }
+
+  const size_t sourceSampleBytes = sampleSize(format.sampleFormat);
+  const size_t fileSampleBytes = sampleSize(fileSampleFormat);
+  uint8_t converted[4096];
+  size_t samples = bytes / sourceSampleBytes;
+  while (samples > 0) {
+    const size_t count = std::min(samples, sizeof(converted) / fileSampleBytes);
+    convertSampleFormat(source, format.sampleFormat, count, converted,
+                        fileSampleFormat, sizeof(converted));
+    append(converted, count * fileSampleBytes);
+    dataSize += count * fileSampleBytes;
+    source += count * sourceSampleBytes;
+    samples -= count;
+  }
+}
+
+void PcmFileWriter::close() {
+  if (fd < 0) {
+    return;
+  }
+
+  try {
+    flush(true);
+    if (directIo) {
+      // Drops the padding of the last block.
+      if (::ftruncate(fd, headerSize + dataSize) < 0) {
+        throw systemError("Cannot truncate " + path);
+      }
+    }
+    if (container == PcmFileContainer::WAV) {
+      if (directIo) {
+        // The header is not a full aligned block.
+        ::close(fd);
+        fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+          throw systemError("Cannot open " + path);
+        }
+      }
+      auto header = wavHeader();
+      writeAll(fd, header.data(), header.size(), 0);
+    }
+  } catch (...) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    fd = -1;
+    throw;
+  }
+
+  if (::close(fd) < 0) {
+    fd = -1;
+    throw systemError("Cannot close " + path);
+  }
+  fd = -1;
+}
+
+std::vector<uint8_t> PcmFileWriter::wavHeader() const {
+  const uint16_t channels = format.channels;
+  const uint16_t containerBits = sampleSize(fileSampleFormat) * 8;
+  const uint16_t blockAlign = channels * sampleSize(fileSampleFormat);
+  // Samples using only part of their container need the extensible
+  // format to tell the number of valid bits.
+  const bool extensible = sampleBits(fileSampleFormat) != containerBits;
+
+  std::vector<uint8_t> header;
+  const uint32_t fmtSize = extensible ? 40 : 16;
+  const size_t size = 12 + 8 + fmtSize + 8;
+  putTag(header, "RIFF");
+  putLe32(header, clampToUint32(size - 8 + dataSize));
+  putTag(header, "WAVE");
+
+  putTag(header, "fmt ");
+  putLe32(header, fmtSize);
+  putLe16(header, extensible ? WAVE_FORMAT_EXTENSIBLE : WAVE_FORMAT_PCM);
+  putLe16(header, channels);
+  putLe32(header, format.sampleRate);
+  putLe32(header, format.sampleRate * blockAlign);
+  putLe16(header, blockAlign);
+  putLe16(header, containerBits);
+  if (extensible) {
+    putLe16(header, 22);
+    putLe16(header, sampleBits(fileSampleFormat));
+    // Front left and right for stereo, otherwise unspecified.
+    putLe32(header, channels == 2 ? 0x3 : 0);
+    header.insert(header.end(), std::begin(PCM_SUBFORMAT_GUID),
+                  std::end(PCM_SUBFORMAT_GUID));
+  }
+
+  putTag(header, "data");
+  putLe32(header, clampToUint32(dataSize));
+  return header;
+}
+
+void PcmFileWriter::append(const uint8_t *data, size_t bytes) {
+  while (bytes > 0) {
+    const size_t count = std::min(bytes, BUFFER_SIZE - bufferUsed);
+    std::memcpy(buffer.get() + bufferUsed, data, count);
+    bufferUsed += count;
+    data += count;
+    bytes -= count;
+    if (bufferUsed == BUFFER_SIZE) {
+      flush(false);
+    }
+  }
+}
+
+void PcmFileWriter::flush(bool final) {
+  size_t bytes = bufferUsed;
+  if (directIo) {
+    if (final) {
+      // Pad the last block, the file is truncated to its size on close().
+      bytes = (bufferUsed + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT *
+              DIRECT_IO_ALIGNMENT;
+      std::memset(buffer.get() + bufferUsed, 0, bytes - bufferUsed);
+    } else {
+      bytes -= bytes % DIRECT_IO_ALIGNMENT;
+    }
+  }
+
+  writeAll(fd, buffer.get(), bytes);
+  if (bytes < bufferUsed) {
+    std::memmove(buffer.get(), buffer.get() + bytes, bufferUsed - bytes);
+    bufferUsed -= bytes;
+  } else {
+    bufferUsed = 0;
+  }
+}
+
+FileAudioEmitter::FileAudioEmitter(std::string path,
+                                   PcmFileContainer container, bool directIo,
+                                   bool realtime)
+    : NullAudioEmitter(realtime), path(std::move(path)),
+      container(container), directIo(directIo) {}
+
+FileAudioEmitter::~FileAudioEmitter() {
+  // The worker calls the overridden hooks, it has to stop first.
+  stop();
+}
+
+std::vector<std::string> FileAudioEmitter::getFiles() {
+  std::lock_guard lock(filesMutex);
+  return files;
+}
+
+void FileAudioEmitter::beginStream(const StreamAudioFormat &format) {
+  if (writer != nullptr && format == writerFormat) {
+    return;
+  }
+  endStream();
+  writer =
+      std::make_unique<PcmFileWriter>(nextPath(), container, format, directIo);
+  writerFormat = format;
+}
+
+void FileAudioEmitter::consumeFrames(const uint8_t *data, size_t bytes) {
+  if (writer != nullptr) {
+    writer->write(data, bytes);
+  }
+}
+
+void FileAudioEmitter::endStream() {
+  if (writer == nullptr) {
+    return;
+  }
+  auto finishedWriter = std::move(writer);
+  finishedWriter->close();
+  spdlog::info("FileAudioEmitter: wrote {} bytes of {}",
+               finishedWriter->dataBytes(), writerFormat.toString());
+}
+
+std::string FileAudioEmitter::nextPath() {
+  std::lock_guard lock(filesMutex);
+  std::string nextPath = path;
+  if (!files.empty()) {
+    auto suffix = "-" + std::to_string(files.size());
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of('/');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) {
+      nextPath += suffix;
+    } else {
+      nextPath.insert(dot, suffix);
+    }
+  }
+  files.push_back(nextPath);
+  return nextPath;
+}
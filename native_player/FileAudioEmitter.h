@@ -0,0 +1,100 @@
+#ifndef FILE_AUDIO_EMITTER_H
+#define FILE_AUDIO_EMITTER_H
+
+#include "AudioInfo.h"
+#include "NullAudioEmitter.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class PcmFileContainer { WAV, RAW };
+
+// Writes PCM frames to a file. RAW files hold the bytes as received. WAV
+// files hold the same samples, PCM24_LE is stored packed as PCM24_3LE
+// since WAV has no 24 bit samples in a 32 bit container aligned to the
+// least significant bit.
+// With directIo the data is written with O_DIRECT in aligned blocks,
+// bypassing the page cache. Falls back to buffered writes if the file
+// system does not support it.
+class PcmFileWriter {
+public:
+  static constexpr size_t BUFFER_SIZE = 1 << 20;
+  static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+  PcmFileWriter(const std::string &path, PcmFileContainer container,
+                const StreamAudioFormat &format, bool directIo = false);
+  ~PcmFileWriter();
+  PcmFileWriter(const PcmFileWriter &) = delete;
+  PcmFileWriter &operator=(const PcmFileWriter &) = delete;
+
+  void write(const void *data, size_t bytes);
+  // Flushes the data and completes the WAV header. Called by the
+  // destructor, which does not report errors.
+  void close();
+
+  // Bytes of audio data written so far, without the header.
+  size_t dataBytes() const { return dataSize; }
+  bool isDirectIo() const { return directIo; }
+
+private:
+  struct FreeDeleter {
+    void operator()(uint8_t *ptr) const;
+  };
+
+  std::string path;
+  PcmFileContainer container;
+  StreamAudioFormat format;
+  AudioSampleFormat fileSampleFormat;
+  bool directIo;
+  int fd = -1;
+
+  std::unique_ptr<uint8_t, FreeDeleter> buffer;
+  size_t bufferUsed = 0;
+  size_t headerSize = 0;
+  size_t dataSize = 0;
+
+  std::vector<uint8_t> wavHeader() const;
+  void append(const uint8_t *data, size_t bytes);
+  void flush(bool final);
+};
+
+// Emitter writing the received frames to files, faster than real time
+// unless realtime is set, e.g. to render the transitions between tracks
+// and compare them with a reference.
+// Pauses and seeks are not visible in the output, the frames following a
+// seek are appended to the current file. Sources of the same format are
+// written back to back into one file. A new file is started when the
+// format changes or a new stream starts after the previous one finished,
+// named after the path with "-1", "-2", ... before the extension.
+class FileAudioEmitter : public NullAudioEmitter {
+public:
+  explicit FileAudioEmitter(std::string path,
+                            PcmFileContainer container = PcmFileContainer::WAV,
+                            bool directIo = false, bool realtime = false);
+  virtual ~FileAudioEmitter();
+
+  // Paths of the files written so far.
+  std::vector<std::string> getFiles();
+
+protected:
+  virtual void beginStream(const StreamAudioFormat &format) override;
+  virtual void consumeFrames(const uint8_t *data, size_t bytes) override;
+  virtual void endStream() override;
+
+private:
+  std::string path;
+  PcmFileContainer container;
+  bool directIo;
+
+  std::unique_ptr<PcmFileWriter> writer;
+  StreamAudioFormat writerFormat;
+
+  std::mutex filesMutex;
+  std::vector<std::string> files;
+
+  std::string nextPath();
+};
+
+#endif
@@ -6,13 +6,16 @@
 #include "StateMonitor.h"
 #include <functional>
 #include <iostream>
-#include <pthread.h>
 #include <vector>
 
 FlacStreamDecoder::FlacStreamDecoder(size_t bufferSize)
     : buffer(bufferSize, std::bind(&FlacStreamDecoder::onEmptyBuffer, this,
                                    std::placeholders::_1)) {
   init();
+  metrics.gauge("buffer_bytes", [this]() { return buffer.size(); });
+  metrics.gauge("buffer_capacity", [this]() { return buffer.max_size(); });
+  metrics.gauge("bytes_per_second",
+                [this]() { return decodeRate.perSecond(); });
 }
 
 void FlacStreamDecoder::connectTo(
@@ -25,12 +28,15 @@ void FlacStreamDecoder::connectTo(
     throw std::runtime_error("Input node is already connected");
   }
 
+  if (!decodingThread.running()) {
+    resetStream();
+  }
+
   this->inputNode = inputNode;
 
-  if (!decodingThread.joinable()) {
+  if (!decodingThread.running()) {
     setState(StreamState(AudioGraphNodeState::PREPARING));
-    decodingThread =
-        std::jthread(std::bind_front(&FlacStreamDecoder::thread_run, this));
+    decodingThread.start(std::bind_front(&FlacStreamDecoder::thread_run, this));
   }
 }
 
@@ -40,10 +46,7 @@ void FlacStreamDecoder::disconnect(
     return;
   }
 
-  if (decodingThread.joinable()) {
-    decodingThread.request_stop();
-    decodingThread.join();
-  }
+  decodingThread.stop();
 
   this->inputNode = nullptr;
 }
@@ -78,40 +81,52 @@ FlacStreamDecoder::write_callback(const ::FLAC__Frame *frame,
     data.resize(blockSizeInBytes);
   }
   convertToFormat(data.data(), buffer, blockSize, format);
+  framesDecoded += blockSize;
 
   size_t bytesWritten = 0;
-  auto combinedStopToken = combineStopTokens(decodingThread.get_stop_token(),
-                                             seekSignal.getStopToken());
+  auto combinedStopToken = combineStopTokens(decodingThread.getStopToken(),
+                                             seekRequests.getStopToken());
 
   while (bytesWritten < blockSizeInBytes) {
-    auto spaceAvailable =
-        this->buffer.waitForSpace(combinedStopToken.get_token());
+    perfmon_begin("FlacStreamDecoder::waitForSpace");
+    size_t spaceAvailable = 0;
+    {
+      ScopedTimer timer(waitForSpaceNs);
+      spaceAvailable = this->buffer.waitForSpace(combinedStopToken.get_token());
+    }
+    perfmon_end("FlacStreamDecoder::waitForSpace");
 
-    if (seekSignal.getStopToken().stop_requested()) {
+    if (seekRequests.pending()) {
       break;
     }
 
-    if (decodingThread.get_stop_token().stop_requested()) {
+    if (decodingThread.getStopToken().stop_requested()) {
       return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
     }
 
     perfmon_begin("FlacStreamDecoder::write_callback-write");
-    bytesWritten += this->buffer.write(
+    auto written = this->buffer.write(
         reinterpret_cast<uint8_t *>(data.data()) + bytesWritten,
         std::min(spaceAvailable, blockSizeInBytes - bytesWritten));
+    bytesWritten += written;
     perfmon_end("FlacStreamDecoder::write_callback-write");
+    bytesDecoded.add(written);
+    decodeRate.add(written);
   }
 
   return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 ::FLAC__StreamDecoderReadStatus
 FlacStreamDecoder::read_callback(FLAC__byte buffer[], size_t *bytes) {
-  auto combinedStopToken = combineStopTokens(seekSignal.getStopToken(),
-                                             decodingThread.get_stop_token());
-  inputNode->waitForData(combinedStopToken.get_token(), *bytes);
+  auto combinedStopToken = combineStopTokens(seekRequests.getStopToken(),
+                                             decodingThread.getStopToken());
+  {
+    ScopedTimer timer(waitForDataNs);
+    inputNode->waitForData(combinedStopToken.get_token(), *bytes);
+  }
   *bytes = inputNode->read(buffer, *bytes);
   sourceStreamPosition += *bytes;
-  if (decodingThread.get_stop_token().stop_requested()) {
+  if (decodingThread.getStopToken().stop_requested()) {
     return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
   }
   auto inputNodeState = inputNode->getState();
@@ -147,6 +162,9 @@ void FlacStreamDecoder::metadata_callback(
 
 ::FLAC__StreamDecoderSeekStatus
 FlacStreamDecoder::seek_callback(FLAC__uint64 absolute_byte_offset) {
+  if (inputNode == nullptr) {
+    return FLAC__STREAM_DECODER_SEEK_STATUS_UNSUPPORTED;
+  }
   auto ret = inputNode->seekTo(absolute_byte_offset);
   if (ret == (size_t)-1) {
     return FLAC__STREAM_DECODER_SEEK_STATUS_UNSUPPORTED;
@@ -209,7 +227,8 @@ void FlacStreamDecoder::setStreamingState() {
   setState({AudioGraphNodeState::STREAMING, streamReadPosition, streamInfo});
 }
 
-void FlacStreamDecoder::handleSeekSignal(size_t position) {
+void FlacStreamDecoder::handleSeekRequest(size_t position) {
+  seeks.add();
   auto state = get_state();
   if (state == FLAC__STREAM_DECODER_SEEK_ERROR) {
     if (!flush()) {
@@ -219,13 +238,13 @@ void FlacStreamDecoder::handleSeekSignal(size_t position) {
   buffer.clear();
   if (position >= flacStreamInfo.value().total_samples) {
     streamReadPosition = flacStreamInfo.value().total_samples;
-    seekSignal.respond(position);
+    seekRequests.respond(position);
     return;
   }
 
   buffer.resetEof();
   setState(StreamState{AudioGraphNodeState::PREPARING});
-  seekSignal.respond(position);
+  seekRequests.respond(position);
   if (!seek_absolute(position)) {
     spdlog::warn("Seek failed, offset={}, state={}", position,
                  FLAC__StreamDecoderStateString[get_state()]);
@@ -235,8 +254,28 @@ void FlacStreamDecoder::handleSeekSignal(size_t position) {
   setStreamingState();
 }
 
+void FlacStreamDecoder::resetStream() {
+  // Rewind the decoder to look for the metadata of a new stream rather
+  // than reallocating it. No input is connected at this point, so the
+  // reset does not seek.
+  if (!reset()) {
+    spdlog::debug("Flac decoder reset failed, state={}, reinitializing",
+                  FLAC__StreamDecoderStateString[get_state()]);
+    finish();
+    init();
+  }
+
+  flacStreamInfo.reset();
+  sourceStreamLength.reset();
+  sourceStreamPosition = 0;
+  streamReadPosition = 0;
+  buffer.resetEof();
+  buffer.clear();
+}
+
 void FlacStreamDecoder::thread_run(std::stop_token token) {
-  pthread_setname_np(pthread_self(), "FlacDecoder");
+  cpuMeter.start();
+  framesDecoded = 0;
   try {
     if (get_state() == FLAC__STREAM_DECODER_UNINITIALIZED) {
       throw std::runtime_error("Flac decoder not initialized");
@@ -244,6 +283,7 @@ void FlacStreamDecoder::thread_run(std::stop_token token) {
     if (token.stop_requested()) {
       return;
     }
+    seekRequests.open();
     bool retval = process_until_end_of_metadata();
     throwOnFlacError(retval);
 
@@ -256,15 +296,18 @@ void FlacStreamDecoder::thread_run(std::stop_token token) {
             state == FLAC__STREAM_DECODER_ABORTED) {
           break;
         }
+        perfmon_begin("FlacStreamDecoder::process_single");
         retval = process_single();
+        perfmon_end("FlacStreamDecoder::process_single");
+        cpuMeter.sample();
         throwOnFlacError(retval);
         if (!streamingStateSet) {
           setStreamingState();
           streamingStateSet = true;
         }
 
-        if (seekSignal.getValue().has_value()) {
-          handleSeekSignal(*seekSignal.getValue());
+        if (auto position = seekRequests.take()) {
+          handleSeekRequest(*position);
           if (static_cast<FLAC__uint64>(streamReadPosition) ==
               flacStreamInfo.value().total_samples) {
             break;
@@ -273,12 +316,13 @@ void FlacStreamDecoder::thread_run(std::stop_token token) {
       }
 
       buffer.setEof();
-      auto seekValue = seekSignal.waitValue(token);
-      if (!seekValue) {
+      reportCpuUsage();
+      auto position = seekRequests.waitAndTake(token);
+      if (!position) {
         break;
       }
 
-      handleSeekSignal(*seekValue);
+      handleSeekRequest(*position);
     }
   } catch (std::exception &ex) {
     std::string message =
@@ -286,23 +330,36 @@ void FlacStreamDecoder::thread_run(std::stop_token token) {
     spdlog::warn(message);
     setState({AudioGraphNodeState::ERROR, message});
   }
+  seekRequests.close();
   buffer.setEof();
   setState(StreamState{AudioGraphNodeState::STOPPED});
 }
 
+void FlacStreamDecoder::reportCpuUsage() {
+  auto usage = cpuMeter.lap();
+  if (!flacStreamInfo.has_value() || framesDecoded == 0) {
+    return;
+  }
+
+  auto audioTime = std::chrono::nanoseconds(
+      framesDecoded * 1'000'000'000ull / flacStreamInfo->sample_rate);
+  framesDecoded = 0;
+  realtimeFactor.set(usage.realtimeFactor(audioTime));
+  spdlog::info("FlacStreamDecoder: decoded {:.1f}s in {:.1f}ms of CPU time, "
+               "realtime factor {:.0f}, context switches voluntary={}, "
+               "involuntary={}",
+               audioTime.count() / 1e9, usage.cpuTime.count() / 1e6,
+               realtimeFactor.get(), usage.voluntarySwitches,
+               usage.involuntarySwitches);
+}
+
 void FlacStreamDecoder::onEmptyBuffer(Buffer<uint8_t> &buffer) {
   if (buffer.isEof() && getState().state != AudioGraphNodeState::ERROR) {
     setState(StreamState{AudioGraphNodeState::FINISHED});
   }
 }
 
-FlacStreamDecoder::~FlacStreamDecoder() {
-  if (decodingThread.joinable()) {
-    decodingThread.request_stop();
-    decodingThread.join();
-    decodingThread = std::jthread();
-  }
-}
+FlacStreamDecoder::~FlacStreamDecoder() { decodingThread.stop(); }
 
 size_t FlacStreamDecoder::read(void *data, size_t size) {
   perfmon_begin("FlacStreamDecoder::read");
@@ -312,25 +369,33 @@ size_t FlacStreamDecoder::read(void *data, size_t size) {
   return readBytes;
 }
 size_t FlacStreamDecoder::waitForData(std::stop_token stopToken, size_t size) {
-  auto combinedToken = combineStopTokens(stopToken, seekSignal.getStopToken());
+  auto combinedToken =
+      combineStopTokens(stopToken, seekRequests.getStopToken());
   return buffer.waitForData(combinedToken.get_token(), size);
 }
 
 size_t FlacStreamDecoder::waitForDataFor(std::stop_token stopToken,
                                          std::chrono::milliseconds timeout,
                                          size_t size) {
-  auto combinedToken = combineStopTokens(stopToken, seekSignal.getStopToken());
+  auto combinedToken =
+      combineStopTokens(stopToken, seekRequests.getStopToken());
   return buffer.waitForDataFor(combinedToken.get_token(), timeout, size);
 }
 
+void FlacStreamDecoder::getBufferLevels(std::vector<NodeBufferLevel> &levels) {
+  levels.push_back({"FlacStreamDecoder", buffer.size(), buffer.max_size()});
+  if (inputNode != nullptr) {
+    inputNode->getBufferLevels(levels);
+  }
+}
+
 size_t FlacStreamDecoder::seekTo(size_t absolutePosition) {
-  if (getState().state == AudioGraphNodeState::ERROR || seekSignal.getValue()) {
+  if (getState().state == AudioGraphNodeState::ERROR) {
     return -1;
   }
 
   spdlog::trace("FlacStreamDecoder::seekTo({})", absolutePosition);
-  seekSignal.sendValue(absolutePosition);
-  auto retVal = seekSignal.getResponse(decodingThread.get_stop_token());
+  auto retVal = seekRequests.post(absolutePosition).get();
   spdlog::trace("FlacStreamDecoder::seekTo({}) -> {}", absolutePosition,
                 retVal);
   return retVal;
@@ -5,10 +5,11 @@
 
 #include <FLAC++/decoder.h>
 #include <memory>
-#include <thread>
 #include <vector>
 
 #include "Buffer.h"
+#include "CommandQueue.h"
+#include "Metrics.h"
 #include "Utils.h"
 
 class FlacStreamDecoder : public AudioGraphOutputNode,
@@ -17,6 +18,10 @@ class FlacStreamDecoder : public AudioGraphOutputNode,
 public:
   FlacStreamDecoder(size_t bufferSize);
 
+  // The decoder can be connected to a new input after being disconnected.
+  // The buffer, the decoding thread and the libFLAC decoder instance are
+  // reused.
+
   virtual void
   connectTo(std::shared_ptr<AudioGraphOutputNode> inputNode) override;
   virtual void
@@ -31,6 +36,8 @@ public:
                                 size_t size) override;
 
   virtual size_t seekTo(size_t absolutePosition) override;
+  virtual void
+  getBufferLevels(std::vector<NodeBufferLevel> &levels) override;
 
   virtual ~FlacStreamDecoder();
 
@@ -58,7 +65,7 @@ protected:
   virtual bool eof_callback() override;
 
 private:
-  std::jthread decodingThread;
+  TrackWorker decodingThread{"FlacDecoder"};
 
   std::optional<FLAC__StreamMetadata_StreamInfo> flacStreamInfo;
   std::optional<size_t> sourceStreamLength;
@@ -68,15 +75,28 @@ private:
   Buffer<uint8_t> buffer;
   std::atomic<long> streamReadPosition = 0;
 
-  Signal<size_t> seekSignal;
+  CommandQueue<size_t> seekRequests{static_cast<size_t>(-1)};
 
   std::shared_ptr<AudioGraphOutputNode> inputNode;
 
+  RateMeter decodeRate;
+  MetricGroup metrics{"FlacStreamDecoder"};
+  Counter &bytesDecoded = metrics.counter("bytes_decoded");
+  Counter &seeks = metrics.counter("seeks");
+  LatencyHistogram &waitForSpaceNs = metrics.histogram("wait_for_space_ns");
+  LatencyHistogram &waitForDataNs = metrics.histogram("wait_for_data_ns");
+  Gauge &realtimeFactor = metrics.gauge("realtime_factor");
+  ThreadCpuMeter cpuMeter{metrics};
+  // Frames decoded since the CPU usage was last reported.
+  size_t framesDecoded = 0;
+
   void thread_run(std::stop_token token);
   void onEmptyBuffer(Buffer<uint8_t> &buffer);
   void throwOnFlacError(bool retval);
   void setStreamingState();
-  void handleSeekSignal(size_t position);
+  void handleSeekRequest(size_t position);
+  void resetStream();
+  void reportCpuUsage();
 };
 
 #endif
\ No newline at end of file
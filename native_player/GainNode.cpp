@@ -0,0 +1,232 @@
+#include "GainNode.h"
+#include "Log.h"
+
+#include <cmath>
+
+namespace {
+float dbToLinear(float gainDb, float peak) {
+  float gain = std::pow(10.0f, gainDb / 20.0f);
+  if (peak > 0.0f) {
+    gain = std::min(gain, 1.0f / peak);
+  }
+  return gain;
+}
+} // namespace
+
+GainNode::GainNode(std::chrono::milliseconds rampTime) : rampTime(rampTime) {
+  metrics.gauge("volume", [this]() { return volume.load(); });
+  metrics.gauge("replay_gain", [this]() { return replayGain.load(); });
+}
+
+GainNode::~GainNode() {
+  std::unique_lock lock(mutex);
+  auto input = inputNode;
+  auto id = stateCallbackId;
+  lock.unlock();
+  // The notifier may be running the callback, which takes the mutex.
+  if (input != nullptr) {
+    input->removeStateChangeCallback(id);
+  }
+}
+
+StreamState GainNode::getState() {
+  auto input = getInputNode();
+  if (input != nullptr) {
+    takeOverState(input.get(), input->getState());
+  }
+  return AudioGraphNode::getState();
+}
+
+void GainNode::connectTo(std::shared_ptr<AudioGraphOutputNode> inputNode) {
+  if (inputNode == nullptr) {
+    throw std::runtime_error("Input node cannot be nullptr");
+  }
+
+  std::unique_lock lock(mutex);
+  if (this->inputNode != nullptr) {
+    throw std::runtime_error("Input node is already connected");
+  }
+  this->inputNode = inputNode;
+  lock.unlock();
+  {
+    std::lock_guard stateLock(stateMutex);
+    inputStateTimestamp = 0;
+  }
+
+  auto id = inputNode->onStateChange(
+      [this, input = inputNode.get()](AudioGraphNode *, StreamState state)
+          -> bool {
+        takeOverState(input, state);
+        return true;
+      });
+
+  lock.lock();
+  stateCallbackId = id;
+}
+
+void GainNode::disconnect(std::shared_ptr<AudioGraphOutputNode> inputNode) {
+  std::unique_lock lock(mutex);
+  if (inputNode != this->inputNode) {
+    return;
+  }
+  this->inputNode = nullptr;
+  auto id = stateCallbackId;
+  stateCallbackId = -1;
+  lock.unlock();
+
+  inputNode->removeStateChangeCallback(id);
+  std::lock_guard stateLock(stateMutex);
+  setState(StreamState(AudioGraphNodeState::STOPPED));
+}
+
+std::shared_ptr<AudioGraphOutputNode> GainNode::getInputNode() {
+  std::lock_guard lock(mutex);
+  return inputNode;
+}
+
+size_t GainNode::read(void *data, size_t size) {
+  auto input = getInputNode();
+  if (input == nullptr) {
+    return 0;
+  }
+
+  auto bytesRead = input->read(data, size);
+  process(data, bytesRead);
+  return bytesRead;
+}
+
+size_t GainNode::waitForData(std::stop_token stopToken, size_t size) {
+  auto input = getInputNode();
+  if (input == nullptr) {
+    return 0;
+  }
+  return input->waitForData(stopToken, size);
+}
+
+size_t GainNode::waitForDataFor(std::stop_token stopToken,
+                                std::chrono::milliseconds timeout,
+                                size_t size) {
+  auto input = getInputNode();
+  if (input == nullptr) {
+    return 0;
+  }
+  return input->waitForDataFor(stopToken, timeout, size);
+}
+
+size_t GainNode::seekTo(size_t absolutePosition) {
+  auto input = getInputNode();
+  if (input == nullptr) {
+    return -1;
+  }
+  return input->seekTo(absolutePosition);
+}
+
+void GainNode::getBufferLevels(std::vector<NodeBufferLevel> &levels) {
+  auto input = getInputNode();
+  if (input != nullptr) {
+    input->getBufferLevels(levels);
+  }
+}
+
+void GainNode::acceptSourceChange() {
+  auto input = getInputNode();
+  if (input == nullptr) {
+    return;
+  }
+  input->acceptSourceChange();
+
+  std::lock_guard lock(mutex);
+  if (!replayGainQueue.empty()) {
+    replayGain = replayGainQueue.front();
+    replayGainQueue.pop_front();
+  }
+}
+
+void GainNode::setVolume(float volume) {
+  this->volume = std::clamp(volume, 0.0f, 1.0f);
+}
+
+float GainNode::getVolume() const { return volume; }
+
+void GainNode::setReplayGain(float gainDb, float peak) {
+  replayGain = dbToLinear(gainDb, peak);
+}
+
+void GainNode::queueReplayGain(float gainDb, float peak) {
+  std::lock_guard lock(mutex);
+  replayGainQueue.push_back(dbToLinear(gainDb, peak));
+}
+
+void GainNode::clearReplayGainQueue() {
+  std::lock_guard lock(mutex);
+  replayGainQueue.clear();
+}
+
+void GainNode::takeOverState(AudioGraphOutputNode *input,
+                             const StreamState &state) {
+  std::lock_guard stateLock(stateMutex);
+  if (input != getInputNode().get() || state.timestamp < inputStateTimestamp) {
+    return;
+  }
+  inputStateTimestamp = state.timestamp;
+  updateFormat(state);
+  setState(state);
+}
+
+void GainNode::updateFormat(const StreamState &state) {
+  if (!state.streamInfo.has_value() ||
+      state.streamInfo->streamType != StreamType::FRAMES) {
+    return;
+  }
+  std::lock_guard lock(formatMutex);
+  if (pendingFormat != state.streamInfo->format) {
+    pendingFormat = state.streamInfo->format;
+    formatChanged = true;
+  }
+}
+
+void GainNode::process(void *data, size_t size) {
+  if (formatChanged.load(std::memory_order_relaxed)) {
+    std::lock_guard lock(formatMutex);
+    format = pendingFormat;
+    formatChanged = false;
+  }
+
+  const size_t frameBytes = format.channels * sampleSize(format.sampleFormat);
+  if (frameBytes == 0) {
+    return;
+  }
+
+  const float gain = volume * replayGain;
+  if (gain != targetGain) {
+    targetGain = gain;
+    rampFramesLeft = rampTime.count() * format.sampleRate / 1000;
+    if (rampFramesLeft == 0) {
+      currentGain = targetGain;
+    } else {
+      gainStep = (targetGain - currentGain) / rampFramesLeft;
+    }
+  }
+
+  if (currentGain == 1.0f && rampFramesLeft == 0) {
+    return;
+  }
+
+  uint8_t *ptr = static_cast<uint8_t *>(data);
+  size_t frames = size / frameBytes;
+  if (rampFramesLeft > 0) {
+    const size_t rampFrames = std::min(frames, rampFramesLeft);
+    applyGain(ptr, format.sampleFormat, rampFrames, format.channels,
+              currentGain, gainStep, dither);
+    rampFramesLeft -= rampFrames;
+    currentGain =
+        rampFramesLeft == 0 ? targetGain : currentGain + gainStep * rampFrames;
+    ptr += rampFrames * frameBytes;
+    frames -= rampFrames;
+  }
+
+  if (frames > 0 && currentGain != 1.0f) {
+    applyGain(ptr, format.sampleFormat, frames, format.channels, currentGain,
+              0.0f, dither);
+  }
+}
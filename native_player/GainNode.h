@@ -0,0 +1,92 @@
+#ifndef GAIN_NODE_H
+#define GAIN_NODE_H
+
+#include "AudioGraphNode.h"
+#include "AudioSampleFormat.h"
+#include "Metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+
+// Applies the user volume and the ReplayGain of the current source to the
+// frames passing through. Gain changes are ramped to avoid clicks and the
+// result is dithered back to the bit depth of the stream. At unity gain the
+// data is passed through untouched.
+class GainNode : public AudioGraphOutputNode, public AudioGraphInputNode {
+public:
+  GainNode(std::chrono::milliseconds rampTime = std::chrono::milliseconds(20));
+  virtual ~GainNode();
+
+  // Takes over the state of the input before returning it, so the reader
+  // sees it without waiting for the notifier.
+  virtual StreamState getState() override;
+
+  virtual void
+  connectTo(std::shared_ptr<AudioGraphOutputNode> inputNode) override;
+  virtual void
+  disconnect(std::shared_ptr<AudioGraphOutputNode> inputNode) override;
+
+  virtual size_t read(void *data, size_t size) override;
+  virtual size_t waitForData(std::stop_token stopToken = std::stop_token(),
+                             size_t size = 1) override;
+  virtual size_t waitForDataFor(std::stop_token stopToken,
+                                std::chrono::milliseconds timeout,
+                                size_t size) override;
+  virtual size_t seekTo(size_t absolutePosition) override;
+  virtual void
+  getBufferLevels(std::vector<NodeBufferLevel> &levels) override;
+
+  virtual void acceptSourceChange() override;
+
+  // Linear volume in range [0, 1]. Takes effect with the next read.
+  void setVolume(float volume);
+  float getVolume() const;
+
+  // Applies the gain immediately. If peak is set, the gain is limited
+  // so that the peak doesn't clip.
+  void setReplayGain(float gainDb, float peak = 0.0f);
+
+  // Queues the gain for the next source, applied when the source change is
+  // accepted. Gains are applied in the order sources were connected
+  // to the upstream node.
+  void queueReplayGain(float gainDb, float peak = 0.0f);
+  void clearReplayGainQueue();
+
+private:
+  std::mutex mutex;
+  std::shared_ptr<AudioGraphOutputNode> inputNode = nullptr;
+  int stateCallbackId = -1;
+  std::deque<float> replayGainQueue;
+  // Serializes taking over the states of the input, which are pulled by
+  // the reader and delivered by the notifier. Recursive as setting the
+  // state may deliver the queued ones in synchronous mode.
+  std::recursive_mutex stateMutex;
+  // Timestamp of the last state taken over, older ones are dropped.
+  unsigned long long inputStateTimestamp = 0;
+  // Format of the input, taken over by the reader when formatChanged is set.
+  std::mutex formatMutex;
+  StreamAudioFormat pendingFormat;
+  std::atomic<bool> formatChanged = false;
+
+  std::atomic<float> volume = 1.0f;
+  std::atomic<float> replayGain = 1.0f;
+
+  // Only accessed from the reading thread
+  std::chrono::milliseconds rampTime;
+  StreamAudioFormat format;
+  DitherState dither;
+  float currentGain = 1.0f;
+  float targetGain = 1.0f;
+  float gainStep = 0.0f;
+  size_t rampFramesLeft = 0;
+
+  MetricGroup metrics{"GainNode"};
+
+  std::shared_ptr<AudioGraphOutputNode> getInputNode();
+  void takeOverState(AudioGraphOutputNode *input, const StreamState &state);
+  void updateFormat(const StreamState &state);
+  void process(void *data, size_t size);
+};
+
+#endif
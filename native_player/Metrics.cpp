@@ -0,0 +1,197 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include <sys/resource.h>
+
+namespace {
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+constexpr int64_t WINDOW_NS =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(RateMeter::WINDOW)
+        .count();
+} // namespace
+
+void RateMeter::add(uint64_t value) {
+  const auto now = nowNs();
+  auto start = windowStartNs.load(std::memory_order_relaxed);
+  if (start == 0 || now - start > 2 * WINDOW_NS) {
+    // First value or after a pause, start a new window.
+    windowValue = 0;
+    start = now;
+    windowStartNs.store(now, std::memory_order_relaxed);
+  }
+
+  windowValue += value;
+  if (now - start >= WINDOW_NS) {
+    rate.store(windowValue * 1e9 / (now - start), std::memory_order_relaxed);
+    windowValue = 0;
+    windowStartNs.store(now, std::memory_order_relaxed);
+  }
+}
+
+double RateMeter::perSecond() const {
+  const auto start = windowStartNs.load(std::memory_order_relaxed);
+  if (start == 0 || nowNs() - start > 2 * WINDOW_NS) {
+    return 0;
+  }
+  return rate.load(std::memory_order_relaxed);
+}
+
+ThreadCpuUsage ThreadCpuUsage::ofCurrentThread() {
+  ThreadCpuUsage usage;
+  timespec time{};
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0) {
+    usage.cpuTime = std::chrono::seconds(time.tv_sec) +
+                    std::chrono::nanoseconds(time.tv_nsec);
+  }
+  rusage resources{};
+  if (getrusage(RUSAGE_THREAD, &resources) == 0) {
+    usage.voluntarySwitches = resources.ru_nvcsw;
+    usage.involuntarySwitches = resources.ru_nivcsw;
+  }
+  return usage;
+}
+
+double
+ThreadCpuUsage::realtimeFactor(std::chrono::nanoseconds audioTime) const {
+  return cpuTime.count() > 0
+             ? static_cast<double>(audioTime.count()) / cpuTime.count()
+             : 0.0;
+}
+
+ThreadCpuUsage ThreadCpuUsage::operator-(const ThreadCpuUsage &other) const {
+  return {cpuTime - other.cpuTime,
+          voluntarySwitches - other.voluntarySwitches,
+          involuntarySwitches - other.involuntarySwitches};
+}
+
+ThreadCpuMeter::ThreadCpuMeter(MetricGroup &metrics)
+    : cpuTime(metrics.counter("cpu_time_ns")),
+      voluntarySwitches(metrics.counter("voluntary_switches")),
+      involuntarySwitches(metrics.counter("involuntary_switches")) {}
+
+void ThreadCpuMeter::start() {
+  lapStart = lastSample = ThreadCpuUsage::ofCurrentThread();
+  lastSampleTime = std::chrono::steady_clock::now();
+}
+
+void ThreadCpuMeter::sample(bool force) {
+  auto now = std::chrono::steady_clock::now();
+  if (!force && now - lastSampleTime < SAMPLE_INTERVAL) {
+    return;
+  }
+  auto usage = ThreadCpuUsage::ofCurrentThread();
+  auto delta = usage - lastSample;
+  cpuTime.add(delta.cpuTime.count());
+  voluntarySwitches.add(delta.voluntarySwitches);
+  involuntarySwitches.add(delta.involuntarySwitches);
+  lastSample = usage;
+  lastSampleTime = now;
+}
+
+ThreadCpuUsage ThreadCpuMeter::lap() {
+  sample(true);
+  auto usage = lastSample - lapStart;
+  lapStart = lastSample;
+  return usage;
+}
+
+MetricGroup::MetricGroup(std::string_view type) {
+  MetricsRegistry::getInstance().add(this, type);
+}
+
+MetricGroup::~MetricGroup() { MetricsRegistry::getInstance().remove(this); }
+
+Counter &MetricGroup::counter(std::string_view name) {
+  auto counter = std::make_unique<Counter>();
+  auto &ref = *counter;
+  std::lock_guard lock(mutex);
+  metrics.emplace_back(name, std::move(counter));
+  return ref;
+}
+
+Gauge &MetricGroup::gauge(std::string_view name) {
+  auto gauge = std::make_unique<Gauge>();
+  auto &ref = *gauge;
+  std::lock_guard lock(mutex);
+  metrics.emplace_back(name, std::move(gauge));
+  return ref;
+}
+
+LatencyHistogram &MetricGroup::histogram(std::string_view name) {
+  auto histogram = std::make_unique<LatencyHistogram>();
+  auto &ref = *histogram;
+  std::lock_guard lock(mutex);
+  metrics.emplace_back(name, std::move(histogram));
+  return ref;
+}
+
+void MetricGroup::gauge(std::string_view name, std::function<double()> read) {
+  std::lock_guard lock(mutex);
+  metrics.emplace_back(name, std::move(read));
+}
+
+void MetricGroup::collect(std::vector<MetricSample> &samples) const {
+  std::lock_guard lock(mutex);
+  for (const auto &[metricName, metric] : metrics) {
+    MetricSample sample{.group = name, .name = metricName};
+    if (auto *counter = std::get_if<std::unique_ptr<Counter>>(&metric)) {
+      sample.type = MetricType::COUNTER;
+      sample.value = (*counter)->get();
+    } else if (auto *gauge = std::get_if<std::unique_ptr<Gauge>>(&metric)) {
+      sample.type = MetricType::GAUGE;
+      sample.value = (*gauge)->get();
+    } else if (auto *histogram =
+                   std::get_if<std::unique_ptr<LatencyHistogram>>(&metric)) {
+      sample.type = MetricType::HISTOGRAM;
+      sample.value = (*histogram)->count();
+      sample.mean = (*histogram)->mean();
+      sample.p50 = (*histogram)->percentile(50);
+      sample.p99 = (*histogram)->percentile(99);
+      sample.max = (*histogram)->max();
+    } else {
+      sample.type = MetricType::GAUGE;
+      sample.value = std::get<std::function<double()>>(metric)();
+    }
+    samples.push_back(std::move(sample));
+  }
+}
+
+MetricsRegistry &MetricsRegistry::getInstance() {
+  // Never destroyed, so that nodes outliving the static destructors can
+  // still unregister.
+  static auto *instance = new MetricsRegistry();
+  return *instance;
+}
+
+std::vector<MetricSample> MetricsRegistry::snapshot() {
+  std::vector<MetricSample> samples;
+  std::lock_guard lock(mutex);
+  auto sortedGroups = groups;
+  std::sort(sortedGroups.begin(), sortedGroups.end(),
+            [](const MetricGroup *a, const MetricGroup *b) {
+              return a->getName() < b->getName();
+            });
+  for (const auto *group : sortedGroups) {
+    group->collect(samples);
+  }
+  return samples;
+}
+
+void MetricsRegistry::add(MetricGroup *group, std::string_view type) {
+  std::lock_guard lock(mutex);
+  auto &count = instanceCounts[std::string(type)];
+  group->name = std::string(type) + "#" + std::to_string(count++);
+  groups.push_back(group);
+}
+
+void MetricsRegistry::remove(MetricGroup *group) {
+  std::lock_guard lock(mutex);
+  std::erase(groups, group);
+}
@@ -0,0 +1,188 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "PerfMon.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Metrics of the audio graph nodes. Each node owns a MetricGroup, which is
+// registered in the MetricsRegistry for the lifetime of the node.
+// Updating a metric is a relaxed atomic operation, cheap enough for the
+// audio thread.
+// The group is to be declared after the members read by its gauges, so
+// that it is unregistered before they are destroyed.
+
+class Counter {
+public:
+  void add(uint64_t value = 1) {
+    count.fetch_add(value, std::memory_order_relaxed);
+  }
+  uint64_t get() const { return count.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> count = 0;
+};
+
+class Gauge {
+public:
+  void set(double newValue) {
+    value.store(newValue, std::memory_order_relaxed);
+  }
+  double get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> value = 0;
+};
+
+// Per second rate of the values added, measured over windows of about
+// a second. Has a single writer, can be read from any thread.
+class RateMeter {
+public:
+  static constexpr std::chrono::milliseconds WINDOW{1000};
+
+  void add(uint64_t value);
+  // Returns 0 if nothing has been added for a while.
+  double perSecond() const;
+
+private:
+  uint64_t windowValue = 0;
+  std::atomic<int64_t> windowStartNs = 0;
+  std::atomic<double> rate = 0;
+};
+
+// Records the time spent in a scope, in nanoseconds.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(LatencyHistogram &histogram)
+      : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+  }
+
+private:
+  LatencyHistogram &histogram;
+  std::chrono::steady_clock::time_point start;
+};
+
+// CPU time and context switches of a thread.
+struct ThreadCpuUsage {
+  std::chrono::nanoseconds cpuTime{0};
+  long voluntarySwitches = 0;
+  long involuntarySwitches = 0;
+
+  // Usage of the calling thread since it started.
+  static ThreadCpuUsage ofCurrentThread();
+
+  // Seconds of audio processed per second of CPU time.
+  double realtimeFactor(std::chrono::nanoseconds audioTime) const;
+
+  ThreadCpuUsage operator-(const ThreadCpuUsage &other) const;
+};
+
+enum class MetricType { COUNTER, GAUGE, HISTOGRAM };
+
+struct MetricSample {
+  // Name of the group, e.g. "FlacStreamDecoder#0".
+  std::string group;
+  std::string name;
+  MetricType type;
+  // Value of a counter or a gauge, number of values of a histogram.
+  double value = 0;
+  // Histograms only.
+  double mean = 0;
+  uint64_t p50 = 0;
+  uint64_t p99 = 0;
+  uint64_t max = 0;
+};
+
+class MetricGroup {
+public:
+  // Instances of the same type are told apart by a number appended to
+  // the name.
+  explicit MetricGroup(std::string_view type);
+  ~MetricGroup();
+  MetricGroup(const MetricGroup &) = delete;
+  MetricGroup &operator=(const MetricGroup &) = delete;
+
+  // The returned references stay valid for the lifetime of the group.
+  Counter &counter(std::string_view name);
+  Gauge &gauge(std::string_view name);
+  // Histograms have a single writer.
+  LatencyHistogram &histogram(std::string_view name);
+  // Gauge evaluated when the metrics are read, from the reading thread.
+  void gauge(std::string_view name, std::function<double()> read);
+
+  const std::string &getName() const { return name; }
+  void collect(std::vector<MetricSample> &samples) const;
+
+private:
+  friend class MetricsRegistry;
+
+  using Metric =
+      std::variant<std::unique_ptr<Counter>, std::unique_ptr<Gauge>,
+                   std::unique_ptr<LatencyHistogram>, std::function<double()>>;
+
+  std::string name;
+  mutable std::mutex mutex;
+  std::vector<std::pair<std::string, Metric>> metrics;
+};
+
+// Accounts the CPU usage of the thread running a node into the
+// cpu_time_ns, voluntary_switches and involuntary_switches counters of its
+// group. Only to be used from the measured thread.
+class ThreadCpuMeter {
+public:
+  static constexpr std::chrono::milliseconds SAMPLE_INTERVAL{1000};
+
+  explicit ThreadCpuMeter(MetricGroup &metrics);
+
+  // Starts measuring the calling thread.
+  void start();
+  // Updates the counters, at most once per SAMPLE_INTERVAL unless forced.
+  void sample(bool force = false);
+  // Returns the usage since start() or the previous lap.
+  ThreadCpuUsage lap();
+
+private:
+  Counter &cpuTime;
+  Counter &voluntarySwitches;
+  Counter &involuntarySwitches;
+
+  ThreadCpuUsage lapStart;
+  ThreadCpuUsage lastSample;
+  std::chrono::steady_clock::time_point lastSampleTime;
+};
+
+class MetricsRegistry {
+public:
+  static MetricsRegistry &getInstance();
+
+  // Metrics of all the groups, ordered by group.
+  std::vector<MetricSample> snapshot();
+
+private:
+  friend class MetricGroup;
+
+  std::mutex mutex;
+  std::vector<MetricGroup *> groups;
+  std::unordered_map<std::string, unsigned> instanceCounts;
+
+  void add(MetricGroup *group, std::string_view type);
+  void remove(MetricGroup *group);
+
+  MetricsRegistry() = default;
+};
+
+#endif
@@ -0,0 +1,350 @@
+#include "NullAudioEmitter.h"
+#include "Log.h"
+#include "PerfMon.h"
+#include "StateMonitor.h"
+
+#include <pthread.h>
+#include <stdexcept>
+
+NullAudioEmitter::NullAudioEmitter(bool realtime,
+                                   std::chrono::milliseconds periodTime)
+    : realtime(realtime), periodTime(periodTime) {
+  if (periodTime.count() <= 0) {
+    throw std::runtime_error("Period time must be positive");
+  }
+}
+
+NullAudioEmitter::~NullAudioEmitter() { stop(); }
+
+void NullAudioEmitter::connectTo(
+    std::shared_ptr<AudioGraphOutputNode> outputNode) {
+  if (outputNode == nullptr) {
+    throw std::runtime_error("Input node cannot be nullptr");
+  }
+  if (inputNode == outputNode) {
+    return;
+  }
+
+  if (inputNode != nullptr) {
+    throw std::runtime_error("NullAudioEmitter is already connected to an "
+                             "AudioGraphOutputNode node");
+  }
+
+  inputNode = outputNode;
+  start();
+}
+
+void NullAudioEmitter::disconnect(
+    std::shared_ptr<AudioGraphOutputNode> outputNode) {
+  if (inputNode == outputNode) {
+    stop();
+    inputNode = nullptr;
+  }
+}
+
+std::future<bool> NullAudioEmitter::pause(bool paused) {
+  return pauseRequests.post(paused);
+}
+
+std::future<size_t> NullAudioEmitter::seek(size_t positionMs) {
+  return seekRequests.post(positionMs);
+}
+
+NullEmitterStats NullAudioEmitter::getStats() {
+  std::lock_guard lock(statsMutex);
+  return stats;
+}
+
+void NullAudioEmitter::start() {
+  if (playbackThread.joinable()) {
+    playbackThread.request_stop();
+    playbackThread.join();
+  }
+  connectTime = Clock::now();
+  playbackThread =
+      std::jthread(std::bind_front(&NullAudioEmitter::workerThread, this));
+}
+
+void NullAudioEmitter::stop() {
+  if (playbackThread.joinable()) {
+    playbackThread.request_stop();
+    playbackThread.join();
+    playbackThread = std::jthread();
+    setState(StreamState(AudioGraphNodeState::STOPPED));
+  }
+}
+
+void NullAudioEmitter::workerThread(std::stop_token token) {
+  pthread_setname_np(pthread_self(), "NullAudio");
+  seekRequests.open();
+  pauseRequests.open();
+  try {
+    while (!token.stop_requested()) {
+      auto inputNodeState = waitForInputToBeReady(token);
+      if (token.stop_requested()) {
+        break;
+      }
+
+      auto streamInfo = inputNodeState.streamInfo;
+      if (!streamInfo.has_value()) {
+        throw std::runtime_error("No stream information available");
+      }
+      if (streamInfo.value().streamType != StreamType::FRAMES) {
+        throw std::runtime_error("Unsupported stream type");
+      }
+
+      currentStreamAudioFormat = streamInfo.value().format;
+      if (seekHappened) {
+        currentSourceTotalFramesRead = inputNodeState.position;
+        seekHappened = false;
+      }
+      paused = false;
+      setState({AudioGraphNodeState::STREAMING,
+                framesToTimeMs(currentSourceTotalFramesRead).count(),
+                streamInfo});
+      readStream(token, streamInfo.value());
+    }
+  } catch (const std::exception &ex) {
+    spdlog::error("Error in NullAudioEmitter::workerThread: {}", ex.what());
+    setState({AudioGraphNodeState::ERROR,
+              "Internal error: " + std::string(ex.what())});
+  }
+
+  try {
+    endStream();
+  } catch (const std::exception &ex) {
+    spdlog::error("Error in NullAudioEmitter::workerThread: {}", ex.what());
+  }
+
+  playbackClock.reset();
+  seekRequests.close();
+  pauseRequests.close();
+}
+
+StreamState NullAudioEmitter::waitForInputToBeReady(std::stop_token token) {
+  StreamState inputNodeState = inputNode->getState();
+  while (!token.stop_requested()) {
+    switch (inputNodeState.state) {
+    case AudioGraphNodeState::PREPARING:
+      setState(StreamState(AudioGraphNodeState::PREPARING));
+      break;
+    case AudioGraphNodeState::STREAMING:
+      return inputNodeState;
+    case AudioGraphNodeState::FINISHED:
+      setState(
+          StreamState(AudioGraphNodeState::FINISHED,
+                      framesToTimeMs(currentSourceTotalFramesRead).count()));
+      break;
+    case AudioGraphNodeState::ERROR:
+      setState({AudioGraphNodeState::ERROR, inputNodeState.message});
+      break;
+    case AudioGraphNodeState::SOURCE_CHANGED:
+      setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+      sourceEndTime = lastFrameTime;
+      inputNode->acceptSourceChange();
+      currentSourceTotalFramesRead = 0;
+      publishPosition(false, Clock::now());
+      break;
+    default:
+      setState(StreamState(AudioGraphNodeState::STOPPED));
+      break;
+    }
+    if (auto positionMs = seekRequests.take()) {
+      handleSeekRequest(*positionMs);
+    }
+
+    if (pauseRequests.take()) {
+      pauseRequests.respond(false);
+    }
+
+    auto combinedToken = combineStopTokens(
+        token, seekRequests.getStopToken(), pauseRequests.getStopToken());
+    StateChangeWaitLock lock(combinedToken.get_token(), *inputNode,
+                             inputNodeState.timestamp);
+    inputNodeState = lock.state();
+  };
+
+  return inputNodeState;
+}
+
+void NullAudioEmitter::readStream(std::stop_token token,
+                                  StreamInfo streamInfo) {
+  const auto format = streamInfo.format;
+  const size_t frameBytes = format.channels * sampleSize(format.sampleFormat);
+  if (frameBytes == 0 || format.sampleRate == 0) {
+    throw std::runtime_error("Unsupported audio format: " + format.toString());
+  }
+  const size_t periodFrames =
+      std::max<size_t>(1, format.sampleRate * periodTime.count() / 1000);
+  periodBuffer.resize(periodFrames * frameBytes);
+  beginStream(format);
+
+  // Time at which the simulated device plays out the frames read so far.
+  std::optional<Clock::time_point> playedUntil;
+
+  while (!token.stop_requested()) {
+    if (auto pauseRequest = pauseRequests.take()) {
+      handlePauseRequest(*pauseRequest, streamInfo);
+      playedUntil.reset();
+    }
+
+    if (auto positionMs = seekRequests.take()) {
+      setState(StreamState(AudioGraphNodeState::PREPARING));
+      if (handleSeekRequest(*positionMs)) {
+        return;
+      }
+    }
+
+    auto combinedToken = combineStopTokens(
+        token, seekRequests.getStopToken(), pauseRequests.getStopToken());
+    if (paused) {
+      std::unique_lock lock(pauseMutex);
+      pauseCondition.wait(lock, combinedToken.get_token(),
+                          []() { return false; });
+      continue;
+    }
+
+    inputNode->waitForData(combinedToken.get_token(), frameBytes);
+    perfmon_begin("nullEmitterRead");
+    const size_t framesRead =
+        inputNode->read(periodBuffer.data(), periodBuffer.size()) / frameBytes;
+    perfmon_end("nullEmitterRead");
+    const auto now = Clock::now();
+    if (framesRead > 0) {
+      onFramesRead(framesRead, now);
+      consumeFrames(periodBuffer.data(), framesRead * frameBytes);
+      if (!realtime) {
+        publishPosition(false, now);
+      }
+    }
+
+    auto inputNodeState = inputNode->getState();
+    if (inputNodeState.state == AudioGraphNodeState::SOURCE_CHANGED) {
+      sourceEndTime = lastFrameTime;
+      inputNode->acceptSourceChange();
+      inputNodeState = inputNode->getState();
+      currentSourceTotalFramesRead = 0;
+      if (inputNodeState.state != AudioGraphNodeState::STREAMING ||
+          !inputNodeState.streamInfo.has_value() ||
+          inputNodeState.streamInfo.value().format != format) {
+        publishPosition(false, Clock::now());
+        setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+        return;
+      }
+      // A crossfading switcher hands over a source which has already been
+      // partially read.
+      currentSourceTotalFramesRead = inputNodeState.position;
+      streamInfo = inputNodeState.streamInfo.value();
+      setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+      setState({AudioGraphNodeState::STREAMING,
+                framesToTimeMs(currentSourceTotalFramesRead).count(),
+                streamInfo});
+    } else if (inputNodeState.state == AudioGraphNodeState::FINISHED ||
+               inputNodeState.state == AudioGraphNodeState::ERROR) {
+      publishPosition(false, now);
+      endStream();
+      return;
+    }
+
+    if (realtime && framesRead > 0) {
+      auto start = playedUntil.value_or(now);
+      if (now > start) {
+        // The simulated device ran empty before the input had data.
+        underruns.add();
+        std::lock_guard lock(statsMutex);
+        ++stats.underruns;
+        start = now;
+      }
+      playedUntil = start + std::chrono::nanoseconds(
+                                framesRead * 1'000'000'000ull /
+                                format.sampleRate);
+      publishPosition(true, *playedUntil);
+      // Keep one period buffered, as a device would.
+      std::this_thread::sleep_until(*playedUntil - periodTime);
+    }
+  }
+}
+
+bool NullAudioEmitter::handleSeekRequest(size_t positionMs) {
+  perfmon_event("seek", positionMs);
+  seekTime = Clock::now();
+  auto seekValue = positionMs * currentStreamAudioFormat.sampleRate / 1000;
+  auto retVal = inputNode->seekTo(seekValue);
+  if (retVal == -1U) {
+    spdlog::warn("Seek request failed: requested={}", seekValue);
+    seekTime.reset();
+    seekRequests.respond(-1);
+    return false;
+  }
+  seekRequests.respond(framesToTimeMs(retVal).count());
+  seekHappened = true;
+  playbackClock.publish(
+      {.frames = static_cast<int64_t>(retVal),
+       .sampleRate = currentStreamAudioFormat.sampleRate,
+       .timestamp = static_cast<unsigned long long>(getTimestampNs()),
+       .running = false},
+      retVal);
+  return true;
+}
+
+void NullAudioEmitter::handlePauseRequest(bool paused,
+                                          const StreamInfo &streamInfo) {
+  this->paused = paused;
+  publishPosition(false, Clock::now());
+  setState({paused ? AudioGraphNodeState::PAUSED
+                   : AudioGraphNodeState::STREAMING,
+            framesToTimeMs(currentSourceTotalFramesRead).count(), streamInfo});
+  pauseRequests.respond(paused);
+}
+
+void NullAudioEmitter::onFramesRead(size_t frames, Clock::time_point now) {
+  framesWritten.add(frames);
+  currentSourceTotalFramesRead += frames;
+
+  std::lock_guard lock(statsMutex);
+  stats.frames += frames;
+  if (connectTime.has_value()) {
+    stats.timeToFirstFrame = now - *connectTime;
+    connectTime.reset();
+  }
+  if (seekTime.has_value()) {
+    auto latency = now - *seekTime;
+    stats.seekLatencies.push_back(latency);
+    seekLatencyNs.record(latency.count());
+    seekTime.reset();
+  }
+  if (sourceEndTime.has_value()) {
+    auto gap = now - *sourceEndTime;
+    stats.switchGaps.push_back(gap);
+    switchGapNs.record(gap.count());
+    sourceEndTime.reset();
+  }
+  if (!firstFrameTime.has_value()) {
+    firstFrameTime = now;
+  }
+  lastFrameTime = now;
+  stats.streamingTime = now - *firstFrameTime;
+}
+
+void NullAudioEmitter::publishPosition(bool running,
+                                       Clock::time_point playedAt) {
+  const auto frames = static_cast<int64_t>(currentSourceTotalFramesRead);
+  playbackClock.publish(
+      {.frames = frames,
+       .sampleRate = currentStreamAudioFormat.sampleRate,
+       .timestamp = static_cast<unsigned long long>(
+           std::chrono::duration_cast<std::chrono::nanoseconds>(
+               playedAt.time_since_epoch())
+               .count()),
+       .running = running},
+      frames);
+}
+
+std::chrono::milliseconds
+NullAudioEmitter::framesToTimeMs(size_t frames) const {
+  if (currentStreamAudioFormat.sampleRate == 0) {
+    return std::chrono::milliseconds(0);
+  }
+  return std::chrono::milliseconds(1000 * frames /
+                                   currentStreamAudioFormat.sampleRate);
+}
@@ -0,0 +1,121 @@
+#ifndef NULL_AUDIO_EMITTER_H
+#define NULL_AUDIO_EMITTER_H
+
+#include "AudioGraphNode.h"
+#include "CommandQueue.h"
+#include "Metrics.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+struct NullEmitterStats {
+  uint64_t frames = 0;
+  // Time between the first and the last frame read.
+  std::chrono::nanoseconds streamingTime{0};
+  // From connectTo() to the first frame read.
+  std::optional<std::chrono::nanoseconds> timeToFirstFrame;
+  // From the last frame of a source to the first frame of the next one.
+  std::vector<std::chrono::nanoseconds> switchGaps;
+  // From the seek request to the first frame read at the new position.
+  std::vector<std::chrono::nanoseconds> seekLatencies;
+  // Periods for which the input had no data in time, realtime mode only.
+  uint64_t underruns = 0;
+};
+
+// Emitter which reads the stream and discards it, so the graph can be run
+// and measured without a sound card. Frames are read in periods of
+// periodTime, either as fast as the input provides them or, in realtime
+// mode, paced at the sample rate of the stream.
+class NullAudioEmitter : public AudioGraphEmitterNode {
+public:
+  explicit NullAudioEmitter(
+      bool realtime = false,
+      std::chrono::milliseconds periodTime = std::chrono::milliseconds(20));
+
+  virtual void
+  connectTo(std::shared_ptr<AudioGraphOutputNode> outputNode) override;
+  virtual void
+  disconnect(std::shared_ptr<AudioGraphOutputNode> outputNode) override;
+
+  virtual std::future<bool> pause(bool paused) override;
+  virtual std::future<size_t> seek(size_t positionMs) override;
+  virtual PlaybackPosition getPosition() const override {
+    return playbackClock.get();
+  }
+
+  NullEmitterStats getStats();
+
+  virtual ~NullAudioEmitter();
+
+protected:
+  // Hooks for emitters consuming the frames, called from the worker
+  // thread. A derived class has to call stop() in its destructor.
+
+  // Called before the frames of a stream are read, also after a seek or
+  // a source change.
+  virtual void beginStream(const StreamAudioFormat &format) {}
+  virtual void consumeFrames(const uint8_t *data, size_t bytes) {}
+  // Called when the input has finished or failed and when the worker
+  // stops.
+  virtual void endStream() {}
+
+  void stop();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  bool realtime;
+  std::chrono::milliseconds periodTime;
+
+  std::shared_ptr<AudioGraphOutputNode> inputNode;
+  std::jthread playbackThread;
+
+  StreamAudioFormat currentStreamAudioFormat;
+  size_t currentSourceTotalFramesRead = 0;
+  PlaybackClock playbackClock;
+  std::vector<uint8_t> periodBuffer;
+
+  CommandQueue<size_t> seekRequests{static_cast<size_t>(-1)};
+  CommandQueue<bool> pauseRequests{false};
+  std::mutex pauseMutex;
+  std::condition_variable_any pauseCondition;
+  bool paused = false;
+  bool seekHappened = false;
+
+  // Start of the measurement of the next first frame, if any.
+  std::optional<Clock::time_point> connectTime;
+  std::optional<Clock::time_point> seekTime;
+  std::optional<Clock::time_point> sourceEndTime;
+  std::optional<Clock::time_point> firstFrameTime;
+  std::optional<Clock::time_point> lastFrameTime;
+
+  std::mutex statsMutex;
+  NullEmitterStats stats;
+
+  MetricGroup metrics{"NullAudioEmitter"};
+  Counter &framesWritten = metrics.counter("frames_written");
+  Counter &underruns = metrics.counter("underruns");
+  LatencyHistogram &switchGapNs = metrics.histogram("switch_gap_ns");
+  LatencyHistogram &seekLatencyNs = metrics.histogram("seek_latency_ns");
+
+  void workerThread(std::stop_token token);
+  StreamState waitForInputToBeReady(std::stop_token token);
+  void readStream(std::stop_token token, StreamInfo streamInfo);
+  bool handleSeekRequest(size_t positionMs);
+  void handlePauseRequest(bool paused, const StreamInfo &streamInfo);
+  void onFramesRead(size_t frames, Clock::time_point now);
+  // The frames read so far are played at the given time.
+  void publishPosition(bool running, Clock::time_point playedAt);
+
+  std::chrono::milliseconds framesToTimeMs(size_t frames) const;
+
+  void start();
+};
+
+#endif
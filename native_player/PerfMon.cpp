@@ -1,54 +1,468 @@
-#ifdef PROFILE
 #include "PerfMon.h"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <numeric>
+
+#include <pthread.h>
+#include <unistd.h>
+
+namespace {
+void increment(std::atomic<uint64_t> &counter, uint64_t value = 1) {
+  // Single writer, a plain load and store is enough and avoids the cost
+  // of a locked instruction.
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+double toUs(uint64_t ns) { return ns / 1000.0; }
+
+uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string escapeJson(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    if (static_cast<unsigned char>(c) >= 0x20) {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Time the trace keeps being recorded after a dump request, so that the
+// recovery from an xrun is visible too.
+const std::chrono::milliseconds TRACE_DUMP_DELAY(200);
+} // namespace
+
+size_t LatencyHistogram::bucketIndex(uint64_t valueNs) {
+  if (valueNs < SUB_BUCKETS) {
+    return valueNs;
+  }
+  const int exponent = 63 - std::countl_zero(valueNs);
+  const uint64_t subBucket =
+      (valueNs >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketHighestValue(size_t index) {
+  if (index < SUB_BUCKETS) {
+    return index;
+  }
+  const int shift = index / SUB_BUCKETS - 1;
+  const uint64_t subBucket = index % SUB_BUCKETS;
+  const uint64_t lowest = (SUB_BUCKETS + subBucket) << shift;
+  return lowest + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t valueNs) {
+  increment(buckets[bucketIndex(valueNs)]);
+  increment(totalCount);
+  increment(sumNs, valueNs);
+  if (valueNs > maxNs.load(std::memory_order_relaxed)) {
+    maxNs.store(valueNs, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    auto value = other.buckets[i].load(std::memory_order_relaxed);
+    if (value != 0) {
+      increment(buckets[i], value);
+    }
+  }
+  increment(totalCount, other.count());
+  increment(sumNs, other.sumNs.load(std::memory_order_relaxed));
+  maxNs.store(std::max(max(), other.max()), std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+  for (auto &bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  totalCount.store(0, std::memory_order_relaxed);
+  sumNs.store(0, std::memory_order_relaxed);
+  maxNs.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const {
+  auto n = count();
+  return n == 0 ? 0.0
+                : static_cast<double>(sumNs.load(std::memory_order_relaxed)) /
+                      n;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+  uint64_t total = 0;
+  for (const auto &bucket : buckets) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  const uint64_t target = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * total)));
+  uint64_t accumulated = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    accumulated += buckets[i].load(std::memory_order_relaxed);
+    if (accumulated >= target) {
+      return std::min(bucketHighestValue(i), max());
+    }
+  }
+  return max();
+}
+
+TraceBuffer::TraceBuffer(size_t capacity)
+    : slots(std::max<size_t>(capacity, 1)) {}
+
+void TraceBuffer::record(Phase phase, uint32_t markId, uint32_t threadId,
+                         int64_t value) {
+  const auto timestamp = nowNs();
+  const auto index = writeIndex.fetch_add(1, std::memory_order_relaxed);
+  auto &slot = slots[index % slots.size()];
+
+  // A writer which has been lapped must not overwrite a newer event, nor
+  // wait for the slot to be written by another one.
+  auto sequence = slot.sequence.load(std::memory_order_relaxed);
+  if (sequence == WRITING || sequence > index ||
+      !slot.sequence.compare_exchange_strong(sequence, WRITING,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.timestampNs.store(timestamp, std::memory_order_relaxed);
+  slot.ids.store((static_cast<uint64_t>(markId) << 32) | threadId,
+                 std::memory_order_relaxed);
+  slot.value.store(value, std::memory_order_relaxed);
+  slot.phase.store(static_cast<uint8_t>(phase), std::memory_order_relaxed);
+  slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+std::vector<TraceBuffer::Event> TraceBuffer::snapshot() const {
+  std::vector<Event> events;
+  const uint64_t end = writeIndex.load(std::memory_order_acquire);
+  const uint64_t begin = end > slots.size() ? end - slots.size() : 0;
+  events.reserve(end - begin);
+
+  for (uint64_t index = begin; index < end; ++index) {
+    const auto &slot = slots[index % slots.size()];
+    if (slot.sequence.load(std::memory_order_acquire) != index + 1) {
+      continue;
+    }
+    const auto ids = slot.ids.load(std::memory_order_relaxed);
+    Event event{
+        .timestampNs = slot.timestampNs.load(std::memory_order_relaxed),
+        .markId = static_cast<uint32_t>(ids >> 32),
+        .threadId = static_cast<uint32_t>(ids),
+        .phase = static_cast<Phase>(slot.phase.load(std::memory_order_relaxed)),
+        .value = slot.value.load(std::memory_order_relaxed)};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != index + 1) {
+      continue;
+    }
+    events.push_back(event);
+  }
+  return events;
+}
+
+struct ThreadMarksHolder {
+  std::unique_ptr<PerfMon::ThreadMarks> marks;
+
+  ~ThreadMarksHolder() {
+    if (marks) {
+      PerfMon::getInstance().unregisterThread(marks.get());
+    }
+  }
+};
+
+PerfMon::ThreadMarks::~ThreadMarks() {
+  for (auto &histogram : histograms) {
+    delete histogram.load(std::memory_order_relaxed);
+  }
+}
+
+LatencyHistogram &PerfMon::ThreadMarks::histogram(MarkId id) {
+  auto *histogram = histograms[id].load(std::memory_order_relaxed);
+  if (histogram == nullptr) {
+    histogram = new LatencyHistogram();
+    histograms[id].store(histogram, std::memory_order_release);
+  }
+  return *histogram;
+}
 
 PerfMon::PerfMon() {}
 
-void PerfMon::begin(const std::string &mark) {
-  auto &perfMark = marks[mark];
-  if (perfMark.open) {
+PerfMon::MarkId PerfMon::markId(std::string_view mark) {
+  std::lock_guard lock(mutex);
+  auto it = markIds.find(std::string(mark));
+  if (it != markIds.end()) {
+    return it->second;
+  }
+  if (markNames.size() >= MAX_MARKS) {
+    std::cerr << "PerfMon: too many marks, ignoring " << mark << std::endl;
+    return MAX_MARKS;
+  }
+  MarkId id = markNames.size();
+  markNames.emplace_back(mark);
+  markIds.emplace(mark, id);
+  return id;
+}
+
+PerfMon::ThreadMarks *PerfMon::threadMarks() {
+  thread_local ThreadMarksHolder holder;
+  if (!holder.marks) {
+    holder.marks = std::make_unique<ThreadMarks>();
+    holder.marks->threadId = static_cast<uint32_t>(gettid());
+    registerThread(holder.marks.get());
+  }
+  return holder.marks.get();
+}
+
+void PerfMon::registerThread(ThreadMarks *marks) {
+  char name[16] = {};
+  pthread_getname_np(pthread_self(), name, sizeof(name));
+
+  std::lock_guard lock(mutex);
+  threads.push_back(marks);
+  threadNames[marks->threadId] = name;
+}
+
+void PerfMon::unregisterThread(ThreadMarks *marks) {
+  std::lock_guard lock(mutex);
+  for (MarkId id = 0; id < MAX_MARKS; ++id) {
+    auto *histogram = marks->histograms[id].load(std::memory_order_acquire);
+    if (histogram != nullptr) {
+      if (!retired[id]) {
+        retired[id] = std::make_unique<LatencyHistogram>();
+      }
+      retired[id]->merge(*histogram);
+    }
+  }
+  std::erase(threads, marks);
+}
+
+void PerfMon::begin(MarkId id) {
+  if (id >= MAX_MARKS) {
     return;
   }
+  // A mark left open by toggling the profiling off is simply restarted.
+  auto *marks = threadMarks();
+  auto &openMark = marks->openMarks[id];
+  openMark.open = true;
+  openMark.start = std::chrono::steady_clock::now();
+
+  if (isTracing()) {
+    if (auto *buffer = traceBuffer.load(std::memory_order_acquire)) {
+      buffer->record(TraceBuffer::Phase::BEGIN, id, marks->threadId, 0);
+    }
+  }
+}
+
+void PerfMon::end(MarkId id) {
+  auto now = std::chrono::steady_clock::now();
+  if (id >= MAX_MARKS) {
+    return;
+  }
+  auto *marks = threadMarks();
+  if (isTracing()) {
+    if (auto *buffer = traceBuffer.load(std::memory_order_acquire)) {
+      buffer->record(TraceBuffer::Phase::END, id, marks->threadId, 0);
+    }
+  }
+
+  auto &openMark = marks->openMarks[id];
+  if (!openMark.open) {
+    return;
+  }
+
+  openMark.open = false;
+  auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      now - openMark.start)
+                      .count();
+  marks->histogram(id).record(duration);
+}
+
+void PerfMon::event(MarkId id, int64_t value) {
+  auto *buffer = traceBuffer.load(std::memory_order_acquire);
+  if (id >= MAX_MARKS || buffer == nullptr) {
+    return;
+  }
+  buffer->record(TraceBuffer::Phase::INSTANT, id, threadMarks()->threadId,
+                 value);
+}
+
+void PerfMon::setTracing(bool enabled, size_t bufferEvents) {
+  if (enabled && traceBuffer.load(std::memory_order_acquire) == nullptr) {
+    std::lock_guard lock(mutex);
+    if (traceBuffer.load(std::memory_order_relaxed) == nullptr) {
+      traceBuffer.store(new TraceBuffer(bufferEvents),
+                        std::memory_order_release);
+    }
+  }
+  tracingFlag.store(enabled, std::memory_order_relaxed);
+}
+
+bool PerfMon::dumpTrace(const std::string &path) {
+  auto *buffer = traceBuffer.load(std::memory_order_acquire);
+  if (buffer == nullptr) {
+    return false;
+  }
+  auto events = buffer->snapshot();
+  if (events.empty()) {
+    return false;
+  }
+
+  std::vector<std::string> names;
+  std::unordered_map<uint32_t, std::string> threadNamesCopy;
+  {
+    std::lock_guard lock(mutex);
+    names = markNames;
+    threadNamesCopy = threadNames;
+  }
+
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
 
-  perfMark.open = true;
-  perfMark.point = std::chrono::high_resolution_clock::now();
+  const auto pid = getpid();
+  bool first = true;
+  auto separator = [&out, &first]() {
+    if (!first) {
+      out << ",\n";
+    }
+    first = false;
+  };
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  for (const auto &[threadId, name] : threadNamesCopy) {
+    separator();
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":" << threadId << ",\"args\":{\"name\":\""
+        << escapeJson(name) << "\"}}";
+  }
+  out << std::fixed << std::setprecision(3);
+  for (const auto &event : events) {
+    separator();
+    const auto &name =
+        event.markId < names.size() ? names[event.markId] : "unknown";
+    out << "{\"name\":\"" << escapeJson(name) << "\",\"ph\":\""
+        << static_cast<char>(event.phase)
+        << "\",\"ts\":" << event.timestampNs / 1000.0 << ",\"pid\":" << pid
+        << ",\"tid\":" << event.threadId;
+    if (event.phase == TraceBuffer::Phase::INSTANT) {
+      out << ",\"s\":\"t\",\"args\":{\"value\":" << event.value << "}";
+    }
+    out << "}";
+  }
+  out << "\n]}\n";
+  return out.good();
 }
 
-void PerfMon::end(const std::string &mark) {
-  auto now = std::chrono::high_resolution_clock::now();
-  auto &perfMark = marks[mark];
-  if (!perfMark.open) {
+void PerfMon::setTraceDumpPath(const std::string &path) {
+  std::lock_guard lock(mutex);
+  traceDumpPath = path;
+  if (path.empty() || traceDumpThread.joinable()) {
     return;
   }
 
-  auto duration =
-      std::chrono::duration_cast<std::chrono::nanoseconds>(now - perfMark.point)
-          .count();
+  traceDumpThread = std::jthread([this](std::stop_token token) {
+    std::stop_callback wakeUp(token, [this]() {
+      traceDumpRequests.fetch_add(1);
+      traceDumpRequests.notify_all();
+    });
+    uint32_t handled = traceDumpRequests.load();
+    while (!token.stop_requested()) {
+      traceDumpRequests.wait(handled);
+      if (token.stop_requested()) {
+        break;
+      }
+      std::this_thread::sleep_for(TRACE_DUMP_DELAY);
+      handled = traceDumpRequests.load();
 
-  if (perfMark.durations.full()) {
-    auto size = perfMark.durations.capacity();
-    perfMark.averageNs +=
-        (double)(duration - perfMark.durations.front()) / size;
-    perfMark.durations.pop_front();
-  } else {
-    perfMark.averageNs =
-        (perfMark.averageNs * perfMark.durations.size() + duration) /
-        (perfMark.durations.size() + 1);
+      std::string path;
+      {
+        std::lock_guard lock(mutex);
+        path = traceDumpPath;
+      }
+      if (!path.empty() && dumpTrace(path)) {
+        std::cout << "PerfMon: trace written to " << path << ", "
+                  << traceBuffer.load()->droppedEvents() << " events dropped"
+                  << std::endl;
+      }
+    }
+  });
+}
+
+void PerfMon::requestTraceDump() {
+  traceDumpRequests.fetch_add(1, std::memory_order_relaxed);
+  traceDumpRequests.notify_one();
+}
+
+std::vector<PerfMon::MarkStats> PerfMon::getStats() {
+  std::vector<MarkStats> stats;
+
+  std::lock_guard lock(mutex);
+  for (MarkId id = 0; id < markNames.size(); ++id) {
+    auto merged = std::make_unique<LatencyHistogram>();
+    if (retired[id]) {
+      merged->merge(*retired[id]);
+    }
+    for (auto *marks : threads) {
+      auto *histogram = marks->histograms[id].load(std::memory_order_acquire);
+      if (histogram != nullptr) {
+        merged->merge(*histogram);
+      }
+    }
+    if (merged->count() == 0) {
+      continue;
+    }
+
+    stats.push_back(MarkStats{.name = markNames[id],
+                              .count = merged->count(),
+                              .meanNs = merged->mean(),
+                              .p50Ns = merged->percentile(50),
+                              .p99Ns = merged->percentile(99),
+                              .p999Ns = merged->percentile(99.9),
+                              .maxNs = merged->max()});
   }
 
-  perfMark.durations.push_back(duration);
-  perfMark.open = false;
+  std::sort(stats.begin(), stats.end(),
+            [](const auto &a, const auto &b) { return a.name < b.name; });
+  return stats;
 }
 
 void PerfMon::printStats() {
-  for (const auto &mark : marks) {
-    std::cout << "PerfMon: " << mark.first << " average "
-              << mark.second.averageNs / 1000.0 << "us" << std::endl;
+  for (const auto &mark : getStats()) {
+    std::cout << std::fixed << std::setprecision(3) << "PerfMon: " << mark.name
+              << " count=" << mark.count << " mean=" << mark.meanNs / 1000
+              << "us p50=" << toUs(mark.p50Ns) << "us p99=" << toUs(mark.p99Ns)
+              << "us p99.9=" << toUs(mark.p999Ns)
+              << "us max=" << toUs(mark.maxNs) << "us" << std::endl;
   }
 }
 
+double PerfMon::getAverageNs(std::string_view mark) {
+  for (const auto &stats : getStats()) {
+    if (stats.name == mark) {
+      return stats.meanNs;
+    }
+  }
+  return 0.0;
+}
+
 void PerfMon::printPeriodically(int seconds) {
   if (printThread.joinable()) {
     printThread.request_stop();
@@ -68,8 +482,14 @@ PerfMon::~PerfMon() {
     printThread.request_stop();
     printThread.join();
   }
+  if (traceDumpThread.joinable()) {
+    traceDumpThread.request_stop();
+    traceDumpThread.join();
+  }
+  delete traceBuffer.load();
 
-  printStats();
+  if (isEnabled()) {
+    printStats();
+  }
 }
 
-#endif // PROFILE
\ No newline at end of file
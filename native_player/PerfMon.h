@@ -1,60 +1,249 @@
 #ifndef PERF_MON_H
 #define PERF_MON_H
 
-#ifdef PROFILE
-#define perfmon_begin(mark) PerfMon::getInstance().begin(mark)
-#define perfmon_end(mark) PerfMon::getInstance().end(mark)
+// Profiling is compiled in but off by default, see PerfMon::setEnabled()
+// and PerfMon::setTracing(). When off, a mark costs a single relaxed
+// atomic load.
+// The mark name is interned once per call site, so it has to be a string
+// literal or another constant expression.
+#define perfmon_mark_id(mark)                                                  \
+  ([]() -> PerfMon::MarkId {                                                   \
+    static const PerfMon::MarkId id = PerfMon::getInstance().markId(mark);     \
+    return id;                                                                 \
+  }())
+#define perfmon_begin(mark)                                                    \
+  do {                                                                         \
+    if (PerfMon::isActive()) {                                                 \
+      PerfMon::getInstance().begin(perfmon_mark_id(mark));                     \
+    }                                                                          \
+  } while (0)
+#define perfmon_end(mark)                                                      \
+  do {                                                                         \
+    if (PerfMon::isActive()) {                                                 \
+      PerfMon::getInstance().end(perfmon_mark_id(mark));                       \
+    }                                                                          \
+  } while (0)
+// Instant event with a value, only recorded in the trace.
+#define perfmon_event(mark, value)                                             \
+  do {                                                                         \
+    if (PerfMon::isTracing()) {                                                \
+      PerfMon::getInstance().event(perfmon_mark_id(mark), value);              \
+    }                                                                          \
+  } while (0)
 #define perfmon_print_stats() PerfMon::getInstance().printStats()
 #define perfmon_print_periodically(seconds)                                    \
   PerfMon::getInstance().printPeriodically(seconds)
-#else
-#define perfmon_begin(mark)
-#define perfmon_end(mark)
-#define perfmon_print_stats()
-#define perfmon_print_periodically(seconds)
-#endif
 
-#ifdef PROFILE
-
-#include <boost/circular_buffer.hpp>
+#include <array>
+#include <atomic>
 #include <chrono>
-#include <iostream>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <vector>
+
+// Log-linear histogram of durations in nanoseconds, in the spirit of
+// HdrHistogram: values are grouped by their power of two, each power is
+// split into SUB_BUCKETS linear buckets, so the relative error of the
+// reported values is below 1/SUB_BUCKETS.
+// A histogram has a single writer, readers may run concurrently.
+class LatencyHistogram {
+public:
+  static constexpr int SUB_BUCKET_BITS = 4;
+  static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  void record(uint64_t valueNs);
+
+  // Adds the values of another histogram. Not safe to be called
+  // concurrently with record().
+  void merge(const LatencyHistogram &other);
+  // Clears all values. Must be called by the writer; concurrent readers
+  // may observe a partially cleared histogram.
+  void reset();
+
+  uint64_t count() const { return totalCount.load(std::memory_order_relaxed); }
+  uint64_t max() const { return maxNs.load(std::memory_order_relaxed); }
+  double mean() const;
+  // Returns the highest value of the bucket containing the given
+  // percentile, in range [0, 100].
+  uint64_t percentile(double percentile) const;
+
+  static size_t bucketIndex(uint64_t valueNs);
+  static uint64_t bucketHighestValue(size_t index);
+
+private:
+  std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+  std::atomic<uint64_t> totalCount = 0;
+  std::atomic<uint64_t> sumNs = 0;
+  std::atomic<uint64_t> maxNs = 0;
+};
+
+// Fixed size ring of timeline events. Any number of threads may record
+// concurrently without locking; the oldest events are overwritten.
+// Each slot is guarded by a sequence number so that a snapshot skips the
+// slots being written. A writer never waits for another one, an event
+// whose slot is busy or already holds a newer event is dropped.
+class TraceBuffer {
+public:
+  enum class Phase : uint8_t { BEGIN = 'B', END = 'E', INSTANT = 'i' };
+
+  struct Event {
+    uint64_t timestampNs;
+    uint32_t markId;
+    uint32_t threadId;
+    Phase phase;
+    int64_t value;
+  };
+
+  explicit TraceBuffer(size_t capacity);
+
+  void record(Phase phase, uint32_t markId, uint32_t threadId, int64_t value);
+
+  // Returns the events currently held, oldest first.
+  std::vector<Event> snapshot() const;
+
+  size_t capacity() const { return slots.size(); }
+
+  uint64_t droppedEvents() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  // Sequence of a slot being written.
+  static constexpr uint64_t WRITING = UINT64_MAX;
+
+  struct Slot {
+    std::atomic<uint64_t> sequence = 0;
+    std::atomic<uint64_t> timestampNs = 0;
+    std::atomic<uint64_t> ids = 0;
+    std::atomic<int64_t> value = 0;
+    std::atomic<uint8_t> phase = 0;
+  };
+
+  std::vector<Slot> slots;
+  std::atomic<uint64_t> writeIndex = 0;
+  std::atomic<uint64_t> dropped = 0;
+};
 
 class PerfMon {
 public:
+  using MarkId = uint32_t;
+  static constexpr MarkId MAX_MARKS = 128;
+  static constexpr size_t TRACE_BUFFER_EVENTS = 65536;
+
+  struct MarkStats {
+    std::string name;
+    uint64_t count;
+    double meanNs;
+    uint64_t p50Ns;
+    uint64_t p99Ns;
+    uint64_t p999Ns;
+    uint64_t maxNs;
+  };
+
   static PerfMon &getInstance() {
     static PerfMon instance;
     return instance;
   }
 
-  void begin(const std::string &mark);
-  void end(const std::string &mark);
+  // Turns the perfmon_* marks on or off at runtime. Collected stats are
+  // kept when profiling is turned off.
+  static void setEnabled(bool enabled) {
+    enabledFlag.store(enabled, std::memory_order_relaxed);
+  }
+  static bool isEnabled() {
+    return enabledFlag.load(std::memory_order_relaxed);
+  }
+
+  // Turns recording of the timeline trace on or off. The trace buffer of
+  // the given number of events is allocated when first enabled.
+  void setTracing(bool enabled, size_t bufferEvents = TRACE_BUFFER_EVENTS);
+  static bool isTracing() {
+    return tracingFlag.load(std::memory_order_relaxed);
+  }
+  static bool isActive() { return isEnabled() || isTracing(); }
+
+  // Returns the id of the mark with the given name, registering it on the
+  // first call. Takes a lock, ids are meant to be cached by the caller.
+  MarkId markId(std::string_view mark);
+
+  // Safe to be called from any thread, the measurements are kept per
+  // thread and merged when the stats are read. Record regardless of
+  // isEnabled(), which is only checked by the perfmon_* macros.
+  void begin(MarkId id);
+  void end(MarkId id);
+
+  void begin(std::string_view mark) { begin(markId(mark)); }
+  void end(std::string_view mark) { end(markId(mark)); }
+
+  // Records an instant event in the trace.
+  void event(MarkId id, int64_t value = 0);
+
+  // Writes the trace in Chrome trace event JSON format, which can be
+  // opened with chrome://tracing or https://ui.perfetto.dev.
+  // Returns false if the trace is empty or the file cannot be written.
+  bool dumpTrace(const std::string &path);
+
+  // Dumps the trace to the given path on requestTraceDump(), from a
+  // background thread. An empty path disables the automatic dumps.
+  void setTraceDumpPath(const std::string &path);
+  // Safe to be called from the audio thread, e.g. on xrun.
+  void requestTraceDump();
 
+  // Stats of all marks merged from all threads, sorted by name.
+  std::vector<MarkStats> getStats();
   void printStats();
   void printPeriodically(int seconds);
 
-  double getAverageNs(const std::string &mark) { return marks[mark].averageNs; }
+  double getAverageNs(std::string_view mark);
 
 private:
-  struct PerfMark {
-    std::chrono::high_resolution_clock::time_point point;
-    bool open;
-    double averageNs;
-    boost::circular_buffer<long> durations;
+  struct ThreadMarks {
+    struct OpenMark {
+      std::chrono::steady_clock::time_point start;
+      bool open = false;
+    };
+    std::array<OpenMark, MAX_MARKS> openMarks;
+    uint32_t threadId = 0;
+    std::array<std::atomic<LatencyHistogram *>, MAX_MARKS> histograms{};
 
-    PerfMark() : open(false), averageNs(0.0), durations(10) {}
+    ~ThreadMarks();
+    LatencyHistogram &histogram(MarkId id);
   };
-  std::unordered_map<std::string, PerfMark> marks;
+  friend struct ThreadMarksHolder;
+
+  static inline std::atomic<bool> enabledFlag = false;
+  static inline std::atomic<bool> tracingFlag = false;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, MarkId> markIds;
+  std::vector<std::string> markNames;
+  std::vector<ThreadMarks *> threads;
+  // Measurements of the threads which have already finished.
+  std::array<std::unique_ptr<LatencyHistogram>, MAX_MARKS> retired;
+
+  std::atomic<TraceBuffer *> traceBuffer = nullptr;
+  std::unordered_map<uint32_t, std::string> threadNames;
 
   std::jthread printThread;
 
+  std::string traceDumpPath;
+  std::atomic<uint32_t> traceDumpRequests = 0;
+  std::jthread traceDumpThread;
+
+  ThreadMarks *threadMarks();
+  void registerThread(ThreadMarks *marks);
+  void unregisterThread(ThreadMarks *marks);
+
   PerfMon();
   ~PerfMon();
   PerfMon(const PerfMon &) = delete;
   PerfMon &operator=(const PerfMon &) = delete;
 };
 
-#endif // PROFILE
-#endif // PERF_MON_H
\ No newline at end of file
+#endif // PERF_MON_H
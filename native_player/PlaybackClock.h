@@ -0,0 +1,93 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include "StreamState.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+// Position of the source being played out at a point in time.
+struct PlaybackPosition {
+  // Frames of the source played at timestamp.
+  int64_t frames = 0;
+  // 0 while nothing has been played.
+  uint32_t sampleRate = 0;
+  // Same clock as StreamState::timestamp.
+  unsigned long long timestamp = 0;
+  // False if the position does not advance, e.g. while paused.
+  bool running = false;
+
+  long positionMs() const {
+    return sampleRate == 0 ? 0 : frames * 1000 / sampleRate;
+  }
+};
+
+// Hands the playback position over from the playback thread to any number
+// of readers without locks. The playback thread publishes an anchor, a
+// position and the time it is played at, readers extrapolate from it at
+// the sample rate, up to the last frame written to the device.
+// The anchor is guarded by a sequence lock: the writer makes the sequence
+// odd while storing it and readers retry until they read an even, unchanged
+// sequence, so reading never waits for the writer to be scheduled.
+class PlaybackClock {
+public:
+  // Playback thread only.
+  void publish(const PlaybackPosition &anchor, int64_t limitFrames) {
+    const uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    frames.store(anchor.frames, std::memory_order_relaxed);
+    limit.store(limitFrames, std::memory_order_relaxed);
+    timestamp.store(anchor.timestamp, std::memory_order_relaxed);
+    sampleRate.store(anchor.sampleRate, std::memory_order_relaxed);
+    running.store(anchor.running, std::memory_order_relaxed);
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // Playback thread only: nothing is played.
+  void reset() { publish(PlaybackPosition(), 0); }
+
+  // The position played at now, which may be before the anchor.
+  PlaybackPosition get(unsigned long long now = getTimestampNs()) const {
+    PlaybackPosition position;
+    int64_t limitFrames = 0;
+    uint64_t seq = 0;
+    do {
+      seq = sequence.load(std::memory_order_acquire);
+      if (seq & 1) {
+        continue;
+      }
+      position.frames = frames.load(std::memory_order_relaxed);
+      limitFrames = limit.load(std::memory_order_relaxed);
+      position.timestamp = timestamp.load(std::memory_order_relaxed);
+      position.sampleRate = sampleRate.load(std::memory_order_relaxed);
+      position.running = running.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || sequence.load(std::memory_order_relaxed) != seq);
+
+    if (!position.running) {
+      return position;
+    }
+    // In double, so a stale anchor cannot overflow.
+    const double elapsedNs = static_cast<double>(now) -
+                             static_cast<double>(position.timestamp);
+    position.frames +=
+        static_cast<int64_t>(elapsedNs * position.sampleRate / 1e9);
+    position.frames = std::clamp<int64_t>(position.frames, 0,
+                                          std::max<int64_t>(limitFrames, 0));
+    position.running = position.frames < limitFrames;
+    position.timestamp = now;
+    return position;
+  }
+
+private:
+  std::atomic<uint64_t> sequence = 0;
+  std::atomic<int64_t> frames = 0;
+  std::atomic<int64_t> limit = 0;
+  std::atomic<unsigned long long> timestamp = 0;
+  std::atomic<uint32_t> sampleRate = 0;
+  std::atomic<bool> running = false;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef PLAYED_FRAMES_COUNTER_H
+#define PLAYED_FRAMES_COUNTER_H
+
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Counts the frames played by the device and calls the callbacks scheduled
+// for a frame, e.g. to report a source change or a pause, once it has been
+// played. Playback thread only.
+// Events are kept in a min-heap ordered by frame, events for the same frame
+// in the order they were scheduled. The callbacks are stored inline in
+// slots reserved up front, so neither scheduling nor dispatching allocates,
+// and update() only compares with the earliest event unless it is due.
+// Should the slots run out, they are doubled rather than failing or
+// calling an event before its frame.
+class PlayedFramesCounter {
+public:
+  // Slots reserved by default.
+  static constexpr std::size_t CAPACITY = 16;
+  // Fits a callback capturing `this` and a StreamState.
+  static constexpr std::size_t CALLBACK_SIZE = 128;
+  using Callback = InplaceFunction<void(int64_t), CALLBACK_SIZE>;
+
+  PlayedFramesCounter() : events(CAPACITY) {}
+
+  // Reserves slots for the given number of pending events. Not to be
+  // called from a callback.
+  void reserve(std::size_t slots) {
+    if (slots > events.size()) {
+      events.resize(slots);
+    }
+  }
+
+  // Calls the callbacks of the events which are due, with the number of
+  // frames played since their frame.
+  void update(int64_t frames) {
+    lastPlayedFrames += frames;
+    while (count > 0 && events[0].frame <= lastPlayedFrames) {
+      const int64_t late = lastPlayedFrames - events[0].frame;
+      // Taken out first, so the callback may schedule events.
+      auto callback = std::move(events[0].callback);
+      pop();
+      callback(late);
+    }
+  }
+
+  int64_t getPlayedFrames() const { return lastPlayedFrames; }
+
+  // Frames to be played until the next event is due, if any is pending.
+  std::optional<int64_t> framesToNextEvent() const {
+    if (count == 0) {
+      return std::nullopt;
+    }
+    return std::max<int64_t>(0, events[0].frame - lastPlayedFrames);
+  }
+
+  std::size_t pendingEvents() const { return count; }
+
+  std::size_t capacity() const { return events.size(); }
+
+  // Number of times the slots ran out and were doubled. Can be read from
+  // any thread.
+  uint64_t slotsGrown() const { return grown.load(std::memory_order_relaxed); }
+
+  // Calls onFramesPlayed once frame more frames have been played.
+  void callOnOrAfterFrame(int64_t frame, Callback onFramesPlayed) {
+    if (count == events.size()) {
+      grown.fetch_add(1, std::memory_order_relaxed);
+      events.resize(2 * events.size());
+    }
+    auto &event = events[count];
+    event.frame = frame + lastPlayedFrames;
+    event.sequence = nextSequence++;
+    event.callback = std::move(onFramesPlayed);
+    siftUp(count++);
+  }
+
+  void reset() {
+    for (std::size_t i = 0; i < count; ++i) {
+      events[i].callback.reset();
+    }
+    count = 0;
+    lastPlayedFrames = 0;
+  }
+
+private:
+  struct Event {
+    int64_t frame = 0;
+    uint64_t sequence = 0;
+    Callback callback;
+  };
+
+  std::vector<Event> events;
+  std::size_t count = 0;
+  uint64_t nextSequence = 0;
+  int64_t lastPlayedFrames = 0;
+  std::atomic<uint64_t> grown = 0;
+
+  static bool before(const Event &a, const Event &b) {
+    return a.frame < b.frame ||
+           (a.frame == b.frame && a.sequence < b.sequence);
+  }
+
+  void pop() {
+    --count;
+    if (count > 0) {
+      events[0] = std::move(events[count]);
+      siftDown(0);
+    } else {
+      events[0].callback.reset();
+    }
+  }
+
+  void siftUp(std::size_t i) {
+    while (i > 0) {
+      const std::size_t parent = (i - 1) / 2;
+      if (!before(events[i], events[parent])) {
+        break;
+      }
+      std::swap(events[i], events[parent]);
+      i = parent;
+    }
+  }
+
+  void siftDown(std::size_t i) {
+    while (true) {
+      const std::size_t left = 2 * i + 1;
+      const std::size_t right = left + 1;
+      std::size_t smallest = i;
+      if (left < count && before(events[left], events[smallest])) {
+        smallest = left;
+      }
+      if (right < count && before(events[right], events[smallest])) {
+        smallest = right;
+      }
+      if (smallest == i) {
+        break;
+      }
+      std::swap(events[i], events[smallest]);
+      i = smallest;
+    }
+  }
+};
+
+#endif
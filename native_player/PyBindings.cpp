@@ -2,9 +2,15 @@
 #include "AudioInfo.h"
 #include "AudioPlayer.h"
 #include "Config.h"
+#include "DeadlineMonitor.h"
+#include "Metrics.h"
+#include "PerfMon.h"
+#include "PlaybackClock.h"
 #include "StateMonitor.h"
 #include "StreamState.h"
+#include "XrunStats.h"
 
+#include <pybind11/functional.h>
 #include <pybind11/operators.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -41,6 +47,13 @@ dict_to_map(const py::dict &py_dict) {
   return result;
 }
 
+struct GilReleasingDeleter {
+  template <typename T> void operator()(T *object) const {
+    py::gil_scoped_release release;
+    delete object;
+  }
+};
+
 PYBIND11_MODULE(native_player, m) {
   py::class_<StreamAudioFormat>(m, "StreamAudioFormat")
       .def(py::init<>())
@@ -77,6 +90,18 @@ PYBIND11_MODULE(native_player, m) {
       .def(pybind11::self == pybind11::self)
       .def(pybind11::self != pybind11::self);
 
+  py::class_<PlaybackPosition>(m, "PlaybackPosition")
+      .def_readonly("frames", &PlaybackPosition::frames)
+      .def_readonly("sample_rate", &PlaybackPosition::sampleRate)
+      .def_readonly("timestamp", &PlaybackPosition::timestamp)
+      .def_readonly("running", &PlaybackPosition::running)
+      .def_property_readonly("position_ms", &PlaybackPosition::positionMs)
+      .def("__repr__", [](const PlaybackPosition &p) {
+        return "<PlaybackPosition frames=" + std::to_string(p.frames) +
+               " sample_rate=" + std::to_string(p.sampleRate) +
+               " running=" + std::to_string(p.running) + ">";
+      });
+
   py::enum_<StreamType>(m, "StreamType")
       .value("BYTES", StreamType::BYTES)
       .value("FRAMES", StreamType::FRAMES)
@@ -84,18 +109,166 @@ PYBIND11_MODULE(native_player, m) {
 
   py::class_<StateMonitor>(m, "StateMonitor")
       .def("wait_state", &StateMonitor::waitState)
+      // Without a timeout, waits until states are queued or the monitor is
+      // stopped, in which case the list is empty.
+      .def(
+          "wait_states",
+          [](StateMonitor &monitor, size_t maxCount,
+             std::optional<long> timeoutMs) {
+            std::optional<std::chrono::milliseconds> timeout;
+            if (timeoutMs.has_value()) {
+              timeout = std::chrono::milliseconds(timeoutMs.value());
+            }
+            return monitor.waitStates(maxCount, timeout);
+          },
+          py::arg("max_count"), py::arg("timeout_ms") = std::nullopt,
+          py::call_guard<py::gil_scoped_release>())
+      // For loop.add_reader(), readable while drain() has states to return
+      // and once the monitor is stopped.
+      .def("fileno", &StateMonitor::getEventFd)
+      .def("drain", &StateMonitor::drain, py::arg("max_count") = SIZE_MAX)
       .def("has_data", &StateMonitor::hasData)
       .def("is_running", &StateMonitor::isRunning)
+      .def("dropped_states", &StateMonitor::droppedStates)
       .def("stop", &StateMonitor::stop);
 
-  py::class_<AudioPlayer>(m, "AudioPlayer")
+  py::class_<TrackSource>(m, "TrackSource")
+      .def(py::init<std::string, float, float>(), py::arg("url"),
+           py::arg("replay_gain_db") = 0.0f,
+           py::arg("replay_gain_peak") = 0.0f)
+      .def_readwrite("url", &TrackSource::url)
+      .def_readwrite("replay_gain_db", &TrackSource::replayGainDb)
+      .def_readwrite("replay_gain_peak", &TrackSource::replayGainPeak);
+
+  py::class_<DeadlineStats>(m, "DeadlineStats")
+      .def_readonly("periods", &DeadlineStats::periods)
+      .def_readonly("near_misses", &DeadlineStats::nearMisses)
+      .def_readonly("misses", &DeadlineStats::misses)
+      .def_readonly("min_slack_ns", &DeadlineStats::minSlackNs)
+      .def_readonly("p1_slack_ns", &DeadlineStats::p1SlackNs)
+      .def_readonly("p50_slack_ns", &DeadlineStats::p50SlackNs)
+      .def("__repr__", [](const DeadlineStats &s) {
+        return "<DeadlineStats periods=" + std::to_string(s.periods) +
+               " near_misses=" + std::to_string(s.nearMisses) +
+               " misses=" + std::to_string(s.misses) +
+               " min_slack_ns=" + std::to_string(s.minSlackNs) + ">";
+      });
+
+  py::class_<NodeBufferLevel>(m, "NodeBufferLevel")
+      .def_readonly("node", &NodeBufferLevel::node)
+      .def_readonly("bytes", &NodeBufferLevel::bytes)
+      .def_readonly("capacity", &NodeBufferLevel::capacity)
+      .def("__repr__", [](const NodeBufferLevel &l) {
+        return "<NodeBufferLevel node=" + l.node +
+               " bytes=" + std::to_string(l.bytes) +
+               " capacity=" + std::to_string(l.capacity) + ">";
+      });
+
+  py::class_<XrunEvent>(m, "XrunEvent")
+      .def_readonly("timestamp", &XrunEvent::timestamp)
+      .def_readonly("position_ms", &XrunEvent::positionMs)
+      .def_readonly("error", &XrunEvent::error)
+      .def_readonly("buffer_time_ms", &XrunEvent::bufferTimeMs)
+      .def_readonly("period_time_ms", &XrunEvent::periodTimeMs)
+      .def_readonly("buffer_levels", &XrunEvent::bufferLevels);
+
+  py::class_<XrunStats>(m, "XrunStats")
+      .def_readonly("count", &XrunStats::count)
+      .def_readonly("recent", &XrunStats::recent)
+      .def_readonly("buffer_time_ms", &XrunStats::bufferTimeMs)
+      .def_readonly("period_time_ms", &XrunStats::periodTimeMs);
+
+  py::enum_<MetricType>(m, "MetricType")
+      .value("COUNTER", MetricType::COUNTER)
+      .value("GAUGE", MetricType::GAUGE)
+      .value("HISTOGRAM", MetricType::HISTOGRAM)
+      .export_values();
+
+  py::class_<MetricSample>(m, "MetricSample")
+      .def_readonly("group", &MetricSample::group)
+      .def_readonly("name", &MetricSample::name)
+      .def_readonly("type", &MetricSample::type)
+      .def_readonly("value", &MetricSample::value)
+      .def_readonly("mean", &MetricSample::mean)
+      .def_readonly("p50", &MetricSample::p50)
+      .def_readonly("p99", &MetricSample::p99)
+      .def_readonly("max", &MetricSample::max)
+      .def("__repr__", [](const MetricSample &s) {
+        return "<MetricSample " + s.group + "." + s.name +
+               " value=" + std::to_string(s.value) + ">";
+      });
+
+  py::class_<PerfMon::MarkStats>(m, "PerfMarkStats")
+      .def_readonly("name", &PerfMon::MarkStats::name)
+      .def_readonly("count", &PerfMon::MarkStats::count)
+      .def_readonly("mean_ns", &PerfMon::MarkStats::meanNs)
+      .def_readonly("p50_ns", &PerfMon::MarkStats::p50Ns)
+      .def_readonly("p99_ns", &PerfMon::MarkStats::p99Ns)
+      .def_readonly("p999_ns", &PerfMon::MarkStats::p999Ns)
+      .def_readonly("max_ns", &PerfMon::MarkStats::maxNs)
+      .def("__repr__", [](const PerfMon::MarkStats &s) {
+        return "<PerfMarkStats name=" + s.name +
+               " count=" + std::to_string(s.count) +
+               " p50_ns=" + std::to_string(s.p50Ns) +
+               " p99_ns=" + std::to_string(s.p99Ns) +
+               " max_ns=" + std::to_string(s.maxNs) + ">";
+      });
+
+  // Result of a seek, get() waits for it.
+  py::class_<std::shared_future<size_t>>(m, "SeekResult")
+      .def("get", &std::shared_future<size_t>::get,
+           py::call_guard<py::gil_scoped_release>())
+      .def("done", [](const std::shared_future<size_t> &f) {
+        return f.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready;
+      });
+
+  // The calls changing the playback wait for the audio threads, e.g. to
+  // join them, the GIL is released meanwhile. So is the destructor, which
+  // joins the prefetch thread while it may wait for the GIL to call the
+  // next track provider.
+  py::class_<AudioPlayer, std::unique_ptr<AudioPlayer, GilReleasingDeleter>>(
+      m, "AudioPlayer")
       .def(py::init<const Config &>(), py::arg("config"))
-      .def("play", &AudioPlayer::play, py::arg("url"))
-      .def("play_next", &AudioPlayer::playNext, py::arg("url"))
-      .def("stop", &AudioPlayer::stop)
-      .def("pause", &AudioPlayer::pause, py::arg("paused"))
-      .def("seek", &AudioPlayer::seek, py::arg("position_ms"))
+      .def("play", &AudioPlayer::play, py::arg("url"),
+           py::arg("replay_gain_db") = 0.0f,
+           py::arg("replay_gain_peak") = 0.0f,
+           py::call_guard<py::gil_scoped_release>())
+      .def("play_next", &AudioPlayer::playNext, py::arg("url"),
+           py::arg("replay_gain_db") = 0.0f,
+           py::arg("replay_gain_peak") = 0.0f,
+           py::call_guard<py::gil_scoped_release>())
+      // The provider is called from the prefetch thread, release the GIL
+      // so that replacing it can wait for the running call to finish.
+      .def("set_next_track_provider", &AudioPlayer::setNextTrackProvider,
+           py::arg("provider"), py::call_guard<py::gil_scoped_release>())
+      .def("stop", &AudioPlayer::stop,
+           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "pause",
+          [](AudioPlayer &player, bool paused) { player.pause(paused); },
+          py::arg("paused"), py::call_guard<py::gil_scoped_release>())
+      .def(
+          "seek",
+          [](AudioPlayer &player, size_t positionMs) {
+            return player.seek(positionMs).share();
+          },
+          py::arg("position_ms"), py::call_guard<py::gil_scoped_release>())
+      .def("set_volume", &AudioPlayer::setVolume, py::arg("volume"))
+      .def("get_volume", &AudioPlayer::getVolume)
+      .def("is_next_ready", &AudioPlayer::isNextReady)
+      .def("deadline_stats", &AudioPlayer::getDeadlineStats)
+      .def("xrun_stats", &AudioPlayer::getXrunStats)
+      .def("metrics", &AudioPlayer::getMetrics)
+      .def_static("enable_profiling", &AudioPlayer::enableProfiling,
+                  py::arg("enabled") = true)
+      .def_static("profiling_stats", &AudioPlayer::getProfilingStats)
+      .def_static("enable_tracing", &AudioPlayer::enableTracing,
+                  py::arg("enabled") = true)
+      .def_static("dump_trace", &AudioPlayer::dumpTrace, py::arg("path"),
+                  py::call_guard<py::gil_scoped_release>())
       .def("get_state", &AudioPlayer::getState)
+      .def("get_position", &AudioPlayer::getPosition)
       .def("monitor", &AudioPlayer::monitor);
 
   py::enum_<AudioGraphNodeState>(m, "AudioGraphNodeState")
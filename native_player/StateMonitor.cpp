@@ -1,22 +1,47 @@
 #include "StateMonitor.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #ifdef __PYTHON__
 #include <pybind11/pybind11.h>
 #endif
 
-StateMonitor::StateMonitor(AudioGraphNode *ptr) : ptr(ptr) {
+namespace {
+bool isTerminal(AudioGraphNodeState state) {
+  return state == AudioGraphNodeState::ERROR ||
+         state == AudioGraphNodeState::FINISHED ||
+         state == AudioGraphNodeState::SOURCE_CHANGED;
+}
+} // namespace
+
+StateMonitor::StateMonitor(AudioGraphNode *ptr, size_t capacity)
+    : ring(std::max<size_t>(capacity, 1)), ptr(ptr) {
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd < 0) {
+    throw std::runtime_error(std::string("Cannot create eventfd: ") +
+                             std::strerror(errno));
+  }
   if (ptr) {
     subscriptionId = ptr->onStateChange(
         [this](AudioGraphNode *node, StreamState state) -> bool {
           std::unique_lock lock(mutex);
-          queue_.push(state);
+          push(state);
+          updateEvent();
           cv.notify_all();
           return true;
         });
   }
 }
 
-StateMonitor::~StateMonitor() { stop(); }
+StateMonitor::~StateMonitor() {
+  stop();
+  ::close(eventFd);
+}
 
 StreamState StateMonitor::waitState() {
 #ifdef __PYTHON__
@@ -27,19 +52,105 @@ StreamState StateMonitor::waitState() {
   }
 
   std::unique_lock lock(mutex);
-  cv.wait(lock, [this] { return !queue_.empty() || stopped; });
+  cv.wait(lock, [this] { return count > 0 || stopped; });
 
   if (stopped) {
     return StreamState(AudioGraphNodeState::STOPPED);
   }
-  auto state = queue_.front();
-  queue_.pop();
+  return pop();
+}
+
+std::vector<StreamState>
+StateMonitor::waitStates(size_t maxCount,
+                         std::optional<std::chrono::milliseconds> timeout) {
+  std::vector<StreamState> states;
+  std::unique_lock lock(mutex);
+  auto ready = [this] { return count > 0 || stopped; };
+  if (timeout.has_value()) {
+    cv.wait_for(lock, timeout.value(), ready);
+  } else {
+    cv.wait(lock, ready);
+  }
+  if (stopped) {
+    return states;
+  }
+  states.reserve(std::min(count, maxCount));
+  while (count > 0 && states.size() < maxCount) {
+    states.push_back(pop());
+  }
+  return states;
+}
+
+std::vector<StreamState> StateMonitor::drain(size_t maxCount) {
+  std::vector<StreamState> states;
+  std::lock_guard lock(mutex);
+  states.reserve(std::min(count, maxCount));
+  while (count > 0 && states.size() < maxCount) {
+    states.push_back(pop());
+  }
+  return states;
+}
+
+void StateMonitor::updateEvent() {
+  const bool readable = count > 0 || stopped;
+  uint64_t value = 1;
+  if (readable) {
+    // Stays readable while the counter is not 0, one write is enough.
+    if (!signalled) {
+      signalled = ::write(eventFd, &value, sizeof(value)) == sizeof(value);
+    }
+  } else if (signalled) {
+    // Non-blocking, reads and resets the counter.
+    signalled = ::read(eventFd, &value, sizeof(value)) != sizeof(value);
+  }
+}
+
+StreamState StateMonitor::pop() {
+  auto state = std::move(*ring[first]);
+  ring[first].reset();
+  first = (first + 1) % ring.size();
+  --count;
+  updateEvent();
   return state;
 }
 
+void StateMonitor::push(const StreamState &state) {
+  if (count == ring.size()) {
+    size_t i = 0;
+    while (i < count && isTerminal(ring[(first + i) % ring.size()]->state)) {
+      ++i;
+    }
+    if (i < count) {
+      // Close the gap, moving the newer states one slot back.
+      for (; i + 1 < count; ++i) {
+        ring[(first + i) % ring.size()] =
+            std::move(ring[(first + i + 1) % ring.size()]);
+      }
+      ring[(first + count - 1) % ring.size()].reset();
+      --count;
+      ++dropped;
+    } else {
+      // Only terminal states queued, unwrap them into a larger ring.
+      std::vector<std::optional<StreamState>> larger(ring.size() * 2);
+      for (i = 0; i < count; ++i) {
+        larger[i] = std::move(ring[(first + i) % ring.size()]);
+      }
+      ring = std::move(larger);
+      first = 0;
+    }
+  }
+  ring[(first + count) % ring.size()] = state;
+  ++count;
+}
+
 bool StateMonitor::hasData() {
   std::unique_lock lock(mutex);
-  return !queue_.empty();
+  return count > 0;
+}
+
+uint64_t StateMonitor::droppedStates() {
+  std::lock_guard lock(mutex);
+  return dropped;
 }
 
 void StateMonitor::stop() {
@@ -47,7 +158,11 @@ void StateMonitor::stop() {
     return;
   }
   ptr->removeStateChangeCallback(subscriptionId);
-  stopped = true;
+  {
+    std::lock_guard lock(mutex);
+    stopped = true;
+    updateEvent();
+  }
   cv.notify_all();
 }
 
@@ -57,9 +172,9 @@ StateChangeWaitLock::StateChangeWaitLock(
     std::stop_token token, AudioGraphNode &node, AudioGraphNodeState nextState,
     std::optional<std::chrono::milliseconds> timeout)
     : lastState(AudioGraphNodeState::STOPPED) {
-  std::unique_lock lock(mutex);
   int subscriptionId = node.onStateChange(
       [this, nextState](AudioGraphNode *node, StreamState state) -> bool {
+        std::lock_guard lock(mutex);
         lastState = state;
         if (state.state == nextState) {
           cv.notify_all();
@@ -67,6 +182,7 @@ StateChangeWaitLock::StateChangeWaitLock(
         }
         return true;
       });
+  std::unique_lock lock(mutex);
   if (timeout.has_value()) {
     cv.wait_for(lock, token, timeout.value(),
                 [this, nextState] { return lastState.state == nextState; });
@@ -74,6 +190,8 @@ StateChangeWaitLock::StateChangeWaitLock(
     cv.wait(lock, token,
             [this, nextState] { return lastState.state == nextState; });
   }
+  // The callback may be running, it locks the mutex.
+  lock.unlock();
   node.removeStateChangeCallback(subscriptionId);
 }
 
@@ -96,5 +214,6 @@ StateChangeWaitLock::StateChangeWaitLock(
     cv.wait(lock, token,
             [this, timestamp] { return lastState.timestamp > timestamp; });
   }
+  lock.unlock();
   node.removeStateChangeCallback(subscriptionId);
 }
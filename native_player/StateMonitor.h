@@ -1,36 +1,76 @@
 #ifndef STATE_MONITOR_H
 #define STATE_MONITOR_H
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
-#include <queue>
+#include <optional>
+#include <vector>
 
 #include "AudioGraphNode.h"
 #include "StreamState.h"
 
+// Queues the states of a node until they are read with waitState().
+// The queue holds up to capacity states. Once it is full, the oldest
+// intermediate state (STOPPED, PREPARING, STREAMING or PAUSED) is dropped,
+// as a newer state supersedes it. The terminal states (ERROR, FINISHED and
+// SOURCE_CHANGED) are never dropped, the queue grows beyond capacity if it
+// holds nothing else.
+// Instead of waiting, an event loop can poll getEventFd() and take the
+// states with drain() once it is readable.
 class StateMonitor {
 public:
   friend class AudioGraphNode;
 
-  StateMonitor(AudioGraphNode *ptr);
+  static constexpr size_t DEFAULT_CAPACITY = 64;
+
+  StateMonitor(AudioGraphNode *ptr, size_t capacity = DEFAULT_CAPACITY);
   StateMonitor(const StateMonitor &) = delete;
   StateMonitor &operator=(const StateMonitor &) = delete;
   ~StateMonitor();
 
   StreamState waitState();
+  // Waits until states are queued, the monitor is stopped or the timeout
+  // expires, and returns up to maxCount of the queued states, oldest first.
+  std::vector<StreamState>
+  waitStates(size_t maxCount,
+             std::optional<std::chrono::milliseconds> timeout = std::nullopt);
+
+  // Returns up to maxCount of the queued states without waiting.
+  std::vector<StreamState> drain(size_t maxCount = SIZE_MAX);
+  // Readable while states are queued and once the monitor is stopped.
+  int getEventFd() const { return eventFd; }
 
   bool hasData();
   bool isRunning() const;
   void stop();
 
+  // Number of states dropped since the monitor was created.
+  uint64_t droppedStates();
+
 protected:
   std::mutex mutex;
   std::condition_variable_any cv;
-  std::queue<StreamState> queue_;
+  // Ring of queued states, count of them starting at first.
+  std::vector<std::optional<StreamState>> ring;
+  size_t first = 0;
+  size_t count = 0;
+  uint64_t dropped = 0;
+  int eventFd = -1;
+  // Whether eventFd is readable.
+  bool signalled = false;
   AudioGraphNode *ptr;
   int subscriptionId;
 
-  bool stopped = false;
+  // Read without the mutex by isRunning().
+  std::atomic<bool> stopped = false;
+
+  void push(const StreamState &state);
+  StreamState pop();
+  // Sets or clears eventFd to match the queue, with the mutex held.
+  void updateEvent();
 };
 
 class StateChangeWaitLock {
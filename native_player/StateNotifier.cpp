@@ -0,0 +1,220 @@
+#include "StateNotifier.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <pthread.h>
+
+namespace {
+constexpr uint64_t FREE_INDEX_MASK = 0xffffffff;
+constexpr uint64_t FREE_TAG_STEP = FREE_INDEX_MASK + 1;
+
+// Set while the thread runs callbacks. States set by the callbacks are
+// delivered by the running loop.
+thread_local bool delivering = false;
+} // namespace
+
+void StateSubscribers::add(std::shared_ptr<Subscription> subscription) {
+  std::lock_guard lock(mutex);
+  subscriptions.push_back(std::move(subscription));
+  count.store(subscriptions.size());
+}
+
+bool StateSubscribers::remove(int id) {
+  std::lock_guard lock(mutex);
+  auto it = std::find_if(
+      subscriptions.begin(), subscriptions.end(),
+      [id](const auto &subscription) { return subscription->id == id; });
+  if (it == subscriptions.end()) {
+    return false;
+  }
+  (*it)->active.store(false);
+  subscriptions.erase(it);
+  count.store(subscriptions.size());
+  return true;
+}
+
+void StateSubscribers::clear() {
+  std::lock_guard lock(mutex);
+  for (auto &subscription : subscriptions) {
+    subscription->active.store(false);
+  }
+  subscriptions.clear();
+  count.store(0);
+}
+
+StateNotifier &StateNotifier::getInstance() {
+  // Never destroyed, nodes may still change their state during static
+  // destruction.
+  static StateNotifier *instance = new StateNotifier();
+  return *instance;
+}
+
+StateNotifier::StateNotifier() : head(&stub), tail(&stub) {
+  for (size_t i = 0; i < POOL_SIZE; ++i) {
+    pool[i].nextFree.store(i + 1 < POOL_SIZE ? i + 2 : 0);
+  }
+  freeHead.store(1);
+  thread = std::thread([this]() { run(); });
+}
+
+void StateNotifier::post(std::shared_ptr<StateSubscribers> subscribers,
+                         AudioGraphNode *node, uint64_t version,
+                         const StreamState &state) {
+  auto *notification = acquire();
+  if (notification == nullptr) {
+    notification = new Notification();
+  }
+  notification->subscribers = std::move(subscribers);
+  notification->node = node;
+  notification->version = version;
+  notification->state = state;
+
+  posted.fetch_add(1);
+  push(notification);
+  wakeups.fetch_add(1);
+  wakeups.notify_one();
+}
+
+void StateNotifier::deliverPending() {
+  if (delivering) {
+    return;
+  }
+  // Everything queued before the target was read is delivered once as
+  // many states were, the states queued later are behind it.
+  const uint64_t target = posted.load();
+  std::lock_guard lock(consumerMutex);
+  while (delivered.load() < target) {
+    if (!deliverNext()) {
+      // A state is being queued by another thread.
+      std::this_thread::yield();
+    }
+  }
+}
+
+StateNotifier::Notification *StateNotifier::acquire() {
+  uint64_t top = freeHead.load(std::memory_order_acquire);
+  while (true) {
+    const auto index = top & FREE_INDEX_MASK;
+    if (index == 0) {
+      return nullptr;
+    }
+    auto *notification = &pool[index - 1];
+    const uint64_t next = ((top & ~FREE_INDEX_MASK) + FREE_TAG_STEP) |
+                          notification->nextFree.load();
+    if (freeHead.compare_exchange_weak(top, next, std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+      return notification;
+    }
+  }
+}
+
+void StateNotifier::release(Notification *notification) {
+  if (notification < pool.data() || notification >= pool.data() + POOL_SIZE) {
+    delete notification;
+    return;
+  }
+  notification->subscribers.reset();
+  const uint64_t index = notification - pool.data() + 1;
+  uint64_t top = freeHead.load(std::memory_order_acquire);
+  while (true) {
+    notification->nextFree.store(top & FREE_INDEX_MASK);
+    const uint64_t next = ((top & ~FREE_INDEX_MASK) + FREE_TAG_STEP) | index;
+    if (freeHead.compare_exchange_weak(top, next, std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+      return;
+    }
+  }
+}
+
+void StateNotifier::push(Notification *notification) {
+  notification->next.store(nullptr, std::memory_order_relaxed);
+  auto *previous = head.exchange(notification, std::memory_order_acq_rel);
+  previous->next.store(notification, std::memory_order_release);
+}
+
+StateNotifier::Notification *StateNotifier::pop() {
+  auto *first = tail;
+  auto *next = first->next.load(std::memory_order_acquire);
+  if (first == &stub) {
+    if (next == nullptr) {
+      return nullptr;
+    }
+    tail = next;
+    first = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next != nullptr) {
+    tail = next;
+    return first;
+  }
+  if (first != head.load(std::memory_order_acquire)) {
+    // A producer has taken the head but not linked it yet.
+    return nullptr;
+  }
+  // The last notification is only taken with a successor, put the stub
+  // behind it.
+  push(&stub);
+  next = first->next.load(std::memory_order_acquire);
+  if (next != nullptr) {
+    tail = next;
+    return first;
+  }
+  return nullptr;
+}
+
+bool StateNotifier::deliverNext() {
+  auto *notification = pop();
+  if (notification == nullptr) {
+    return false;
+  }
+  deliver(*notification);
+  release(notification);
+  delivered.fetch_add(1);
+  return true;
+}
+
+void StateNotifier::deliver(Notification &notification) {
+  auto &subscribers = *notification.subscribers;
+  if (subscribers.count.load() == 0) {
+    return;
+  }
+
+  std::lock_guard dispatchLock(subscribers.dispatchMutex);
+  std::vector<std::shared_ptr<StateSubscribers::Subscription>> subscriptions;
+  {
+    std::lock_guard lock(subscribers.mutex);
+    subscriptions = subscribers.subscriptions;
+  }
+
+  delivering = true;
+  for (auto &subscription : subscriptions) {
+    if (!subscription->active.load() ||
+        subscription->version >= notification.version) {
+      continue;
+    }
+    subscription->version = notification.version;
+    bool keep = true;
+    try {
+      keep = subscription->callback(notification.node, *notification.state);
+    } catch (const std::exception &ex) {
+      spdlog::error("State change callback failed: {}", ex.what());
+    }
+    if (!keep) {
+      subscribers.remove(subscription->id);
+    }
+  }
+  delivering = false;
+}
+
+void StateNotifier::run() {
+  pthread_setname_np(pthread_self(), "StateNotifier");
+  while (true) {
+    const uint32_t seen = wakeups.load();
+    {
+      std::lock_guard lock(consumerMutex);
+      while (deliverNext()) {
+      }
+    }
+    wakeups.wait(seen);
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef STATE_NOTIFIER_H
+#define STATE_NOTIFIER_H
+
+#include "StreamState.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+class AudioGraphNode;
+
+using StateChangeCallback = std::function<bool(AudioGraphNode *, StreamState)>;
+
+// The state change callbacks of a node run by the notifier. Shared with the
+// queued notifications, which may outlive the node.
+struct StateSubscribers {
+  struct Subscription {
+    int id;
+    StateChangeCallback callback;
+    // Version of the last state passed to the callback, older queued
+    // states are skipped.
+    uint64_t version;
+    std::atomic<bool> active = true;
+  };
+
+  // Guards subscriptions.
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Subscription>> subscriptions;
+  std::atomic<size_t> count = 0;
+  // Held while the callbacks run, so removing one can wait for it to
+  // return. Recursive since callbacks may remove callbacks of the node.
+  std::recursive_mutex dispatchMutex;
+
+  void add(std::shared_ptr<Subscription> subscription);
+  // Returns false if there is no active subscription with the id.
+  bool remove(int id);
+  void clear();
+};
+
+// Runs the state change callbacks of all nodes on a single thread, so the
+// threads setting the states, e.g. the playback thread, only queue a copy
+// of the new state. Queueing is lock free, the states of a node are
+// delivered in the order they were set. The queued notifications come
+// from a preallocated pool, the heap is only used once it is exhausted.
+// In synchronous mode, meant for tests, setState() returns once the
+// queued states are delivered, delivering them itself unless the notifier
+// thread is.
+class StateNotifier {
+public:
+  static StateNotifier &getInstance();
+
+  static void setSynchronous(bool synchronous) {
+    synchronousFlag.store(synchronous);
+  }
+  static bool isSynchronous() { return synchronousFlag.load(); }
+
+  // Queues the state, never blocks.
+  void post(std::shared_ptr<StateSubscribers> subscribers,
+            AudioGraphNode *node, uint64_t version, const StreamState &state);
+
+  // Delivers the states queued so far on the calling thread, unless it is
+  // already delivering states.
+  void deliverPending();
+
+private:
+  struct Notification {
+    std::atomic<Notification *> next = nullptr;
+    std::shared_ptr<StateSubscribers> subscribers;
+    AudioGraphNode *node = nullptr;
+    uint64_t version = 0;
+    // Kept when the notification returns to the pool, so the storage of
+    // the message is reused.
+    std::optional<StreamState> state;
+    // Index + 1 of the next free notification of the pool, 0 at the end.
+    std::atomic<uint32_t> nextFree = 0;
+  };
+
+  static constexpr size_t POOL_SIZE = 256;
+
+  inline static std::atomic<bool> synchronousFlag = false;
+
+  // Intrusive multi producer, single consumer queue. Producers push to
+  // head, the consumer pops from tail.
+  std::atomic<Notification *> head;
+  Notification *tail;
+  Notification stub;
+
+  std::array<Notification, POOL_SIZE> pool;
+  // Index + 1 of the first free notification in the low half, 0 if the
+  // pool is exhausted, and a tag bumped by every change in the high half,
+  // so a stale head is never swapped in.
+  std::atomic<uint64_t> freeHead = 0;
+
+  std::atomic<uint64_t> posted = 0;
+  std::atomic<uint64_t> delivered = 0;
+  std::atomic<uint32_t> wakeups = 0;
+  // Held by the thread delivering states.
+  std::mutex consumerMutex;
+  std::thread thread;
+
+  StateNotifier();
+
+  Notification *acquire();
+  void release(Notification *notification);
+  void push(Notification *notification);
+  Notification *pop();
+  // Consumer only: delivers the oldest queued state, if any.
+  bool deliverNext();
+  void deliver(Notification &notification);
+  void run();
+};
+
+#endif
@@ -2,106 +2,287 @@
 #define UTILS_H
 
 #include <array>
+#include <cstddef>
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <pthread.h>
 #include <stop_token>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
+namespace detail {
+// Stop sources which were not stopped, kept per thread for reuse by
+// CombinedStopToken since creating one allocates its shared state.
+class StopSourcePool {
+public:
+  static constexpr std::size_t CAPACITY = 16;
+
+  static std::stop_source acquire() {
+    auto &sources = pool();
+    if (sources.empty()) {
+      return std::stop_source();
+    }
+    auto source = std::move(sources.back());
+    sources.pop_back();
+    return source;
+  }
+
+  static void release(std::stop_source &&source) {
+    auto &sources = pool();
+    if (!source.stop_requested() && sources.size() < CAPACITY) {
+      sources.push_back(std::move(source));
+    }
+  }
+
+private:
+  static std::vector<std::stop_source> &pool() {
+    thread_local std::vector<std::stop_source> sources = [] {
+      std::vector<std::stop_source> reserved;
+      reserved.reserve(CAPACITY);
+      return reserved;
+    }();
+    return sources;
+  }
+};
+} // namespace detail
+
+// Stop token which is stopped as soon as any of the given tokens is.
+// Meant to be created per call on the stack: the callbacks are stored
+// inline and the stop source is taken from a per thread pool, so no
+// allocation happens once the pool is warm. A single token which can be
+// stopped is passed through as is.
+// The token returned by get_token() must not be used after the
+// CombinedStopToken is destroyed, its stop source may be reused.
 template <std::size_t N> class CombinedStopToken {
   static_assert(N > 0, "Number of tokens must be greater than 0");
 
 public:
   template <typename... Tokens>
-  CombinedStopToken(Tokens... tokens) : stopTokens_{tokens...} {
+  CombinedStopToken(const Tokens &...tokens) {
     static_assert(sizeof...(Tokens) == N,
                   "Number of tokens must match template parameter N");
     static_assert((std::is_same_v<Tokens, std::stop_token> && ...),
                   "All Tokens must be std::stop_token");
-    registerCallbacks(std::index_sequence_for<Tokens...>{});
+    // Tokens are only copied where needed, each copy is an atomic
+    // reference count update.
+    const std::size_t stoppable = (tokens.stop_possible() + ...);
+    if (stoppable == 1) {
+      ((tokens.stop_possible() ? (void)(passedToken_ = tokens) : (void)0),
+       ...);
+    }
+    if (stoppable <= 1) {
+      return;
+    }
+
+    combinedSource_ = detail::StopSourcePool::acquire();
+    std::size_t i = 0;
+    (registerCallback(i++, tokens), ...);
   }
 
-  std::stop_token get_token() { return combinedSource_.get_token(); }
+  ~CombinedStopToken() {
+    if (!combinedSource_.stop_possible()) {
+      return;
+    }
+    // Waits for callbacks running on other threads.
+    for (auto &callback : callbacks_) {
+      callback.reset();
+    }
+    detail::StopSourcePool::release(std::move(combinedSource_));
+  }
 
-private:
-  using Callback = std::stop_callback<std::function<void()>>;
-  std::array<std::stop_token, N> stopTokens_;
-  std::stop_source combinedSource_;
-  std::array<std::unique_ptr<Callback>, N> callbacks_;
+  // The callbacks refer to the stop source of this object.
+  CombinedStopToken(const CombinedStopToken &) = delete;
+  CombinedStopToken &operator=(const CombinedStopToken &) = delete;
 
-  template <std::size_t... Is>
-  void registerCallbacks(std::index_sequence<Is...>) {
-    (registerCallback<Is>(), ...);
+  std::stop_token get_token() const {
+    return combinedSource_.stop_possible() ? combinedSource_.get_token()
+                                           : passedToken_;
   }
 
-  template <std::size_t I> void registerCallback() {
-    auto &token = stopTokens_[I];
-    callbacks_[I] = std::make_unique<Callback>(
-        token, [this]() { combinedSource_.request_stop(); });
+private:
+  struct RequestStop {
+    std::stop_source *source;
+    void operator()() const noexcept { source->request_stop(); }
+  };
+
+  std::stop_source combinedSource_{std::nostopstate};
+  std::stop_token passedToken_;
+  std::array<std::optional<std::stop_callback<RequestStop>>, N> callbacks_;
+
+  void registerCallback(std::size_t i, const std::stop_token &token) {
+    if (token.stop_possible()) {
+      // Requests the stop right away if the token is already stopped.
+      callbacks_[i].emplace(token, RequestStop{&combinedSource_});
+    }
   }
 };
 
 template <typename... Tokens>
-CombinedStopToken<sizeof...(Tokens)> combineStopTokens(Tokens... tokens) {
+CombinedStopToken<sizeof...(Tokens)>
+combineStopTokens(const Tokens &...tokens) {
   return CombinedStopToken<sizeof...(Tokens)>(tokens...);
 }
 
-template <typename SignalType> class Signal {
+// Move only callable stored inline, constructing or calling it never
+// allocates. Callables larger than SIZE bytes do not compile.
+template <typename Signature, std::size_t SIZE> class InplaceFunction;
+
+template <typename R, typename... Args, std::size_t SIZE>
+class InplaceFunction<R(Args...), SIZE> {
+public:
+  InplaceFunction() = default;
+
+  template <typename F, typename = std::enable_if_t<!std::is_same_v<
+                            std::decay_t<F>, InplaceFunction>>>
+  InplaceFunction(F &&f) {
+    using Callable = std::decay_t<F>;
+    static_assert(sizeof(Callable) <= SIZE,
+                  "Callable does not fit into the inline storage");
+    static_assert(alignof(Callable) <= alignof(std::max_align_t),
+                  "Callable is over-aligned");
+    static_assert(std::is_nothrow_move_constructible_v<Callable>,
+                  "Callable must be nothrow move constructible");
+    new (storage) Callable(std::forward<F>(f));
+    invoker = [](void *callable, Args... args) -> R {
+      return (*static_cast<Callable *>(callable))(std::forward<Args>(args)...);
+    };
+    manager = [](void *dest, void *src) noexcept {
+      auto *callable = static_cast<Callable *>(src);
+      if (dest != nullptr) {
+        new (dest) Callable(std::move(*callable));
+      }
+      callable->~Callable();
+    };
+  }
+
+  InplaceFunction(InplaceFunction &&other) noexcept { moveFrom(other); }
+  InplaceFunction &operator=(InplaceFunction &&other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+  ~InplaceFunction() { reset(); }
+
+  explicit operator bool() const { return invoker != nullptr; }
+  R operator()(Args... args) {
+    return invoker(storage, std::forward<Args>(args)...);
+  }
+
+  void reset() {
+    if (manager != nullptr) {
+      manager(nullptr, storage);
+    }
+    invoker = nullptr;
+    manager = nullptr;
+  }
+
 private:
-  std::stop_source signalStopSource;
-  std::condition_variable_any cv;
-  mutable std::mutex mutex;
+  alignas(std::max_align_t) std::byte storage[SIZE];
+  R (*invoker)(void *, Args...) = nullptr;
+  // Moves the callable from src to dest, unless dest is null, and
+  // destroys it in src.
+  void (*manager)(void *dest, void *src) noexcept = nullptr;
 
-  std::optional<SignalType> value;
-  SignalType ackValue;
+  void moveFrom(InplaceFunction &other) {
+    if (other.manager == nullptr) {
+      return;
+    }
+    other.manager(storage, other.storage);
+    invoker = other.invoker;
+    manager = other.manager;
+    other.invoker = nullptr;
+    other.manager = nullptr;
+  }
+};
 
+// Thread which outlives the jobs it runs, so a node reused for another
+// track does not start a new thread. Each job gets a stop token of its
+// own, stop() cancels the running job and waits for it to return.
+class TrackWorker {
 public:
-  Signal() = default;
-  ~Signal() { cv.notify_all(); }
-
-  void sendValue(const SignalType &value) {
-    {
-      std::unique_lock lock(mutex);
-      this->value = value;
-      ackValue = SignalType();
-      signalStopSource.request_stop();
-    }
-    cv.notify_all();
+  using Job = InplaceFunction<void(std::stop_token), 32>;
+
+  explicit TrackWorker(const char *name)
+      : thread([this, name](std::stop_token token) {
+          pthread_setname_np(pthread_self(), name);
+          run(token);
+        }) {}
+
+  ~TrackWorker() {
+    stop();
+    thread.request_stop();
+    thread.join();
   }
 
-  std::optional<SignalType> getValue() const {
+  TrackWorker(const TrackWorker &) = delete;
+  TrackWorker &operator=(const TrackWorker &) = delete;
+
+  // Runs the job on the worker thread, a running job is stopped first.
+  void start(Job newJob) {
     std::unique_lock lock(mutex);
-    return value;
+    stopLocked(lock);
+    jobStopSource = std::stop_source();
+    job = std::move(newJob);
+    busy = true;
+    condition.notify_all();
   }
 
-  SignalType getResponse(std::stop_token stopToken) {
+  void stop() {
     std::unique_lock lock(mutex);
-    cv.wait(lock, stopToken, [this] { return !value.has_value(); });
-    if (stopToken.stop_requested()) {
-      return SignalType();
-    }
-    return ackValue;
+    stopLocked(lock);
   }
 
-  void respond(const SignalType &ackValue) {
-    std::unique_lock lock(mutex);
-    value.reset();
-    this->ackValue = ackValue;
-    signalStopSource = std::stop_source();
-    lock.unlock();
-    cv.notify_all();
+  // True until the job returns, on its own or after stop().
+  bool running() {
+    std::lock_guard lock(mutex);
+    return busy;
   }
 
-  std::stop_token getStopToken() const {
+  // Stop token of the current or the last job.
+  std::stop_token getStopToken() {
     std::lock_guard lock(mutex);
-    return signalStopSource.get_token();
+    return jobStopSource.get_token();
   }
 
-  std::optional<SignalType> waitValue(std::stop_token stopToken) {
+private:
+  std::mutex mutex;
+  std::condition_variable_any condition;
+  Job job;
+  std::stop_source jobStopSource;
+  bool busy = false;
+  // Declared last, the thread uses all of the above.
+  std::jthread thread;
+
+  void stopLocked(std::unique_lock<std::mutex> &lock) {
+    if (!busy) {
+      return;
+    }
+    jobStopSource.request_stop();
+    condition.wait(lock, [this] { return !busy; });
+  }
+
+  void run(std::stop_token token) {
     std::unique_lock lock(mutex);
-    cv.wait(lock, stopToken, [this] { return value.has_value(); });
-    return value;
+    while (condition.wait(lock, token, [this] { return bool(job); })) {
+      auto current = std::move(job);
+      auto jobToken = jobStopSource.get_token();
+      lock.unlock();
+      current(jobToken);
+      current.reset();
+      lock.lock();
+      busy = false;
+      condition.notify_all();
+    }
   }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,31 @@
+#ifndef XRUN_STATS_H
+#define XRUN_STATS_H
+
+#include "AudioGraphNode.h"
+
+#include <cstdint>
+#include <vector>
+
+struct XrunEvent {
+  // Steady clock timestamp, same as StreamState::timestamp.
+  unsigned long long timestamp;
+  // Position in the track being played.
+  long positionMs;
+  // -EPIPE for an underrun, -ESTRPIPE for a suspended device.
+  int error;
+  uint32_t bufferTimeMs;
+  uint32_t periodTimeMs;
+  std::vector<NodeBufferLevel> bufferLevels;
+};
+
+struct XrunStats {
+  // Number of xruns since startup.
+  uint64_t count = 0;
+  // The most recent xruns, oldest first.
+  std::vector<XrunEvent> recent;
+  // Current device settings.
+  uint32_t bufferTimeMs = 0;
+  uint32_t periodTimeMs = 0;
+};
+
+#endif
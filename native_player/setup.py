@@ -8,16 +8,23 @@ extensions = [
         "native_player",
         sources=[
             "Buffer.cpp",
+            "AdaptiveLatency.cpp",
             "AlsaAudioEmitter.cpp",
             "AudioSampleFormat.cpp",
             "AudioGraphHttpStream.cpp",
             "AudioGraphNode.cpp",
             "AudioPlayer.cpp",
             "AudioStreamSwitcher.cpp",
+            "DeadlineMonitor.cpp",
+            "FileAudioEmitter.cpp",
             "FlacStreamDecoder.cpp",
+            "GainNode.cpp",
+            "Metrics.cpp",
+            "NullAudioEmitter.cpp",
             "PerfMon.cpp",
             "StreamState.cpp",
             "StateMonitor.cpp",
+            "StateNotifier.cpp",
             "PyBindings.cpp",
             "Log.cpp",
         ],
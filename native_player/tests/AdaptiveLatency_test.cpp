@@ -0,0 +1,47 @@
+#include "AdaptiveLatency.h"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+class AdaptiveLatencyTest : public ::testing::Test {
+protected:
+  AdaptiveLatency::Clock::time_point now = AdaptiveLatency::Clock::now();
+  AdaptiveLatency latency{{40, 10}, 200, 3, 10s, 60s};
+};
+
+TEST_F(AdaptiveLatencyTest, raisedAfterRepeatedXruns) {
+  EXPECT_FALSE(latency.onXrun(now));
+  EXPECT_FALSE(latency.onXrun(now + 1s));
+  EXPECT_TRUE(latency.onXrun(now + 2s));
+  EXPECT_EQ(latency.getSettings(), (AdaptiveLatency::Settings{80, 20}));
+}
+
+TEST_F(AdaptiveLatencyTest, sparseXrunsAreTolerated) {
+  EXPECT_FALSE(latency.onXrun(now));
+  EXPECT_FALSE(latency.onXrun(now + 8s));
+  EXPECT_FALSE(latency.onXrun(now + 16s));
+  EXPECT_EQ(latency.getSettings(), (AdaptiveLatency::Settings{40, 10}));
+}
+
+TEST_F(AdaptiveLatencyTest, limitedByMaxLatency) {
+  for (int i = 0; i < 12; ++i) {
+    latency.onXrun(now + i * 1ms);
+  }
+  EXPECT_EQ(latency.getSettings(), (AdaptiveLatency::Settings{160, 40}));
+}
+
+TEST_F(AdaptiveLatencyTest, loweredWhenStable) {
+  for (int i = 0; i < 6; ++i) {
+    latency.onXrun(now + i * 1ms);
+  }
+  ASSERT_EQ(latency.getSettings(), (AdaptiveLatency::Settings{160, 40}));
+
+  EXPECT_FALSE(latency.lowerIfStable(now + 30s));
+  EXPECT_TRUE(latency.lowerIfStable(now + 61s));
+  EXPECT_EQ(latency.getSettings(), (AdaptiveLatency::Settings{80, 20}));
+  EXPECT_FALSE(latency.lowerIfStable(now + 62s));
+  EXPECT_TRUE(latency.lowerIfStable(now + 122s));
+  EXPECT_EQ(latency.getSettings(), (AdaptiveLatency::Settings{40, 10}));
+  EXPECT_FALSE(latency.lowerIfStable(now + 1000s));
+}
@@ -1,11 +1,13 @@
 #include "AlsaAudioEmitter.h"
 #include "SineWaveNode.h"
 
+#include <algorithm>
 #include <cmath>
 #include <gtest/gtest.h>
 
 #include "Config.h"
 #include "ErrorFakeNode.h"
+#include "Metrics.h"
 #include "SlowOutputNode.h"
 #include "TestHelpers.h"
 
@@ -70,7 +72,7 @@ TEST_F(AlsaAudioEmitterTest, pause) {
       AudioGraphNodeState::STREAMING);
   auto sleepAmount = totalDuration / 2;
   std::this_thread::sleep_for(std::chrono::milliseconds(sleepAmount));
-  alsaAudioEmitter->pause(true);
+  alsaAudioEmitter->pause(true).get();
   auto state = waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::PAUSED,
                              std::chrono::milliseconds(1000));
   EXPECT_EQ(state.state, AudioGraphNodeState::PAUSED);
@@ -80,7 +82,7 @@ TEST_F(AlsaAudioEmitterTest, pause) {
               30);
   ASSERT_EQ(alsaAudioEmitter->getState().state, AudioGraphNodeState::PAUSED);
   std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  alsaAudioEmitter->pause(false);
+  alsaAudioEmitter->pause(false).get();
   EXPECT_EQ(
       waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING).state,
       AudioGraphNodeState::STREAMING);
@@ -132,7 +134,8 @@ TEST_F(AlsaAudioEmitterTest, test_seekToForward) {
       AudioGraphNodeState::STREAMING);
   auto sleepAmount = totalDuration / 4;
   std::this_thread::sleep_for(std::chrono::milliseconds(sleepAmount));
-  EXPECT_EQ(alsaAudioEmitter->seek(totalDuration / 2), totalDuration / 2);
+  EXPECT_EQ(alsaAudioEmitter->seek(totalDuration / 2).get(),
+            totalDuration / 2);
   auto state = waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING);
   EXPECT_NEAR(state.position, 1000, 10);
   EXPECT_EQ(
@@ -150,7 +153,7 @@ TEST_F(AlsaAudioEmitterTest, test_seekBackwards) {
       AudioGraphNodeState::STREAMING);
   auto sleepAmount = totalDuration / 4;
   std::this_thread::sleep_for(std::chrono::milliseconds(sleepAmount));
-  alsaAudioEmitter->seek(0);
+  alsaAudioEmitter->seek(0).get();
   auto state = waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING);
   EXPECT_NEAR(state.position, 0, 10);
   EXPECT_EQ(
@@ -160,7 +163,7 @@ TEST_F(AlsaAudioEmitterTest, test_seekBackwards) {
 }
 
 TEST_F(AlsaAudioEmitterTest, test_seekWhenStopped) {
-  EXPECT_EQ(alsaAudioEmitter->seek(0), -1);
+  EXPECT_EQ(alsaAudioEmitter->seek(0).get(), -1);
 }
 
 TEST_F(AlsaAudioEmitterTest, test_seekAfterFinished) {
@@ -173,7 +176,7 @@ TEST_F(AlsaAudioEmitterTest, test_seekAfterFinished) {
   EXPECT_EQ(
       waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::FINISHED).state,
       AudioGraphNodeState::FINISHED);
-  alsaAudioEmitter->seek(10);
+  alsaAudioEmitter->seek(10).get();
   auto state = waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING);
   EXPECT_EQ(state.position, 10);
   EXPECT_EQ(
@@ -186,7 +189,8 @@ TEST_F(AlsaAudioEmitterTest, test_seekPastEnd) {
   auto outputNode = std::make_shared<SineWaveNode>(440, totalDuration);
   alsaAudioEmitter->connectTo(outputNode);
   waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING);
-  EXPECT_EQ(alsaAudioEmitter->seek(totalDuration + 100), totalDuration);
+  EXPECT_EQ(alsaAudioEmitter->seek(totalDuration + 100).get(),
+            totalDuration);
   auto state = waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::FINISHED,
                              std::chrono::milliseconds(2000));
   EXPECT_EQ(state.state, AudioGraphNodeState::FINISHED);
@@ -199,13 +203,68 @@ TEST_F(AlsaAudioEmitterTest, test_seekToEndAndBack) {
   EXPECT_EQ(
       waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING).state,
       AudioGraphNodeState::STREAMING);
-  EXPECT_EQ(alsaAudioEmitter->seek(totalDuration), totalDuration);
+  EXPECT_EQ(alsaAudioEmitter->seek(totalDuration).get(), totalDuration);
   EXPECT_EQ(waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::FINISHED,
                           std::chrono::milliseconds(1000))
                 .state,
             AudioGraphNodeState::FINISHED);
-  EXPECT_EQ(alsaAudioEmitter->seek(0), 0);
+  EXPECT_EQ(alsaAudioEmitter->seek(0).get(), 0);
   auto state = waitForStatus(*alsaAudioEmitter, AudioGraphNodeState::STREAMING);
   EXPECT_EQ(state.position, 0);
   EXPECT_EQ(state.state, AudioGraphNodeState::STREAMING);
-}
\ No newline at end of file
+}
+
+TEST(AlsaAudioEmitterTimerSchedulingTest, playsAndSeeks) {
+  Config config = {{"output.alsa.device", "default"},
+                   {"output.alsa.latency_ms", "80"},
+                   {"output.alsa.period_ms", "20"},
+                   {"output.alsa.timer_scheduling.enabled", "true"},
+                   {"output.alsa.timer_scheduling.buffer_ms", "1000"},
+                   {"output.alsa.timer_scheduling.max_fill_ms", "500"}};
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 3000);
+  auto start = std::chrono::steady_clock::now();
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  // Starts with the latency filled, not the whole buffer.
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(500));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  EXPECT_EQ(emitter->seek(2000).get(), 2000);
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  EXPECT_NEAR(state.position, 2000, 10);
+  EXPECT_EQ(waitForStatus(*emitter, AudioGraphNodeState::FINISHED).state,
+            AudioGraphNodeState::FINISHED);
+  emitter->disconnect(outputNode);
+}
+
+TEST(AlsaAudioEmitterPrerollTest, playsAndSeeks) {
+  Config config = {{"output.alsa.device", "default"},
+                   {"output.alsa.latency_ms", "1000"},
+                   {"output.alsa.period_ms", "20"},
+                   {"output.alsa.preroll.enabled", "true"},
+                   {"output.alsa.preroll.start_ms", "60"}};
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 3000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_EQ(emitter->seek(1000).get(), 1000);
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  EXPECT_NEAR(state.position, 1000, 10);
+  EXPECT_EQ(waitForStatus(*emitter, AudioGraphNodeState::FINISHED).state,
+            AudioGraphNodeState::FINISHED);
+
+  // Measured for the start and the seek.
+  auto samples = MetricsRegistry::getInstance().snapshot();
+  auto sample = std::find_if(
+      samples.begin(), samples.end(), [&emitter](const MetricSample &sample) {
+        return sample.group == emitter->getMetricsGroupName() &&
+               sample.name == "time_to_first_sample_ns";
+      });
+  ASSERT_NE(sample, samples.end());
+  EXPECT_EQ(sample->value, 2);
+  emitter->disconnect(outputNode);
+}
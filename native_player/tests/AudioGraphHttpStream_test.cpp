@@ -42,6 +42,30 @@ TEST_F(AudioGraphHttpStreamTest, read) {
   EXPECT_EQ(totalBytesRead, totalLength);
 }
 
+TEST_F(AudioGraphHttpStreamTest, reopen) {
+  auto audioGraphHttpStream =
+      std::make_shared<AudioGraphHttpStream>(bufferSize);
+  EXPECT_EQ(audioGraphHttpStream->getState().state,
+            AudioGraphNodeState::STOPPED);
+  audioGraphHttpStream->open(urlNoRanges);
+  waitForStatus(*audioGraphHttpStream, AudioGraphNodeState::STREAMING);
+
+  audioGraphHttpStream->open(url);
+  std::vector<uint8_t> data(bufferSize);
+  auto state =
+      waitForStatus(*audioGraphHttpStream, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(state.position, 0);
+  size_t totalLength = state.streamInfo.value().streamSize;
+  size_t bytesToRead = 0;
+  size_t totalBytesRead = 0;
+  while ((bytesToRead =
+              audioGraphHttpStream->waitForData(std::stop_token(), 1)) != 0) {
+    audioGraphHttpStream->read(data.data(), bytesToRead);
+    totalBytesRead += bytesToRead;
+  }
+  EXPECT_EQ(totalBytesRead, totalLength);
+}
+
 TEST_F(AudioGraphHttpStreamTest, read_no_ranges) {
   auto audioGraphHttpStream =
       std::make_shared<AudioGraphHttpStream>(urlNoRanges, bufferSize);
@@ -25,6 +25,11 @@ protected:
   AudioPlayer audioPlayer;
 
   AudioPlayerTest() : audioPlayer(config) {}
+
+  // The tests check the states received by monitors once the player
+  // reached a state.
+  void SetUp() override { StateNotifier::setSynchronous(true); }
+  void TearDown() override { StateNotifier::setSynchronous(false); }
 };
 
 TEST_F(AudioPlayerTest, constructor_destructor) {}
@@ -135,7 +140,7 @@ TEST_F(AudioPlayerTest, seek_forward) {
   auto monitor = audioPlayer.monitor();
   audioPlayer.play(url3);
   std::this_thread::sleep_for(std::chrono::seconds(4));
-  audioPlayer.seek(6000);
+  audioPlayer.seek(6000).get();
 
   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
 
@@ -163,7 +168,7 @@ TEST_F(AudioPlayerTest, seek_backward) {
   auto monitor = audioPlayer.monitor();
   audioPlayer.play(url3);
   std::this_thread::sleep_for(std::chrono::seconds(4));
-  audioPlayer.seek(0);
+  audioPlayer.seek(0).get();
 
   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
 
@@ -192,8 +197,8 @@ TEST_F(AudioPlayerTest, seek_one_after_another) {
   audioPlayer.play(url3);
 
   std::this_thread::sleep_for(std::chrono::seconds(4));
-  EXPECT_EQ(audioPlayer.seek(5000), 5000);
-  EXPECT_EQ(audioPlayer.seek(500), 500);
+  EXPECT_EQ(audioPlayer.seek(5000).get(), 5000);
+  EXPECT_EQ(audioPlayer.seek(500).get(), 500);
 
   std::this_thread::sleep_for(std::chrono::seconds(4));
 
@@ -221,7 +226,7 @@ TEST_F(AudioPlayerTest, test_play_pause_next) {
   auto monitor = audioPlayer.monitor();
   audioPlayer.play(url1);
   std::this_thread::sleep_for(std::chrono::seconds(2));
-  audioPlayer.pause(true);
+  audioPlayer.pause(true).get();
   std::this_thread::sleep_for(std::chrono::seconds(2));
   audioPlayer.play(url2);
 
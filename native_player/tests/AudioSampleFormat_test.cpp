@@ -1,5 +1,6 @@
 #include "AudioSampleFormat.h"
 
+#include <cstdint>
 #include <gtest/gtest.h>
 #include <vector>
 
@@ -151,4 +152,129 @@ TEST(AudioSampleFormatTest, DestinationBufferCannoFitAllSamples) {
   for (size_t i = 0; i < destSamples.size(); ++i) {
     EXPECT_EQ(sourceSamples[i], destSamples[i]) << "i = " << i;
   }
-}
\ No newline at end of file
+}
+
+TEST(AudioSampleFormatTest, CrossfadePCM16) {
+  const size_t frames = 5;
+  std::vector<int16_t> fadeOut(frames * 2, 1000);
+  std::vector<int16_t> fadeIn(frames * 2, -1000);
+
+  crossfadeSamples(fadeOut.data(), fadeIn.data(), AudioSampleFormat::PCM16_LE,
+                   frames, 2, 0, 4);
+
+  const std::vector<int16_t> expectedSamples = {1000, 1000, 500,   500,  0,
+                                                0,    -500, -500, -1000, -1000};
+  for (size_t i = 0; i < fadeOut.size(); ++i) {
+    EXPECT_EQ(fadeOut[i], expectedSamples[i]) << "i = " << i;
+  }
+}
+
+TEST(AudioSampleFormatTest, CrossfadePCM24KeepsSign) {
+  const size_t frames = 3;
+  std::vector<int32_t> fadeOut(frames * 2, -2000000 & 0xFFFFFF);
+  std::vector<int32_t> fadeIn(frames * 2, -1000000 & 0xFFFFFF);
+
+  crossfadeSamples(fadeOut.data(), fadeIn.data(), AudioSampleFormat::PCM24_LE,
+                   frames, 2, 1, 2);
+
+  const std::vector<int32_t> expectedSamples = {-1500000, -1500000, -1000000,
+                                                -1000000, -500000,  -500000};
+  for (size_t i = 0; i < fadeOut.size(); ++i) {
+    EXPECT_EQ(fadeOut[i], expectedSamples[i] & 0xFFFFFF) << "i = " << i;
+  }
+}
+
+TEST(AudioSampleFormatTest, ApplyGainPCM16) {
+  const size_t frames = 7;
+  std::vector<int16_t> samples(frames * 2, 10000);
+  DitherState dither;
+
+  applyGain(samples.data(), AudioSampleFormat::PCM16_LE, frames, 2, 0.5f, 0.0f,
+            dither);
+
+  for (size_t i = 0; i < samples.size(); ++i) {
+    EXPECT_NEAR(samples[i], 5000, 1.5) << "i = " << i;
+  }
+}
+
+TEST(AudioSampleFormatTest, ApplyGainPCM24Clips) {
+  const size_t frames = 4;
+  std::vector<int32_t> samples(frames * 2);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = (i % 2 ? -8000000 : 8000000) & 0xFFFFFF;
+  }
+  DitherState dither;
+
+  applyGain(samples.data(), AudioSampleFormat::PCM24_LE, frames, 2, 2.0f, 0.0f,
+            dither);
+
+  for (size_t i = 0; i < samples.size(); ++i) {
+    EXPECT_EQ(samples[i], (i % 2 ? -8388608 : 8388607) & 0xFFFFFF)
+        << "i = " << i;
+  }
+}
+
+namespace {
+// Encodes 24 bit samples in the given format.
+std::vector<uint8_t> encodeSamples(const std::vector<int32_t> &samples,
+                                   AudioSampleFormat format) {
+  std::vector<uint8_t> buffer(samples.size() * sampleSize(format));
+  convertSampleFormat(samples.data(), AudioSampleFormat::PCM24_LE,
+                      samples.size(), buffer.data(), format, buffer.size());
+  return buffer;
+}
+
+std::vector<int32_t> decodeSamples(const std::vector<uint8_t> &buffer,
+                                   AudioSampleFormat format) {
+  std::vector<int32_t> samples(buffer.size() / sampleSize(format));
+  convertSampleFormat(buffer.data(), format, samples.size(), samples.data(),
+                      AudioSampleFormat::PCM24_LE,
+                      samples.size() * sizeof(int32_t));
+  for (auto &sample : samples) {
+    sample = (sample << 8) >> 8;
+  }
+  return samples;
+}
+} // namespace
+
+TEST(AudioSampleFormatTest, ApplyGainStereoMatchesScalarPath) {
+  // Odd, so the last frame takes the scalar tail of the stereo path
+  const size_t frames = 33;
+  std::vector<int32_t> source(frames * 2);
+  for (size_t i = 0; i < source.size(); ++i) {
+    source[i] = (i % 2 ? -1 : 1) * static_cast<int32_t>(i * 250000 % 8388607);
+  }
+
+  for (auto format : {AudioSampleFormat::PCM16_LE, AudioSampleFormat::PCM24_LE,
+                      AudioSampleFormat::PCM32_LE}) {
+    const double lsb = format == AudioSampleFormat::PCM16_LE ? 256.0 : 1.0;
+    const auto input = decodeSamples(encodeSamples(source, format), format);
+
+    // Stereo with a ramp, against the exact gain. The dither, the rounding
+    // and the float precision of large samples add up to less than 2 LSBs.
+    auto stereo = encodeSamples(input, format);
+    DitherState stereoDither;
+    applyGain(stereo.data(), format, frames, 2, 0.25f, 0.02f, stereoDither);
+    const auto ramped = decodeSamples(stereo, format);
+    for (size_t i = 0; i < input.size(); ++i) {
+      const double gain = 0.25 + static_cast<double>(i / 2) * 0.02;
+      EXPECT_NEAR(ramped[i], input[i] * gain, 2 * lsb)
+          << sampleFormatToString(format) << " i = " << i;
+    }
+
+    // Stereo against the same samples as one channel, which are processed
+    // one at a time. Only the dither differs, by less than an LSB each.
+    stereo = encodeSamples(input, format);
+    auto scalar = encodeSamples(input, format);
+    stereoDither = DitherState{};
+    DitherState scalarDither;
+    applyGain(stereo.data(), format, frames, 2, 0.7f, 0.0f, stereoDither);
+    applyGain(scalar.data(), format, frames * 2, 1, 0.7f, 0.0f, scalarDither);
+    const auto vectorResult = decodeSamples(stereo, format);
+    const auto scalarResult = decodeSamples(scalar, format);
+    for (size_t i = 0; i < input.size(); ++i) {
+      EXPECT_NEAR(vectorResult[i], scalarResult[i], 2 * lsb)
+          << sampleFormatToString(format) << " i = " << i;
+    }
+  }
+}
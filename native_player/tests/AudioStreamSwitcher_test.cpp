@@ -37,6 +37,54 @@ public:
   }
 };
 
+// Streams a sine wave once it is set ready, until then it is preparing.
+class PreparingNode : public SineWaveNode {
+public:
+  using SineWaveNode::SineWaveNode;
+
+  std::atomic<bool> ready = false;
+
+  virtual StreamState getState() override {
+    return ready ? SineWaveNode::getState()
+                 : StreamState(AudioGraphNodeState::PREPARING);
+  }
+};
+
+// Holds read() until it is released.
+class BlockingReadNode : public SineWaveNode {
+public:
+  using SineWaveNode::SineWaveNode;
+
+  std::atomic<bool> reading = false;
+  std::atomic<bool> released = false;
+
+  virtual size_t read(void *data, size_t size) override {
+    reading = true;
+    reading.notify_all();
+    released.wait(false);
+    return SineWaveNode::read(data, size);
+  }
+};
+
+// Holds getState() while it is set blocking, until it is released.
+class BlockingStateNode : public PreparingNode {
+public:
+  using PreparingNode::PreparingNode;
+
+  std::atomic<bool> blocking = false;
+  std::atomic<bool> querying = false;
+  std::atomic<bool> released = false;
+
+  virtual StreamState getState() override {
+    if (blocking) {
+      querying = true;
+      querying.notify_all();
+      released.wait(false);
+    }
+    return PreparingNode::getState();
+  }
+};
+
 class AudioStreamSwitcherTest : public ::testing::Test {
 protected:
   std::shared_ptr<SineWaveNode> sineWaveNode440 =
@@ -211,6 +259,31 @@ TEST_F(AudioStreamSwitcherTest, disconnectDuringWait) {
   disconnectThread.join();
 }
 
+TEST_F(AudioStreamSwitcherTest, disconnectWaitsForRead) {
+  auto node = std::make_shared<BlockingReadNode>(440, 100);
+  audioStreamSwitcher->connectTo(node);
+  audioStreamSwitcher->acceptSourceChange();
+
+  std::vector<uint8_t> buffer(100);
+  std::thread readerThread(
+      [&]() { audioStreamSwitcher->read(buffer.data(), buffer.size()); });
+  node->reading.wait(false);
+
+  std::atomic<bool> disconnected = false;
+  std::thread disconnectThread([&]() {
+    audioStreamSwitcher->disconnect(node);
+    disconnected = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_FALSE(disconnected);
+
+  node->released = true;
+  node->released.notify_all();
+  readerThread.join();
+  disconnectThread.join();
+  EXPECT_TRUE(disconnected);
+}
+
 TEST_F(AudioStreamSwitcherTest, connect_after_finished) {
   audioStreamSwitcher->connectTo(sineWaveNode440);
   ASSERT_EQ(audioStreamSwitcher->getState().state,
@@ -239,4 +312,162 @@ TEST_F(AudioStreamSwitcherTest, connect_after_finished) {
   }
   EXPECT_EQ(audioStreamSwitcher->getState().state,
             AudioGraphNodeState::FINISHED);
-}
\ No newline at end of file
+}
+
+TEST_F(AudioStreamSwitcherTest, crossfade) {
+  auto crossfadeSwitcher =
+      std::make_shared<AudioStreamSwitcher>(std::chrono::milliseconds(20));
+  crossfadeSwitcher->connectTo(sineWaveNode440);
+  crossfadeSwitcher->connectTo(sineWaveNode880);
+  crossfadeSwitcher->acceptSourceChange();
+
+  const size_t frameSize = 4;
+  const size_t crossfadeFrames = 960;
+  std::vector<uint8_t> buffer(1024);
+  size_t totalBytes = 0;
+  while (crossfadeSwitcher->getState().state ==
+         AudioGraphNodeState::STREAMING) {
+    totalBytes += crossfadeSwitcher->read(buffer.data(), buffer.size());
+  }
+  ASSERT_EQ(crossfadeSwitcher->getState().state,
+            AudioGraphNodeState::SOURCE_CHANGED);
+  EXPECT_EQ(totalBytes, 4800 * frameSize);
+
+  crossfadeSwitcher->acceptSourceChange();
+  auto state = crossfadeSwitcher->getState();
+  EXPECT_EQ(state.state, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(state.position, crossfadeFrames);
+
+  totalBytes = 0;
+  while (crossfadeSwitcher->getState().state ==
+         AudioGraphNodeState::STREAMING) {
+    totalBytes += crossfadeSwitcher->read(buffer.data(), buffer.size());
+  }
+  EXPECT_EQ(totalBytes, (2400 - crossfadeFrames) * frameSize);
+  EXPECT_EQ(crossfadeSwitcher->getState().state,
+            AudioGraphNodeState::FINISHED);
+}
+
+TEST_F(AudioStreamSwitcherTest, crossfade_format_mismatch) {
+  auto crossfadeSwitcher =
+      std::make_shared<AudioStreamSwitcher>(std::chrono::milliseconds(20));
+  auto sineWaveNode880_44k = std::make_shared<SineWaveNode>(880, 50, 44100);
+  crossfadeSwitcher->connectTo(sineWaveNode440);
+  crossfadeSwitcher->connectTo(sineWaveNode880_44k);
+  crossfadeSwitcher->acceptSourceChange();
+
+  std::vector<uint8_t> buffer(1024);
+  size_t totalBytes = 0;
+  while (crossfadeSwitcher->getState().state ==
+         AudioGraphNodeState::STREAMING) {
+    totalBytes += crossfadeSwitcher->read(buffer.data(), buffer.size());
+  }
+  ASSERT_EQ(crossfadeSwitcher->getState().state,
+            AudioGraphNodeState::SOURCE_CHANGED);
+  EXPECT_EQ(totalBytes, 4800 * 4);
+
+  crossfadeSwitcher->acceptSourceChange();
+  EXPECT_EQ(crossfadeSwitcher->getState().position, 0);
+}
+
+TEST_F(AudioStreamSwitcherTest, prebuffer) {
+  auto prebufferSwitcher = std::make_shared<AudioStreamSwitcher>(
+      std::chrono::milliseconds(0), std::chrono::milliseconds(20));
+  EXPECT_FALSE(prebufferSwitcher->isNextSourceReady());
+
+  prebufferSwitcher->connectTo(sineWaveNode440);
+  EXPECT_TRUE(prebufferSwitcher->isNextSourceReady());
+
+  prebufferSwitcher->acceptSourceChange();
+  EXPECT_EQ(prebufferSwitcher->getState().state,
+            AudioGraphNodeState::STREAMING);
+  EXPECT_FALSE(prebufferSwitcher->isNextSourceReady());
+
+  prebufferSwitcher->connectTo(sineWaveNode880);
+  EXPECT_TRUE(prebufferSwitcher->isNextSourceReady());
+}
+
+TEST_F(AudioStreamSwitcherTest, silenceUntilNextSourceIsPrebuffered) {
+  auto prebufferSwitcher = std::make_shared<AudioStreamSwitcher>(
+      std::chrono::milliseconds(0), std::chrono::milliseconds(20));
+  auto nextNode = std::make_shared<PreparingNode>(880, 50);
+  prebufferSwitcher->connectTo(sineWaveNode440);
+  prebufferSwitcher->connectTo(nextNode);
+  prebufferSwitcher->acceptSourceChange();
+
+  // 100ms of the first source, then 10ms of silence
+  std::vector<uint8_t> buffer(100 * 192);
+  EXPECT_EQ(prebufferSwitcher->read(buffer.data(), buffer.size()),
+            buffer.size());
+  std::vector<uint8_t> silence(10 * 192, 0xff);
+  EXPECT_EQ(prebufferSwitcher->read(silence.data(), silence.size()),
+            silence.size());
+  EXPECT_EQ(silence, std::vector<uint8_t>(silence.size(), 0));
+  EXPECT_EQ(prebufferSwitcher->waitForDataFor(
+                std::stop_token(), std::chrono::milliseconds(0), 192),
+            192);
+  EXPECT_EQ(prebufferSwitcher->getState().state,
+            AudioGraphNodeState::STREAMING);
+
+  nextNode->ready = true;
+  EXPECT_EQ(prebufferSwitcher->read(buffer.data(), buffer.size()), 0);
+  EXPECT_EQ(prebufferSwitcher->getState().state,
+            AudioGraphNodeState::SOURCE_CHANGED);
+  prebufferSwitcher->acceptSourceChange();
+  EXPECT_EQ(prebufferSwitcher->read(buffer.data(), 10 * 192), 10 * 192);
+  EXPECT_TRUE(isSineWaveValid(880, 10, buffer.data()));
+}
+
+TEST_F(AudioStreamSwitcherTest, nextSourceIsQueriedWithoutTheLock) {
+  auto prebufferSwitcher = std::make_shared<AudioStreamSwitcher>(
+      std::chrono::milliseconds(0), std::chrono::milliseconds(20));
+  auto nextNode = std::make_shared<BlockingStateNode>(880, 50);
+  prebufferSwitcher->connectTo(sineWaveNode440);
+  prebufferSwitcher->connectTo(nextNode);
+  prebufferSwitcher->acceptSourceChange();
+
+  std::vector<uint8_t> buffer(100 * 192);
+  EXPECT_EQ(prebufferSwitcher->read(buffer.data(), buffer.size()),
+            buffer.size());
+  EXPECT_EQ(prebufferSwitcher->read(buffer.data(), 192), 192);
+
+  nextNode->blocking = true;
+  size_t bytes = 1;
+  std::thread readerThread(
+      [&]() { bytes = prebufferSwitcher->read(buffer.data(), 192); });
+  nextNode->querying.wait(false);
+
+  // Neither waits for the next source to answer.
+  EXPECT_TRUE(prebufferSwitcher->hasNextSource());
+  prebufferSwitcher->disconnect(nextNode);
+  EXPECT_FALSE(prebufferSwitcher->hasNextSource());
+
+  nextNode->released = true;
+  nextNode->released.notify_all();
+  readerThread.join();
+  // The source removed while it was queried is not switched to.
+  EXPECT_EQ(bytes, 0);
+  EXPECT_EQ(prebufferSwitcher->getState().state,
+            AudioGraphNodeState::FINISHED);
+}
+
+TEST_F(AudioStreamSwitcherTest, remainingTime) {
+  EXPECT_FALSE(audioStreamSwitcher->remainingTime().has_value());
+  EXPECT_FALSE(audioStreamSwitcher->hasNextSource());
+
+  audioStreamSwitcher->connectTo(sineWaveNode440);
+  EXPECT_TRUE(audioStreamSwitcher->hasNextSource());
+  audioStreamSwitcher->acceptSourceChange();
+  EXPECT_FALSE(audioStreamSwitcher->hasNextSource());
+  EXPECT_EQ(audioStreamSwitcher->remainingTime(),
+            std::chrono::milliseconds(100));
+
+  std::vector<uint8_t> buffer(480 * 4);
+  EXPECT_EQ(audioStreamSwitcher->read(buffer.data(), buffer.size()),
+            buffer.size());
+  EXPECT_EQ(audioStreamSwitcher->remainingTime(),
+            std::chrono::milliseconds(90));
+
+  audioStreamSwitcher->connectTo(sineWaveNode880);
+  EXPECT_TRUE(audioStreamSwitcher->hasNextSource());
+}
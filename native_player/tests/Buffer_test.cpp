@@ -1,6 +1,7 @@
 #include "Buffer.h"
 #include "PerfMon.h"
 
+#include <cstring>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -67,6 +68,26 @@ TEST_F(BufferTest, waitForSpace) {
   EXPECT_EQ(expectedData, actualData);
 }
 
+TEST_F(BufferTest, wrapAround) {
+  Buffer<uint8_t> buffer(8);
+  std::vector<uint8_t> out(8);
+  for (uint8_t i = 0; i < 40; i += 5) {
+    const uint8_t in[5] = {i, uint8_t(i + 1), uint8_t(i + 2), uint8_t(i + 3),
+                           uint8_t(i + 4)};
+    ASSERT_EQ(buffer.write(in, 5), 5);
+    ASSERT_EQ(buffer.read(out.data(), 5), 5);
+    EXPECT_EQ(std::vector<uint8_t>(out.begin(), out.begin() + 5),
+              std::vector<uint8_t>(in, in + 5));
+  }
+
+  const uint8_t in[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  EXPECT_EQ(buffer.write(in, 10), 8);
+  EXPECT_EQ(buffer.availableSpace(), 0);
+  EXPECT_EQ(buffer.read(out.data(), 10), 8);
+  EXPECT_EQ(out, std::vector<uint8_t>(in, in + 8));
+  EXPECT_TRUE(buffer.empty());
+}
+
 #ifdef PROFILE
 
 TEST_F(BufferTest, read_write_performance_test) {
@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include "CommandQueue.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+bool isReady(const std::future<int> &future) {
+  return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+} // namespace
+
+class CommandQueueTest : public ::testing::Test {
+protected:
+  CommandQueue<int, int, 4> queue{-1};
+
+  void SetUp() override { queue.open(); }
+};
+
+TEST_F(CommandQueueTest, postWhileClosed) {
+  queue.close();
+  auto result = queue.post(1);
+  ASSERT_TRUE(isReady(result));
+  EXPECT_EQ(result.get(), -1);
+  EXPECT_FALSE(queue.take());
+}
+
+TEST_F(CommandQueueTest, postTakeRespond) {
+  EXPECT_FALSE(queue.pending());
+  EXPECT_FALSE(queue.getStopToken().stop_requested());
+  auto result = queue.post(5);
+  EXPECT_FALSE(isReady(result));
+  EXPECT_TRUE(queue.pending());
+  EXPECT_TRUE(queue.getStopToken().stop_requested());
+
+  EXPECT_EQ(queue.take(), 5);
+  EXPECT_FALSE(queue.pending());
+  EXPECT_FALSE(queue.getStopToken().stop_requested());
+  EXPECT_FALSE(isReady(result));
+  queue.respond(50);
+  EXPECT_EQ(result.get(), 50);
+  EXPECT_FALSE(queue.take());
+}
+
+TEST_F(CommandQueueTest, latestCommandWins) {
+  auto first = queue.post(1);
+  auto second = queue.post(2);
+  auto third = queue.post(3);
+  EXPECT_EQ(queue.take(), 3);
+  queue.respond(30);
+  EXPECT_EQ(first.get(), 30);
+  EXPECT_EQ(second.get(), 30);
+  EXPECT_EQ(third.get(), 30);
+}
+
+TEST_F(CommandQueueTest, oldestCommandsAreDroppedWhenFull) {
+  std::vector<std::future<int>> results;
+  for (int i = 1; i <= 6; ++i) {
+    results.push_back(queue.post(i));
+  }
+  EXPECT_EQ(results[0].get(), -1);
+  EXPECT_EQ(results[1].get(), -1);
+  EXPECT_EQ(queue.take(), 6);
+  queue.respond(60);
+  for (size_t i = 2; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].get(), 60);
+  }
+}
+
+TEST_F(CommandQueueTest, commandsAfterTakeAreKept) {
+  auto first = queue.post(1);
+  EXPECT_EQ(queue.take(), 1);
+  auto second = queue.post(2);
+  queue.respond(10);
+  EXPECT_EQ(first.get(), 10);
+  EXPECT_TRUE(queue.getStopToken().stop_requested());
+  EXPECT_EQ(queue.take(), 2);
+  queue.respond(20);
+  EXPECT_EQ(second.get(), 20);
+}
+
+TEST_F(CommandQueueTest, closeCompletesPendingCommands) {
+  auto taken = queue.post(1);
+  EXPECT_EQ(queue.take(), 1);
+  auto pending = queue.post(2);
+  queue.close();
+  EXPECT_EQ(taken.get(), -1);
+  EXPECT_EQ(pending.get(), -1);
+
+  queue.open();
+  EXPECT_FALSE(queue.take());
+  auto result = queue.post(3);
+  EXPECT_EQ(queue.take(), 3);
+  queue.respond(30);
+  EXPECT_EQ(result.get(), 30);
+}
+
+TEST_F(CommandQueueTest, waitAndTake) {
+  std::jthread poster([this]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.post(7);
+  });
+  EXPECT_EQ(queue.waitAndTake(std::stop_token()), 7);
+  queue.respond(0);
+
+  std::stop_source source;
+  std::jthread stopper([&source]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    source.request_stop();
+  });
+  EXPECT_FALSE(queue.waitAndTake(source.get_token()));
+}
+
+TEST(CommandQueueConcurrencyTest, allFuturesComplete) {
+  constexpr int POSTERS = 4;
+  constexpr int COMMANDS = 2000;
+  CommandQueue<int, int, 8> queue(-1);
+  queue.open();
+
+  std::jthread worker([&queue](std::stop_token token) {
+    while (auto command = queue.waitAndTake(token)) {
+      queue.respond(*command);
+    }
+    queue.close();
+  });
+
+  std::vector<std::jthread> posters;
+  std::vector<std::vector<std::future<int>>> results(POSTERS);
+  for (int i = 0; i < POSTERS; ++i) {
+    posters.emplace_back([&queue, &results, i]() {
+      for (int j = 1; j <= COMMANDS; ++j) {
+        results[i].push_back(queue.post(j));
+      }
+    });
+  }
+  posters.clear();
+
+  for (auto &posterResults : results) {
+    for (auto &result : posterResults) {
+      auto value = result.get();
+      EXPECT_TRUE(value == -1 || (value >= 1 && value <= COMMANDS)) << value;
+    }
+  }
+  EXPECT_EQ(queue.post(COMMANDS + 1).get(), COMMANDS + 1);
+}
@@ -0,0 +1,47 @@
+#include "DeadlineMonitor.h"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+TEST(DeadlineMonitorTest, noPeriods) {
+  DeadlineMonitor monitor;
+  auto stats = monitor.getStats();
+  EXPECT_EQ(stats.periods, 0);
+  EXPECT_EQ(stats.minSlackNs, 0);
+  EXPECT_EQ(monitor.getMinSlackNs(), 0);
+}
+
+TEST(DeadlineMonitorTest, slackAndNearMisses) {
+  DeadlineMonitor monitor;
+  monitor.setNearMissThreshold(20ms);
+  for (int i = 0; i < 98; ++i) {
+    monitor.record(60ms);
+  }
+  monitor.record(10ms);
+  monitor.record(-1ms);
+
+  auto stats = monitor.getStats();
+  EXPECT_EQ(stats.periods, 100);
+  EXPECT_EQ(stats.nearMisses, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.minSlackNs, -1'000'000);
+  EXPECT_NEAR(stats.p50SlackNs, 60'000'000, 60'000'000 / 16);
+  EXPECT_NEAR(stats.p1SlackNs, 10'000'000, 10'000'000 / 16);
+  EXPECT_EQ(monitor.getNearMisses(), stats.nearMisses);
+  EXPECT_EQ(monitor.getMinSlackNs(), stats.minSlackNs);
+}
+
+TEST(DeadlineMonitorTest, reset) {
+  DeadlineMonitor monitor;
+  monitor.setNearMissThreshold(20ms);
+  monitor.record(5ms);
+  monitor.reset();
+  monitor.record(40ms);
+
+  auto stats = monitor.getStats();
+  EXPECT_EQ(stats.periods, 1);
+  EXPECT_EQ(stats.nearMisses, 0);
+  EXPECT_EQ(stats.minSlackNs, 40'000'000);
+  EXPECT_EQ(monitor.getNearMissThreshold(), 20ms);
+}
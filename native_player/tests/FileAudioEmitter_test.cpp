@@ -0,0 +1,181 @@
+#include "FileAudioEmitter.h"
+#include "AudioStreamSwitcher.h"
+#include "SineWaveNode.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#include "TestHelpers.h"
+
+namespace {
+std::vector<uint8_t> readFile(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {});
+}
+
+uint32_t le32(const std::vector<uint8_t> &data, size_t offset) {
+  uint32_t value = 0;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+uint16_t le16(const std::vector<uint8_t> &data, size_t offset) {
+  uint16_t value = 0;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+std::vector<uint8_t> sineWave(int frequency, int durationMs) {
+  SineWaveNode node(frequency, durationMs);
+  std::vector<uint8_t> data(durationMs * 48 * 4);
+  data.resize(node.read(data.data(), data.size()));
+  return data;
+}
+
+StreamAudioFormat format(AudioSampleFormat sampleFormat) {
+  return StreamAudioFormat{.sampleRate = 44100,
+                           .channels = 2,
+                           .bitsPerSample = 24,
+                           .sampleFormat = sampleFormat};
+}
+} // namespace
+
+class FileAudioEmitterTest : public ::testing::Test {
+protected:
+  std::string path =
+      testing::TempDir() +
+      testing::UnitTest::GetInstance()->current_test_info()->name() + ".wav";
+
+  void TearDown() override {
+    std::remove(path.c_str());
+    for (int i = 1; i < 3; ++i) {
+      auto other = path;
+      other.insert(other.size() - 4, "-" + std::to_string(i));
+      std::remove(other.c_str());
+    }
+  }
+};
+
+TEST_F(FileAudioEmitterTest, writesWav) {
+  auto emitter = std::make_shared<FileAudioEmitter>(path);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 1000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED);
+  emitter->disconnect(outputNode);
+
+  auto data = readFile(path);
+  ASSERT_EQ(data.size(), 44 + 48000 * 4);
+  EXPECT_EQ(std::string(data.begin(), data.begin() + 4), "RIFF");
+  EXPECT_EQ(le32(data, 4), data.size() - 8);
+  EXPECT_EQ(std::string(data.begin() + 8, data.begin() + 16), "WAVEfmt ");
+  EXPECT_EQ(le16(data, 20), 1);
+  EXPECT_EQ(le16(data, 22), 2);
+  EXPECT_EQ(le32(data, 24), 48000);
+  EXPECT_EQ(le16(data, 34), 16);
+  EXPECT_EQ(le32(data, 40), 48000 * 4);
+  EXPECT_TRUE(std::equal(data.begin() + 44, data.end(),
+                         sineWave(440, 1000).begin()));
+  EXPECT_EQ(emitter->getFiles(), std::vector<std::string>{path});
+}
+
+TEST_F(FileAudioEmitterTest, gaplessSourcesShareAFile) {
+  auto emitter = std::make_shared<FileAudioEmitter>(path);
+  auto switcher = std::make_shared<AudioStreamSwitcher>();
+  switcher->connectTo(std::make_shared<SineWaveNode>(440, 100));
+  switcher->connectTo(std::make_shared<SineWaveNode>(880, 50));
+  switcher->connectTo(std::make_shared<SineWaveNode>(440, 100, 44100));
+  emitter->connectTo(switcher);
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED,
+                std::chrono::milliseconds(2000));
+  emitter->disconnect(switcher);
+
+  auto files = emitter->getFiles();
+  ASSERT_EQ(files.size(), 2);
+  auto expected = sineWave(440, 100);
+  auto second = sineWave(880, 50);
+  expected.insert(expected.end(), second.begin(), second.end());
+  auto data = readFile(files[0]);
+  ASSERT_EQ(data.size(), 44 + expected.size());
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), data.begin() + 44));
+
+  // The format change starts a new file.
+  EXPECT_EQ(files[1], path.substr(0, path.size() - 4) + "-1.wav");
+  data = readFile(files[1]);
+  EXPECT_EQ(le32(data, 24), 44100);
+  EXPECT_EQ(data.size(), 44 + 4410 * 4);
+}
+
+TEST_F(FileAudioEmitterTest, seekIsNotVisibleInOutput) {
+  auto emitter = std::make_shared<FileAudioEmitter>(
+      path, PcmFileContainer::RAW, false, true);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 1000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  emitter->pause(true).get();
+  emitter->seek(900).get();
+  emitter->pause(false).get();
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED);
+  auto framesRead = emitter->getStats().frames;
+  emitter->disconnect(outputNode);
+
+  EXPECT_LT(framesRead, 48000 / 2);
+  EXPECT_EQ(readFile(path).size(), framesRead * 4);
+}
+
+TEST(PcmFileWriterTest, storesPcm24AsPackedWav) {
+  const std::string path = testing::TempDir() + "PcmFileWriterTest24.wav";
+  const int32_t samples[] = {0x123456, 0x7fffff, 0xfedcba, 0x800000};
+  {
+    PcmFileWriter writer(path, PcmFileContainer::WAV, format(PCM24_LE));
+    writer.write(samples, sizeof(samples));
+    EXPECT_EQ(writer.dataBytes(), 4 * 3);
+  }
+  auto data = readFile(path);
+  std::remove(path.c_str());
+  ASSERT_EQ(data.size(), 44 + 4 * 3);
+  EXPECT_EQ(le16(data, 32), 6);
+  EXPECT_EQ(le16(data, 34), 24);
+  const std::vector<uint8_t> expected = {0x56, 0x34, 0x12, 0xff, 0xff, 0x7f,
+                                         0xba, 0xdc, 0xfe, 0x00, 0x00, 0x80};
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), data.begin() + 44));
+}
+
+TEST(PcmFileWriterTest, storesPcm32AsExtensibleWav) {
+  const std::string path = testing::TempDir() + "PcmFileWriterTest32.wav";
+  const int32_t samples[] = {0x12345600, -0x100};
+  {
+    PcmFileWriter writer(path, PcmFileContainer::WAV, format(PCM32_LE));
+    writer.write(samples, sizeof(samples));
+  }
+  auto data = readFile(path);
+  std::remove(path.c_str());
+  ASSERT_EQ(data.size(), 68 + sizeof(samples));
+  EXPECT_EQ(le32(data, 16), 40);
+  EXPECT_EQ(le16(data, 20), 0xfffe);
+  EXPECT_EQ(le16(data, 34), 32);
+  EXPECT_EQ(le16(data, 38), 24);
+  EXPECT_EQ(le32(data, 64), sizeof(samples));
+  EXPECT_EQ(std::memcmp(data.data() + 68, samples, sizeof(samples)), 0);
+}
+
+TEST(PcmFileWriterTest, directIo) {
+  // Not on tmpfs, which does not support O_DIRECT.
+  const std::string path = "PcmFileWriterTestDirect.raw";
+  std::vector<uint8_t> expected(PcmFileWriter::BUFFER_SIZE + 1001);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    expected[i] = i * 7;
+  }
+  {
+    PcmFileWriter writer(path, PcmFileContainer::RAW, format(PCM16_LE), true);
+    writer.write(expected.data(), 3);
+    writer.write(expected.data() + 3, expected.size() - 3);
+  }
+  EXPECT_EQ(readFile(path), expected);
+  std::remove(path.c_str());
+}
@@ -89,6 +89,36 @@ TEST_F(FlacStreamDecoderTest, getState) {
   EXPECT_EQ(flacStreamDecoder->getState().state, AudioGraphNodeState::STOPPED);
 }
 
+TEST_F(FlacStreamDecoderTest, reconnect) {
+  auto flacStreamDecoder = std::make_shared<FlacStreamDecoder>(bufferSize);
+  auto inputNode440 = std::make_shared<FileInputNode>("files/tone440.flac");
+  flacStreamDecoder->connectTo(inputNode440);
+  waitForStatus(*flacStreamDecoder, AudioGraphNodeState::STREAMING);
+  uint8_t data[1000];
+  EXPECT_EQ(flacStreamDecoder->read(data, 1000), 1000);
+  flacStreamDecoder->disconnect(inputNode440);
+
+  auto inputNode880 = std::make_shared<FileInputNode>("files/tone880.flac");
+  flacStreamDecoder->connectTo(inputNode880);
+  EXPECT_EQ(flacStreamDecoder->getState().state,
+            AudioGraphNodeState::PREPARING);
+  auto state =
+      waitForStatus(*flacStreamDecoder, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(state.position, 0);
+  ASSERT_TRUE(state.streamInfo.has_value());
+  EXPECT_EQ(state.streamInfo.value().streamSize, 44100);
+  int totalSize = 0;
+  int num = 0;
+  do {
+    flacStreamDecoder->waitForData();
+    num = flacStreamDecoder->read(data, 1000);
+    totalSize += num;
+  } while (num > 0 && flacStreamDecoder->getState().state !=
+                          AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(totalSize, 44100 * 4);
+  flacStreamDecoder->disconnect(inputNode880);
+}
+
 TEST_F(FlacStreamDecoderTest, stream_error) {
   auto flacStreamDecoder = std::make_shared<FlacStreamDecoder>(bufferSize);
   auto inputNode = std::make_shared<ErrorFakeNode>();
@@ -0,0 +1,87 @@
+#include "GainNode.h"
+#include "SineWaveNode.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+class GainNodeTest : public ::testing::Test {
+protected:
+  std::shared_ptr<SineWaveNode> reference =
+      std::make_shared<SineWaveNode>(440, 100);
+  std::shared_ptr<SineWaveNode> sineWaveNode =
+      std::make_shared<SineWaveNode>(440, 100);
+  std::shared_ptr<GainNode> gainNode =
+      std::make_shared<GainNode>(std::chrono::milliseconds(0));
+
+  void SetUp() override { gainNode->connectTo(sineWaveNode); }
+  void TearDown() override { gainNode->disconnect(sineWaveNode); }
+};
+
+TEST_F(GainNodeTest, mirrorsInputState) {
+  auto state = gainNode->getState();
+  EXPECT_EQ(state.state, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(state.streamInfo, sineWaveNode->getState().streamInfo);
+}
+
+TEST_F(GainNodeTest, unityGainIsBitPerfect) {
+  std::vector<int16_t> expected(960);
+  std::vector<int16_t> data(960);
+  reference->read(expected.data(), expected.size() * sizeof(int16_t));
+
+  EXPECT_EQ(gainNode->read(data.data(), data.size() * sizeof(int16_t)),
+            data.size() * sizeof(int16_t));
+  EXPECT_EQ(data, expected);
+}
+
+TEST_F(GainNodeTest, volume) {
+  gainNode->setVolume(0.5f);
+  std::vector<int16_t> expected(960);
+  std::vector<int16_t> data(960);
+  reference->read(expected.data(), expected.size() * sizeof(int16_t));
+  gainNode->read(data.data(), data.size() * sizeof(int16_t));
+
+  for (size_t i = 0; i < data.size(); ++i) {
+    EXPECT_NEAR(data[i], expected[i] / 2.0, 1.5) << "i = " << i;
+  }
+}
+
+TEST_F(GainNodeTest, queuedReplayGainAppliedOnSourceChange) {
+  gainNode->queueReplayGain(-6.0206f);
+  std::vector<int16_t> expected(960);
+  std::vector<int16_t> data(960);
+  reference->read(expected.data(), expected.size() * sizeof(int16_t));
+  gainNode->read(data.data(), data.size() * sizeof(int16_t));
+  EXPECT_EQ(data, expected);
+
+  gainNode->acceptSourceChange();
+  reference->read(expected.data(), expected.size() * sizeof(int16_t));
+  gainNode->read(data.data(), data.size() * sizeof(int16_t));
+  for (size_t i = 0; i < data.size(); ++i) {
+    EXPECT_NEAR(data[i], expected[i] / 2.0, 1.5) << "i = " << i;
+  }
+}
+
+TEST_F(GainNodeTest, volumeChangeIsRamped) {
+  auto rampedNode = std::make_shared<GainNode>(std::chrono::milliseconds(10));
+  auto input = std::make_shared<SineWaveNode>(440, 100);
+  rampedNode->connectTo(input);
+  rampedNode->setVolume(0.0f);
+
+  // 10ms at 48KHz, stereo
+  std::vector<int16_t> expected(960);
+  std::vector<int16_t> data(960);
+  reference->read(expected.data(), expected.size() * sizeof(int16_t));
+  rampedNode->read(data.data(), data.size() * sizeof(int16_t));
+  for (size_t i = 0; i < data.size(); ++i) {
+    const double gain = 1.0 - static_cast<double>(i / 2) / 480.0;
+    EXPECT_NEAR(data[i], expected[i] * gain, 1.5) << "i = " << i;
+  }
+
+  reference->read(expected.data(), expected.size() * sizeof(int16_t));
+  rampedNode->read(data.data(), data.size() * sizeof(int16_t));
+  for (size_t i = 0; i < data.size(); ++i) {
+    EXPECT_NEAR(data[i], 0, 1.5) << "i = " << i;
+  }
+  rampedNode->disconnect(input);
+}
@@ -0,0 +1,108 @@
+#include "Metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+std::vector<MetricSample> samplesOf(const std::string &group) {
+  auto samples = MetricsRegistry::getInstance().snapshot();
+  std::erase_if(samples, [&group](const MetricSample &sample) {
+    return sample.group != group;
+  });
+  return samples;
+}
+} // namespace
+
+TEST(MetricsTest, snapshot) {
+  MetricGroup group("MetricsTest.snapshot");
+  auto &counter = group.counter("counter");
+  auto &gauge = group.gauge("gauge");
+  auto &histogram = group.histogram("histogram");
+  int callbackValue = 7;
+  group.gauge("callback", [&callbackValue]() { return callbackValue; });
+
+  counter.add(3);
+  counter.add();
+  gauge.set(0.5);
+  histogram.record(1000);
+  histogram.record(3000);
+
+  EXPECT_EQ(group.getName(), "MetricsTest.snapshot#0");
+  auto samples = samplesOf(group.getName());
+  ASSERT_EQ(samples.size(), 4);
+  EXPECT_EQ(samples[0].name, "counter");
+  EXPECT_EQ(samples[0].type, MetricType::COUNTER);
+  EXPECT_EQ(samples[0].value, 4);
+  EXPECT_EQ(samples[1].name, "gauge");
+  EXPECT_EQ(samples[1].type, MetricType::GAUGE);
+  EXPECT_EQ(samples[1].value, 0.5);
+  EXPECT_EQ(samples[2].name, "histogram");
+  EXPECT_EQ(samples[2].type, MetricType::HISTOGRAM);
+  EXPECT_EQ(samples[2].value, 2);
+  EXPECT_EQ(samples[2].max, 3000);
+  EXPECT_EQ(samples[3].name, "callback");
+  EXPECT_EQ(samples[3].value, 7);
+}
+
+TEST(MetricsTest, groupsAreUnregistered) {
+  std::string name;
+  {
+    MetricGroup first("MetricsTest.instances");
+    MetricGroup second("MetricsTest.instances");
+    EXPECT_NE(first.getName(), second.getName());
+    second.counter("counter");
+    name = second.getName();
+    EXPECT_EQ(samplesOf(name).size(), 1);
+  }
+  EXPECT_TRUE(samplesOf(name).empty());
+}
+
+TEST(MetricsTest, rateMeter) {
+  RateMeter meter;
+  EXPECT_EQ(meter.perSecond(), 0);
+
+  auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start <
+         RateMeter::WINDOW + std::chrono::milliseconds(100)) {
+    meter.add(1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  // About 100 additions per second.
+  EXPECT_GT(meter.perSecond(), 50'000);
+  EXPECT_LT(meter.perSecond(), 150'000);
+}
+
+TEST(MetricsTest, threadCpuMeter) {
+  MetricGroup group("MetricsTest.threadCpuMeter");
+  ThreadCpuMeter meter(group);
+  meter.start();
+
+  auto busyUntil =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+  volatile uint64_t sink = 0;
+  while (std::chrono::steady_clock::now() < busyUntil) {
+    sink = sink + 1;
+  }
+  // Sampled at most once per interval.
+  meter.sample();
+  EXPECT_EQ(samplesOf(group.getName())[0].value, 0);
+
+  auto usage = meter.lap();
+  EXPECT_GT(usage.cpuTime, std::chrono::milliseconds(10));
+  EXPECT_LE(usage.cpuTime, std::chrono::milliseconds(1000));
+  auto samples = samplesOf(group.getName());
+  ASSERT_EQ(samples.size(), 3);
+  EXPECT_EQ(samples[0].name, "cpu_time_ns");
+  EXPECT_EQ(samples[0].value, usage.cpuTime.count());
+
+  // A lap starts where the previous one ended.
+  EXPECT_LT(meter.lap().cpuTime, usage.cpuTime);
+}
+
+TEST(MetricsTest, realtimeFactor) {
+  ThreadCpuUsage usage{std::chrono::milliseconds(10)};
+  EXPECT_DOUBLE_EQ(usage.realtimeFactor(std::chrono::seconds(1)), 100);
+  EXPECT_EQ(ThreadCpuUsage{}.realtimeFactor(std::chrono::seconds(1)), 0);
+}
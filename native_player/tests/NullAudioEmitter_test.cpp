@@ -0,0 +1,178 @@
+#include "NullAudioEmitter.h"
+#include "AudioStreamSwitcher.h"
+#include "SineWaveNode.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "ErrorFakeNode.h"
+#include "TestHelpers.h"
+
+TEST(NullAudioEmitterTest, constructor_destructor) {
+  NullAudioEmitter emitter;
+  EXPECT_THROW(NullAudioEmitter(false, std::chrono::milliseconds(0)),
+               std::runtime_error);
+}
+
+TEST(NullAudioEmitterTest, readsAsFastAsPossible) {
+  auto emitter = std::make_shared<NullAudioEmitter>();
+  auto outputNode = std::make_shared<SineWaveNode>(440, 5000);
+  auto start = std::chrono::steady_clock::now();
+  emitter->connectTo(outputNode);
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::FINISHED,
+                             std::chrono::milliseconds(2000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(state.position, 5000);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(2000));
+
+  auto stats = emitter->getStats();
+  EXPECT_EQ(stats.frames, 5 * 48000);
+  ASSERT_TRUE(stats.timeToFirstFrame.has_value());
+  EXPECT_LT(*stats.timeToFirstFrame, std::chrono::milliseconds(500));
+  EXPECT_EQ(stats.underruns, 0);
+  emitter->disconnect(outputNode);
+  EXPECT_EQ(emitter->getState().state, AudioGraphNodeState::STOPPED);
+}
+
+TEST(NullAudioEmitterTest, realtime) {
+  auto emitter = std::make_shared<NullAudioEmitter>(true);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 500);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED);
+
+  auto stats = emitter->getStats();
+  EXPECT_EQ(stats.frames, 48000 / 2);
+  // Reads are paced at the sample rate, only the first two periods are
+  // read at once to keep one buffered. A slow run only takes longer.
+  EXPECT_GE(stats.streamingTime, std::chrono::milliseconds(460));
+  emitter->disconnect(outputNode);
+}
+
+TEST(NullAudioEmitterTest, pause) {
+  auto emitter = std::make_shared<NullAudioEmitter>(true);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 1000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  emitter->pause(true).get();
+  auto state = emitter->getState();
+  EXPECT_EQ(state.state, AudioGraphNodeState::PAUSED);
+  auto frames = emitter->getStats().frames;
+  EXPECT_GT(frames, 0);
+  EXPECT_LT(frames, 48000);
+  EXPECT_EQ(state.position, static_cast<long>(frames * 1000 / 48000));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(emitter->getStats().frames, frames);
+
+  emitter->pause(false).get();
+  EXPECT_EQ(emitter->getState().state, AudioGraphNodeState::STREAMING);
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(emitter->getStats().frames, 48000);
+  emitter->disconnect(outputNode);
+}
+
+TEST(NullAudioEmitterTest, position) {
+  auto emitter = std::make_shared<NullAudioEmitter>(true);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 1000);
+  EXPECT_EQ(emitter->getPosition().sampleRate, 0);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto position = emitter->getPosition();
+  EXPECT_EQ(position.sampleRate, 48000);
+  EXPECT_TRUE(position.running);
+  EXPECT_GT(position.frames, 0);
+  EXPECT_LE(position.frames,
+            static_cast<int64_t>(emitter->getStats().frames));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_GT(emitter->getPosition().frames, position.frames);
+
+  emitter->pause(true).get();
+  position = emitter->getPosition();
+  EXPECT_FALSE(position.running);
+  EXPECT_EQ(position.positionMs(), emitter->getState().position);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(emitter->getPosition().frames, position.frames);
+  emitter->pause(false).get();
+
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(emitter->getPosition().frames, 48000);
+  emitter->disconnect(outputNode);
+  EXPECT_EQ(emitter->getPosition().sampleRate, 0);
+}
+
+TEST(NullAudioEmitterTest, seek) {
+  auto emitter = std::make_shared<NullAudioEmitter>(true);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 2000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(emitter->seek(1500).get(), 1500);
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(state.position, 1500);
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED);
+
+  auto stats = emitter->getStats();
+  ASSERT_EQ(stats.seekLatencies.size(), 1);
+  EXPECT_LT(stats.seekLatencies[0], std::chrono::milliseconds(100));
+  emitter->disconnect(outputNode);
+}
+
+TEST(NullAudioEmitterTest, rapidSeeksEndAtTheLatest) {
+  auto emitter = std::make_shared<NullAudioEmitter>(true);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 3000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  std::vector<std::future<size_t>> results;
+  for (size_t positionMs = 100; positionMs < 2000; positionMs += 10) {
+    results.push_back(emitter->seek(positionMs));
+  }
+  auto last = emitter->seek(2000);
+  // Seeks superseded before being handled share the result of a later
+  // one or, if too many were pending, are dropped.
+  for (auto &result : results) {
+    auto positionMs = result.get();
+    EXPECT_TRUE(positionMs == static_cast<size_t>(-1) ||
+                (positionMs >= 100 && positionMs <= 2000))
+        << positionMs;
+  }
+  EXPECT_EQ(last.get(), 2000);
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  EXPECT_GE(state.position, 2000);
+  emitter->disconnect(outputNode);
+}
+
+TEST(NullAudioEmitterTest, seekWhenStopped) {
+  NullAudioEmitter emitter;
+  EXPECT_EQ(emitter.seek(0).get(), -1);
+}
+
+TEST(NullAudioEmitterTest, switchGaps) {
+  auto emitter = std::make_shared<NullAudioEmitter>();
+  auto switcher = std::make_shared<AudioStreamSwitcher>();
+  switcher->connectTo(std::make_shared<SineWaveNode>(440, 100));
+  switcher->connectTo(std::make_shared<SineWaveNode>(880, 100));
+  switcher->connectTo(std::make_shared<SineWaveNode>(440, 100, 44100));
+  emitter->connectTo(switcher);
+  waitForStatus(*emitter, AudioGraphNodeState::FINISHED,
+                std::chrono::milliseconds(2000));
+
+  auto stats = emitter->getStats();
+  EXPECT_EQ(stats.frames, 4800 + 4800 + 4410);
+  // The second switch changes the sample rate.
+  EXPECT_EQ(stats.switchGaps.size(), 2);
+  emitter->disconnect(switcher);
+}
+
+TEST(NullAudioEmitterTest, stream_error) {
+  auto emitter = std::make_shared<NullAudioEmitter>();
+  auto outputNode = std::make_shared<ErrorFakeNode>();
+  emitter->connectTo(outputNode);
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::ERROR,
+                             std::chrono::milliseconds(1000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::ERROR);
+  EXPECT_EQ(state.message, "Fake error message");
+  emitter->disconnect(outputNode);
+}
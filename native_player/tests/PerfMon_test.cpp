@@ -0,0 +1,181 @@
+#include "PerfMon.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+TEST(LatencyHistogramTest, bucketBounds) {
+  for (uint64_t value : {0ul, 1ul, 15ul, 16ul, 17ul, 1000ul, 123456789ul,
+                         ~uint64_t(0)}) {
+    auto index = LatencyHistogram::bucketIndex(value);
+    ASSERT_LT(index, LatencyHistogram::BUCKETS);
+    auto highest = LatencyHistogram::bucketHighestValue(index);
+    EXPECT_GE(highest, value);
+    EXPECT_LE(highest - value, value / LatencyHistogram::SUB_BUCKETS);
+    if (index > 0) {
+      EXPECT_LT(LatencyHistogram::bucketHighestValue(index - 1), value);
+    }
+  }
+}
+
+TEST(LatencyHistogramTest, percentiles) {
+  LatencyHistogram histogram;
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    histogram.record(i * 1000);
+  }
+  histogram.record(50'000'000);
+
+  EXPECT_EQ(histogram.count(), 1001);
+  EXPECT_EQ(histogram.max(), 50'000'000);
+  EXPECT_NEAR(histogram.percentile(50), 500'000, 500'000 / 16);
+  EXPECT_NEAR(histogram.percentile(99), 990'000, 990'000 / 16);
+  EXPECT_EQ(histogram.percentile(100), 50'000'000);
+}
+
+TEST(PerfMonTest, marksFromMultipleThreads) {
+  auto &perfMon = PerfMon::getInstance();
+  auto id = perfMon.markId("PerfMonTest.threads");
+  EXPECT_EQ(perfMon.markId("PerfMonTest.threads"), id);
+
+  std::vector<std::jthread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&perfMon, id]() {
+      for (int i = 0; i < 1000; ++i) {
+        perfMon.begin(id);
+        perfMon.end(id);
+      }
+    });
+  }
+  threads.clear();
+
+  bool found = false;
+  for (const auto &stats : perfMon.getStats()) {
+    if (stats.name == "PerfMonTest.threads") {
+      found = true;
+      EXPECT_EQ(stats.count, 4000);
+      EXPECT_LE(stats.p50Ns, stats.p99Ns);
+      EXPECT_LE(stats.p99Ns, stats.p999Ns);
+      EXPECT_LE(stats.p999Ns, stats.maxNs);
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
+TEST(PerfMonTest, disabledMarksAreNotRecorded) {
+  PerfMon::setEnabled(false);
+  for (int i = 0; i < 10; ++i) {
+    perfmon_begin("PerfMonTest.disabled");
+    perfmon_end("PerfMonTest.disabled");
+  }
+  EXPECT_EQ(PerfMon::getInstance().getAverageNs("PerfMonTest.disabled"), 0);
+
+  PerfMon::setEnabled(true);
+  perfmon_begin("PerfMonTest.disabled");
+  PerfMon::setEnabled(false);
+  perfmon_end("PerfMonTest.disabled");
+  PerfMon::setEnabled(true);
+  perfmon_begin("PerfMonTest.disabled");
+  perfmon_end("PerfMonTest.disabled");
+  PerfMon::setEnabled(false);
+
+  for (const auto &stats : PerfMon::getInstance().getStats()) {
+    if (stats.name == "PerfMonTest.disabled") {
+      EXPECT_EQ(stats.count, 1);
+    }
+  }
+}
+
+TEST(TraceBufferTest, keepsMostRecentEvents) {
+  TraceBuffer buffer(8);
+  for (int i = 0; i < 20; ++i) {
+    buffer.record(TraceBuffer::Phase::INSTANT, 1, 2, i);
+  }
+
+  auto events = buffer.snapshot();
+  ASSERT_EQ(events.size(), 8);
+  for (size_t i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(events[i].value, 12 + i);
+    EXPECT_EQ(events[i].markId, 1);
+    EXPECT_EQ(events[i].threadId, 2);
+    EXPECT_EQ(events[i].phase, TraceBuffer::Phase::INSTANT);
+  }
+}
+
+TEST(TraceBufferTest, concurrentRecordAndSnapshot) {
+  TraceBuffer buffer(256);
+  std::atomic<bool> done = false;
+  std::jthread reader([&buffer, &done]() {
+    while (!done) {
+      for (const auto &event : buffer.snapshot()) {
+        // Each writer records its id as both the thread and the value.
+        ASSERT_EQ(event.value, event.threadId);
+      }
+    }
+  });
+
+  std::vector<std::jthread> writers;
+  for (uint32_t t = 0; t < 4; ++t) {
+    writers.emplace_back([&buffer, t]() {
+      for (int i = 0; i < 10000; ++i) {
+        buffer.record(TraceBuffer::Phase::BEGIN, 0, t, t);
+      }
+    });
+  }
+  writers.clear();
+  done = true;
+
+  // A writer lapped while its slot was busy drops its event.
+  auto size = buffer.snapshot().size();
+  EXPECT_LE(size, 256);
+  EXPECT_GE(size + buffer.droppedEvents(), 256);
+}
+
+TEST(PerfMonTest, dumpTrace) {
+  auto &perfMon = PerfMon::getInstance();
+  perfMon.setTracing(true);
+  perfmon_begin("PerfMonTest.\"trace\"");
+  perfmon_event("PerfMonTest.event", 42);
+  perfmon_end("PerfMonTest.\"trace\"");
+  perfMon.setTracing(false);
+  perfmon_event("PerfMonTest.event", 43);
+
+  const std::string path = testing::TempDir() + "PerfMonTest.json";
+  ASSERT_TRUE(perfMon.dumpTrace(path));
+  std::stringstream json;
+  json << std::ifstream(path).rdbuf();
+  std::remove(path.c_str());
+
+  auto trace = json.str();
+  EXPECT_TRUE(
+      trace.starts_with("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+  EXPECT_TRUE(trace.ends_with("]}\n"));
+  EXPECT_NE(trace.find("\"name\":\"PerfMonTest.\\\"trace\\\"\",\"ph\":\"B\""),
+            std::string::npos);
+  EXPECT_NE(trace.find("\"name\":\"PerfMonTest.\\\"trace\\\"\",\"ph\":\"E\""),
+            std::string::npos);
+  EXPECT_NE(trace.find("\"args\":{\"value\":42}"), std::string::npos);
+  EXPECT_EQ(trace.find("\"args\":{\"value\":43}"), std::string::npos);
+  EXPECT_NE(trace.find("\"name\":\"thread_name\""), std::string::npos);
+}
+
+TEST(PerfMonTest, overhead) {
+  PerfMon::setEnabled(true);
+  const int iterations = 100000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    perfmon_begin("PerfMonTest.overhead");
+    perfmon_end("PerfMonTest.overhead");
+  }
+  auto elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << "PerfMon begin/end pair: " << elapsedNs / iterations << "ns"
+            << std::endl;
+  // Generous bound, the tests run unoptimized and with sanitizers.
+  EXPECT_LT(elapsedNs / iterations, 2000);
+  PerfMon::setEnabled(false);
+}
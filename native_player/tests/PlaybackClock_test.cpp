@@ -0,0 +1,83 @@
+#include "PlaybackClock.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+TEST(PlaybackClockTest, nothingPlayed) {
+  PlaybackClock clock;
+  auto position = clock.get();
+  EXPECT_EQ(position.frames, 0);
+  EXPECT_EQ(position.sampleRate, 0);
+  EXPECT_FALSE(position.running);
+  EXPECT_EQ(position.positionMs(), 0);
+}
+
+TEST(PlaybackClockTest, extrapolatesFromTheAnchor) {
+  PlaybackClock clock;
+  clock.publish({.frames = 48000,
+                 .sampleRate = 48000,
+                 .timestamp = 1'000'000'000,
+                 .running = true},
+                96000);
+
+  auto position = clock.get(1'500'000'000);
+  EXPECT_EQ(position.frames, 72000);
+  EXPECT_EQ(position.positionMs(), 1500);
+  EXPECT_EQ(position.timestamp, 1'500'000'000);
+  EXPECT_TRUE(position.running);
+
+  // Before the anchor, e.g. frames which are still to be played.
+  EXPECT_EQ(clock.get(750'000'000).frames, 36000);
+}
+
+TEST(PlaybackClockTest, stopsAtTheLimit) {
+  PlaybackClock clock;
+  clock.publish({.frames = 48000,
+                 .sampleRate = 48000,
+                 .timestamp = 1'000'000'000,
+                 .running = true},
+                60000);
+
+  auto position = clock.get(2'000'000'000);
+  EXPECT_EQ(position.frames, 60000);
+  EXPECT_FALSE(position.running);
+  // A stale anchor does not overflow.
+  EXPECT_EQ(clock.get(-1ull).frames, 60000);
+}
+
+TEST(PlaybackClockTest, holdsWhileNotRunning) {
+  PlaybackClock clock;
+  clock.publish({.frames = 4410,
+                 .sampleRate = 44100,
+                 .timestamp = 1'000'000'000,
+                 .running = false},
+                4410);
+
+  auto position = clock.get(5'000'000'000);
+  EXPECT_EQ(position.frames, 4410);
+  EXPECT_EQ(position.positionMs(), 100);
+  EXPECT_FALSE(position.running);
+
+  clock.reset();
+  EXPECT_EQ(clock.get().sampleRate, 0);
+}
+
+TEST(PlaybackClockTest, readersSeeConsistentAnchors) {
+  PlaybackClock clock;
+  std::jthread writer([&clock](std::stop_token token) {
+    for (int64_t i = 1; !token.stop_requested(); ++i) {
+      // Anchors with frames equal to the sample rate.
+      clock.publish({.frames = i % 100000,
+                     .sampleRate = static_cast<uint32_t>(i % 100000),
+                     .timestamp = 0,
+                     .running = false},
+                    i % 100000);
+    }
+  });
+
+  for (int i = 0; i < 100000; ++i) {
+    auto position = clock.get();
+    ASSERT_EQ(position.frames, position.sampleRate);
+  }
+}
@@ -0,0 +1,88 @@
+#include "PlayedFramesCounter.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+TEST(PlayedFramesCounterTest, callsEventsOnceTheirFrameIsPlayed) {
+  PlayedFramesCounter counter;
+  std::vector<std::pair<int, int64_t>> calls;
+  counter.callOnOrAfterFrame(
+      300, [&calls](int64_t late) { calls.push_back({3, late}); });
+  counter.callOnOrAfterFrame(
+      100, [&calls](int64_t late) { calls.push_back({1, late}); });
+  counter.callOnOrAfterFrame(
+      200, [&calls](int64_t late) { calls.push_back({2, late}); });
+  EXPECT_EQ(counter.framesToNextEvent(), 100);
+
+  counter.update(50);
+  EXPECT_TRUE(calls.empty());
+  EXPECT_EQ(counter.framesToNextEvent(), 50);
+
+  counter.update(160);
+  std::vector<std::pair<int, int64_t>> expected = {{1, 110}, {2, 10}};
+  EXPECT_EQ(calls, expected);
+  EXPECT_EQ(counter.pendingEvents(), 1);
+
+  counter.update(90);
+  expected.push_back({3, 0});
+  EXPECT_EQ(calls, expected);
+  EXPECT_EQ(counter.getPlayedFrames(), 300);
+  EXPECT_FALSE(counter.framesToNextEvent());
+}
+
+TEST(PlayedFramesCounterTest, eventsOfTheSameFrameKeepTheirOrder) {
+  PlayedFramesCounter counter;
+  counter.update(1000);
+  std::vector<int> calls;
+  for (int i = 0; i < 8; ++i) {
+    counter.callOnOrAfterFrame(10,
+                               [&calls, i](int64_t) { calls.push_back(i); });
+  }
+  counter.update(10);
+  EXPECT_EQ(calls, std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7}));
+}
+
+TEST(PlayedFramesCounterTest, callbacksMayScheduleEvents) {
+  PlayedFramesCounter counter;
+  int calls = 0;
+  counter.callOnOrAfterFrame(10, [&counter, &calls](int64_t) {
+    ++calls;
+    counter.callOnOrAfterFrame(0, [&calls](int64_t) { ++calls; });
+  });
+  counter.update(10);
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(PlayedFramesCounterTest, capacity) {
+  PlayedFramesCounter counter;
+  counter.reserve(4);
+  EXPECT_EQ(counter.capacity(), PlayedFramesCounter::CAPACITY);
+  counter.reserve(2 * PlayedFramesCounter::CAPACITY);
+  EXPECT_EQ(counter.capacity(), 2 * PlayedFramesCounter::CAPACITY);
+
+  // Grows once the slots run out, no event is called before its frame.
+  std::vector<int64_t> calls;
+  const int64_t events = 3 * PlayedFramesCounter::CAPACITY;
+  for (int64_t i = events; i > 0; --i) {
+    counter.callOnOrAfterFrame(i, [&calls, i](int64_t late) {
+      EXPECT_EQ(late, 0);
+      calls.push_back(i);
+    });
+  }
+  EXPECT_TRUE(calls.empty());
+  EXPECT_EQ(counter.slotsGrown(), 1);
+  EXPECT_EQ(counter.capacity(), 4 * PlayedFramesCounter::CAPACITY);
+  for (int64_t i = 0; i < events; ++i) {
+    counter.update(1);
+  }
+  ASSERT_EQ(calls.size(), static_cast<size_t>(events));
+  EXPECT_TRUE(std::is_sorted(calls.begin(), calls.end()));
+
+  counter.reset();
+  EXPECT_EQ(counter.pendingEvents(), 0);
+  EXPECT_EQ(counter.getPlayedFrames(), 0);
+  counter.callOnOrAfterFrame(0, [](int64_t) {});
+  EXPECT_EQ(counter.framesToNextEvent(), 0);
+}
@@ -5,9 +5,31 @@
 
 #include <gtest/gtest.h>
 #include <memory>
+#include <poll.h>
+#include <thread>
+#include <vector>
 
 #include "TestHelpers.h"
 
+namespace {
+std::vector<AudioGraphNodeState> readStates(StateMonitor &monitor) {
+  std::vector<AudioGraphNodeState> states;
+  while (monitor.hasData()) {
+    states.push_back(monitor.waitState().state);
+  }
+  return states;
+}
+
+// Queues states in synchronous mode, the monitor has them once set.
+class BoundedStateMonitorTest : public ::testing::Test {
+protected:
+  StateNode node;
+
+  void SetUp() override { StateNotifier::setSynchronous(true); }
+  void TearDown() override { StateNotifier::setSynchronous(false); }
+};
+} // namespace
+
 class AudioGraphNodeTest : public ::testing::Test {
 protected:
   Config config = {{"output.alsa.device", "default"},
@@ -48,4 +70,126 @@ TEST_F(AudioGraphNodeTest, stateMonitor) {
 
   alsaAudioEmitter->disconnect(flacStreamDecoder);
   flacStreamDecoder->disconnect(fileInputNode);
-}
\ No newline at end of file
+}
+
+TEST_F(BoundedStateMonitorTest, dropsTheOldestIntermediateStates) {
+  StateMonitor monitor(&node, 3);
+  node.setState(StreamState(AudioGraphNodeState::PREPARING));
+  node.setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING, 100));
+  node.setState(StreamState(AudioGraphNodeState::PAUSED, 200));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING, 300));
+
+  EXPECT_EQ(monitor.droppedStates(), 3);
+  auto state = monitor.waitState();
+  EXPECT_EQ(state.state, AudioGraphNodeState::SOURCE_CHANGED);
+  state = monitor.waitState();
+  EXPECT_EQ(state.state, AudioGraphNodeState::PAUSED);
+  EXPECT_EQ(state.position, 200);
+  state = monitor.waitState();
+  EXPECT_EQ(state.state, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(state.position, 300);
+  EXPECT_FALSE(monitor.hasData());
+}
+
+TEST_F(BoundedStateMonitorTest, neverDropsTerminalStates) {
+  StateMonitor monitor(&node, 4);
+  node.setState(StreamState(AudioGraphNodeState::FINISHED));
+  node.setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+  node.setState(StreamState(AudioGraphNodeState::ERROR, "error"));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING, 100));
+
+  // The initial state is the only intermediate one.
+  EXPECT_EQ(monitor.droppedStates(), 1);
+  std::vector<AudioGraphNodeState> expected = {
+      AudioGraphNodeState::FINISHED, AudioGraphNodeState::SOURCE_CHANGED,
+      AudioGraphNodeState::ERROR, AudioGraphNodeState::STREAMING};
+  EXPECT_EQ(readStates(monitor), expected);
+}
+
+TEST_F(BoundedStateMonitorTest, deliversAllTerminalStatesBeyondCapacity) {
+  StateMonitor monitor(&node, 2);
+  std::vector<AudioGraphNodeState> expected;
+  for (int i = 0; i < 4; ++i) {
+    node.setState(StreamState(AudioGraphNodeState::SOURCE_CHANGED));
+    node.setState(StreamState(AudioGraphNodeState::FINISHED));
+    expected.push_back(AudioGraphNodeState::SOURCE_CHANGED);
+    expected.push_back(AudioGraphNodeState::FINISHED);
+  }
+
+  // Only the initial state is dropped.
+  EXPECT_EQ(monitor.droppedStates(), 1);
+  EXPECT_EQ(readStates(monitor), expected);
+}
+
+TEST_F(BoundedStateMonitorTest, keepsAllStatesWithinCapacity) {
+  StateMonitor monitor(&node, 4);
+  node.setState(StreamState(AudioGraphNodeState::PREPARING));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  std::vector<AudioGraphNodeState> expected = {
+      AudioGraphNodeState::STOPPED, AudioGraphNodeState::PREPARING,
+      AudioGraphNodeState::STREAMING};
+  EXPECT_EQ(readStates(monitor), expected);
+
+  // The ring wraps around.
+  node.setState(StreamState(AudioGraphNodeState::PAUSED));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  node.setState(StreamState(AudioGraphNodeState::FINISHED));
+  expected = {AudioGraphNodeState::PAUSED, AudioGraphNodeState::STREAMING,
+              AudioGraphNodeState::FINISHED};
+  EXPECT_EQ(readStates(monitor), expected);
+  EXPECT_EQ(monitor.droppedStates(), 0);
+}
+
+TEST_F(BoundedStateMonitorTest, waitStatesReturnsUpToMaxCount) {
+  StateMonitor monitor(&node);
+  node.setState(StreamState(AudioGraphNodeState::PREPARING));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+
+  auto states = monitor.waitStates(2);
+  ASSERT_EQ(states.size(), 2);
+  EXPECT_EQ(states[0].state, AudioGraphNodeState::STOPPED);
+  EXPECT_EQ(states[1].state, AudioGraphNodeState::PREPARING);
+  states = monitor.waitStates(2);
+  ASSERT_EQ(states.size(), 1);
+  EXPECT_EQ(states[0].state, AudioGraphNodeState::STREAMING);
+
+  EXPECT_TRUE(monitor.waitStates(2, std::chrono::milliseconds(10)).empty());
+}
+
+TEST_F(BoundedStateMonitorTest, waitStatesReturnsWhenStopped) {
+  StateMonitor monitor(&node);
+  monitor.waitStates(1);
+  std::jthread stopper([&monitor]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    monitor.stop();
+  });
+  EXPECT_TRUE(monitor.waitStates(1).empty());
+}
+
+TEST_F(BoundedStateMonitorTest, eventFdIsReadableWhileStatesAreQueued) {
+  auto isReadable = [](int fd) {
+    pollfd pfd{.fd = fd, .events = POLLIN};
+    return ::poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+  };
+  StateMonitor monitor(&node);
+  // The initial state.
+  EXPECT_TRUE(isReadable(monitor.getEventFd()));
+  EXPECT_EQ(monitor.drain().size(), 1);
+  EXPECT_FALSE(isReadable(monitor.getEventFd()));
+  EXPECT_TRUE(monitor.drain().empty());
+
+  node.setState(StreamState(AudioGraphNodeState::PREPARING));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  EXPECT_TRUE(isReadable(monitor.getEventFd()));
+  auto states = monitor.drain(1);
+  ASSERT_EQ(states.size(), 1);
+  EXPECT_EQ(states[0].state, AudioGraphNodeState::PREPARING);
+  EXPECT_TRUE(isReadable(monitor.getEventFd()));
+  EXPECT_EQ(monitor.waitState().state, AudioGraphNodeState::STREAMING);
+  EXPECT_FALSE(isReadable(monitor.getEventFd()));
+
+  monitor.stop();
+  EXPECT_TRUE(isReadable(monitor.getEventFd()));
+  EXPECT_TRUE(monitor.drain().empty());
+}
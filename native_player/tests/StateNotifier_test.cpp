@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+
+#include "AudioGraphNode.h"
+#include "StateNotifier.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TestHelpers.h"
+
+namespace {
+// Collects the states passed to a callback.
+class StateRecorder {
+public:
+  bool record(StreamState state) {
+    std::lock_guard lock(mutex);
+    states.push_back(state.state);
+    threads.push_back(std::this_thread::get_id());
+    cv.notify_all();
+    return true;
+  }
+
+  std::vector<AudioGraphNodeState> waitFor(size_t count) {
+    std::unique_lock lock(mutex);
+    cv.wait_for(lock, std::chrono::seconds(1),
+                [this, count] { return states.size() >= count; });
+    return states;
+  }
+
+  std::thread::id lastThread() {
+    std::lock_guard lock(mutex);
+    return threads.back();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<AudioGraphNodeState> states;
+  std::vector<std::thread::id> threads;
+};
+} // namespace
+
+TEST(StateNotifierTest, callbacksRunOnTheNotifierThread) {
+  StateNode node;
+  StateRecorder recorder;
+  auto id =
+      node.onStateChange([&recorder](AudioGraphNode *, StreamState state) {
+        return recorder.record(state);
+      });
+  node.setState(StreamState(AudioGraphNodeState::PREPARING));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  node.setState(StreamState(AudioGraphNodeState::FINISHED));
+
+  std::vector<AudioGraphNodeState> expected = {
+      AudioGraphNodeState::STOPPED, AudioGraphNodeState::PREPARING,
+      AudioGraphNodeState::STREAMING, AudioGraphNodeState::FINISHED};
+  EXPECT_EQ(recorder.waitFor(expected.size()), expected);
+  EXPECT_NE(recorder.lastThread(), std::this_thread::get_id());
+  node.removeStateChangeCallback(id);
+}
+
+TEST(StateNotifierTest, inlineCallbacksRunWhenTheStateIsSet) {
+  StateNode node;
+  StateRecorder recorder;
+  node.onStateChange(
+      [&recorder](AudioGraphNode *, StreamState state) {
+        return recorder.record(state);
+      },
+      StateDispatch::INLINE);
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+
+  std::vector<AudioGraphNodeState> expected = {AudioGraphNodeState::STOPPED,
+                                               AudioGraphNodeState::STREAMING};
+  EXPECT_EQ(recorder.waitFor(0), expected);
+  EXPECT_EQ(recorder.lastThread(), std::this_thread::get_id());
+}
+
+TEST(StateNotifierTest, synchronousMode) {
+  StateNotifier::setSynchronous(true);
+  StateNode node;
+  StateRecorder recorder;
+  node.onStateChange([&recorder](AudioGraphNode *, StreamState state) {
+    return recorder.record(state);
+  });
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  StateNotifier::setSynchronous(false);
+
+  std::vector<AudioGraphNodeState> expected = {AudioGraphNodeState::STOPPED,
+                                               AudioGraphNodeState::STREAMING};
+  EXPECT_EQ(recorder.waitFor(0), expected);
+}
+
+TEST(StateNotifierTest, statesSetBeforeTheCallbackAreNotDelivered) {
+  StateNode node;
+  StateRecorder blocker;
+  std::mutex gate;
+  std::unique_lock gateLock(gate);
+  // Keeps the notifier busy until the second callback is registered.
+  auto blockerId = node.onStateChange(
+      [&gate, &blocker](AudioGraphNode *, StreamState state) {
+        if (state.state != AudioGraphNodeState::STOPPED) {
+          std::lock_guard lock(gate);
+        }
+        return blocker.record(state);
+      });
+  node.setState(StreamState(AudioGraphNodeState::PREPARING));
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+
+  StateRecorder recorder;
+  node.onStateChange([&recorder](AudioGraphNode *, StreamState state) {
+    return recorder.record(state);
+  });
+  node.setState(StreamState(AudioGraphNodeState::FINISHED));
+  gateLock.unlock();
+
+  EXPECT_EQ(blocker.waitFor(4).size(), 4);
+  std::vector<AudioGraphNodeState> expected = {AudioGraphNodeState::STREAMING,
+                                               AudioGraphNodeState::FINISHED};
+  EXPECT_EQ(recorder.waitFor(2), expected);
+  node.removeStateChangeCallback(blockerId);
+}
+
+TEST(StateNotifierTest, removeWaitsForTheRunningCallback) {
+  StateNode node;
+  std::atomic<bool> started = false;
+  std::atomic<bool> finished = false;
+  auto id = node.onStateChange(
+      [&started, &finished](AudioGraphNode *, StreamState state) {
+        if (state.state == AudioGraphNodeState::STREAMING) {
+          started = true;
+          std::this_thread::sleep_for(std::chrono::milliseconds(50));
+          finished = true;
+        }
+        return true;
+      });
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  while (!started) {
+    std::this_thread::yield();
+  }
+  node.removeStateChangeCallback(id);
+  EXPECT_TRUE(finished);
+}
+
+TEST(StateNotifierTest, callbackIsRemovedWhenItReturnsFalse) {
+  StateNode node;
+  std::atomic<int> calls = 0;
+  node.onStateChange([&calls](AudioGraphNode *, StreamState state) {
+    ++calls;
+    return state.state != AudioGraphNodeState::STREAMING;
+  });
+  // Called after the first callback.
+  StateRecorder recorder;
+  node.onStateChange([&recorder](AudioGraphNode *, StreamState state) {
+    return recorder.record(state);
+  });
+  node.setState(StreamState(AudioGraphNodeState::STREAMING));
+  node.setState(StreamState(AudioGraphNodeState::FINISHED));
+  EXPECT_EQ(recorder.waitFor(3).size(), 3);
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(StateNotifierTest, statesQueuedBeyondThePoolAreDelivered) {
+  StateNode node;
+  std::mutex gate;
+  std::unique_lock gateLock(gate);
+  auto blockerId =
+      node.onStateChange([&gate](AudioGraphNode *, StreamState state) {
+        if (state.state != AudioGraphNodeState::STOPPED) {
+          std::lock_guard lock(gate);
+        }
+        return true;
+      });
+  StateRecorder recorder;
+  node.onStateChange([&recorder](AudioGraphNode *, StreamState state) {
+    return recorder.record(state);
+  });
+  // More states than pooled notifications, queued while the notifier is
+  // blocked by the first one.
+  for (int i = 0; i < 300; ++i) {
+    node.setState(StreamState(i % 2 ? AudioGraphNodeState::PAUSED
+                                    : AudioGraphNodeState::STREAMING));
+  }
+  gateLock.unlock();
+
+  auto states = recorder.waitFor(301);
+  ASSERT_EQ(states.size(), 301);
+  EXPECT_EQ(states.back(), AudioGraphNodeState::PAUSED);
+  node.removeStateChangeCallback(blockerId);
+}
@@ -2,7 +2,13 @@
 #include "StreamState.h"
 
 namespace {
-StreamState
+// Lets the tests set the state of a node.
+class StateNode : public AudioGraphNode {
+public:
+  using AudioGraphNode::setState;
+};
+
+inline StreamState
 waitForStatus(AudioGraphNode &node, AudioGraphNodeState status,
               std::optional<std::chrono::milliseconds> timeout = std::nullopt) {
   StateChangeWaitLock lock(std::stop_token(), node, status, timeout);
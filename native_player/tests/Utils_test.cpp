@@ -2,6 +2,8 @@
 
 #include "Utils.h"
 
+#include <thread>
+
 class CombinedStopTokenTest : public ::testing::Test {
 protected:
   std::stop_source source1;
@@ -72,3 +74,109 @@ TEST_F(CombinedStopTokenTest, three_stop_tokens_stop3) {
   EXPECT_TRUE(source2.stop_requested());
   EXPECT_TRUE(token.stop_requested());
 }
+
+TEST_F(CombinedStopTokenTest, already_stopped_token) {
+  source1.request_stop();
+  auto combinedToken2 =
+      combineStopTokens(source1.get_token(), source2.get_token());
+  EXPECT_TRUE(combinedToken2.get_token().stop_requested());
+}
+
+TEST_F(CombinedStopTokenTest, single_stoppable_token_is_passed_through) {
+  auto combinedToken2 =
+      combineStopTokens(std::stop_token(), source1.get_token());
+  EXPECT_EQ(combinedToken2.get_token(), source1.get_token());
+
+  auto neverStopped = combineStopTokens(std::stop_token(), std::stop_token());
+  EXPECT_FALSE(neverStopped.get_token().stop_possible());
+}
+
+TEST_F(CombinedStopTokenTest, nested_combinations) {
+  std::stop_source source3;
+  auto inner = combineStopTokens(source1.get_token(), source2.get_token());
+  auto outer = combineStopTokens(inner.get_token(), source3.get_token());
+  EXPECT_FALSE(outer.get_token().stop_requested());
+  source2.request_stop();
+  EXPECT_TRUE(inner.get_token().stop_requested());
+  EXPECT_TRUE(outer.get_token().stop_requested());
+}
+
+TEST_F(CombinedStopTokenTest, stop_does_not_leak_into_later_combinations) {
+  for (int i = 0; i < 2; ++i) {
+    std::stop_source first;
+    std::stop_source second;
+    auto combined = combineStopTokens(first.get_token(), second.get_token());
+    EXPECT_FALSE(combined.get_token().stop_requested());
+    first.request_stop();
+    EXPECT_TRUE(combined.get_token().stop_requested());
+  }
+
+  // Sources released without a stop are reused, unaffected by stops of
+  // the tokens they were combined from.
+  std::stop_source first;
+  std::stop_source second;
+  {
+    auto combined = combineStopTokens(first.get_token(), second.get_token());
+  }
+  first.request_stop();
+  auto combined = combineStopTokens(source1.get_token(), source2.get_token());
+  EXPECT_FALSE(combined.get_token().stop_requested());
+  source1.request_stop();
+  EXPECT_TRUE(combined.get_token().stop_requested());
+}
+
+TEST_F(CombinedStopTokenTest, stop_from_other_thread) {
+  auto token = combinedToken.get_token();
+  std::jthread stopper([this]() { source2.request_stop(); });
+  std::mutex mutex;
+  std::condition_variable_any cv;
+  std::unique_lock lock(mutex);
+  cv.wait(lock, token, []() { return false; });
+  EXPECT_TRUE(token.stop_requested());
+}
+
+TEST(InplaceFunctionTest, callsAndMovesTheCallable) {
+  auto counter = std::make_shared<int>(0);
+  InplaceFunction<int(int), 32> function = [counter](int value) {
+    return *counter += value;
+  };
+  EXPECT_TRUE(function);
+  EXPECT_EQ(function(2), 2);
+  EXPECT_EQ(counter.use_count(), 2);
+
+  auto moved = std::move(function);
+  EXPECT_FALSE(function);
+  EXPECT_EQ(moved(3), 5);
+  EXPECT_EQ(counter.use_count(), 2);
+
+  moved.reset();
+  EXPECT_FALSE(moved);
+  EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(TrackWorkerTest, runsJobsOnTheSameThread) {
+  TrackWorker worker("TrackWorker");
+  std::thread::id firstThread;
+  std::thread::id secondThread;
+
+  worker.start([&](std::stop_token token) {
+    firstThread = std::this_thread::get_id();
+    std::mutex mutex;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mutex);
+    cv.wait(lock, token, []() { return false; });
+  });
+  EXPECT_TRUE(worker.running());
+  auto firstToken = worker.getStopToken();
+  worker.stop();
+  EXPECT_FALSE(worker.running());
+  EXPECT_TRUE(firstToken.stop_requested());
+
+  worker.start(
+      [&](std::stop_token) { secondThread = std::this_thread::get_id(); });
+  EXPECT_FALSE(worker.getStopToken().stop_requested());
+  worker.stop();
+  EXPECT_NE(firstThread, std::thread::id());
+  EXPECT_EQ(firstThread, secondThread);
+  EXPECT_NE(firstThread, std::this_thread::get_id());
+}
@@ -0,0 +1,36 @@
+#include "AudioGraphNode.h"
+#include "../TestHelpers.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+
+namespace {
+// Cost of a state change as seen by the node setting it, with the given
+// number of registered callbacks, run by the notifier or inline.
+void BM_SetStateDispatch(benchmark::State &state) {
+  StateNode node;
+  std::atomic<size_t> calls = 0;
+  const auto dispatch =
+      state.range(1) ? StateDispatch::INLINE : StateDispatch::NOTIFIER;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    node.onStateChange(
+        [&calls](AudioGraphNode *, StreamState) {
+          calls.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        },
+        dispatch);
+  }
+
+  const StreamState streaming(AudioGraphNodeState::STREAMING, 0,
+                              StreamInfo{.streamType = StreamType::FRAMES});
+  const StreamState paused(AudioGraphNodeState::PAUSED);
+  bool isPaused = false;
+  for (auto _ : state) {
+    node.setState(isPaused ? streaming : paused);
+    isPaused = !isPaused;
+  }
+  benchmark::DoNotOptimize(calls);
+}
+BENCHMARK(BM_SetStateDispatch)->ArgsProduct({{0, 1, 4, 16}, {0, 1}});
+} // namespace
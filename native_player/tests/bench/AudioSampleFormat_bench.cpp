@@ -0,0 +1,78 @@
+#include "AudioSampleFormat.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+constexpr size_t FRAMES = 4096;
+constexpr size_t CHANNELS = 2;
+
+void BM_ConvertToFormat(benchmark::State &state) {
+  const auto format = static_cast<AudioSampleFormat>(state.range(0));
+  std::vector<int32_t> left(FRAMES, 0x123456);
+  std::vector<int32_t> right(FRAMES, -0x123456);
+  const int32_t *const samples[] = {left.data(), right.data()};
+  std::vector<uint8_t> buffer(FRAMES * CHANNELS * sampleSize(format));
+  for (auto _ : state) {
+    convertToFormat(buffer.data(), samples, FRAMES, format);
+    benchmark::DoNotOptimize(buffer.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * FRAMES);
+  state.SetLabel(sampleFormatToString(format));
+}
+// PCM24_3LE is not supported by convertToFormat.
+BENCHMARK(BM_ConvertToFormat)
+    ->Arg(AudioSampleFormat::PCM16_LE)
+    ->Arg(AudioSampleFormat::PCM24_LE)
+    ->Arg(AudioSampleFormat::PCM32_LE);
+
+void BM_ConvertSampleFormat(benchmark::State &state) {
+  const auto sourceFormat = static_cast<AudioSampleFormat>(state.range(0));
+  const auto destFormat = static_cast<AudioSampleFormat>(state.range(1));
+  const size_t samples = FRAMES * CHANNELS;
+  std::vector<uint8_t> source(samples * sampleSize(sourceFormat), 0x5a);
+  std::vector<uint8_t> dest(samples * sampleSize(destFormat));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(convertSampleFormat(source.data(), sourceFormat,
+                                                 samples, dest.data(),
+                                                 destFormat, dest.size()));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * samples);
+  state.SetLabel(std::string(sampleFormatToString(sourceFormat)) + " -> " +
+                 sampleFormatToString(destFormat));
+}
+BENCHMARK(BM_ConvertSampleFormat)
+    ->ArgsProduct({{AudioSampleFormat::PCM16_LE, AudioSampleFormat::PCM24_LE,
+                    AudioSampleFormat::PCM32_LE, AudioSampleFormat::PCM24_3LE},
+                   {AudioSampleFormat::PCM16_LE, AudioSampleFormat::PCM24_LE,
+                    AudioSampleFormat::PCM32_LE,
+                    AudioSampleFormat::PCM24_3LE}});
+
+// The stereo formats but 24 bit packed are processed two frames at a time,
+// one channel and the other formats one sample at a time. The same samples
+// as one channel give the cost of the scalar path.
+void BM_ApplyGain(benchmark::State &state) {
+  const auto format = static_cast<AudioSampleFormat>(state.range(0));
+  const auto channels = static_cast<size_t>(state.range(1));
+  const size_t samples = FRAMES * CHANNELS;
+  std::vector<uint8_t> buffer(samples * sampleSize(format), 0x5a);
+  DitherState dither;
+  for (auto _ : state) {
+    applyGain(buffer.data(), format, samples / channels, channels, 0.5f,
+              1e-6f, dither);
+    benchmark::DoNotOptimize(buffer.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * samples);
+  state.SetLabel(std::string(sampleFormatToString(format)) +
+                 (channels == CHANNELS ? " vector" : " scalar"));
+}
+BENCHMARK(BM_ApplyGain)
+    ->ArgsProduct({{AudioSampleFormat::PCM16_LE, AudioSampleFormat::PCM24_LE,
+                    AudioSampleFormat::PCM32_LE},
+                   {1, CHANNELS}});
+} // namespace
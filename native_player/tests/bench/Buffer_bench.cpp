@@ -0,0 +1,54 @@
+#include "Buffer.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr size_t BUFFER_SIZE = 65536;
+
+void BM_BufferWriteRead(benchmark::State &state) {
+  const size_t chunk = state.range(0);
+  Buffer<uint8_t> buffer(BUFFER_SIZE);
+  std::vector<uint8_t> data(chunk);
+  for (auto _ : state) {
+    buffer.write(data.data(), chunk);
+    benchmark::DoNotOptimize(buffer.read(data.data(), chunk));
+  }
+  state.SetBytesProcessed(state.iterations() * chunk);
+}
+BENCHMARK(BM_BufferWriteRead)->RangeMultiplier(4)->Range(64, 16384);
+
+// A producer thread keeps the buffer full while the benchmark thread reads,
+// as the decoder and the ALSA thread do.
+void BM_BufferContended(benchmark::State &state) {
+  const size_t chunk = state.range(0);
+  Buffer<uint8_t> buffer(BUFFER_SIZE);
+  std::jthread producer([&buffer, chunk](std::stop_token token) {
+    std::vector<uint8_t> data(chunk);
+    while (!token.stop_requested()) {
+      if (buffer.waitForSpace(token, chunk) >= chunk) {
+        buffer.write(data.data(), chunk);
+      }
+    }
+  });
+
+  std::vector<uint8_t> data(chunk);
+  size_t bytes = 0;
+  for (auto _ : state) {
+    buffer.waitForData(std::stop_token(), chunk);
+    bytes += buffer.read(data.data(), chunk);
+  }
+  state.SetBytesProcessed(bytes);
+
+  producer.request_stop();
+  // Wakes up the producer if it waits for space.
+  buffer.clear();
+}
+BENCHMARK(BM_BufferContended)
+    ->RangeMultiplier(4)
+    ->Range(64, 16384)
+    ->UseRealTime();
+} // namespace
@@ -0,0 +1,46 @@
+#include "FileInputNode.h"
+#include "FlacStreamDecoder.h"
+
+#include "../TestHelpers.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+constexpr size_t DECODER_BUFFER_SIZE = 65536;
+
+// Decodes the whole file, reading the decoded frames in chunks of the given
+// number of bytes. Paths are relative to native_player/tests.
+void BM_FlacDecode(benchmark::State &state, const char *path) {
+  const size_t chunk = state.range(0);
+  std::vector<uint8_t> data(chunk);
+  size_t bytes = 0;
+  for (auto _ : state) {
+    auto decoder = std::make_shared<FlacStreamDecoder>(DECODER_BUFFER_SIZE);
+    auto input = std::make_shared<FileInputNode>(path);
+    decoder->connectTo(input);
+    waitForStatus(*decoder, AudioGraphNodeState::STREAMING);
+    size_t read = 0;
+    do {
+      decoder->waitForData(std::stop_token(), chunk);
+      read = decoder->read(data.data(), chunk);
+      bytes += read;
+    } while (read > 0 &&
+             decoder->getState().state != AudioGraphNodeState::FINISHED);
+    decoder->disconnect(input);
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK_CAPTURE(BM_FlacDecode, tone440, "files/tone440.flac")
+    ->RangeMultiplier(8)
+    ->Range(256, 65536)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_FlacDecode, tone880, "files/tone880.flac")
+    ->RangeMultiplier(8)
+    ->Range(256, 65536)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+} // namespace
@@ -0,0 +1,109 @@
+#include "AudioStreamSwitcher.h"
+#include "FileInputNode.h"
+#include "FlacStreamDecoder.h"
+#include "NullAudioEmitter.h"
+
+#include "../TestHelpers.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+// Whole graph benchmarks: FileInputNode -> FlacStreamDecoder ->
+// AudioStreamSwitcher -> NullAudioEmitter. Paths are relative to
+// native_player/tests.
+namespace {
+constexpr size_t DECODER_BUFFER_SIZE = 65536;
+const char *const FILES[] = {"files/tone440.flac", "files/tone880.flac"};
+
+struct Pipeline {
+  std::vector<std::shared_ptr<FileInputNode>> inputs;
+  std::vector<std::shared_ptr<FlacStreamDecoder>> decoders;
+  std::shared_ptr<AudioStreamSwitcher> switcher =
+      std::make_shared<AudioStreamSwitcher>();
+  std::shared_ptr<NullAudioEmitter> emitter;
+
+  Pipeline(size_t tracks, bool realtime)
+      : emitter(std::make_shared<NullAudioEmitter>(realtime)) {
+    for (size_t i = 0; i < tracks; ++i) {
+      inputs.push_back(std::make_shared<FileInputNode>(FILES[i % 2]));
+      decoders.push_back(
+          std::make_shared<FlacStreamDecoder>(DECODER_BUFFER_SIZE));
+      decoders.back()->connectTo(inputs.back());
+      switcher->connectTo(decoders.back());
+    }
+  }
+
+  ~Pipeline() {
+    emitter->disconnect(switcher);
+    for (size_t i = 0; i < decoders.size(); ++i) {
+      decoders[i]->disconnect(inputs[i]);
+    }
+  }
+};
+
+double toMs(std::chrono::nanoseconds time) { return time.count() / 1e6; }
+
+double meanMs(const std::vector<std::chrono::nanoseconds> &times) {
+  if (times.empty()) {
+    return 0;
+  }
+  std::chrono::nanoseconds sum{0};
+  for (auto time : times) {
+    sum += time;
+  }
+  return toMs(sum) / times.size();
+}
+
+// Plays the given number of tracks back to back as fast as possible.
+void BM_PipelineThroughput(benchmark::State &state) {
+  const size_t tracks = state.range(0);
+  NullEmitterStats total;
+  double timeToFirstFrameMs = 0;
+  for (auto _ : state) {
+    Pipeline pipeline(tracks, false);
+    pipeline.emitter->connectTo(pipeline.switcher);
+    waitForStatus(*pipeline.emitter, AudioGraphNodeState::FINISHED);
+    auto stats = pipeline.emitter->getStats();
+    total.frames += stats.frames;
+    total.switchGaps.insert(total.switchGaps.end(), stats.switchGaps.begin(),
+                            stats.switchGaps.end());
+    timeToFirstFrameMs += toMs(stats.timeToFirstFrame.value_or(
+        std::chrono::nanoseconds(0)));
+  }
+  state.SetItemsProcessed(total.frames);
+  state.counters["time_to_first_frame_ms"] = benchmark::Counter(
+      timeToFirstFrameMs, benchmark::Counter::kAvgIterations);
+  state.counters["switch_gap_ms"] = meanMs(total.switchGaps);
+}
+BENCHMARK(BM_PipelineThroughput)
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Seeks within a track played at the speed of playback.
+void BM_PipelineSeek(benchmark::State &state) {
+  std::vector<std::chrono::nanoseconds> seekLatencies;
+  uint64_t underruns = 0;
+  for (auto _ : state) {
+    Pipeline pipeline(1, true);
+    pipeline.emitter->connectTo(pipeline.switcher);
+    waitForStatus(*pipeline.emitter, AudioGraphNodeState::STREAMING);
+    for (size_t positionMs : {800, 200, 500}) {
+      pipeline.emitter->seek(positionMs).get();
+      waitForStatus(*pipeline.emitter, AudioGraphNodeState::STREAMING);
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    pipeline.emitter->pause(true).get();
+    auto stats = pipeline.emitter->getStats();
+    seekLatencies.insert(seekLatencies.end(), stats.seekLatencies.begin(),
+                         stats.seekLatencies.end());
+    underruns += stats.underruns;
+  }
+  state.counters["seek_latency_ms"] = meanMs(seekLatencies);
+  state.counters["underruns"] = underruns;
+}
+BENCHMARK(BM_PipelineSeek)->Unit(benchmark::kMillisecond)->UseRealTime();
+} // namespace
@@ -0,0 +1,56 @@
+#include "Utils.h"
+
+#include <benchmark/benchmark.h>
+
+#include <functional>
+#include <memory>
+#include <stop_token>
+
+namespace {
+// The previous implementation of CombinedStopToken, allocating a stop
+// source and a callback per token, as the baseline.
+template <std::size_t N> class AllocatingCombinedStopToken {
+public:
+  template <typename... Tokens>
+  AllocatingCombinedStopToken(Tokens... tokens) {
+    std::size_t i = 0;
+    ((callbacks[i++] = std::make_unique<Callback>(
+          tokens, [this]() { source.request_stop(); })),
+     ...);
+  }
+
+  std::stop_token get_token() { return source.get_token(); }
+
+private:
+  using Callback = std::stop_callback<std::function<void()>>;
+  std::stop_source source;
+  std::array<std::unique_ptr<Callback>, N> callbacks;
+};
+
+template <typename Combined>
+void BM_CombinedStopTokenConstruction(benchmark::State &state) {
+  std::stop_source first;
+  std::stop_source second;
+  std::stop_source third;
+  for (auto _ : state) {
+    Combined combined(first.get_token(), second.get_token(),
+                      third.get_token());
+    benchmark::DoNotOptimize(combined.get_token().stop_requested());
+  }
+}
+BENCHMARK(BM_CombinedStopTokenConstruction<CombinedStopToken<3>>);
+BENCHMARK(BM_CombinedStopTokenConstruction<AllocatingCombinedStopToken<3>>);
+
+template <typename Combined>
+void BM_CombinedStopTokenRequestStop(benchmark::State &state) {
+  for (auto _ : state) {
+    std::stop_source first;
+    std::stop_source second;
+    Combined combined(first.get_token(), second.get_token());
+    second.request_stop();
+    benchmark::DoNotOptimize(combined.get_token().stop_requested());
+  }
+}
+BENCHMARK(BM_CombinedStopTokenRequestStop<CombinedStopToken<2>>);
+BENCHMARK(BM_CombinedStopTokenRequestStop<AllocatingCombinedStopToken<2>>);
+} // namespace
@@ -0,0 +1,250 @@
+#include "AlsaAudioEmitter.h"
+#include "SineWaveNode.h"
+
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include "Config.h"
+#include "FakeAlsa.h"
+#include "Metrics.h"
+#include "StateMonitor.h"
+#include "../TestHelpers.h"
+
+class AlsaAudioEmitterFakeTest : public ::testing::Test {
+protected:
+  void SetUp() override { FakeAlsa::reset(); }
+};
+
+// Prepares until the test lets it stream.
+class PreparingSineWaveNode : public SineWaveNode {
+public:
+  PreparingSineWaveNode(int durationMs)
+      : SineWaveNode(440, durationMs), streamInfo(getState().streamInfo) {
+    setState(StreamState(AudioGraphNodeState::PREPARING));
+  }
+
+  void startStreaming() {
+    setState(StreamState(AudioGraphNodeState::STREAMING, 0, streamInfo));
+  }
+
+private:
+  std::optional<StreamInfo> streamInfo;
+};
+
+std::vector<AudioGraphNodeState> readStates(StateMonitor &monitor) {
+  std::vector<AudioGraphNodeState> states;
+  for (const auto &state : monitor.drain()) {
+    if (states.empty() || states.back() != state.state) {
+      states.push_back(state.state);
+    }
+  }
+  return states;
+}
+
+TEST_F(AlsaAudioEmitterFakeTest, pause) {
+  Config config = {{"output.alsa.latency_ms", "80"},
+                   {"output.alsa.period_ms", "20"}};
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 1000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+
+  // The pause is reported once the queued frames are played.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  const auto pauseRequested = std::chrono::steady_clock::now();
+  EXPECT_TRUE(emitter->pause(true).get());
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::PAUSED,
+                             std::chrono::milliseconds(1000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::PAUSED);
+  EXPECT_NEAR(std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - pauseRequested)
+                  .count(),
+              80, 30);
+  EXPECT_NEAR(state.position, 580, 30);
+  EXPECT_EQ(FakeAlsa::getStats().framesRewound, 0);
+
+  EXPECT_FALSE(emitter->pause(false).get());
+  EXPECT_EQ(waitForStatus(*emitter, AudioGraphNodeState::FINISHED).state,
+            AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(FakeAlsa::getStats().xruns, 0);
+  emitter->disconnect(outputNode);
+}
+
+class AlsaAudioEmitterFakeTimerSchedulingTest
+    : public AlsaAudioEmitterFakeTest {
+protected:
+  Config config = {{"output.alsa.latency_ms", "80"},
+                   {"output.alsa.period_ms", "20"},
+                   {"output.alsa.timer_scheduling.enabled", "true"},
+                   {"output.alsa.timer_scheduling.buffer_ms", "1000"},
+                   {"output.alsa.timer_scheduling.max_fill_ms", "500"},
+                   {"output.alsa.timer_scheduling.margin_ms", "50"}};
+};
+
+TEST_F(AlsaAudioEmitterFakeTimerSchedulingTest, pauseAndResumeRewind) {
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 3000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+
+  // The fill level has grown to max_fill_ms, the queue beyond the margin
+  // is taken back so the pause is heard right away.
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  const auto pauseRequested = std::chrono::steady_clock::now();
+  EXPECT_TRUE(emitter->pause(true).get());
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::PAUSED,
+                             std::chrono::milliseconds(1000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::PAUSED);
+  EXPECT_LT(std::chrono::steady_clock::now() - pauseRequested,
+            std::chrono::milliseconds(150));
+  EXPECT_NEAR(state.position, 1050, 50);
+  const auto rewoundOnPause = FakeAlsa::getStats().framesRewound;
+  EXPECT_GT(rewoundOnPause, 48 * 300);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_FALSE(emitter->pause(false).get());
+  state = waitForStatus(*emitter, AudioGraphNodeState::STREAMING,
+                        std::chrono::milliseconds(1000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::STREAMING);
+  // The silence queued while paused is taken back too.
+  EXPECT_GT(FakeAlsa::getStats().framesRewound, rewoundOnPause);
+
+  // The frames taken back are read again from the source, none is lost.
+  state = waitForStatus(*emitter, AudioGraphNodeState::FINISHED,
+                        std::chrono::milliseconds(3000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(state.position, 3000);
+  auto samples = MetricsRegistry::getInstance().snapshot();
+  auto sample = std::find_if(
+      samples.begin(), samples.end(), [&emitter](const MetricSample &sample) {
+        return sample.group == emitter->getMetricsGroupName() &&
+               sample.name == "frames_written";
+      });
+  ASSERT_NE(sample, samples.end());
+  EXPECT_EQ(sample->value, 48 * 3000 + rewoundOnPause);
+  EXPECT_EQ(FakeAlsa::getStats().xruns, 0);
+  emitter->disconnect(outputNode);
+}
+
+TEST_F(AlsaAudioEmitterFakeTimerSchedulingTest,
+       resumeRewindsWhileThePauseIsPending) {
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  StateMonitor monitor(emitter.get());
+  auto outputNode = std::make_shared<SineWaveNode>(440, 2000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_TRUE(emitter->pause(true).get());
+  const auto rewoundOnPause = FakeAlsa::getStats().framesRewound;
+  // Resumed before the margin left queued on the pause is played, the
+  // PAUSED state is still to be reported when the silence after it is
+  // taken back.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(emitter->getState().state, AudioGraphNodeState::STREAMING);
+  EXPECT_FALSE(emitter->pause(false).get());
+  EXPECT_GT(FakeAlsa::getStats().framesRewound, rewoundOnPause);
+
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::FINISHED,
+                             std::chrono::milliseconds(3000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(state.position, 2000);
+
+  const auto states = readStates(monitor);
+  const std::vector<AudioGraphNodeState> expected = {
+      AudioGraphNodeState::STOPPED,   AudioGraphNodeState::PREPARING,
+      AudioGraphNodeState::STREAMING, AudioGraphNodeState::PAUSED,
+      AudioGraphNodeState::STREAMING, AudioGraphNodeState::FINISHED};
+  EXPECT_EQ(states, expected);
+  monitor.stop();
+  emitter->disconnect(outputNode);
+}
+
+class AlsaAudioEmitterFakePrerollTest : public AlsaAudioEmitterFakeTest {
+protected:
+  Config config = {{"output.alsa.latency_ms", "1000"},
+                   {"output.alsa.period_ms", "20"},
+                   {"output.alsa.preroll.enabled", "true"},
+                   {"output.alsa.preroll.start_ms", "100"}};
+};
+
+TEST_F(AlsaAudioEmitterFakePrerollTest, startsWithStartMsQueued) {
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<PreparingSineWaveNode>(2000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::PREPARING);
+  // Opened while the input is preparing.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(FakeAlsa::getStats().opens, 1);
+
+  outputNode->startStreaming();
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  EXPECT_EQ(FakeAlsa::getStats().queuedAtStart, 48 * 100);
+
+  // The fill limit doubles with every write up to the whole buffer.
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  EXPECT_GT(FakeAlsa::getStats().maxQueued, 48 * 900);
+  EXPECT_EQ(waitForStatus(*emitter, AudioGraphNodeState::FINISHED).state,
+            AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(FakeAlsa::getStats().opens, 1);
+  EXPECT_EQ(FakeAlsa::getStats().xruns, 0);
+  emitter->disconnect(outputNode);
+}
+
+TEST_F(AlsaAudioEmitterFakePrerollTest, startsWithTheMarginsQueued) {
+  config["output.alsa.latency_ms"] = "500";
+  config["output.alsa.preroll.start_ms"] = "60";
+  config["output.alsa.timer_scheduling.enabled"] = "true";
+  config["output.alsa.timer_scheduling.margin_ms"] = "50";
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<SineWaveNode>(440, 1000);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::STREAMING);
+  // Twice the margin and a period, to wait for data after the first write.
+  EXPECT_EQ(FakeAlsa::getStats().queuedAtStart, 48 * 120);
+  EXPECT_EQ(waitForStatus(*emitter, AudioGraphNodeState::FINISHED).state,
+            AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(FakeAlsa::getStats().xruns, 0);
+  emitter->disconnect(outputNode);
+}
+
+TEST_F(AlsaAudioEmitterFakePrerollTest, openFailureInThePrerollIsNotAnError) {
+  FakeAlsa::failOpen(-EBUSY);
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  StateMonitor monitor(emitter.get());
+  auto outputNode = std::make_shared<PreparingSineWaveNode>(500);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::PREPARING);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(FakeAlsa::getStats().failedOpens, 1);
+  EXPECT_EQ(emitter->getState().state, AudioGraphNodeState::PREPARING);
+
+  // Opened again once the input is streaming.
+  outputNode->startStreaming();
+  EXPECT_EQ(waitForStatus(*emitter, AudioGraphNodeState::FINISHED).state,
+            AudioGraphNodeState::FINISHED);
+  EXPECT_EQ(FakeAlsa::getStats().opens, 1);
+  const std::vector<AudioGraphNodeState> expected = {
+      AudioGraphNodeState::STOPPED, AudioGraphNodeState::PREPARING,
+      AudioGraphNodeState::STREAMING, AudioGraphNodeState::FINISHED};
+  EXPECT_EQ(readStates(monitor), expected);
+  monitor.stop();
+  emitter->disconnect(outputNode);
+}
+
+TEST_F(AlsaAudioEmitterFakePrerollTest, openFailure) {
+  FakeAlsa::failOpen(-ENOENT, 2);
+  auto emitter = std::make_shared<AlsaAudioEmitter>(config);
+  auto outputNode = std::make_shared<PreparingSineWaveNode>(500);
+  emitter->connectTo(outputNode);
+  waitForStatus(*emitter, AudioGraphNodeState::PREPARING);
+  outputNode->startStreaming();
+  auto state = waitForStatus(*emitter, AudioGraphNodeState::ERROR,
+                             std::chrono::milliseconds(1000));
+  EXPECT_EQ(state.state, AudioGraphNodeState::ERROR);
+  ASSERT_TRUE(state.message.has_value());
+  EXPECT_NE(state.message->find("Cannot open audio device default"),
+            std::string::npos);
+  EXPECT_EQ(FakeAlsa::getStats().failedOpens, 2);
+  emitter->disconnect(outputNode);
+}
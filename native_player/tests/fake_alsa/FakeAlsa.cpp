@@ -0,0 +1,575 @@
+#include "FakeAlsa.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <sys/timerfd.h>
+#include <thread>
+#include <vector>
+
+struct _snd_pcm {
+  snd_pcm_state_t state = SND_PCM_STATE_OPEN;
+  unsigned int rate = 0;
+  unsigned int channels = 0;
+  snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+  snd_pcm_uframes_t bufferSize = 0;
+  snd_pcm_uframes_t periodSize = 0;
+  snd_pcm_uframes_t availMin = 1;
+  std::vector<uint8_t> buffer;
+  snd_pcm_channel_area_t area{};
+  // Positions in frames since the device was prepared, never wrapped.
+  uint64_t hwPtr = 0;
+  uint64_t applPtr = 0;
+  uint64_t hwPtrAtStart = 0;
+  std::chrono::steady_clock::time_point startTime;
+  int timerFd = -1;
+};
+
+struct _snd_pcm_hw_params {
+  snd_pcm_access_t access = SND_PCM_ACCESS_RW_INTERLEAVED;
+  snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+  unsigned int channels = 0;
+  unsigned int rate = 0;
+  snd_pcm_uframes_t bufferSize = 0;
+  snd_pcm_uframes_t periodSize = 0;
+};
+
+struct _snd_pcm_sw_params {
+  snd_pcm_uframes_t availMin = 1;
+};
+
+struct _snd_pcm_status {
+  snd_pcm_state_t state;
+  snd_pcm_sframes_t delay;
+  snd_htimestamp_t htstamp;
+};
+
+namespace {
+std::mutex mutex;
+FakeAlsa::Stats stats;
+int openError = 0;
+int openErrorCount = 0;
+
+int sampleBytes(snd_pcm_format_t format) {
+  switch (format) {
+  case SND_PCM_FORMAT_S16_LE:
+    return 2;
+  case SND_PCM_FORMAT_S24_3LE:
+    return 3;
+  case SND_PCM_FORMAT_S24_LE:
+  case SND_PCM_FORMAT_S32_LE:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+int frameBytes(const snd_pcm_t *pcm) {
+  return sampleBytes(pcm->format) * pcm->channels;
+}
+
+// Advances the hardware pointer to the current time.
+void sync(snd_pcm_t *pcm) {
+  if (pcm->state != SND_PCM_STATE_RUNNING &&
+      pcm->state != SND_PCM_STATE_DRAINING) {
+    return;
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - pcm->startTime;
+  pcm->hwPtr = pcm->hwPtrAtStart +
+               std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() *
+                   pcm->rate / 1'000'000'000;
+  if (pcm->hwPtr >= pcm->applPtr) {
+    pcm->hwPtr = pcm->applPtr;
+    if (pcm->state == SND_PCM_STATE_RUNNING) {
+      pcm->state = SND_PCM_STATE_XRUN;
+      std::lock_guard lock(mutex);
+      ++stats.xruns;
+    } else {
+      pcm->state = SND_PCM_STATE_SETUP;
+    }
+  }
+}
+
+snd_pcm_sframes_t queued(const snd_pcm_t *pcm) {
+  return pcm->applPtr - pcm->hwPtr;
+}
+
+snd_pcm_sframes_t avail(const snd_pcm_t *pcm) {
+  return pcm->bufferSize - queued(pcm);
+}
+
+// Arms the timer of the poll descriptor for the time avail_min frames are
+// free, a device which is not running never becomes ready.
+void armTimer(snd_pcm_t *pcm) {
+  itimerspec spec{};
+  if (avail(pcm) >= static_cast<snd_pcm_sframes_t>(pcm->availMin)) {
+    spec.it_value.tv_nsec = 1;
+  } else if (pcm->state == SND_PCM_STATE_RUNNING) {
+    const int64_t ns =
+        (pcm->availMin - avail(pcm)) * 1'000'000'000ll / pcm->rate;
+    spec.it_value.tv_sec = ns / 1'000'000'000;
+    spec.it_value.tv_nsec = std::max<int64_t>(1, ns % 1'000'000'000);
+  }
+  timerfd_settime(pcm->timerFd, 0, &spec, nullptr);
+}
+
+// The error of a call on a device which ran empty.
+int xrunError(snd_pcm_t *pcm) {
+  sync(pcm);
+  return pcm->state == SND_PCM_STATE_XRUN ? -EPIPE : 0;
+}
+} // namespace
+
+namespace FakeAlsa {
+
+void reset() {
+  std::lock_guard lock(mutex);
+  stats = Stats();
+  openError = 0;
+  openErrorCount = 0;
+}
+
+void failOpen(int err, int count) {
+  std::lock_guard lock(mutex);
+  openError = err;
+  openErrorCount = count;
+}
+
+Stats getStats() {
+  std::lock_guard lock(mutex);
+  return stats;
+}
+
+} // namespace FakeAlsa
+
+const char *snd_strerror(int errnum) { return strerror(-errnum); }
+
+int snd_pcm_open(snd_pcm_t **pcm, const char *name, snd_pcm_stream_t stream,
+                 int mode) {
+  (void)name;
+  (void)mode;
+  {
+    std::lock_guard lock(mutex);
+    if (openErrorCount > 0) {
+      --openErrorCount;
+      ++stats.failedOpens;
+      return openError;
+    }
+    ++stats.opens;
+  }
+  if (stream != SND_PCM_STREAM_PLAYBACK) {
+    return -EINVAL;
+  }
+  *pcm = new _snd_pcm();
+  (*pcm)->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  return 0;
+}
+
+int snd_pcm_close(snd_pcm_t *pcm) {
+  close(pcm->timerFd);
+  delete pcm;
+  return 0;
+}
+
+int snd_pcm_hw_free(snd_pcm_t *pcm) {
+  if (pcm->state == SND_PCM_STATE_RUNNING) {
+    return -EBADFD;
+  }
+  pcm->state = SND_PCM_STATE_OPEN;
+  pcm->buffer.clear();
+  return 0;
+}
+
+int snd_pcm_prepare(snd_pcm_t *pcm) {
+  if (pcm->state == SND_PCM_STATE_OPEN) {
+    return -EBADFD;
+  }
+  pcm->state = SND_PCM_STATE_PREPARED;
+  pcm->hwPtr = pcm->applPtr = 0;
+  return 0;
+}
+
+int snd_pcm_start(snd_pcm_t *pcm) {
+  if (pcm->state != SND_PCM_STATE_PREPARED) {
+    return -EBADFD;
+  }
+  if (queued(pcm) == 0) {
+    return -EPIPE;
+  }
+  pcm->state = SND_PCM_STATE_RUNNING;
+  pcm->hwPtrAtStart = pcm->hwPtr;
+  pcm->startTime = std::chrono::steady_clock::now();
+  std::lock_guard lock(mutex);
+  ++stats.starts;
+  stats.queuedAtStart = stats.maxQueued = queued(pcm);
+  return 0;
+}
+
+int snd_pcm_drop(snd_pcm_t *pcm) {
+  if (pcm->state == SND_PCM_STATE_OPEN) {
+    return -EBADFD;
+  }
+  pcm->state = SND_PCM_STATE_SETUP;
+  return 0;
+}
+
+int snd_pcm_drain(snd_pcm_t *pcm) {
+  sync(pcm);
+  if (pcm->state == SND_PCM_STATE_RUNNING) {
+    pcm->state = SND_PCM_STATE_DRAINING;
+    std::this_thread::sleep_for(std::chrono::nanoseconds(
+        queued(pcm) * 1'000'000'000ll / pcm->rate));
+    sync(pcm);
+  }
+  return snd_pcm_drop(pcm);
+}
+
+int snd_pcm_resume(snd_pcm_t *pcm) {
+  (void)pcm;
+  return -ENOSYS;
+}
+
+snd_pcm_state_t snd_pcm_state(snd_pcm_t *pcm) {
+  sync(pcm);
+  return pcm->state;
+}
+
+int snd_pcm_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp) {
+  if (int err = xrunError(pcm)) {
+    return err;
+  }
+  *delayp = queued(pcm);
+  return 0;
+}
+
+snd_pcm_sframes_t snd_pcm_avail_update(snd_pcm_t *pcm) {
+  if (int err = xrunError(pcm)) {
+    return err;
+  }
+  armTimer(pcm);
+  return avail(pcm);
+}
+
+snd_pcm_sframes_t snd_pcm_rewindable(snd_pcm_t *pcm) {
+  if (int err = xrunError(pcm)) {
+    return err;
+  }
+  return queued(pcm);
+}
+
+snd_pcm_sframes_t snd_pcm_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames) {
+  const snd_pcm_sframes_t rewindable = snd_pcm_rewindable(pcm);
+  if (rewindable < 0) {
+    return rewindable;
+  }
+  frames = std::min<snd_pcm_uframes_t>(frames, rewindable);
+  pcm->applPtr -= frames;
+  std::lock_guard lock(mutex);
+  stats.framesRewound += frames;
+  return frames;
+}
+
+snd_pcm_sframes_t snd_pcm_forwardable(snd_pcm_t *pcm) {
+  if (int err = xrunError(pcm)) {
+    return err;
+  }
+  return avail(pcm);
+}
+
+snd_pcm_sframes_t snd_pcm_forward(snd_pcm_t *pcm, snd_pcm_uframes_t frames) {
+  const snd_pcm_sframes_t forwardable = snd_pcm_forwardable(pcm);
+  if (forwardable < 0) {
+    return forwardable;
+  }
+  frames = std::min<snd_pcm_uframes_t>(frames, forwardable);
+  pcm->applPtr += frames;
+  std::lock_guard lock(mutex);
+  stats.framesForwarded += frames;
+  return frames;
+}
+
+int snd_pcm_poll_descriptors_count(snd_pcm_t *pcm) {
+  (void)pcm;
+  return 1;
+}
+
+int snd_pcm_poll_descriptors(snd_pcm_t *pcm, struct pollfd *pfds,
+                             unsigned int space) {
+  if (space < 1) {
+    return 0;
+  }
+  pfds[0] = pollfd{pcm->timerFd, POLLIN, 0};
+  return 1;
+}
+
+int snd_pcm_poll_descriptors_revents(snd_pcm_t *pcm, struct pollfd *pfds,
+                                     unsigned int nfds,
+                                     unsigned short *revents) {
+  *revents = 0;
+  if (nfds < 1 || !(pfds[0].revents & POLLIN)) {
+    return 0;
+  }
+  uint64_t expirations = 0;
+  [[maybe_unused]] auto ret =
+      read(pcm->timerFd, &expirations, sizeof(expirations));
+  if (xrunError(pcm) < 0) {
+    *revents = POLLERR;
+  } else if (avail(pcm) >= static_cast<snd_pcm_sframes_t>(pcm->availMin)) {
+    *revents = POLLOUT;
+  }
+  armTimer(pcm);
+  return 0;
+}
+
+int snd_pcm_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t **areas,
+                       snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames) {
+  if (int err = xrunError(pcm)) {
+    return err;
+  }
+  if (pcm->buffer.empty()) {
+    return -EBADFD;
+  }
+  *offset = pcm->applPtr % pcm->bufferSize;
+  *frames = std::min({*frames, static_cast<snd_pcm_uframes_t>(avail(pcm)),
+                      pcm->bufferSize - *offset});
+  *areas = &pcm->area;
+  return 0;
+}
+
+snd_pcm_sframes_t snd_pcm_mmap_commit(snd_pcm_t *pcm,
+                                      snd_pcm_uframes_t offset,
+                                      snd_pcm_uframes_t frames) {
+  if (int err = xrunError(pcm)) {
+    return err;
+  }
+  if (offset != pcm->applPtr % pcm->bufferSize ||
+      frames > static_cast<snd_pcm_uframes_t>(avail(pcm))) {
+    return -EINVAL;
+  }
+  pcm->applPtr += frames;
+  std::lock_guard lock(mutex);
+  stats.maxQueued =
+      std::max<snd_pcm_uframes_t>(stats.maxQueued, queued(pcm));
+  return frames;
+}
+
+snd_pcm_sframes_t snd_pcm_bytes_to_frames(snd_pcm_t *pcm, ssize_t bytes) {
+  return bytes / frameBytes(pcm);
+}
+
+ssize_t snd_pcm_frames_to_bytes(snd_pcm_t *pcm, snd_pcm_sframes_t frames) {
+  return frames * frameBytes(pcm);
+}
+
+long snd_pcm_bytes_to_samples(snd_pcm_t *pcm, ssize_t bytes) {
+  return bytes / sampleBytes(pcm->format);
+}
+
+ssize_t snd_pcm_samples_to_bytes(snd_pcm_t *pcm, long samples) {
+  return samples * sampleBytes(pcm->format);
+}
+
+int snd_pcm_status(snd_pcm_t *pcm, snd_pcm_status_t *status) {
+  sync(pcm);
+  status->state = pcm->state;
+  status->delay = queued(pcm);
+  clock_gettime(CLOCK_MONOTONIC, &status->htstamp);
+  return 0;
+}
+
+size_t snd_pcm_status_sizeof(void) { return sizeof(snd_pcm_status_t); }
+
+snd_pcm_state_t snd_pcm_status_get_state(const snd_pcm_status_t *obj) {
+  return obj->state;
+}
+
+snd_pcm_sframes_t snd_pcm_status_get_delay(const snd_pcm_status_t *obj) {
+  return obj->delay;
+}
+
+void snd_pcm_status_get_htstamp(const snd_pcm_status_t *obj,
+                                snd_htimestamp_t *ptr) {
+  *ptr = obj->htstamp;
+}
+
+int snd_pcm_hw_params_malloc(snd_pcm_hw_params_t **ptr) {
+  *ptr = new _snd_pcm_hw_params();
+  return 0;
+}
+
+void snd_pcm_hw_params_free(snd_pcm_hw_params_t *obj) { delete obj; }
+
+void snd_pcm_hw_params_copy(snd_pcm_hw_params_t *dst,
+                            const snd_pcm_hw_params_t *src) {
+  *dst = *src;
+}
+
+int snd_pcm_hw_params_any(snd_pcm_t *pcm, snd_pcm_hw_params_t *params) {
+  (void)pcm;
+  *params = _snd_pcm_hw_params();
+  return 0;
+}
+
+int snd_pcm_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params) {
+  if (params->access != SND_PCM_ACCESS_MMAP_INTERLEAVED ||
+      sampleBytes(params->format) == 0 || params->channels == 0 ||
+      params->rate == 0 || params->periodSize == 0 ||
+      params->bufferSize < params->periodSize) {
+    return -EINVAL;
+  }
+  pcm->rate = params->rate;
+  pcm->channels = params->channels;
+  pcm->format = params->format;
+  pcm->bufferSize = params->bufferSize;
+  pcm->periodSize = params->periodSize;
+  pcm->availMin = params->periodSize;
+  pcm->buffer.assign(pcm->bufferSize * frameBytes(pcm), 0);
+  pcm->area = {pcm->buffer.data(), 0,
+               static_cast<unsigned int>(8 * frameBytes(pcm))};
+  pcm->state = SND_PCM_STATE_PREPARED;
+  pcm->hwPtr = pcm->applPtr = 0;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_access(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                 snd_pcm_access_t _access) {
+  (void)pcm;
+  params->access = _access;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_format(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                 snd_pcm_format_t val) {
+  (void)pcm;
+  if (sampleBytes(val) == 0) {
+    return -EINVAL;
+  }
+  params->format = val;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_channels(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                   unsigned int val) {
+  (void)pcm;
+  params->channels = val;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_rate_resample(snd_pcm_t *pcm,
+                                        snd_pcm_hw_params_t *params,
+                                        unsigned int val) {
+  (void)pcm;
+  (void)params;
+  (void)val;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_rate_near(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                    unsigned int *val, int *dir) {
+  (void)pcm;
+  (void)dir;
+  params->rate = *val;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_buffer_time_near(snd_pcm_t *pcm,
+                                           snd_pcm_hw_params_t *params,
+                                           unsigned int *val, int *dir) {
+  (void)pcm;
+  (void)dir;
+  params->bufferSize = static_cast<uint64_t>(*val) * params->rate / 1'000'000;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_buffer_size_near(snd_pcm_t *pcm,
+                                           snd_pcm_hw_params_t *params,
+                                           snd_pcm_uframes_t *val) {
+  (void)pcm;
+  params->bufferSize = *val;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_period_time_near(snd_pcm_t *pcm,
+                                           snd_pcm_hw_params_t *params,
+                                           unsigned int *val, int *dir) {
+  (void)pcm;
+  (void)dir;
+  params->periodSize = static_cast<uint64_t>(*val) * params->rate / 1'000'000;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_period_size_near(snd_pcm_t *pcm,
+                                           snd_pcm_hw_params_t *params,
+                                           snd_pcm_uframes_t *val, int *dir) {
+  (void)pcm;
+  (void)dir;
+  params->periodSize = *val;
+  return 0;
+}
+
+int snd_pcm_hw_params_get_buffer_time(const snd_pcm_hw_params_t *params,
+                                      unsigned int *val, int *dir) {
+  (void)dir;
+  if (params->rate == 0) {
+    return -EINVAL;
+  }
+  *val = static_cast<uint64_t>(params->bufferSize) * 1'000'000 / params->rate;
+  return 0;
+}
+
+int snd_pcm_hw_params_get_buffer_size(const snd_pcm_hw_params_t *params,
+                                      snd_pcm_uframes_t *val) {
+  *val = params->bufferSize;
+  return 0;
+}
+
+int snd_pcm_hw_params_get_period_size(const snd_pcm_hw_params_t *params,
+                                      snd_pcm_uframes_t *frames, int *dir) {
+  (void)dir;
+  *frames = params->periodSize;
+  return 0;
+}
+
+int snd_pcm_sw_params_malloc(snd_pcm_sw_params_t **ptr) {
+  *ptr = new _snd_pcm_sw_params();
+  return 0;
+}
+
+void snd_pcm_sw_params_free(snd_pcm_sw_params_t *obj) { delete obj; }
+
+int snd_pcm_sw_params_current(snd_pcm_t *pcm, snd_pcm_sw_params_t *params) {
+  params->availMin = pcm->availMin;
+  return 0;
+}
+
+int snd_pcm_sw_params(snd_pcm_t *pcm, snd_pcm_sw_params_t *params) {
+  pcm->availMin = params->availMin;
+  return 0;
+}
+
+int snd_pcm_sw_params_set_avail_min(snd_pcm_t *pcm, snd_pcm_sw_params_t *params,
+                                    snd_pcm_uframes_t val) {
+  (void)pcm;
+  params->availMin = val;
+  return 0;
+}
+
+int snd_pcm_sw_params_set_tstamp_mode(snd_pcm_t *pcm,
+                                      snd_pcm_sw_params_t *params,
+                                      snd_pcm_tstamp_t val) {
+  (void)pcm;
+  (void)params;
+  (void)val;
+  return 0;
+}
+
+int snd_pcm_sw_params_set_tstamp_type(snd_pcm_t *pcm,
+                                      snd_pcm_sw_params_t *params,
+                                      snd_pcm_tstamp_type_t val) {
+  (void)pcm;
+  (void)params;
+  (void)val;
+  return 0;
+}
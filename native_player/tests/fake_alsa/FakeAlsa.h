@@ -0,0 +1,37 @@
+#ifndef FAKE_ALSA_H
+#define FAKE_ALSA_H
+
+#include <alsa/asoundlib.h>
+
+#include <cstdint>
+
+// A playback device in place of libasound, for the tests of the
+// AlsaAudioEmitter on machines without a sound card. The device plays in
+// real time from the moment it is started, and supports the mmap access,
+// rewinds and the poll descriptors the emitter uses.
+namespace FakeAlsa {
+
+struct Stats {
+  int opens = 0;
+  int failedOpens = 0;
+  int starts = 0;
+  int xruns = 0;
+  // Frames queued when the device was last started.
+  snd_pcm_uframes_t queuedAtStart = 0;
+  // Most frames queued at once since the device was last started.
+  snd_pcm_uframes_t maxQueued = 0;
+  uint64_t framesRewound = 0;
+  uint64_t framesForwarded = 0;
+};
+
+// Resets the stats and lets the device be opened again.
+void reset();
+
+// Makes the next `count` calls of snd_pcm_open() fail with `err`.
+void failOpen(int err, int count = 1);
+
+Stats getStats();
+
+} // namespace FakeAlsa
+
+#endif
@@ -26,6 +26,10 @@ protected:
   IntegrationTest()
       : flacStreamDecoder(std::make_shared<FlacStreamDecoder>(65536)),
         alsaAudioEmitter(std::make_shared<AlsaAudioEmitter>(config)) {}
+
+  // Monitors are read once the emitter has finished.
+  void SetUp() override { StateNotifier::setSynchronous(true); }
+  void TearDown() override { StateNotifier::setSynchronous(false); }
 };
 
 TEST_F(IntegrationTest, fileInputIntegration) {
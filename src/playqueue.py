@@ -1,9 +1,8 @@
+import asyncio
 import logging
 import time
 
-from functools import partial
 from typing import Optional
-from threading import Timer, Thread
 
 from collections import OrderedDict
 
@@ -20,6 +19,7 @@ from native_player.native_player import (
     AudioPlayer,
     StreamState,
     AudioGraphNodeState,
+    MetricType,
     StreamInfo,
     py_dict_to_config,
 )
@@ -27,6 +27,9 @@ from native_player.native_player import (
 
 logger = logging.getLogger(__name__.split(".")[-1])
 
+# Maximum number of player states handled per event loop callback.
+STATE_BATCH_SIZE = 16
+
 # enum State {
 #   IDLE = 0,
 #   READY,
@@ -48,9 +51,6 @@ logger = logging.getLogger(__name__.split(".")[-1])
 #   SOURCE_CHANGED
 # };
 
-PREFETCH_TIME_MS = 5000
-
-
 def get_duration_ms(stream_info: StreamInfo) -> int:
     return int(stream_info.stream_size / stream_info.format.sample_rate * 1000)
 
@@ -88,25 +88,30 @@ class PlayQueue(AsyncExecutor):
         self.current_track_id = 0
         self.track_list: list[TrackInfo] = []
 
-        self.timer_thread = None
         self.state_monitor = self.track_player.monitor()
         self.prepared_tracks = OrderedDict()
-
-        self.state_update_thread = Thread(target=self._state_update_listener)
-        self.state_update_thread.start()
+        # The player decides when the next track has to be opened.
+        self.track_player.set_next_track_provider(self._on_next_track_needed)
 
     def __del__(self):
         self.terminate()
 
     def terminate(self):
+        self.track_player.set_next_track_provider(None)
         self.track_player.stop()
         self.state_monitor.stop()
-        self.state_update_thread.join()
         super().terminate()
 
-    def _state_update_listener(self):
-        while self.state_monitor.is_running():
-            new_state = self.state_monitor.wait_state()
+    def attach_event_loop(self, loop: asyncio.AbstractEventLoop):
+        # The monitor is readable while it has states, and once stopped.
+        # States set before are kept by the monitor until then.
+        loop.add_reader(self.state_monitor, self._on_states_ready, loop)
+
+    def _on_states_ready(self, loop: asyncio.AbstractEventLoop):
+        if not self.state_monitor.is_running():
+            loop.remove_reader(self.state_monitor)
+            return
+        for new_state in self.state_monitor.drain(STATE_BATCH_SIZE):
             logger.info(f"New state: {new_state}")
             self._process_state_update(new_state)
 
@@ -119,12 +124,9 @@ class PlayQueue(AsyncExecutor):
                 self._request_more_tracks()
             return
         elif new_state.state == AudioGraphNodeState.FINISHED:
-            if self.timer_thread is None:
-                self.play_next(self.current_track_id + 1)
-        elif new_state.state == AudioGraphNodeState.STREAMING:
-            self._setup_prefetch_timer(new_state)
-        elif new_state.state != AudioGraphNodeState.STREAMING:
-            self._cancel_prefetch_timer()
+            # Tracks might have been added after the player asked for the
+            # next one.
+            self._play_next_sync(self.current_track_id + 1)
 
         state_update_ts = time.monotonic_ns()
         position_diff = 0
@@ -164,10 +166,13 @@ class PlayQueue(AsyncExecutor):
 
         self.prepared_tracks.clear()
         self.prepared_tracks[index] = track_url
-        self.track_player.play(track_url)
+        self.track_player.play(track_url, **self._replay_gain(index))
 
     @enqueue
     def play_next(self, index):
+        self._play_next_sync(index)
+
+    def _play_next_sync(self, index):
         if len(self.track_list) == 0:
             return
 
@@ -185,7 +190,7 @@ class PlayQueue(AsyncExecutor):
             return
 
         self.prepared_tracks[index] = track_url
-        self.track_player.play_next(track_url)
+        self.track_player.play_next(track_url, **self._replay_gain(index))
 
     @enqueue
     def pause(self, paused: bool):
@@ -261,6 +266,15 @@ class PlayQueue(AsyncExecutor):
             ],
         }
 
+    def _replay_gain(self, index: int) -> dict:
+        metadata = self.track_list[index].metadata
+        if metadata is None:
+            return {}
+        return {
+            "replay_gain_db": metadata.replaygain_gain or 0.0,
+            "replay_gain_peak": metadata.replaygain_peak or 0.0,
+        }
+
     def get_track_info(self, index: int):
         if index not in range(0, len(self.track_list)):
             return None
@@ -283,6 +297,27 @@ class PlayQueue(AsyncExecutor):
             timestamp=time.monotonic_ns(),
         )
 
+    def get_metrics(self) -> list[dict]:
+        return [
+            {
+                "group": sample.group,
+                "name": sample.name,
+                "type": sample.type.name.lower(),
+                "value": sample.value,
+                **(
+                    {
+                        "mean": sample.mean,
+                        "p50": sample.p50,
+                        "p99": sample.p99,
+                        "max": sample.max,
+                    }
+                    if sample.type == MetricType.HISTOGRAM
+                    else {}
+                ),
+            }
+            for sample in self.track_player.metrics()
+        ]
+
     @enqueue
     def replay(self) -> PlayerState:
         stream_state = self.track_player.get_state()
@@ -322,6 +357,12 @@ class PlayQueue(AsyncExecutor):
         if stream_state.state != AudioGraphNodeState.STREAMING:
             return stream_state.position
 
+        # Extrapolated from the last device period rather than from the time
+        # of the state change.
+        position = self.track_player.get_position()
+        if position.sample_rate:
+            return position.position_ms
+
         progress = stream_state.position + int(
             (time.monotonic_ns() - stream_state.timestamp) / 1_000_000
         )
@@ -348,33 +389,15 @@ class PlayQueue(AsyncExecutor):
         if self.current_track_id == len(self.track_list) - 1:
             self.event_emitter.dispatch(EventType.RequestMoreTracks)
 
-    def _setup_prefetch_timer(self, state: StreamInfo):
-        self._cancel_prefetch_timer()
-        next_track_id = self.current_track_id + 1
-        stream_info = state.stream_info
-        if not stream_info:
-            return
-
-        time_to_prefetch_s = (
-            get_duration_ms(stream_info) - state.position - PREFETCH_TIME_MS
-        ) / 1000
-
-        if time_to_prefetch_s < 0:
-            self.play_next(next_track_id)
-            return
-
-        logger.info(f"Prefetching next track in {time_to_prefetch_s} seconds")
-
-        self.timer_thread = Timer(
-            time_to_prefetch_s,
-            partial(self.play_next, next_track_id),
-        )
-        self.timer_thread.start()
+    def _on_next_track_needed(self):
+        # Called by the player from its prefetch thread. The track is added
+        # through the executor to keep prepared_tracks in order with play().
+        self._prefetch_next_track()
+        return None
 
-    def _cancel_prefetch_timer(self):
-        if self.timer_thread is not None:
-            self.timer_thread.cancel()
-            self.timer_thread = None
+    @enqueue
+    def _prefetch_next_track(self):
+        self._play_next_sync(self.current_track_id + 1)
 
     def _notify_track_change(self):
         self.event_emitter.dispatch(
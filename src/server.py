@@ -1,3 +1,4 @@
+import asyncio
 from contextlib import asynccontextmanager
 from typing import List, Union
 from fastapi import FastAPI, Query, Request
@@ -27,6 +28,7 @@ async def lifespan(app: FastAPI):
         sd = ServiceDiscovery()
         await sd.register_service()
         state_keeper.restore_state(playqueue, inputmodule)
+        playqueue.attach_event_loop(asyncio.get_running_loop())
         yield
 
     except Exception as e:
@@ -121,8 +123,10 @@ async def read_queue_stop():
 
 
 @app.put("/queue/current_track/seek")
-async def read_queue_seek(position_ms: int):
-    value = playqueue.seek(position_ms).get()
+def read_queue_seek(position_ms: int):
+    # The player returns as soon as the seek is queued. Waiting for its
+    # result blocks, so this runs in the threadpool, off the event loop.
+    value = playqueue.seek(position_ms).get().get()
     return {"message": "Ok", "position_ms": value}
 
 
@@ -202,6 +206,11 @@ async def remove(index: int):
     return {"message": "Ok"}
 
 
+@app.get("/metrics")
+def metrics() -> list[dict]:
+    return playqueue.get_metrics()
+
+
 @app.get("/device/list")
 async def set_device_params():
     return device.supported_functions() if device else []